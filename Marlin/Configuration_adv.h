@@ -1171,9 +1171,22 @@
 
 // @section hidden
 
+// Store step rates of planner blocks in 16 bits, so more blocks fit in the same RAM.
+// A block can't step faster than 65535 steps/s then, the planner slows it down like
+// max feedrate does. Default X/Y max is 400 steps/mm * 120 mm/s = 48000 steps/s.
+//
+// sizeof(block_t) with 5 axes, S_CURVE_ACCELERATION and LIN_ADVANCE:
+//   32-bit rates:          108 bytes, 16 blocks = 1728 bytes
+//   COMPACT_PLANNER_BLOCK: 100 bytes, 32 blocks = 3200 bytes, 64 blocks = 6400 bytes
+// M2000 S10 reports the size of the running firmware and free heap.
+#define COMPACT_PLANNER_BLOCK
+
 // The number of linear motions that can be in the plan at any give time.
 // THE BLOCK_BUFFER_SIZE NEEDS TO BE A POWER OF 2 (e.g. 8, 16, 32) because shifts and ors are used to do the ring-buffering.
-#if ENABLED(SDSUPPORT)
+// Laser raster moves are often shorter than 0.1mm, more blocks give longer look-ahead for them.
+#if ENABLED(COMPACT_PLANNER_BLOCK)
+  #define BLOCK_BUFFER_SIZE 32
+#elif ENABLED(SDSUPPORT)
   #define BLOCK_BUFFER_SIZE 16 // SD,LCD,Buttons take more memory, block buffer needs to be smaller
 #else
   #define BLOCK_BUFFER_SIZE 16 // maximize block buffer
@@ -1184,7 +1197,10 @@
 // The ASCII buffer for serial input
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 4
-#define HMI_BUFSIZE 8
+// RAM budget of HMI gcode queue, lines are packed into it by actual length
+#define HMI_CMD_ARENA_SIZE (8 * MAX_CMD_SIZE)
+// max lines can be held by HMI gcode queue
+#define HMI_CMD_LINES_MAX 48
 #define INVALID_CMD_LINE  0xFFFFFFFFU
 
 // Transmission to Host Buffer Size
@@ -2057,6 +2073,15 @@
  */
 #define FASTER_GCODE_PARSER
 
+/**
+ * Parse commands when they are put into the command queue, and keep
+ * them as binary commands. Values are ready when commands are executed,
+ * so the next block is planned sooner. Commands with string argument,
+ * subcode or more than 8 parameters are still kept as text.
+ * Requires FASTER_GCODE_PARSER.
+ */
+#define PREPARSED_COMMAND_QUEUE
+
 /**
  * CNC G-code options
  * Support CNC-style G-code dialects used by laser cutters, drawing machine cams, etc.
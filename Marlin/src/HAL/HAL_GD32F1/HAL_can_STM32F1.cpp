@@ -368,6 +368,95 @@ bool CanSendPacked2(uint32_t ID, uint8_t PortNum, uint8_t FrameType, uint8_t Dat
   return false;
 }
 
+/**
+ * CanTxMailboxPut:Put a frame into the transmit mailbox, don't wait for it
+ * para PortNum: The can bus port number, 1 or 2
+ * para Mailbox: The index of mailbox, 0-2
+ * para ID: The ID of the target
+ * para IDType: The ID Type, standar(IDTYPE_STD) or externsion(IDTYPE_EXT)
+ * para FrameType: The frame type,etc remote control or data
+ * para DataLen: The count of the data to be send
+ * para pData: The pointer to the data
+ * return : true if success, or else false if the mailbox is not empty
+ */
+bool CanTxMailboxPut(uint8_t PortNum, uint8_t Mailbox, uint32_t ID, uint8_t IDType, uint8_t FrameType, uint8_t DataLen, uint8_t *pData) {
+  CAN_TypeDef *CANx = (PortNum == 1)? CAN1 : CAN2;
+  CAN_TxMailBox_TypeDef *mb = &CANx->sTxMailBox[Mailbox];
+  uint32_t tir;
+
+  if(Mailbox > 2 || !(CANx->TSR & (CAN_TSR_TME0 << Mailbox)))
+    return false;
+
+  if(IDTYPE_STDID == IDType)
+    tir = (ID << 21) | CAN_ID_STD;
+  else
+    tir = (ID << 3) | CAN_ID_EXT;
+
+  if(FrameType == FRAME_REMOTE) {
+    tir |= CAN_RTR_REMOTE;
+    DataLen = 0;
+  }
+  else if(DataLen > 8) {
+    DataLen = 8;
+  }
+
+  mb->TDTR = (mb->TDTR & ~CAN_TDT0R_DLC) | DataLen;
+  if(DataLen) {
+    mb->TDLR = (uint32_t)pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+    mb->TDHR = (uint32_t)pData[4] | ((uint32_t)pData[5] << 8) | ((uint32_t)pData[6] << 16) | ((uint32_t)pData[7] << 24);
+  }
+
+  // request transmission
+  mb->TIR = tir | CAN_TI0R_TXRQ;
+  return true;
+}
+
+/**
+ * CanTxMailboxDone:Check which transmit mailboxes have finished their request
+ * and clear their status
+ * para PortNum: The can bus port number, 1 or 2
+ * para OkMask: The pointer to save which of them are sent out successfully
+ * return : bit mask of finished mailboxes, bit0 for mailbox 0
+ */
+uint8_t CanTxMailboxDone(uint8_t PortNum, uint8_t *OkMask) {
+  CAN_TypeDef *CANx = (PortNum == 1)? CAN1 : CAN2;
+  uint32_t tsr = CANx->TSR;
+  uint32_t clear = 0;
+  uint8_t done = 0;
+  uint8_t ok = 0;
+
+  if(tsr & CAN_TSR_RQCP0) {
+    done |= 1;
+    if(tsr & CAN_TSR_TXOK0) ok |= 1;
+    clear |= CAN_TSR_RQCP0;
+  }
+  if(tsr & CAN_TSR_RQCP1) {
+    done |= 2;
+    if(tsr & CAN_TSR_TXOK1) ok |= 2;
+    clear |= CAN_TSR_RQCP1;
+  }
+  if(tsr & CAN_TSR_RQCP2) {
+    done |= 4;
+    if(tsr & CAN_TSR_TXOK2) ok |= 4;
+    clear |= CAN_TSR_RQCP2;
+  }
+
+  // write 1 to clear RQCPx, TXOKx and other status of the mailbox
+  if(clear)
+    CANx->TSR = clear;
+
+  *OkMask = ok;
+  return done;
+}
+
+/**
+ * CanTxIrqEnable:Enable the transmit mailbox empty interrupt
+ * para PortNum: The can bus port number, 1 or 2
+ */
+void CanTxIrqEnable(uint8_t PortNum) {
+  CAN_ITConfig((PortNum == 1)? CAN1 : CAN2, CAN_IT_TME, ENABLE);
+}
+
 /**
  * Canbus1ParseData:Canbus 1 parse the for ISR
  * para ID: The pointer to save the ID
@@ -13,6 +13,10 @@ void CanInit();
 uint32_t CanSendPacked(uint32_t ID, uint8_t IDType, uint8_t PortNum, uint8_t FrameType, uint8_t DataLen, uint8_t *pData);
 bool CanSendPacked2(uint32_t ID, uint8_t PortNum, uint8_t FrameType, uint8_t DataLen, uint8_t *pData, uint32_t *RegStatusValue);
 
+bool CanTxMailboxPut(uint8_t PortNum, uint8_t Mailbox, uint32_t ID, uint8_t IDType, uint8_t FrameType, uint8_t DataLen, uint8_t *pData);
+uint8_t CanTxMailboxDone(uint8_t PortNum, uint8_t *OkMask);
+void CanTxIrqEnable(uint8_t PortNum);
+
 uint8_t Canbus1ParseData(uint32_t *ID, uint8_t *IDType, uint8_t *FrameType, uint8_t *pData, uint8_t *Len, uint8_t FIFONum);
 uint8_t Canbus2ParseData(uint32_t *ID, uint8_t *IDType, uint8_t *FrameType, uint8_t *pData, uint8_t *Len, uint8_t FIFONum);
 
@@ -60,6 +60,8 @@ typedef uint16_t hal_timer_t;
 
 #define TEMP_TIMER_PRESCALE     1000 // prescaler for setting Temp timer, 72Khz
 #define TEMP_TIMER_FREQUENCY    1000 // temperature interrupt frequency
+#define STEP_TIMER_IRQ_PRIO     1
+#define TEMP_TIMER_IRQ_PRIO     4
 
 #define STEPPER_TIMER_PRESCALE 24             // prescaler for setting stepper timer, 4Mhz
 #define STEPPER_TIMER_RATE     (HAL_TIMER_RATE / STEPPER_TIMER_PRESCALE)   // frequency of stepper timer
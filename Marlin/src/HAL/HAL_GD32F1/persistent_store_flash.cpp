@@ -36,74 +36,44 @@
 
 #include "../shared/persistent_store_api.h"
 
-#include <flash_stm32.h>
-#include <EEPROM.h>
-
-// Store settings in the last two pages
-// Flash pages must be erased before writing, so keep track.
-bool firstWrite = false;
-uint32_t pageBase = EEPROM_START_ADDRESS;
-
-#define HAL_GD32F1_EEPROM_SIZE 4096
-char HAL_GD32F1_eeprom_content[HAL_GD32F1_EEPROM_SIZE];
+#include "../../../../snapmaker/src/common/settings_log.h"
 
+// Settings are kept as a log of changed bytes in the two EEPROM pages,
+// see settings_log.h. Nothing is mirrored in RAM, reads go to flash.
 
 bool PersistentStore::access_start() {
-  uint32_t Address;
-  uint16_t *pBuff;
-  Address = pageBase;
-  pBuff = (uint16_t*)HAL_GD32F1_eeprom_content;
-  for (int i=0;i<HAL_GD32F1_EEPROM_SIZE;i=i+2) {
-      *pBuff++ = *((uint16_t*)Address);
-      Address += 2;
-  }
-  firstWrite = true;
+  settingslog.Begin();
   return true;
 }
 
 bool PersistentStore::access_finish() {
-  uint32_t Address;
-  uint16_t *pu16value;
-
-
-  Address = pageBase;
-  pu16value = (uint16_t*)HAL_GD32F1_eeprom_content;
-  FLASH_Unlock();
-  FLASH_ErasePage(EEPROM_PAGE0_BASE);
-  FLASH_ErasePage(EEPROM_PAGE1_BASE); 
-  for (int i=0;i<HAL_GD32F1_EEPROM_SIZE;i=i+2) {
-    FLASH_ProgramHalfWord(Address, *pu16value++);
-    Address += 2;
-  }
-  FLASH_Lock();
-  return true;
-
+  return settingslog.End() == E_SUCCESS;
 }
 
 bool PersistentStore::write_data(int &pos, const uint8_t *value, const size_t size, uint16_t *crc) {
-  int bytewritten = 0;
-  int bytetowrite = size;
-  uint8_t* Buff = (uint8_t *)value;
-  while (bytetowrite--) {
-    HAL_GD32F1_eeprom_content[pos++] = *Buff++;
-    bytewritten++;
-  }
+  ErrCode ret = settingslog.Write(pos, value, size);
 
   crc16(crc, value, size);
-  return false;
+  pos += size;
+  return ret != E_SUCCESS;
 }
 
 bool PersistentStore::read_data(int &pos, uint8_t* value, const size_t size, uint16_t *crc, const bool writing/*=true*/) {
-  for (uint16_t i = 0; i < size; i++) {
-    uint8_t c = HAL_GD32F1_eeprom_content[pos + i];
-    if (writing) value[i] = c;
-    crc16(crc, &c, 1);
+  uint8_t buff[16];
+  size_t n;
+
+  for (size_t i = 0; i < size; i += n) {
+    n = MIN(size - i, sizeof(buff));
+    if (settingslog.Read(pos + i, buff, n) != E_SUCCESS)
+      return true;
+    if (writing) memcpy(value + i, buff, n);
+    crc16(crc, buff, n);
   }
   pos += size;
   return false;
 }
 
-size_t PersistentStore::capacity() { return 4095; }
+size_t PersistentStore::capacity() { return settingslog.capacity(); }
 
 #endif // EEPROM_SETTINGS && EEPROM FLASH
 #endif // __GD32F1__
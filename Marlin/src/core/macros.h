@@ -303,3 +303,8 @@
 #define FLASH_UPDATE_CONTENT_INFO (FLASH_MARLIN + MARLIN_CODE_SIZE) 
 #define FLASH_UPDATE_CONTENT      (FLASH_UPDATE_CONTENT_INFO + UPDATE_CONTENT_INFO_SIZE)
 
+// cache of module descriptors, the last page of marlin code area which is
+// out of link region (see gd32f105ve.ld), it will be lost after upgrading
+#define MODULE_CACHE_SIZE         (2*1024)
+#define FLASH_MODULE_CACHE        (FLASH_UPDATE_CONTENT_INFO - MODULE_CACHE_SIZE)
+
@@ -33,6 +33,7 @@
 #define DEBUG_OUT ENABLED(DEBUG_LEVELING_FEATURE)
 #include "../../../core/debug_out.h"
 #include "../../../../../snapmaker/src/snapmaker.h"
+#include "../../../../../snapmaker/src/common/mesh_cells.h"
 
 int bilinear_grid_spacing[2], bilinear_start[2];
 float bilinear_grid_factor[2],
@@ -227,6 +228,21 @@ void print_bilinear_leveling_grid() {
     return bed_level_virt_cmr(row, 1, tx);
   }
 
+  // coefficients of virtual grid cells, rebuilt with the grid
+  static MeshCell_t mesh_cell_table[(VIRTUAL_GRID_MAX_NUM - 1) * (VIRTUAL_GRID_MAX_NUM - 1)];
+
+  static void refresh_mesh_cells() {
+    const float start[2] = { float(bilinear_start[X_AXIS]), float(bilinear_start[Y_AXIS]) },
+                spacing[2] = { float(bilinear_grid_spacing_virt[X_AXIS]), float(bilinear_grid_spacing_virt[Y_AXIS]) };
+
+    meshcells.Init(mesh_cell_table, COUNT(mesh_cell_table));
+
+    // lookup falls back to float math on the virtual grid
+    if (!meshcells.Build(&z_values_virt[0][0], VIRTUAL_GRID_MAX_NUM, ABL_GRID_POINTS_VIRT_X, ABL_GRID_POINTS_VIRT_Y,
+                         start, spacing, ENABLED(EXTRAPOLATE_BEYOND_GRID)))
+      LOG_W("leveling mesh doesn't fit fixed point cells\n");
+  }
+
   void bed_level_virt_interpolate() {
     bilinear_grid_spacing_virt[X_AXIS] = bilinear_grid_spacing[X_AXIS] / (BILINEAR_SUBDIVISIONS);
     bilinear_grid_spacing_virt[Y_AXIS] = bilinear_grid_spacing[Y_AXIS] / (BILINEAR_SUBDIVISIONS);
@@ -246,6 +262,7 @@ void print_bilinear_leveling_grid() {
                 (float)ty / (BILINEAR_SUBDIVISIONS)
               );
           }
+    refresh_mesh_cells();
   }
 #endif // ABL_BILINEAR_SUBDIVISION
 
@@ -275,6 +292,11 @@ void refresh_bed_level() {
 // Get the Z adjustment for non-linear bed leveling
 float bilinear_z_offset(const float raw[XYZ]) {
 
+  #if ENABLED(ABL_BILINEAR_SUBDIVISION)
+    // Cell coefficients and fixed point math, see mesh_cells.h
+    if (meshcells.valid()) return meshcells.Offset(raw[X_AXIS], raw[Y_AXIS]);
+  #endif
+
   static float z1, d2, z3, d4, L, D, ratio_x, ratio_y,
                last_x = -999.999, last_y = -999.999;
 
@@ -791,6 +791,8 @@ void GcodeSuite::execute_command(void) {
 
       case 2001: M2001(); break;
 
+      case 2002: M2002(); break;                                  // M2002: Set radius of workpiece on B for rotary mode
+
       default: parser.unknown_command_error(); break;
     }
     break;
@@ -852,7 +854,19 @@ void GcodeSuite::process_next_command() {
 
   if (DEBUGGING(ECHO)) {
     SERIAL_ECHO_START();
-    SERIAL_ECHOLN(current_command);
+    if (current_command[0] == GCODE_BIN_MARK) {
+      const binary_command_t * const bin = (binary_command_t*)current_command;
+      SERIAL_CHAR(bin->letter);
+      SERIAL_ECHO(bin->codenum);
+      for (uint8_t i = 0; i < bin->count; i++) {
+        SERIAL_CHAR(' ');
+        SERIAL_CHAR(bin->word[i].letter);
+        SERIAL_ECHO_F(bin->word[i].value, 5);
+      }
+      SERIAL_EOL();
+    }
+    else
+      SERIAL_ECHOLN(current_command);
     #if ENABLED(M100_FREE_MEMORY_WATCHER)
       SERIAL_ECHOPAIR("slot:", cmd_queue_index_r);
       M100_dump_routine(PSTR("   Command Queue:"), (const char*)command_queue, (const char*)(command_queue + sizeof(command_queue)));
@@ -25,6 +25,8 @@
 
 #include "../../Marlin.h"
 
+#include "../../../../snapmaker/src/module/toolhead_laser.h"
+
 #if BOTH(FWRETRACT, FWRETRACT_AUTORETRACT)
   #include "../../feature/fwretract.h"
 #endif
@@ -101,6 +103,9 @@ void GcodeSuite::G0_G1(
 
     #endif // FWRETRACT
 
+    // inline laser power in percent, blocks of this move will carry it
+    if (parser.seenval('S') && laser.IsOnline())
+      laser.PlanPower(constrain(parser.value_float(), 0, TOOLHEAD_LASER_POWER_NORMAL_LIMIT));
 
     #if IS_SCARA
       fast_move ? prepare_uninterpolated_move_to_destination() : prepare_move_to_destination();
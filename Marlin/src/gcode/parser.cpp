@@ -66,6 +66,10 @@ int GCodeParser::codenum;
   // Optimized Parameters
   uint32_t GCodeParser::codebits;  // found bits
   uint8_t GCodeParser::param[26];  // parameter offsets from command_ptr
+
+  bool GCodeParser::binary;
+  float GCodeParser::bin_value[26];
+  float GCodeParser::value_bin;
 #else
   char *GCodeParser::command_args; // start of parameters
 #endif
@@ -89,9 +93,125 @@ void GCodeParser::reset() {
   #if ENABLED(FASTER_GCODE_PARSER)
     codebits = 0;                       // No codes yet
     //ZERO(param);                      // No parameters (should be safe to comment out this line)
+    binary = false;                     // Values are in text
   #endif
 }
 
+#if ENABLED(FASTER_GCODE_PARSER)
+
+  // Populate all fields from a binary command, no need to scan text
+  void GCodeParser::parse_binary(const binary_command_t * const cmd) {
+    reset();
+
+    command_ptr = (char*)cmd;
+    command_letter = cmd->letter;
+    codenum = cmd->codenum;
+    binary = true;
+
+    for (uint8_t i = 0; i < cmd->count && i < GCODE_BIN_WORDS_MAX; i++) {
+      const uint8_t ind = LETTER_BIT(cmd->word[i].letter);
+      if (ind >= COUNT(param)) continue;
+      SBI32(codebits, ind);
+      param[ind] = 1;                   // not 0, means having value
+      bin_value[ind] = cmd->word[i].value;
+    }
+  }
+
+#endif
+
+#if ENABLED(PREPARSED_COMMAND_QUEUE)
+
+  #define COMPILE_END(c) ((c) == '\0' || (c) == '\n' || (c) == '\r' || (c) == ';' || (c) == '*')
+
+  /**
+   * Parse a command in the same way as parse(), values are converted now.
+   * Return false if the command must be kept as text: it isn't G or M,
+   * it has subcode, string argument, parameter without value or too many
+   * parameters, or a value which float cannot hold as exact integer.
+   */
+  bool GCodeParser::compile(const char *p, binary_command_t &cmd) {
+    char number[16];
+    const char *start;
+    uint8_t digits;
+    uint32_t num, bits = 0;
+
+    // Skip spaces
+    while (*p == ' ') ++p;
+
+    // Skip N[-0-9] if included in the command line
+    if (*p == 'N' && NUMERIC_SIGNED(p[1])) {
+      p += 2;
+      while (NUMERIC(*p)) ++p;
+      while (*p == ' ')   ++p;
+    }
+
+    cmd.letter = *p++;
+    if (cmd.letter != 'G' && cmd.letter != 'M') return false;
+
+    while (*p == ' ') ++p;
+    if (!NUMERIC(*p)) return false;
+
+    num = 0;
+    do {
+      num *= 10, num += *p++ - '0';
+      if (num > 0xFFFF) return false;                   // Too big for binary command
+    } while (NUMERIC(*p));
+    if (*p == '.') return false;                        // Subcode
+    cmd.codenum = num;
+
+    // Codes with string argument
+    if (cmd.letter == 'M') switch (cmd.codenum) {
+      #if ENABLED(GCODE_MACROS)
+        case 810: case 811: case 812: case 813: case 814:
+        case 815: case 816: case 817: case 818: case 819:
+      #endif
+      case 23: case 28: case 30: case 32: case 117: case 118: case 928: return false;
+      default: break;
+    }
+
+    cmd.mark = GCODE_BIN_MARK;
+    cmd.count = 0;
+
+    for (;;) {
+      while (*p == ' ') ++p;
+      if (COMPILE_END(*p)) break;
+
+      // G and M may chain another command, see chain()
+      const char code = *p++;
+      if (!WITHIN(code, 'A', 'Z') || code == 'G' || code == 'M') return false;
+      if (cmd.count >= GCODE_BIN_WORDS_MAX || TEST32(bits, LETTER_BIT(code))) return false;
+      SBI32(bits, LETTER_BIT(code));
+
+      while (*p == ' ') ++p;                            // Skip spaces between parameter & value
+
+      // [-+]?[0-9]*.?[0-9]*, at least one digit
+      start = p;
+      digits = 0;
+      if (*p == '-' || *p == '+') ++p;
+      while (NUMERIC(*p)) ++p, ++digits;
+      if (*p == '.') for (++p; NUMERIC(*p); ++p) ++digits;
+      if (!digits) return false;                        // Parameter without value may be string
+      if (!(*p == ' ' || COMPILE_END(*p) || WITHIN(*p, 'A', 'Z'))) return false;
+      if (p - start >= (int)sizeof(number)) return false;
+
+      // next parameter may follow right away, convert the value alone
+      memcpy(number, start, p - start);
+      number[p - start] = '\0';
+      const float value = strtof(number, NULL);
+
+      // value_long() of text is strtol(), same as truncated float below 2^24
+      if (ABS(value) >= 16777216.0f) return false;
+
+      cmd.word[cmd.count].letter = code;
+      cmd.word[cmd.count].value = value;
+      cmd.count++;
+    }
+
+    return true;
+  }
+
+#endif
+
 void GCodeParser::parse(const char *p) {
   parse((char*)p);
 }
@@ -100,6 +220,10 @@ void GCodeParser::parse(const char *p) {
 // 58 bytes of SRAM are used to speed up seen/value
 void GCodeParser::parse(char *p) {
 
+  #if ENABLED(FASTER_GCODE_PARSER)
+    if (*p == GCODE_BIN_MARK) return parse_binary((binary_command_t*)p);
+  #endif
+
   reset(); // No codes to report
 
   // Skip spaces
@@ -315,6 +439,7 @@ void GCodeParser::parse(char *p) {
   // Parse the next parameter as a new command
   bool GCodeParser::chain() {
     #if ENABLED(FASTER_GCODE_PARSER)
+      if (binary) return false;         // Binary command is always single
       char *next_command = command_ptr;
       if (next_command) {
         while (*next_command && *next_command != ' ') ++next_command;
@@ -332,6 +457,12 @@ void GCodeParser::parse(char *p) {
 
 void GCodeParser::unknown_command_error() {
   SERIAL_ECHO_START();
+  #if ENABLED(FASTER_GCODE_PARSER)
+    if (binary) {
+      SERIAL_ECHOLNPAIR(MSG_UNKNOWN_COMMAND, command_letter, "", codenum, "\"");
+      return;
+    }
+  #endif
   SERIAL_ECHOLNPAIR(MSG_UNKNOWN_COMMAND, command_ptr, "\"");
 }
 
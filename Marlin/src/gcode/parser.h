@@ -34,6 +34,29 @@
   #include "../libs/hex_print_routines.h"
 #endif
 
+/**
+ * Binary command, its values are decoded already, put in command queue
+ * by Snapmaker HMI instead of text. It begins with GCODE_BIN_MARK which
+ * never begins a text command.
+ */
+#define GCODE_BIN_MARK      '\x01'
+#define GCODE_BIN_WORDS_MAX 8
+
+typedef struct {
+  char  letter;
+  float value;
+} __attribute__((packed)) binary_word_t;
+
+typedef struct {
+  char          mark;             // GCODE_BIN_MARK
+  char          letter;           // G, M
+  uint16_t      codenum;
+  uint8_t       count;            // count of words
+  binary_word_t word[GCODE_BIN_WORDS_MAX];
+} __attribute__((packed)) binary_command_t;
+
+#define GCODE_BIN_SIZE(count) (offsetof(binary_command_t, word) + (count) * sizeof(binary_word_t))
+
 /**
  * GCode parser
  *
@@ -54,6 +77,10 @@ private:
   #if ENABLED(FASTER_GCODE_PARSER)
     static uint32_t codebits;       // Parameters pre-scanned
     static uint8_t param[26];       // For A-Z, offsets into command args
+
+    static bool binary;             // Values are from binary command
+    static float bin_value[26];     // For A-Z, values of binary command
+    static float value_bin;         // Set by seen in binary command
   #else
     static char *command_args;      // Args start here, for slow scan
   #endif
@@ -135,7 +162,13 @@ public:
       const bool b = TEST32(codebits, ind);
       if (b) {
         char * const ptr = command_ptr + param[ind];
-        value_ptr = param[ind] && valid_float(ptr) ? ptr : (char*)NULL;
+        if (binary) {
+          // words of binary command always have value
+          value_ptr = ptr;
+          value_bin = bin_value[ind];
+        }
+        else
+          value_ptr = param[ind] && valid_float(ptr) ? ptr : (char*)NULL;
       }
       return b;
     }
@@ -205,6 +238,18 @@ public:
   static void parse(char * p);
   static void parse(const char *p);
 
+  #if ENABLED(FASTER_GCODE_PARSER)
+    static void parse_binary(const binary_command_t * const cmd);
+    #define BINARY_VALUE(V) if (binary) return (V)
+  #else
+    #define BINARY_VALUE(V) NOOP
+  #endif
+
+  #if ENABLED(PREPARSED_COMMAND_QUEUE)
+    // Parse a text command to binary command without touching parser state
+    static bool compile(const char *p, binary_command_t &cmd);
+  #endif
+
   #if ENABLED(CNC_COORDINATE_SYSTEMS)
     // Parse the next parameter as a new command
     static bool chain();
@@ -219,6 +264,7 @@ public:
   // Float removes 'E' to prevent scientific notation interpretation
   static inline float value_float() {
     if (value_ptr) {
+      BINARY_VALUE(value_bin);
       char *e = value_ptr;
       for (;;) {
         const char c = *e;
@@ -237,8 +283,16 @@ public:
   }
 
   // Code value as a long or ulong
-  static inline int32_t value_long() { return value_ptr ? strtol(value_ptr, NULL, 10) : 0L; }
-  static inline uint32_t value_ulong() { return value_ptr ? strtoul(value_ptr, NULL, 10) : 0UL; }
+  static inline int32_t value_long() {
+    if (!value_ptr) return 0L;
+    BINARY_VALUE((int32_t)value_bin);
+    return strtol(value_ptr, NULL, 10);
+  }
+  static inline uint32_t value_ulong() {
+    if (!value_ptr) return 0UL;
+    BINARY_VALUE((uint32_t)(int32_t)value_bin);
+    return strtoul(value_ptr, NULL, 10);
+  }
 
   // Code value for use as time
   static inline millis_t value_millis() { return value_ulong(); }
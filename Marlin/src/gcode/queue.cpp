@@ -136,7 +136,13 @@ inline bool _enqueuecommand(const char* cmd, bool say_ok=false
   #endif
 ) {
   if (*cmd == ';' || commands_in_queue >= BUFSIZE) return false;
-  strcpy(command_queue[cmd_queue_index_w], cmd);
+  #if ENABLED(PREPARSED_COMMAND_QUEUE)
+    binary_command_t bin;
+    if (parser.compile(cmd, bin))
+      memcpy(command_queue[cmd_queue_index_w], &bin, GCODE_BIN_SIZE(bin.count));
+    else
+  #endif
+      strcpy(command_queue[cmd_queue_index_w], cmd);
   _commit_command(say_ok
     #if NUM_SERIAL > 1
       , port
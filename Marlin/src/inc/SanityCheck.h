@@ -2055,6 +2055,10 @@ static_assert(   _ARR_TEST(3,0) && _ARR_TEST(3,1) && _ARR_TEST(3,2)
   #error "GCODE_MACROS_SLOTS must be a number from 1 to 10."
 #endif
 
+#if ENABLED(PREPARSED_COMMAND_QUEUE) && DISABLED(FASTER_GCODE_PARSER)
+  #error "PREPARSED_COMMAND_QUEUE requires FASTER_GCODE_PARSER."
+#endif
+
 #if ENABLED(CUSTOM_USER_MENUS)
   #ifdef USER_GCODE_1
     constexpr char _chr1 = USER_GCODE_1[strlen(USER_GCODE_1) - 1];
@@ -69,9 +69,9 @@
 
   char* hex_address(const void * const w) {
     #ifdef CPU_32_BIT
-      (void)hex_long((ptr_int_t)w);
+      (void)hex_long((ptr_int_t)(uintptr_t)w);
     #else
-      (void)hex_word((ptr_int_t)w);
+      (void)hex_word((ptr_int_t)(uintptr_t)w);
     #endif
     return _hex;
   }
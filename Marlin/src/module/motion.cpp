@@ -30,6 +30,7 @@
 #include "planner.h"
 #include "temperature.h"
 #include "../../snapmaker/src/module/rotary_module.h"
+#include "../../snapmaker/src/module/linear.h"
 
 #include "../gcode/gcode.h"
 
@@ -784,13 +785,13 @@ void clean_up_after_endstop_or_probe_move() {
 
       // Remaining cartesian distances
       const float zdiff = destination[Z_AXIS] - current_position[Z_AXIS],
-                  bdiff = destination[B_AXIS] - current_position[B_AXIS], // degree treated as mm as well to calculate distance
+                  bdiff = destination[B_AXIS] - current_position[B_AXIS], // degrees
                   ediff = destination[E_AXIS] - current_position[E_AXIS];
 
-      // Get the linear distance in XYZ
+      // Get the linear distance in XYZ and on surface of B
       // If the move is very short, check the E move distance
       // No E move either? Game over.
-      float cartesian_mm = SQRT(sq(xdiff) + sq(ydiff) + sq(zdiff) + sq(bdiff));
+      float cartesian_mm = SQRT(sq(xdiff) + sq(ydiff) + sq(zdiff) + sq(bdiff * planner.b_mm_per_degree));
       if (UNEAR_ZERO(cartesian_mm)) cartesian_mm = ABS(ediff);
       if (UNEAR_ZERO(cartesian_mm)) return;
 
@@ -1452,6 +1453,10 @@ void homeaxis(const AxisEnum axis) {
     if (axis == Z_AXIS && bltouch.deploy()) return;
   #endif
 
+  #if (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
+    linear_p->ArmEndstopLatch();
+  #endif
+
   float maxlen;
   if (axis == B_AXIS) {
     maxlen = planner.get_axis_position_mm(B_AXIS);
@@ -1501,6 +1506,10 @@ void homeaxis(const AxisEnum axis) {
       if (axis == Z_AXIS && bltouch.deploy()) return;
     #endif
 
+    #if (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
+      linear_p->ArmEndstopLatch();
+    #endif
+
     do_homing_move(axis, 2 * bump, get_homing_bump_feedrate(axis));
 
     #if HOMING_Z_WITH_PROBE && ENABLED(BLTOUCH)
@@ -1509,6 +1518,12 @@ void homeaxis(const AxisEnum axis) {
     #endif
   }
 
+  #if (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
+    // axis has run over the trigger point for the latency of stopping steppers,
+    // position is latched in CAN IRQ when the endstop frame arrived
+    const float endstop_overrun = (axis != B_AXIS)? linear_p->EndstopOverrun(axis, axis_home_dir) : 0;
+  #endif
+
   if (axis != B_AXIS)
     do_homing_move(axis, axis_home_dir * -3, get_homing_bump_feedrate(axis));
 
@@ -1632,6 +1647,9 @@ void homeaxis(const AxisEnum axis) {
     //current_position[axis] -= home_dir(axis) * 0.5f;
     //do_blocking_move_to(current_position, 10);
     set_axis_is_at_home(axis);
+    #if (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
+      current_position[axis] += endstop_overrun;
+    #endif
     sync_plan_position();
 
     destination[axis] = current_position[axis];
@@ -72,6 +72,7 @@
 #include "../Marlin.h"
 
 #include "../../../snapmaker/src/snapmaker.h"
+#include "../../../snapmaker/src/module/toolhead_laser.h"
 
 #if HAS_LEVELING
   #include "../feature/bedlevel/bedlevel.h"
@@ -118,6 +119,9 @@ uint32_t Planner::max_acceleration_steps_per_s2[X_TO_EN]; // (steps/s^2) Derived
 
 float Planner::steps_to_mm[X_TO_EN];           // (mm) Millimeters per step
 
+float Planner::rotary_radius = 0,              // (mm) Rotary mode is off
+      Planner::b_mm_per_degree = 1.0f;
+
 #if ENABLED(JUNCTION_DEVIATION)
   float Planner::junction_deviation_mm;       // (mm) M205 J
   #if ENABLED(LIN_ADVANCE)
@@ -736,6 +740,9 @@ void Planner::calculate_trapezoid_for_block(block_t* const block, const float &e
     #if ENABLED(S_CURVE_ACCELERATION)
       // We won't reach the cruising rate. Let's calculate the speed we will reach
       cruise_rate = final_speed(initial_rate, accel, accelerate_steps);
+      #if ENABLED(COMPACT_PLANNER_BLOCK)
+        NOMORE(cruise_rate, uint32_t(BLOCK_RATE_MAX));  // Rounding may take it over nominal_rate
+      #endif
     #endif
   }
   #if ENABLED(S_CURVE_ACCELERATION)
@@ -1830,6 +1837,13 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
   // Clear all flags, including the "busy" bit
   block->flag = 0x00;
 
+  // laser output is changed by stepper ISR when this block starts,
+  // so changing power won't need to wait for planner being empty
+  if (laser.IsOnline()) {
+    block->flag |= BLOCK_FLAG_LASER_PWM;
+    block->laser_pwm = laser.planner_pwm();
+  }
+
   // Set direction bits
   block->direction_bits = dm;
 
@@ -1893,7 +1907,7 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
     delta_mm[X_AXIS] = dx * steps_to_mm[X_AXIS];
     delta_mm[Y_AXIS] = dy * steps_to_mm[Y_AXIS];
     delta_mm[Z_AXIS] = dz * steps_to_mm[Z_AXIS];
-    delta_mm[B_AXIS] = db * steps_to_mm[B_AXIS];
+    delta_mm[B_AXIS] = db * steps_to_mm[B_AXIS] * b_mm_per_degree;
   #endif
   delta_mm[E_AXIS] = esteps_float * steps_to_mm[E_AXIS_N(extruder)];
 
@@ -2158,7 +2172,7 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
   #endif
 
   block->nominal_speed_sqr = sq(block->millimeters * inverse_secs);   //   (mm/sec)^2 Always > 0
-  block->nominal_rate = CEIL(block->step_event_count * inverse_secs); // (step/sec) Always > 0
+  uint32_t nominal_rate = CEIL(block->step_event_count * inverse_secs); // (step/sec) Always > 0
 
   #if ENABLED(FILAMENT_WIDTH_SENSOR)
     static float filwidth_e_count = 0, filwidth_delay_dist = 0;
@@ -2212,7 +2226,9 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
     #if ENABLED(DISTINCT_E_FACTORS)
       if (i == E_AXIS) i += extruder;
     #endif
-    if (cs > settings.max_feedrate_mm_s[i]) NOMORE(speed_factor, settings.max_feedrate_mm_s[i] / cs);
+    // B limit is in degrees, speed of it is on the surface
+    const float max_fr = settings.max_feedrate_mm_s[i] * (i == B_AXIS ? b_mm_per_degree : 1.0f);
+    if (cs > max_fr) NOMORE(speed_factor, max_fr / cs);
   }
 
   // Max segment time in µs.
@@ -2253,12 +2269,18 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
     }
   #endif // XY_FREQUENCY_LIMIT
 
+  // Limit step rate to what block_t can hold
+  #if ENABLED(COMPACT_PLANNER_BLOCK)
+    if (nominal_rate * speed_factor > BLOCK_RATE_MAX) NOMORE(speed_factor, float(BLOCK_RATE_MAX) / nominal_rate);
+  #endif
+
   // Correct the speed
   if (speed_factor < 1.0f) {
     LOOP_X_TO_E(i) current_speed[i] *= speed_factor;
-    block->nominal_rate *= speed_factor;
+    nominal_rate *= speed_factor;
     block->nominal_speed_sqr = block->nominal_speed_sqr * sq(speed_factor);
   }
+  block->nominal_rate = nominal_rate;
 
   // Compute and limit the acceleration rate for the trapezoid generator.
   const float steps_per_mm = block->step_event_count * inverse_millimeters;
@@ -2322,7 +2344,7 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
             SQRT(sq(target_float[X_AXIS] - position_float[X_AXIS])
                + sq(target_float[Y_AXIS] - position_float[Y_AXIS])
                + sq(target_float[Z_AXIS] - position_float[Z_AXIS])
-               + sq(target_float[B_AXIS] - position_float[B_AXIS]))
+               + sq((target_float[B_AXIS] - position_float[B_AXIS]) * b_mm_per_degree))
           #endif
         ;
 
@@ -2640,9 +2662,10 @@ bool Planner::_populate_block(block_t * const block, bool split_move,
 
 /**
  * Planner::buffer_sync_block
- * Add a block to the buffer that just updates the position
+ * Add a block to the buffer that just updates the position,
+ * or just changes laser output with BLOCK_FLAG_LASER_PWM
  */
-void Planner::buffer_sync_block() {
+void Planner::buffer_sync_block(const uint8_t sync_flag/*=BLOCK_FLAG_SYNC_POSITION*/) {
   // Wait for the next available block
   uint8_t next_buffer_head;
   block_t * const block = get_next_free_block(next_buffer_head);
@@ -2650,7 +2673,10 @@ void Planner::buffer_sync_block() {
   // Clear block
   memset(block, 0, sizeof(block_t));
 
-  block->flag = BLOCK_FLAG_SYNC_POSITION;
+  block->flag = BLOCK_FLAG_SYNC_POSITION | sync_flag;
+
+  if (TEST(sync_flag, BLOCK_BIT_LASER_PWM))
+    block->laser_pwm = laser.planner_pwm();
 
   block->position[X_AXIS] = position[X_AXIS];
   block->position[Y_AXIS] = position[Y_AXIS];
@@ -2949,6 +2975,17 @@ void Planner::refresh_positioning() {
   reset_acceleration_rates();
 }
 
+/**
+ * In rotary mode B is still commanded in degrees, but lengths, feedrates,
+ * accelerations and junctions of the planner are on the workpiece surface,
+ * so F of a rotary job is the surface speed the slicer means.
+ * Per-axis limits of B stay in degrees and are scaled to the surface.
+ */
+void Planner::set_rotary_radius(const float &radius) {
+  rotary_radius = radius > 0 ? radius : 0;
+  b_mm_per_degree = rotary_radius > 0 ? RADIANS(rotary_radius) : 1.0f;
+}
+
 #if ENABLED(AUTOTEMP)
 
   void Planner::autotemp_M104_M109() {
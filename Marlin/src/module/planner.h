@@ -64,16 +64,35 @@ enum BlockFlagBit : char {
   BLOCK_BIT_CONTINUED,
 
   // Sync the stepper counts from the block
-  BLOCK_BIT_SYNC_POSITION
+  BLOCK_BIT_SYNC_POSITION,
+
+  // Output laser_pwm of the block when the block starts
+  BLOCK_BIT_LASER_PWM
 };
 
 enum BlockFlag : char {
   BLOCK_FLAG_RECALCULATE          = _BV(BLOCK_BIT_RECALCULATE),
   BLOCK_FLAG_NOMINAL_LENGTH       = _BV(BLOCK_BIT_NOMINAL_LENGTH),
   BLOCK_FLAG_CONTINUED            = _BV(BLOCK_BIT_CONTINUED),
-  BLOCK_FLAG_SYNC_POSITION        = _BV(BLOCK_BIT_SYNC_POSITION)
+  BLOCK_FLAG_SYNC_POSITION        = _BV(BLOCK_BIT_SYNC_POSITION),
+  BLOCK_FLAG_LASER_PWM            = _BV(BLOCK_BIT_LASER_PWM)
 };
 
+/**
+ * Step rates of a block, in step_events/sec.
+ *
+ * With COMPACT_PLANNER_BLOCK they take 16 bits, and the planner limits
+ * the speed of a block so that its nominal rate fits, same as it does
+ * for max feedrate.
+ */
+#if ENABLED(COMPACT_PLANNER_BLOCK)
+  typedef uint16_t block_rate_t;
+  #define BLOCK_RATE_MAX 0xFFFFUL
+#else
+  typedef uint32_t block_rate_t;
+  #define BLOCK_RATE_MAX 0xFFFFFFFFUL
+#endif
+
 /**
  * struct block_t
  *
@@ -82,11 +101,22 @@ enum BlockFlag : char {
  *
  * The "nominal" values are as-specified by gcode, and
  * may never actually be reached due to acceleration limits.
+ *
+ * Byte fields are packed behind flag and narrow fields are kept at the
+ * end, so there is little padding between fields.
  */
 typedef struct block_t {
 
   volatile uint8_t flag;                    // Block flags (See BlockFlag enum above) - Modified by ISR and main thread!
 
+  uint8_t direction_bits : NUM_AXIS;        // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
+
+  #if ENABLED(LIN_ADVANCE)
+    uint8_t use_advance_lead : 1;
+  #endif
+
+  uint16_t laser_pwm;                       // laser output while executing this block
+
   // Fields used by the motion planner to manage acceleration
   float nominal_speed_sqr,                  // The nominal speed for this block in (mm/sec)^2
         entry_speed_sqr,                    // Entry speed at previous-current junction in (mm/sec)^2
@@ -107,23 +137,12 @@ typedef struct block_t {
   };
   uint32_t step_event_count;                // The number of step events required to complete this block
 
-  #if EXTRUDERS > 1
-    uint8_t extruder;                       // The extruder to move (if E move)
-  #else
-    static constexpr uint8_t extruder = 0;
-  #endif
-
-  #if ENABLED(MIXING_EXTRUDER)
-    MIXER_BLOCK_FIELD;                      // Normalized color for the mixing steppers
-  #endif
-
   // Settings for the trapezoid generator
   uint32_t accelerate_until,                // The index of the step event on which to stop acceleration
            decelerate_after;                // The index of the step event on which to start decelerating
 
   #if ENABLED(S_CURVE_ACCELERATION)
-    uint32_t cruise_rate,                   // The actual cruise rate to use, between end of the acceleration phase and start of deceleration phase
-             acceleration_time,             // Acceleration time and deceleration time in STEP timer counts
+    uint32_t acceleration_time,             // Acceleration time and deceleration time in STEP timer counts
              deceleration_time,
              acceleration_time_inverse,     // Inverse of acceleration and deceleration periods, expressed as integer. Scale depends on CPU being used
              deceleration_time_inverse;
@@ -131,21 +150,42 @@ typedef struct block_t {
     uint32_t acceleration_rate;             // The acceleration rate used for acceleration calculation
   #endif
 
-  uint8_t direction_bits;                   // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
-
   // Advance extrusion
   #if ENABLED(LIN_ADVANCE)
-    bool use_advance_lead;
+    float e_D_ratio;
+  #endif
+
+  uint32_t acceleration_steps_per_s2;       // acceleration steps/sec^2
+
+  #if ENABLED(ULTRA_LCD)
+    uint32_t segment_time_us;
+  #endif
+
+  uint32_t filePos;                         // position of gcode of this block in the file
+
+  #if ENABLED(LIN_ADVANCE)
     uint16_t advance_speed,                 // STEP timer value for extruder speed offset ISR
              max_adv_steps,                 // max. advance steps to get cruising speed pressure (not always nominal_speed!)
              final_adv_steps;               // advance steps due to exit speed
-    float e_D_ratio;
   #endif
 
-  uint32_t nominal_rate,                    // The nominal step rate for this block in step_events/sec
-           initial_rate,                    // The jerk-adjusted step rate at start of block
-           final_rate,                      // The minimal rate at exit
-           acceleration_steps_per_s2;       // acceleration steps/sec^2
+  block_rate_t nominal_rate,                // The nominal step rate for this block in step_events/sec
+               initial_rate,                // The jerk-adjusted step rate at start of block
+               final_rate;                  // The minimal rate at exit
+
+  #if ENABLED(S_CURVE_ACCELERATION)
+    block_rate_t cruise_rate;               // The actual cruise rate to use, between end of the acceleration phase and start of deceleration phase
+  #endif
+
+  #if EXTRUDERS > 1
+    uint8_t extruder;                       // The extruder to move (if E move)
+  #else
+    static constexpr uint8_t extruder = 0;
+  #endif
+
+  #if ENABLED(MIXING_EXTRUDER)
+    MIXER_BLOCK_FIELD;                      // Normalized color for the mixing steppers
+  #endif
 
   #if FAN_COUNT > 0
     uint8_t fan_speed[FAN_COUNT];
@@ -155,10 +195,6 @@ typedef struct block_t {
     uint8_t valve_pressure, e_to_p_pressure;
   #endif
 
-  uint32_t segment_time_us;
-
-  uint32_t filePos;                       // position of gcode of this block in the file
-
 } block_t;
 
 #define HAS_POSITION_FLOAT ANY(LIN_ADVANCE, SCARA_FEEDRATE_SCALING, GRADIENT_MIX)
@@ -242,6 +278,9 @@ class Planner {
     static uint32_t max_acceleration_steps_per_s2[X_TO_EN]; // (steps/s^2) Derived from mm_per_s2
     static float steps_to_mm[X_TO_EN];          // Millimeters per step
 
+    static float rotary_radius;                 // (mm) Workpiece radius on B, 0 takes B degrees as mm
+    static float b_mm_per_degree;               // Surface mm per B degree, derived from rotary_radius
+
     #if ENABLED(JUNCTION_DEVIATION)
       static float junction_deviation_mm;       // (mm) M205 J
       #if ENABLED(LIN_ADVANCE)
@@ -361,6 +400,9 @@ class Planner {
     static void reset_acceleration_rates();
     static void refresh_positioning();
 
+    // Plan B moves by distance on the surface of a workpiece with this radius
+    static void set_rotary_radius(const float &radius);
+
     FORCE_INLINE static void refresh_e_factor(const uint8_t e) {
       e_factor[e] = (flow_percentage[e] * 0.01f
         #if DISABLED(NO_VOLUMETRICS)
@@ -613,9 +655,10 @@ class Planner {
 
     /**
      * Planner::buffer_sync_block
-     * Add a block to the buffer that just updates the position
+     * Add a block to the buffer that just updates the position,
+     * or just changes laser output with BLOCK_FLAG_LASER_PWM
      */
-    static void buffer_sync_block();
+    static void buffer_sync_block(const uint8_t sync_flag=BLOCK_FLAG_SYNC_POSITION);
 
   #if IS_KINEMATIC
     private:
@@ -910,8 +953,11 @@ FORCE_INLINE static bool has_blocks_queued() { return (block_buffer_head != bloc
 
       FORCE_INLINE static float limit_value_by_axis_maximum(const float &max_value, float (&unit_vec)[X_TO_E]) {
         float limit_value = max_value;
-        LOOP_X_TO_E(idx) if (unit_vec[idx]) // Avoid divide by zero
-          NOMORE(limit_value, ABS(settings.max_acceleration_mm_per_s2[idx] / unit_vec[idx]));
+        LOOP_X_TO_E(idx) if (unit_vec[idx]) { // Avoid divide by zero
+          // B limit is in degrees, unit vector is on the surface
+          const float max_accel = settings.max_acceleration_mm_per_s2[idx] * (idx == B_AXIS ? b_mm_per_degree : 1.0f);
+          NOMORE(limit_value, ABS(max_accel / unit_vec[idx]));
+        }
         return limit_value;
       }
 
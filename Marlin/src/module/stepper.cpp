@@ -99,6 +99,8 @@ Stepper stepper; // Singleton
 #include "../HAL/shared/Delay.h"
 #include "../../../snapmaker/src/module/emergency_stop.h"
 #include "../../../snapmaker/src/snapmaker.h"
+#include "../../../snapmaker/src/module/toolhead_laser.h"
+#include "../../../snapmaker/src/common/cycle_trace.h"
 
 #if MB(ALLIGATOR)
   #include "../feature/dac/dac_dac084s085.h"
@@ -1274,7 +1276,9 @@ HAL_STEP_TIMER_ISR() {
 
   HAL_timer_isr_prologue(STEP_TIMER_NUM);
 
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_STEPPER_ISR);
   Stepper::isr();
+  CYCLE_TRACE_END(CYCLE_TRACE_STEPPER_ISR);
 
   HAL_timer_isr_epilogue(STEP_TIMER_NUM);
 }
@@ -1343,7 +1347,11 @@ void Stepper::isr() {
     // ^== Time critical. NOTHING besides pulse generation should be above here!!!
 
     // Run main stepping block processing ISR if we have to
-    if (!nextMainISR) nextMainISR = Stepper::stepper_block_phase_isr();
+    if (!nextMainISR) {
+      CYCLE_TRACE_BEGIN(CYCLE_TRACE_BLOCK_PHASE);
+      nextMainISR = Stepper::stepper_block_phase_isr();
+      CYCLE_TRACE_END(CYCLE_TRACE_BLOCK_PHASE);
+    }
 
     uint32_t interval =
       #if ENABLED(LIN_ADVANCE)
@@ -1608,7 +1616,7 @@ uint32_t Stepper::stepper_block_phase_isr() {
       #endif
       axis_did_move = 0;
       // when a block is outputed, we record it position in file if it has
-      pl_recovery.SaveCmdLine(current_block->filePos);
+      pl_recovery.SaveCmdLine(current_block->filePos, current_block->laser_pwm);
       current_block = NULL;
       planner.discard_current_block();
     }
@@ -1718,13 +1726,16 @@ uint32_t Stepper::stepper_block_phase_isr() {
     // Anything in the buffer?
     if ((current_block = planner.get_current_block())) {
 
-      // Sync block? Sync the stepper counts and return
+      // Sync block? Sync the stepper counts or laser output and return
       while (TEST(current_block->flag, BLOCK_BIT_SYNC_POSITION)) {
-        _set_position(
-          current_block->position[X_AXIS], current_block->position[Y_AXIS],
-          current_block->position[Z_AXIS], current_block->position[B_AXIS],
-          current_block->position[E_AXIS]
-        );
+        if (TEST(current_block->flag, BLOCK_BIT_LASER_PWM))
+          laser.ApplyBlockPwm(current_block->laser_pwm);
+        else
+          _set_position(
+            current_block->position[X_AXIS], current_block->position[Y_AXIS],
+            current_block->position[Z_AXIS], current_block->position[B_AXIS],
+            current_block->position[E_AXIS]
+          );
         planner.discard_current_block();
 
         // Try to get a new block
@@ -1807,6 +1818,10 @@ uint32_t Stepper::stepper_block_phase_isr() {
       //if (!!current_block->steps[C_AXIS]) SBI(axis_bits, Z_HEAD);
       axis_did_move = axis_bits;
 
+      // Change laser output before the block starts moving
+      if (TEST(current_block->flag, BLOCK_BIT_LASER_PWM))
+        laser.ApplyBlockPwm(current_block->laser_pwm);
+
       // No acceleration / deceleration time elapsed so far
       acceleration_time = deceleration_time = 0;
 
@@ -368,6 +368,10 @@ class Stepper {
     // Get the position of a stepper, in steps
     static int32_t position(const AxisEnum axis);
 
+    // Get the position of a stepper from an ISR, in steps. Reading one word is atomic,
+    // so it doesn't need to suspend the stepper ISR
+    FORCE_INLINE static int32_t isr_position(const AxisEnum axis) { return count_position[axis]; }
+
     // Report the positions of the steppers, in steps
     static void report_positions();
 
@@ -31,6 +31,7 @@
 #include "planner.h"
 #include "../core/language.h"
 #include "../HAL/shared/Delay.h"
+#include "../../../snapmaker/src/common/cycle_trace.h"
 
 #if (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
   #include "snapmaker.h"
@@ -2499,7 +2500,9 @@ void Temperature::readings_ready() {
 HAL_TEMP_TIMER_ISR() {
   HAL_timer_isr_prologue(TEMP_TIMER_NUM);
 
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_TEMP_ISR);
   Temperature::isr();
+  CYCLE_TRACE_END(CYCLE_TRACE_TEMP_ISR);
 
   HAL_timer_isr_epilogue(TEMP_TIMER_NUM);
 }
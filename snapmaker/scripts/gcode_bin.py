@@ -0,0 +1,286 @@
+import sys
+import argparse
+import re
+import struct
+
+from fractions import Fraction
+
+_VERSION = "1.0.0"
+
+# event of binary file gcode pack, see snapmaker/src/hmi/event_handler.h
+EID_FILE_GCODE_BIN_REQ = 0x15
+
+# same limits as text pack
+FILE_GCODE_PACK_MAX_SIZE  = 320
+FILE_GCODE_PACK_MAX_LINES = 32
+
+# opcodes and words, must be same as snapmaker/src/hmi/gcode_bin.cpp
+GCODE_BIN_OPC = [('G', 0), ('G', 1), ('G', 4), ('M', 3), ('M', 4), ('M', 5), ('M', 106), ('M', 107)]
+GCODE_BIN_OPC_TEXT = 0xFF
+
+GCODE_BIN_LETTER = ['X', 'Y', 'Z', 'B', 'E', 'F', 'S', 'P']
+GCODE_BIN_SCALE  = [1000, 1000, 1000, 1000, 100000, 100, 1000, 1000]
+
+# so delta of two values fits in int32
+GCODE_BIN_FIXED_MAX = 1 << 30
+
+_COMMAND = re.compile(r'^([GM])0*(\d+)$')
+_NUMBER  = re.compile(r'^[-+]?(\d+\.?\d*|\.\d+)$')
+
+
+def split_words(line):
+    """Split a line to words like Marlin does, comment is dropped"""
+    line = line.split(';', 1)[0].strip()
+    return line.split() if line else []
+
+
+def decoded_value(fixed, scale):
+    """Same as (float)fixed / scale in firmware"""
+    return float32(Fraction(float32(Fraction(fixed))) / scale)
+
+
+def to_fixed(index, text):
+    """Convert value of word to fixed point, None if firmware cannot get
+    the same float as parsing the text"""
+    if not _NUMBER.match(text):
+        return None
+
+    value = Fraction(text) * GCODE_BIN_SCALE[index]
+    if value.denominator != 1 or abs(value.numerator) >= GCODE_BIN_FIXED_MAX:
+        return None
+
+    # we have no negative zero
+    if value == 0 and text.startswith('-'):
+        return None
+
+    # fixed point isn't exact in float if it is not less than 2^24
+    if decoded_value(value.numerator, GCODE_BIN_SCALE[index]) != float32(Fraction(text)):
+        return None
+
+    return value.numerator
+
+
+def zigzag_varint(value):
+    zigzag = ((value << 1) ^ (value >> 31)) & 0xFFFFFFFF
+    out = bytearray()
+    while True:
+        byte = zigzag & 0x7F
+        zigzag >>= 7
+        if zigzag:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def text_record(line):
+    text = line.rstrip('\r\n').encode('ascii', 'replace')
+    return bytes([GCODE_BIN_OPC_TEXT]) + text + b'\0'
+
+
+def encode_line(line, last):
+    """Encode one line, last is values of words and will be updated"""
+    words = split_words(line)
+    if not words:
+        return text_record(line)
+
+    m = _COMMAND.match(words[0])
+    if not m or (m.group(1), int(m.group(2))) not in GCODE_BIN_OPC:
+        return text_record(line)
+
+    opc = GCODE_BIN_OPC.index((m.group(1), int(m.group(2))))
+    values = {}
+    for word in words[1:]:
+        letter = word[0]
+        if letter not in GCODE_BIN_LETTER or letter in values:
+            return text_record(line)
+        index = GCODE_BIN_LETTER.index(letter)
+        fixed = to_fixed(index, word[1:])
+        if fixed is None:
+            return text_record(line)
+        values[letter] = (index, fixed)
+
+    present = 0
+    changed = 0
+    deltas = b''
+    for index, letter in enumerate(GCODE_BIN_LETTER):
+        if letter not in values:
+            continue
+        fixed = values[letter][1]
+        present |= 1 << index
+        if fixed != last[index]:
+            changed |= 1 << index
+            deltas += zigzag_varint(fixed - last[index])
+            last[index] = fixed
+
+    return bytes([opc, present, changed]) + deltas
+
+
+def encode(lines, first_line=0):
+    """Encode lines to payloads of EID_FILE_GCODE_BIN_REQ, in order"""
+    packs = []
+    records = []
+    size = 0
+    last = [0] * len(GCODE_BIN_LETTER)
+    first = first_line
+
+    for line in lines:
+        record = encode_line(line, list(last)) if records else None
+        if record is None or size + len(record) > FILE_GCODE_PACK_MAX_SIZE or \
+           len(records) >= FILE_GCODE_PACK_MAX_LINES:
+            if records:
+                packs.append(make_pack(first, records))
+                first += len(records)
+            # values of words are 0 at the beginning of every pack
+            records = []
+            size = 0
+            last = [0] * len(GCODE_BIN_LETTER)
+
+        record = encode_line(line, last)
+        if len(record) > FILE_GCODE_PACK_MAX_SIZE:
+            raise ValueError('line {} is too long'.format(first + len(records)))
+        records.append(record)
+        size += len(record)
+
+    if records:
+        packs.append(make_pack(first, records))
+
+    return packs
+
+
+def make_pack(first, records):
+    return struct.pack('>BIB', EID_FILE_GCODE_BIN_REQ, first, len(records)) + b''.join(records)
+
+
+def decode(pack):
+    """Decode a pack like firmware, return first line and list of commands.
+    Command is a text or (letter, codenum, [(letter, fixed, scale)])"""
+    _, first, count = struct.unpack('>BIB', pack[:6])
+    data = pack[6:]
+    last = [0] * len(GCODE_BIN_LETTER)
+    commands = []
+    i = 0
+
+    while i < len(data):
+        opc = data[i]
+        i += 1
+        if opc == GCODE_BIN_OPC_TEXT:
+            end = data.index(b'\0', i)
+            commands.append(data[i:end].decode('ascii'))
+            i = end + 1
+            continue
+
+        present, changed = data[i], data[i + 1]
+        i += 2
+        words = []
+        for index in range(len(GCODE_BIN_LETTER)):
+            if changed & (1 << index):
+                zigzag = 0
+                shift = 0
+                while True:
+                    zigzag |= (data[i] & 0x7F) << shift
+                    shift += 7
+                    i += 1
+                    if not data[i - 1] & 0x80:
+                        break
+                last[index] += (zigzag >> 1) ^ -(zigzag & 1)
+                if abs(last[index]) >= GCODE_BIN_FIXED_MAX:
+                    raise ValueError('pack of line {}: value of {} is out of range'.format(first, GCODE_BIN_LETTER[index]))
+            if present & (1 << index):
+                words.append((GCODE_BIN_LETTER[index], last[index], GCODE_BIN_SCALE[index]))
+        commands.append((GCODE_BIN_OPC[opc][0], GCODE_BIN_OPC[opc][1], words))
+
+    if len(commands) != count:
+        raise ValueError('pack of line {}: count {} but {} lines'.format(first, count, len(commands)))
+
+    return first, commands
+
+
+def float32(value):
+    """Round a Fraction to nearest float32, ties to even, like strtof()"""
+    if value == 0:
+        return 0.0
+    guess = struct.unpack('<f', struct.pack('<f', float(value)))[0]
+    bits = struct.unpack('<i', struct.pack('<f', guess))[0]
+    best = None
+    for b in (bits - 1, bits, bits + 1):
+        cand = struct.unpack('<f', struct.pack('<i', b))[0]
+        error = abs(Fraction(cand) - value)
+        if best is None or error < best[0] or (error == best[0] and b % 2 == 0):
+            best = (error, cand)
+    return best[1]
+
+
+def parse_ascii(line):
+    """Parse a line like Marlin parser, values are float32"""
+    words = split_words(line)
+    m = _COMMAND.match(words[0])
+    return (m.group(1), int(m.group(2)),
+            {w[0]: float32(Fraction(w[1:])) for w in words[1:]})
+
+
+def verify(lines, packs):
+    """Check decoded packs against parsing the text, return count of errors"""
+    errors = 0
+    index = 0
+
+    for pack in packs:
+        first, commands = decode(pack)
+        if first != index:
+            print('pack begins at line {}, expect {}'.format(first, index))
+            return errors + 1
+
+        for cmd in commands:
+            line = lines[index]
+            if isinstance(cmd, str):
+                if cmd != line.rstrip('\r\n'):
+                    print('line {}: text "{}" but got "{}"'.format(index, line.rstrip(), cmd))
+                    errors += 1
+            else:
+                got = (cmd[0], cmd[1], {w[0]: decoded_value(w[1], w[2]) for w in cmd[2]})
+                expect = parse_ascii(line)
+                if got != expect:
+                    print('line {}: "{}" decoded as {}'.format(index, line.rstrip(), got))
+                    errors += 1
+            index += 1
+
+    if index != len(lines):
+        print('decoded {} lines, expect {}'.format(index, len(lines)))
+        errors += 1
+
+    return errors
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Encode gcode file to binary file gcode packs')
+    parser.add_argument('-v', '--version', action='version', version=_VERSION)
+    parser.add_argument('-o', '--output', help='write packs to file, every pack is led by its length (2 bytes, LE)')
+    parser.add_argument('--verify', action='store_true', help='decode packs and compare with parsing the text')
+    parser.add_argument('input', help='gcode file')
+    args = parser.parse_args()
+
+    with open(args.input, 'r', errors='replace') as f:
+        lines = f.read().splitlines()
+
+    packs = encode(lines)
+
+    text_size = sum(len(l) + 1 for l in lines)
+    bin_size = sum(len(p) for p in packs)
+    print('lines: {}, packs: {}, text: {} bytes, binary: {} bytes ({:.1f}%)'.format(
+          len(lines), len(packs), text_size, bin_size, 100.0 * bin_size / max(text_size, 1)))
+
+    if args.output:
+        with open(args.output, 'wb') as f:
+            for p in packs:
+                f.write(struct.pack('<H', len(p)))
+                f.write(p)
+
+    if args.verify:
+        errors = verify(lines, packs)
+        print('verify: {} errors'.format(errors))
+        if errors:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
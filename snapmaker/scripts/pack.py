@@ -5,6 +5,7 @@ import re
 import shutil
 import struct
 import os
+import zlib
 
 from os.path import join, dirname
 from pathlib import Path
@@ -21,6 +22,85 @@ TYPE_EXTERNAL_MODULE = 1
 TYPE_SCREEN_MODULE = 2
 
 
+# packed image, see snapmaker/src/common/fw_unpacker.h
+PACK_MAGIC = 0x315A4D53
+PACK_DISTANCE_MAX = 4096
+PACK_LENGTH_MIN = 3
+PACK_LENGTH_MAX = PACK_LENGTH_MIN + 15 + 255
+# matches tried for every position, more is slower and packs a little better
+PACK_CHAIN_MAX = 64
+
+
+def lzss_pack(raw):
+    out = bytearray()
+    chains = {}
+    flag_index = 0
+    items = 8
+    pos = 0
+
+    def remember(i):
+        chains.setdefault(raw[i:i + PACK_LENGTH_MIN], []).append(i)
+
+    while pos < len(raw):
+        if items == 8:
+            flag_index = len(out)
+            out.append(0)
+            items = 0
+
+        best_length = 0
+        best_distance = 0
+        limit = min(PACK_LENGTH_MAX, len(raw) - pos)
+        candidates = chains.get(raw[pos:pos + PACK_LENGTH_MIN], [])
+        for start in reversed(candidates[-PACK_CHAIN_MAX:]):
+            if pos - start > PACK_DISTANCE_MAX:
+                break
+            length = PACK_LENGTH_MIN
+            while length < limit and raw[start + length] == raw[pos + length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_distance = pos - start
+                if length == limit:
+                    break
+
+        if best_length >= PACK_LENGTH_MIN and limit >= PACK_LENGTH_MIN:
+            code = best_length - PACK_LENGTH_MIN
+            high = (best_distance - 1) >> 8 << 4
+            if code < 15:
+                out += bytes([high | code, (best_distance - 1) & 0xFF])
+            else:
+                out += bytes([high | 15, (best_distance - 1) & 0xFF, code - 15])
+            for i in range(pos, pos + best_length):
+                remember(i)
+            pos += best_length
+        else:
+            out[flag_index] |= 1 << items
+            out.append(raw[pos])
+            remember(pos)
+            pos += 1
+
+        items += 1
+
+    return out
+
+
+def pack_image(input, output):
+    with open(input, 'rb') as f:
+        raw = f.read()
+
+    packed = lzss_pack(raw)
+    print('packed {}: {} -> {} bytes'.format(output, len(raw), len(packed)))
+
+    with open(output, 'wb') as f:
+        # Header (16)
+        # - Magic (4 bytes)
+        # - Raw Length (4 bytes)
+        # - Packed Length (4 bytes)
+        # - CRC32 of raw image (4 bytes)
+        f.write(struct.pack('<IIII', PACK_MAGIC, len(raw), len(packed), zlib.crc32(raw) & 0xFFFFFFFF))
+        f.write(packed)
+
+
 def pack_minor_image(image_type, start_id, end_id, version, input, output):
     with open(input, 'rb') as f:
         raw_bin = f.read()
@@ -158,7 +238,7 @@ def pack_major_image(controller=None, module=None, screen=None, version=None):
 
 
 
-def pack_minor_controller_image(raw_bin, source_dir, version):
+def pack_minor_controller_image(raw_bin, source_dir, version, compress=False):
     date = datetime.datetime.today().strftime('%Y%m%d')
 
     if version == None and source_dir != None:
@@ -197,6 +277,8 @@ def pack_minor_controller_image(raw_bin, source_dir, version):
         os.rename(image_path, image_path.with_suffix('.bin.old'))
 
     pack_minor_image(MINOR_IMAGE_TYPE_CONTROLLER, 0, 0, version, raw_bin, str(image_path))
+    if compress:
+        pack_image(str(image_path), str(image_path))
 
     return image_path
 
@@ -206,7 +288,7 @@ def pack_factory_module_image(raw_app_bin, source_dir, serial_number, module_id,
     pass
 
 
-def pack_minor_module_image(raw_bin, source_dir, version):
+def pack_minor_module_image(raw_bin, source_dir, version, compress=False):
     date = datetime.datetime.today().strftime('%Y%m%d')
 
     if version == None and source_dir != None:
@@ -245,6 +327,8 @@ def pack_minor_module_image(raw_bin, source_dir, version):
         os.rename(image_path, image_path.with_suffix('.bin.old'))
 
     pack_minor_image(MINOR_IMAGE_TYPE_MODULE, 0, 0, version, raw_bin, str(image_path))
+    if compress:
+        pack_image(str(image_path), str(image_path))
 
     return image_path
 
@@ -307,6 +391,11 @@ def main(argv=None):
                         type=str,
                         default=None)
 
+    parser.add_argument('-z', '--compress',
+                        help="compress minor images, controller unpacks them when receiving",
+                        action='store_true',
+                        default=False)
+
     parser.add_argument('-v', '--version',
                         help="specify version for major image",
                         type=str,
@@ -319,12 +408,12 @@ def main(argv=None):
 
 
     if args.controller:
-        minor_contoller = pack_minor_controller_image(args.controller, args.dir, args.version_controller)
+        minor_contoller = pack_minor_controller_image(args.controller, args.dir, args.version_controller, args.compress)
     else:
         minor_contoller = None
 
     if args.module:
-        minor_module = pack_minor_module_image(args.module, args.dir, args.version_module)
+        minor_module = pack_minor_module_image(args.module, args.dir, args.version_module, args.compress)
     else:
         minor_module = None
 
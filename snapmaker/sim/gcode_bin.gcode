@@ -0,0 +1,126 @@
+; sample of a 3D print and a rotary laser job for gcode_bin.py
+G28
+G90
+M83
+M107
+G1 Z0.2 F1200
+M106 S255
+G0 X109.384 Y108.339 F6000
+G1 X126.467 Y113.096 E0.34142
+G1 X132.508 Y126.430 E1.42800
+G1 X132.952 Y107.306 E0.38772
+G1 X116.799 Y98.011 E0.90204
+G1 X136.508 Y105.247 E0.63622
+G1 X129.552 Y115.582 E0.26668
+G1 X141.127 Y135.060 E1.25053
+G1 X130.660 Y125.262 E0.47022
+G1 X139.878 Y121.977 E0.72856
+G0 X130.975 Y122.257 F6000
+G1 X121.890 Y112.272 E0.04390
+G1 X107.748 Y130.207 E0.05921
+G1 X94.561 Y142.283 E0.72144 ; infill
+G1 X90.005 Y128.131 E0.81720
+G1 X89.822 Y109.756 E0.17926
+G1 X71.010 Y112.820 E0.96114
+G1 X75.803 Y108.042 E0.37422
+G1 X73.722 Y102.690 E0.61642
+G1 X83.011 Y111.905 E0.06816
+G0 X68.869 Y125.248 F6000
+G1 X70.935 Y122.974 E0.95250
+G1 X73.253 Y125.798 E0.60555
+G1 X55.594 Y134.455 E0.34506
+G1 X48.348 Y150.969 E1.29216
+G1 X35.183 Y141.205 E0.86297
+G1 X18.233 Y155.948 E0.36994 ; infill
+G1 X22.416 Y165.997 E0.74057
+G1 X7.150 Y151.517 E0.47677
+G1 X8.760 Y166.075 E0.08816
+G0 X19.393 Y151.856 F6000
+G1 X20.689 Y142.774 E1.08037
+G1 X16.256 Y154.910 E0.31302
+G1 X34.303 Y147.185 E0.09591
+G1 X30.166 Y157.460 E0.92664
+G1 X20.735 Y164.447 E1.07412
+G1 X18.560 Y162.608 E0.56699
+G1 X38.509 Y159.501 E0.28691
+G1 X24.094 Y152.610 E0.85516
+G1 X20.452 Y143.378 E1.32632 ; infill
+G0 X17.401 Y127.924 F6000
+G1 X19.705 Y136.124 E0.19297
+G1 X31.609 Y150.984 E0.56762
+G1 X24.733 Y146.732 E0.58163
+G1 X12.862 Y162.196 E1.00530
+G1 X13.732 Y169.173 E0.98107
+G1 X18.446 Y172.512 E0.09398
+G1 X1.084 Y185.545 E0.06398
+G1 X-2.269 Y172.226 E0.44855
+G1 X16.913 Y171.198 E1.34979
+G0 X-2.468 Y183.324 F6000
+G1 X6.470 Y202.187 E0.84872
+G1 X17.163 Y189.849 E0.45363 ; infill
+G1 X30.218 Y208.264 E0.48066
+G1 X37.765 Y208.700 E0.18125
+G1 X43.225 Y214.493 E1.17745
+G1 X62.517 Y228.491 E1.08196
+G1 X46.541 Y209.345 E1.45676
+G1 X54.717 Y194.483 E1.24921
+G1 X48.370 Y187.011 E0.88489
+G1 E-0.8 F2400
+G4 P500
+M107
+T0
+G1 X12.3456789 Y5
+G1 X-0.0 Y1
+M104 S200
+
+G92 E0
+M106 S127.5
+M5
+M3 S0
+G0 X10 Y20 B0 F3000
+G1 X10.000 B11.570 S300 F600
+G1 X10.250 B31.568 S1000 F600
+G1 X10.500 B48.021 S500 F600
+G1 X10.750 B69.523 S1000 F600
+G1 X11.000 B95.005 S500 F600
+G1 X11.250 B99.101 S500 F1200
+G1 X11.500 B110.468 S300 F600
+G1 X11.750 B131.976 S1000 F1200
+G1 X12.000 B158.230 S500 F1200
+G1 X12.250 B176.524 S500 F600
+G1 X12.500 B195.184 S500 F600
+G1 X12.750 B202.642 S300 F600
+G1 X13.000 B214.870 S500 F600
+G1 X13.250 B220.168 S1000 F600
+G1 X13.500 B243.319 S1000 F1200
+G1 X13.750 B246.953 S500 F1200
+G1 X14.000 B273.621 S500 F1200
+G1 X14.250 B297.474 S500 F600
+G1 X14.500 B308.192 S500 F600
+G1 X14.750 B324.798 S300 F1200
+G1 X15.000 B326.421 S1000 F1200
+G1 X15.250 B342.215 S1000 F600
+G1 X15.500 B358.546 S1000 F600
+G1 X15.750 B374.980 S300 F600
+G1 X16.000 B377.233 S500 F600
+G1 X16.250 B388.704 S300 F1200
+G1 X16.500 B418.159 S300 F1200
+G1 X16.750 B432.757 S1000 F1200
+G1 X17.000 B454.624 S300 F1200
+G1 X17.250 B467.630 S300 F1200
+G1 X17.500 B494.034 S300 F1200
+G1 X17.750 B513.509 S300 F600
+G1 X18.000 B540.071 S1000 F600
+G1 X18.250 B541.889 S300 F600
+G1 X18.500 B560.728 S500 F1200
+G1 X18.750 B562.176 S300 F1200
+G1 X19.000 B584.501 S500 F1200
+G1 X19.250 B608.141 S300 F600
+G1 X19.500 B637.263 S500 F600
+G1 X19.750 B658.813 S500 F1200
+M5
+G0 B0
+M4 S600
+G1 Y30.5 S600
+M5
+M2000
@@ -0,0 +1,49 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_HARDWARE_SERIAL_H_
+#define SNAPMAKER_SIM_HARDWARE_SERIAL_H_
+
+#include <stddef.h>
+#include <libmaple/usart.h>
+
+#include "Print.h"
+
+// the part of HardwareSerial used by UartHost and Marlin, see sim_uart.cpp.
+// Serial without USART is the console of Marlin, it goes to stdout
+class HardwareSerial : public Print {
+  public:
+    HardwareSerial(usart_dev *dev) : dev_(dev) {}
+
+    void begin(uint32 baud);
+    int read(void);
+    using Print::write;
+    virtual size_t write(uint8 ch);
+    void flush(void);
+
+    usart_dev *c_dev(void) { return dev_; }
+
+  private:
+    usart_dev *dev_;
+};
+
+extern HardwareSerial Serial;
+
+#endif  // #ifndef SNAPMAKER_SIM_HARDWARE_SERIAL_H_
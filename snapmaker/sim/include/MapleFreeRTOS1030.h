@@ -0,0 +1,99 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_FREERTOS_H_
+#define SNAPMAKER_SIM_FREERTOS_H_
+
+// FreeRTOS APIs used by the service layer, for the host build.
+// There is only one task, so mutexes are always free and blocking calls
+// just run the simulated peripherals until they can return
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t      TickType_t;
+
+#define pdFALSE       ((BaseType_t)0)
+#define pdTRUE        ((BaseType_t)1)
+#define pdPASS        (pdTRUE)
+#define pdFAIL        (pdFALSE)
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+
+#define configTICK_RATE_HZ  ((TickType_t)1000)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / (TickType_t)1000))
+#define portTICK_PERIOD_MS  ((TickType_t)1000 / configTICK_RATE_HZ)
+
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY  5
+
+#define configASSERT(x) do { if (!(x)) SimAssert(__FILE__, __LINE__, #x); } while (0)
+
+#define taskSCHEDULER_SUSPENDED   ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING     ((BaseType_t)2)
+
+// IRQs only happen when the task blocks
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#define portYIELD_FROM_ISR(x) (void)(x)
+
+typedef struct SimTask      *TaskHandle_t;
+typedef struct SimSemaphore *SemaphoreHandle_t;
+typedef SemaphoreHandle_t   xSemaphoreHandle;
+typedef struct SimMessageBuffer *MessageBufferHandle_t;
+typedef struct SimEventGroup *EventGroupHandle_t;
+typedef uint32_t            EventBits_t;
+
+void SimAssert(const char *file, int line, const char *expr);
+
+void *pvPortMalloc(size_t size);
+void vPortFree(void *p);
+
+BaseType_t xTaskGetSchedulerState(void);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t ticks);
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+
+// every message takes 4 more bytes for its length, as FreeRTOS does
+MessageBufferHandle_t xMessageBufferCreate(size_t size);
+size_t xMessageBufferSend(MessageBufferHandle_t mb, const void *data, size_t length, TickType_t ticks);
+size_t xMessageBufferReceive(MessageBufferHandle_t mb, void *data, size_t max, TickType_t ticks);
+BaseType_t xMessageBufferReset(MessageBufferHandle_t mb);
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t ticks);
+
+#endif  // #ifndef SNAPMAKER_SIM_FREERTOS_H_
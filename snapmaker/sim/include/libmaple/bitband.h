@@ -0,0 +1,57 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_BITBAND_H_
+#define SNAPMAKER_SIM_BITBAND_H_
+
+#include <libmaple/libmaple_types.h>
+
+// There is no bit-band alias on host, and addresses don't fit in uint32.
+// Only inline drivers of timers and ADC take aliases of peripherals, which
+// are not simulated, so they get a word nobody reads. SRAM bits are real
+
+static inline volatile uint32 *bb_perip(volatile void *address, uint32 bit) {
+  static volatile uint32 sink;
+
+  (void)address;
+  (void)bit;
+  return &sink;
+}
+
+static inline uint8 bb_peri_get_bit(volatile void *address, uint32 bit) {
+  return *bb_perip(address, bit);
+}
+
+static inline void bb_peri_set_bit(volatile void *address, uint32 bit, uint8 val) {
+  *bb_perip(address, bit) = val;
+}
+
+static inline uint8 bb_sram_get_bit(volatile void *address, uint32 bit) {
+  return (*(volatile uint32 *)address >> bit) & 1;
+}
+
+static inline void bb_sram_set_bit(volatile void *address, uint32 bit, uint8 val) {
+  if (val)
+    *(volatile uint32 *)address |= 1UL << bit;
+  else
+    *(volatile uint32 *)address &= ~(1UL << bit);
+}
+
+#endif  // #ifndef SNAPMAKER_SIM_BITBAND_H_
@@ -0,0 +1,35 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_LIBMAPLE_TYPES_H_
+#define SNAPMAKER_SIM_LIBMAPLE_TYPES_H_
+
+#include_next <libmaple/libmaple_types.h>
+
+// glibc has defined it with inline, so "static inline __always_inline" of
+// libmaple headers would have inline twice. glibc builds its own inline
+// helpers of string.h on it, give them back the inline they lose here
+#undef __always_inline
+#define __always_inline __attribute__((always_inline))
+#undef __extern_always_inline
+#define __extern_always_inline \
+  extern __inline __attribute__((__always_inline__, __gnu_inline__))
+
+#endif  // #ifndef SNAPMAKER_SIM_LIBMAPLE_TYPES_H_
@@ -0,0 +1,74 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_NVIC_H_
+#define SNAPMAKER_SIM_NVIC_H_
+
+#include <libmaple/libmaple_types.h>
+
+#ifndef BIT
+#define BIT(shift)  (1UL << (shift))
+#endif
+
+// numbers are same as series/nvic.h of GD32F105
+typedef enum nvic_irq_num {
+  NVIC_CAN1_TX_IRQn   = 19,
+  NVIC_CAN1_RX0_IRQn  = 20,
+  NVIC_CAN1_RX1_IRQn  = 21,
+  NVIC_CAN1_SCE_IRQn  = 22,
+  NVIC_USART2         = 38,
+  NVIC_UART5          = 53,
+  NVIC_CAN2_TX_IRQn   = 63,
+  NVIC_CAN2_RX0_IRQn  = 64,
+  NVIC_CAN2_RX1_IRQn  = 65,
+  NVIC_CAN2_SCE_IRQn  = 66,
+
+  NVIC_IRQ_MAX        = 68
+} nvic_irq_num;
+
+typedef struct nvic_reg_map {
+  volatile uint32 ISER[8];
+  volatile uint32 ICER[8];
+  volatile uint32 ISPR[8];
+  volatile uint32 ICPR[8];
+  volatile uint8  IP[240];
+} nvic_reg_map;
+
+// SimServiceIrq() runs enabled vectors pended here
+extern nvic_reg_map sim_nvic;
+#define NVIC_BASE   (&sim_nvic)
+
+static inline void nvic_irq_enable(nvic_irq_num irq_num) {
+  NVIC_BASE->ISER[irq_num / 32] |= BIT(irq_num % 32);
+}
+
+static inline void nvic_irq_disable(nvic_irq_num irq_num) {
+  NVIC_BASE->ISER[irq_num / 32] &= ~BIT(irq_num % 32);
+}
+
+// IRQs of the sim only run when the task blocks, so there is nothing to mask
+static inline void nvic_globalirq_enable(void) {}
+static inline void nvic_globalirq_disable(void) {}
+
+static inline void nvic_irq_set_priority(nvic_irq_num irqn, uint8 priority) {
+  NVIC_BASE->IP[irqn] = (uint8)(priority << 4);
+}
+
+#endif  // #ifndef SNAPMAKER_SIM_NVIC_H_
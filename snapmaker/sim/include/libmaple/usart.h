@@ -0,0 +1,73 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_USART_H_
+#define SNAPMAKER_SIM_USART_H_
+
+#include <libmaple/libmaple_types.h>
+#include <libmaple/ring_buffer.h>
+#include <libmaple/nvic.h>
+
+#ifndef USART_RX_BUF_SIZE
+#define USART_RX_BUF_SIZE   1024
+#endif
+
+#ifndef USART_TX_BUF_SIZE
+#define USART_TX_BUF_SIZE   1024
+#endif
+
+// bits are same as libmaple
+#define USART_SR_TXE        BIT(7)
+#define USART_SR_RXNE       BIT(5)
+#define USART_SR_IDLE       BIT(4)
+#define USART_SR_ORE        BIT(3)
+
+#define USART_CR1_UE        BIT(13)
+#define USART_CR1_TXEIE     BIT(7)
+#define USART_CR1_RXNEIE    BIT(5)
+#define USART_CR1_IDLEIE    BIT(4)
+#define USART_CR1_TE        BIT(3)
+#define USART_CR1_RE        BIT(2)
+
+typedef struct usart_reg_map {
+  volatile uint32 SR;
+  volatile uint32 DR;
+  volatile uint32 BRR;
+  volatile uint32 CR1;
+  volatile uint32 CR2;
+  volatile uint32 CR3;
+  volatile uint32 GTPR;
+} usart_reg_map;
+
+typedef struct usart_dev {
+  usart_reg_map *regs;
+  ring_buffer   *rb;
+  ring_buffer   *wb;
+  uint32        max_baud;
+  uint8         rx_buf[USART_RX_BUF_SIZE];
+  uint8         tx_buf[USART_TX_BUF_SIZE];
+  nvic_irq_num  irq_num;
+} usart_dev;
+
+// only the HMI UART is simulated, see sim_uart.cpp
+extern usart_reg_map sim_usart2_regs;
+#define USART2_BASE   (&sim_usart2_regs)
+
+#endif  // #ifndef SNAPMAKER_SIM_USART_H_
@@ -0,0 +1,43 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_WIRISH_TIME_H_
+#define SNAPMAKER_SIM_WIRISH_TIME_H_
+
+#include <stdint.h>
+
+// libmaple headers include this in extern "C" blocks
+#ifdef __cplusplus
+extern "C++" {
+#endif
+
+// time of the virtual clock, see sim.h
+uint32_t millis(void);
+uint32_t micros(void);
+
+// busy waiting, peripherals are still running
+void delay(unsigned long ms);
+void delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // #ifndef SNAPMAKER_SIM_WIRISH_TIME_H_
@@ -0,0 +1,1509 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+#include "sim_can.h"
+#include "sim_uart.h"
+#include "sim_flash.h"
+#include "sim_ring.h"
+#include "sim_mesh.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/protocol_sstp.h"
+#include "hmi/uart_host.h"
+#include "hmi/event_queue.h"
+#include "hmi/event_handler.h"
+#include "hmi/gcode_bin.h"
+#include "module/can_host.h"
+#include "module/module_cache.h"
+#include "module/toolhead_laser.h"
+#include "common/settings_log.h"
+#include "common/fw_unpacker.h"
+#include "service/power_loss_recovery.h"
+#include "service/system.h"
+#include "snapmaker.h"
+
+#include "src/core/macros.h"
+#include "src/module/motion.h"
+#include "src/gcode/parser.h"
+#include "src/module/planner.h"
+
+#include "flash_stm32.h"
+
+// scenarios run one after another on the same clock, exit code is
+// the number of failed ones
+//
+// usage: snapmaker_sim [--flash image] [--gcode-bin gcode packs] [--verbose]
+//   --flash      keep flash in image file, so module cache learnt by last run
+//                is hit by this one
+//   --gcode-bin  decode packs made by scripts/gcode_bin.py from gcode, e.g.
+//                gcode_bin.py -o packs snapmaker/sim/gcode_bin.gcode
+//   --verbose    print debug logs of service layer
+
+#define CHECK(cond) do { \
+                      if (!(cond)) { \
+                        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+                        return false; \
+                      } \
+                    } while (0)
+
+#define MS_TO_NS(ms)  ((uint64_t)(ms) * SIM_NS_PER_MS)
+
+// word in simulated flash
+#define CACHE_WORD_AT(addr) (*((volatile uint32_t *)(uintptr_t)(addr)))
+#define CACHE_COMMIT_WORD   CACHE_WORD_AT(FLASH_MODULE_CACHE + 4)
+
+/* ring buffer shared by IRQ and task, checked by real threads and
+ * measured by wall clock, they don't advance the virtual clock
+ */
+static bool RunRing() {
+  printf("ring: stress by 2 threads\n");
+  CHECK(SimRingStress(2000000));
+
+  printf("ring: bench\n");
+  SimRingBench(8);
+  SimRingBench(64);
+
+  return true;
+}
+
+
+/* HMI task sends events to Marlin task in EventQueue, Marlin task handles
+ * them in place every cost_us. Events are split into 2 segments like they
+ * wrap around the end of UART RX buffer. Events sent before Flush() in
+ * the middle are dropped, others must arrive in order and intact
+ */
+struct EventQueueRun {
+  EventQueue queue;
+  uint32_t   total;
+  uint32_t   cost_us;
+  uint32_t   next;      // index of event expected
+  uint32_t   got;
+  uint32_t   dropped;
+  uint32_t   flushed;   // events before it are dropped
+  bool       bad;
+  bool       stop;
+};
+
+static uint16_t EventSize(uint32_t index) {
+  return 6 + (index * 37) % 600;
+}
+
+static void FillEvent(uint8_t *event, uint32_t index) {
+  memcpy(event, &index, 4);
+  for (uint16_t j = 4; j < EventSize(index); j++)
+    event[j] = (uint8_t)(index + j);
+}
+
+static void ConsumeEvent(void *arg) {
+  static uint8_t expect[SSTP_RECV_BUFFER_SIZE];
+  EventQueueRun *run = (EventQueueRun *)arg;
+  uint8_t  *event;
+  uint16_t length;
+  uint32_t index;
+
+  if (run->stop)
+    return;
+
+  if (run->queue.Take(event, length)) {
+    memcpy(&index, event, 4);
+
+    // events sent before Flush() are skipped
+    if (index != run->next && run->next < run->flushed && index == run->flushed) {
+      run->dropped += index - run->next;
+      run->next = index;
+    }
+
+    FillEvent(expect, run->next);
+    if (index != run->next || length != EventSize(index) || memcmp(event, expect, length) || event[length])
+      run->bad = true;
+
+    run->next++;
+    run->got++;
+  }
+
+  SimSchedule(run->cost_us * SIM_NS_PER_US, ConsumeEvent, run);
+}
+
+static bool ConsumedAll(void *arg) {
+  EventQueueRun *run = (EventQueueRun *)arg;
+  return run->bad || run->next == run->total;
+}
+
+static bool RunEventQueue(uint32_t total, uint32_t cost_us) {
+  static uint8_t event[SSTP_RECV_BUFFER_SIZE];
+  static EventQueueRun run;
+  SSTP_View_t view;
+  uint16_t size;
+  uint64_t start;
+
+  printf("event queue: %u events, %u us for each\n", total, cost_us);
+
+  run.total = total;
+  run.cost_us = cost_us;
+  run.flushed = total;
+
+  start = SimNow();
+  SimSchedule(cost_us * SIM_NS_PER_US, ConsumeEvent, &run);
+
+  for (uint32_t i = 0; i < total; i++) {
+    FillEvent(event, i);
+    size = EventSize(i);
+
+    view.seg[0] = event;
+    view.seg_len[0] = (uint16_t)(i % size);
+    view.seg[1] = event + view.seg_len[0];
+    view.seg_len[1] = size - view.seg_len[0];
+    view.length = size;
+    CHECK(run.queue.Send(view, pdMS_TO_TICKS(100)) == E_SUCCESS);
+
+    if (i == total / 2) {
+      run.queue.Flush();
+      run.flushed = i + 1;
+    }
+  }
+
+  CHECK(SimWait(ConsumedAll, &run, MS_TO_NS(1000)));
+  run.stop = true;
+
+  printf("  %u handled, %u dropped by flush in %llu ms\n", run.got, run.dropped,
+          (unsigned long long)((SimNow() - start) / SIM_NS_PER_MS));
+
+  CHECK(!run.bad && run.got + run.dropped == total && run.dropped > 0);
+
+  // too long to fit behind a pad
+  view.seg[0] = event;
+  view.seg_len[0] = SSTP_RECV_BUFFER_SIZE;
+  view.seg_len[1] = 0;
+  view.length = SSTP_RECV_BUFFER_SIZE;
+  CHECK(run.queue.Send(view, 0) == E_PARAM);
+
+  return true;
+}
+
+
+static uint32_t std_reports = 0;
+static uint32_t std_lost = 0;
+static uint32_t std_next = 0;
+
+
+/* SSTP checksum against the reference, on random lengths and alignments */
+static bool RunChecksum() {
+  SSTP_Event_t e;
+  uint8_t  data[4] = {0x01, 0x02, 0x03, 0x04};
+  uint16_t chk;
+
+  ProtocolSSTP::VerifyChecksum(1000);
+
+  // checksum in header of a known packet
+  e.id = data[0];
+  e.op_code = data[1];
+  e.length = 2;
+  e.data = data + 2;
+  chk = ProtocolSSTP().CalcChecksum(e);
+  CHECK(chk == (uint16_t)~(0x0102 + 0x0304));
+
+  return true;
+}
+
+
+/* Screen streams events back to back, HMI task is woken up by idle line or
+ * every HMI_RX_NOTIFY_THRESHOLD bytes, and takes events in place.
+ * cost_us is time HMI task spends on every event, IRQs still run meanwhile,
+ * events are lost if it's slower than the line for longer than RX buffer holds
+ */
+static bool RunUart(uint32_t total, uint16_t size, uint32_t cost_us) {
+  static uint8_t packet[SSTP_RECV_BUFFER_SIZE + SSTP_HEADER_SIZE];
+  static uint8_t event[SSTP_RECV_BUFFER_SIZE];
+  static uint8_t got[SSTP_RECV_BUFFER_SIZE];
+  ProtocolSSTP sstp;
+  SSTP_View_t  view;
+  uint16_t length;
+  uint32_t checked = 0;
+  uint32_t bytes = 0;
+  uint64_t start;
+  uint64_t elapsed;
+
+  printf("uart: %u events of %u bytes, %u us for each\n", total, size, cost_us);
+
+  SimUartClearStat();
+  hmi.ClearRxStat();
+
+  start = SimNow();
+
+  for (uint32_t i = 0; i < total; i++) {
+    for (uint16_t j = 0; j < size; j++)
+      event[j] = (uint8_t)(i + j);
+
+    length = size;
+    CHECK(sstp.Package(event, packet, length) == E_SUCCESS);
+    SimUartFeed(packet, length);
+    bytes += length;
+  }
+
+  while (checked < total) {
+    // all bytes have arrived and nothing wakes us up, events are lost
+    if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SSTP_VIEW_TIMEOUT_MS)) && !SimUartPending())
+      break;
+
+    hmi.RecordWakeup();
+
+    while (hmi.PeekCmd(view) == E_SUCCESS) {
+      length = ProtocolSSTP::CopyView(view, got);
+      hmi.ReleaseCmd(view);
+      hmi.RecordEvent();
+
+      for (uint16_t j = 0; j < size; j++)
+        event[j] = (uint8_t)(checked + j);
+      CHECK(length == size && !memcmp(got, event, size));
+      checked++;
+
+      if (cost_us)
+        SimRunFor(cost_us * SIM_NS_PER_US);
+    }
+  }
+
+  elapsed = SimNow() - start;
+
+  printf("  %u/%u events in %llu ms, %llu events/s, line limit %llu events/s\n", checked, total,
+          (unsigned long long)(elapsed / SIM_NS_PER_MS),
+          (unsigned long long)(checked * 1000000000ULL / (elapsed? elapsed : 1)),
+          (unsigned long long)(115200 / 10 * total / bytes));
+  printf("  overruns %u, idle lines %u\n", SimUartStat().overruns, SimUartStat().idle_lines);
+  hmi.ShowRxStat();
+
+  CHECK(checked == total && !hmi.rx_stat().drops && !SimUartStat().overruns);
+
+  return true;
+}
+
+
+static void StdReportCallback(CanStdDataFrame_t &frame) {
+  uint32_t seq = 0;
+
+  memcpy(&seq, frame.data, 4);
+  if (seq != std_next)
+    std_lost += seq - std_next;
+  std_next = seq + 1;
+  std_reports++;
+}
+
+
+/* Round trips of ext commands to echo modules on both channels, while a
+ * module keeps reporting std frames to the same channel
+ */
+static bool RunCan(SimModule **modules, uint8_t total, uint32_t rounds, uint16_t size, uint32_t report_us) {
+  uint8_t     data[CAN_EXT_WAIT_BUFFER_SIZE];
+  uint8_t     expect[CAN_EXT_WAIT_BUFFER_SIZE];
+  CanExtCmd_t cmd;
+  Function_t  function;
+  message_id_t msg_id;
+  uint32_t    rtt;
+  uint32_t    rtt_max = 0;
+  uint64_t    rtt_total = 0;
+  uint32_t    failed = 0;
+  uint64_t    start;
+  uint64_t    elapsed;
+
+  printf("can: %u round trips of %u bytes to %u modules, std report every %u us\n",
+          rounds, size, total, report_us);
+
+  memset(&function, 0, sizeof(function));
+  function.id = 0;
+  msg_id = canhost.RegisterFunction(function, StdReportCallback);
+  CHECK(msg_id != MODULE_MESSAGE_ID_INVALID);
+
+  std_reports = 0;
+  std_lost = 0;
+  std_next = 0;
+
+  SimCanClearStat();
+  canhost.ClearLatency();
+
+  if (report_us)
+    modules[0]->ReportStd(msg_id, 8, report_us);
+
+  start = SimNow();
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    SimModule *m = modules[i % total];
+
+    for (uint16_t j = 0; j < size; j++)
+      data[j] = (uint8_t)(i * 7 + j);
+    data[MODULE_EXT_CMD_INDEX_ID] = 0x40;
+    memcpy(expect, data, size);
+    expect[MODULE_EXT_CMD_INDEX_ID] = 0x41;
+
+    cmd.mac.val = 0;
+    cmd.mac.bits.id = m->mac();
+    cmd.mac.bits.channel = m->channel();
+    cmd.data = data;
+    cmd.length = size;
+
+    rtt = micros();
+    if (canhost.SendExtCmdSync(cmd, 100) != E_SUCCESS) {
+      failed++;
+      continue;
+    }
+    rtt = micros() - rtt;
+
+    CHECK(cmd.length == size && !memcmp(data, expect, size));
+
+    rtt_total += rtt;
+    if (rtt > rtt_max)
+      rtt_max = rtt;
+  }
+
+  elapsed = SimNow() - start;
+
+  if (report_us)
+    modules[0]->ReportStd(msg_id, 8, 0);
+  // let reports queued in module arrive
+  SimRunFor(MS_TO_NS(50));
+
+  printf("  %u/%u round trips in %llu ms, avg %llu us, max %u us, %llu bytes/s\n",
+          rounds - failed, rounds, (unsigned long long)(elapsed / SIM_NS_PER_MS),
+          (unsigned long long)(rtt_total / ((rounds - failed)? rounds - failed : 1)), rtt_max,
+          (unsigned long long)(2ULL * size * (rounds - failed) * 1000000000ULL / (elapsed? elapsed : 1)));
+  printf("  std reports: sent %u, got %u, lost %u\n", modules[0]->std_reports(), std_reports, std_lost);
+  for (int ch = 0; ch < SIM_CAN_CHANNELS; ch++) {
+    SimCanStat_t &s = SimCanStat(ch);
+    printf("  CH%d: %u frames, host %u, host lost arbitration %u, dropped by filter %u, busy %llu%%\n",
+            ch + 1, s.frames, s.host_frames, s.host_lost, s.dropped,
+            (unsigned long long)(s.busy_ns * 100 / (SimNow() - start)));
+  }
+  canhost.ShowLatency();
+
+  CHECK(!failed);
+  CHECK(std_reports == modules[0]->std_reports() && !std_lost);
+
+  return true;
+}
+
+
+/* Two modules on the same channel answer at the same time. The one with
+ * lower ID wins arbitration of every frame, so its ack cuts into the other
+ * one. Nobody waits for the acks, they go to the queue of EventHandler()
+ */
+static bool RunCanConcurrent(SimModule *low, SimModule *high, uint32_t rounds, uint16_t size) {
+  uint8_t     data[2][CAN_EXT_WAIT_BUFFER_SIZE];
+  uint8_t     rx[4 + CAN_EXT_WAIT_BUFFER_SIZE];
+  SimModule   *m[2] = {high, low};
+  CanExtCmd_t cmd;
+  MAC_t       mac;
+  uint16_t    length;
+  uint32_t    got = 0;
+  int         i;
+
+  printf("can: %u rounds of %u bytes acks from 0x%X and 0x%X at the same time\n",
+          rounds, size, low->mac(), high->mac());
+
+  CHECK(low->channel() == high->channel() && low->mac() < high->mac());
+
+  SimCanClearStat();
+  canhost.FlushExtCmd();
+
+  for (uint32_t r = 0; r < rounds; r++) {
+    // the one with higher ID gets request first, and starts to answer first
+    for (i = 0; i < 2; i++) {
+      for (uint16_t j = 0; j < size; j++)
+        data[i][j] = (uint8_t)(r * 13 + i * 101 + j);
+      data[i][MODULE_EXT_CMD_INDEX_ID] = 0x40;
+
+      cmd.mac.val = 0;
+      cmd.mac.bits.id = m[i]->mac();
+      cmd.mac.bits.channel = m[i]->channel();
+      cmd.data = data[i];
+      cmd.length = size;
+      CHECK(canhost.SendExtCmd(cmd) == E_SUCCESS);
+      data[i][MODULE_EXT_CMD_INDEX_ID] = 0x41;
+    }
+
+    for (int k = 0; k < 2; k++) {
+      length = canhost.ReceiveExtCmd(mac, rx, sizeof(rx), 100);
+      CHECK(length == size);
+
+      for (i = 0; i < 2 && m[i]->mac() != mac.bits.id; i++);
+      CHECK(i < 2);
+      CHECK(!memcmp(rx, data[i], size));
+      got++;
+    }
+  }
+
+  SimCanStat_t &s = SimCanStat(low->channel());
+  printf("  got %u/%u acks, %u times a module took bus in the middle of the other\n",
+          got, 2 * rounds, s.interleaved);
+  canhost.ShowLatency();
+
+  CHECK(s.interleaved > 0);
+
+  return true;
+}
+
+
+/* SendExtCmdBatch() puts requests to all modules on the bus before it
+ * waits, so acks of modules on the same channel come at the same time
+ */
+static bool RunCanBatch(SimModule **modules, uint8_t total, uint32_t rounds, uint16_t size) {
+  uint8_t     data[CAN_EXT_WAIT_QUEUE_MAX][CAN_EXT_WAIT_BUFFER_SIZE];
+  uint8_t     expect[CAN_EXT_WAIT_QUEUE_MAX][CAN_EXT_WAIT_BUFFER_SIZE];
+  CanExtCmd_t cmd[CAN_EXT_WAIT_QUEUE_MAX];
+  ErrCode     ret[CAN_EXT_WAIT_QUEUE_MAX];
+  uint32_t    interleaved = 0;
+  uint32_t    got = 0;
+  uint64_t    start;
+  int         i;
+
+  printf("can: %u batches of %u bytes to %u modules\n", rounds, size, total);
+
+  CHECK(total <= CAN_EXT_WAIT_QUEUE_MAX);
+
+  SimCanClearStat();
+  start = SimNow();
+
+  for (uint32_t r = 0; r < rounds; r++) {
+    // modules with higher ID get requests first, and start to answer first
+    for (i = 0; i < total; i++) {
+      SimModule *m = modules[total - 1 - i];
+
+      for (uint16_t j = 0; j < size; j++)
+        data[i][j] = (uint8_t)(r * 11 + i * 37 + j);
+      data[i][MODULE_EXT_CMD_INDEX_ID] = 0x40;
+      memcpy(expect[i], data[i], size);
+      expect[i][MODULE_EXT_CMD_INDEX_ID] = 0x41;
+
+      cmd[i].mac.val = 0;
+      cmd[i].mac.bits.id = m->mac();
+      cmd[i].mac.bits.channel = m->channel();
+      cmd[i].data = data[i];
+      cmd[i].length = size;
+    }
+
+    canhost.SendExtCmdBatch(cmd, ret, total, CAN_EXT_WAIT_BUFFER_SIZE, 100);
+
+    for (i = 0; i < total; i++) {
+      CHECK(ret[i] == E_SUCCESS);
+      CHECK(cmd[i].length == size && !memcmp(data[i], expect[i], size));
+      got++;
+    }
+  }
+
+  for (int ch = 0; ch < SIM_CAN_CHANNELS; ch++)
+    interleaved += SimCanStat(ch).interleaved;
+
+  printf("  got %u/%u acks in %llu ms, %u times a module took bus in the middle of another\n",
+          got, rounds * total, (unsigned long long)((SimNow() - start) / SIM_NS_PER_MS), interleaved);
+
+  CHECK(interleaved > 0);
+
+  return true;
+}
+
+
+static uint32_t ExtRequests(SimModule **modules, uint8_t total) {
+  uint32_t requests = 0;
+
+  for (int i = 0; i < total; i++)
+    requests += modules[i]->ext_requests();
+
+  return requests;
+}
+
+
+// bring up modules as InitModules() does, with requests which are cached
+static bool BootModules(SimModule **modules, uint8_t total, uint8_t acks[][4]) {
+  uint8_t     data[CAN_EXT_WAIT_BUFFER_SIZE];
+  CanExtCmd_t cmd;
+
+  for (int i = 0; i < total; i++) {
+    cmd.mac.val = 0;
+    cmd.mac.bits.id = modules[i]->mac();
+    cmd.mac.bits.channel = modules[i]->channel();
+    cmd.data = data;
+    cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_FUNCID_REQ;
+    cmd.length = 1;
+
+    CHECK(canhost.SendExtCmdSync(cmd, 500) == E_SUCCESS);
+    CHECK(cmd.length == 4 && !memcmp(cmd.data, acks[i], 4));
+  }
+
+  return true;
+}
+
+
+static bool Reboot(SimModule **modules, uint8_t total, uint8_t acks[][4], ModuleCacheState expect) {
+  MAC_t    macs[SIM_CAN_MODULE_MAX];
+  uint32_t hashes[SIM_CAN_MODULE_MAX];
+  uint32_t requests = ExtRequests(modules, total);
+  uint64_t start = SimNow();
+
+  for (int i = 0; i < total; i++) {
+    macs[i].val = 0;
+    macs[i].bits.id = modules[i]->mac();
+    macs[i].bits.channel = modules[i]->channel();
+    hashes[i] = 0x1000 + i;
+  }
+
+  SimFlashClearStat();
+
+  modulecache.Begin(macs, hashes, total);
+  CHECK(modulecache.state() == expect);
+  SimCanClearStat();
+  canhost.PrefetchFunctionIds(macs, total);
+
+  if (!BootModules(modules, total, acks))
+    return false;
+
+  modulecache.End();
+
+  printf("  boot in %llu us, %u requests to modules, %u erases, %u half words programmed\n",
+          (unsigned long long)((SimNow() - start) / SIM_NS_PER_US), ExtRequests(modules, total) - requests,
+          SimFlashStat().erases, SimFlashStat().programs);
+
+  // acks are taken from flash
+  if (expect == MODULE_CACHE_STATE_HIT)
+    CHECK(ExtRequests(modules, total) == requests);
+
+  // modules are asked together, and not again one by one
+  if (expect == MODULE_CACHE_STATE_LEARN)
+    CHECK(ExtRequests(modules, total) - requests == total);
+
+  // no request lost arbitration to an ack
+  for (int ch = 0; ch < SIM_CAN_CHANNELS; ch++)
+    CHECK(SimCanStat(ch).host_lost == 0);
+
+  return true;
+}
+
+
+// ack of the first module is changed, it's found by validation
+static bool ChangeAck(SimModule **modules, uint8_t total, uint8_t acks[][4], uint8_t value) {
+  uint8_t ack[4];
+
+  memcpy(ack, acks[0], 4);
+  ack[3] = value;
+  modules[0]->SetExtAck(MODULE_EXT_CMD_GET_FUNCID_REQ, ack, 4);
+
+  // old ack is taken from cache in booting
+  CHECK(Reboot(modules, total, acks, MODULE_CACHE_STATE_HIT));
+  while (modulecache.ValidateStep());
+  CHECK(CACHE_COMMIT_WORD != MODULE_CACHE_COMMIT);
+
+  acks[0][3] = value;
+  CHECK(Reboot(modules, total, acks, MODULE_CACHE_STATE_LEARN));
+  CHECK(Reboot(modules, total, acks, MODULE_CACHE_STATE_HIT));
+  while (modulecache.ValidateStep());
+  CHECK(CACHE_COMMIT_WORD == MODULE_CACHE_COMMIT);
+
+  return true;
+}
+
+
+static bool RunModuleCache(SimModule **modules, uint8_t total, bool persistent) {
+  uint8_t  acks[SIM_CAN_MODULE_MAX][4];
+  uint32_t requests;
+
+  printf("module cache: %u modules\n", total);
+
+  for (int i = 0; i < total; i++) {
+    acks[i][0] = MODULE_EXT_CMD_GET_FUNCID_REQ + 1;
+    acks[i][1] = 1;
+    acks[i][2] = 0;
+    acks[i][3] = (uint8_t)i;
+    modules[i]->SetExtAck(MODULE_EXT_CMD_GET_FUNCID_REQ, acks[i], 4);
+  }
+
+  // flash kept by last run may have been learnt already
+  if (!persistent || CACHE_COMMIT_WORD != MODULE_CACHE_COMMIT) {
+    CHECK(Reboot(modules, total, acks, MODULE_CACHE_STATE_LEARN));
+  }
+  CHECK(Reboot(modules, total, acks, MODULE_CACHE_STATE_HIT));
+
+  // all of cached acks are asked again in background
+  requests = ExtRequests(modules, total);
+  CHECK(modulecache.state() == MODULE_CACHE_STATE_VALIDATE);
+  while (modulecache.ValidateStep());
+  CHECK(modulecache.state() == MODULE_CACHE_STATE_OFF);
+  CHECK(ExtRequests(modules, total) - requests == total);
+  CHECK(CACHE_COMMIT_WORD == MODULE_CACHE_COMMIT);
+
+  // firmware of module is changed without changing its version, then back,
+  // so flash kept in image is same as the beginning
+  CHECK(ChangeAck(modules, total, acks, 0x80));
+  CHECK(ChangeAck(modules, total, acks, 0));
+
+  return true;
+}
+
+
+// settings as configuration_store saves them: version and crc at the
+// beginning, then fields of 4 bytes
+#define SETTINGS_OFFSET     100
+#define SETTINGS_SIZE       1200
+#define SETTINGS_LIVE_Z     (SETTINGS_OFFSET + SETTINGS_SIZE - 4)
+
+static void SetVersion(uint8_t *image) {
+  uint16_t crc = 0;
+
+  memcpy(image + SETTINGS_OFFSET, "V70", 4);
+  for (int i = SETTINGS_OFFSET + 6; i < SETTINGS_OFFSET + SETTINGS_SIZE; i++)
+    crc = crc * 31 + image[i];
+  memcpy(image + SETTINGS_OFFSET + 4, &crc, 2);
+}
+
+
+// End() is skipped if commit is false, like power loss before it
+static bool SaveSettings(const uint8_t *image, bool commit) {
+  uint8_t err[4] = {'E', 'R', 'R', 0};
+  bool ok = true;
+
+  settingslog.Begin();
+  ok &= (settingslog.Write(SETTINGS_OFFSET, err, 4) == E_SUCCESS);
+  for (int i = SETTINGS_OFFSET + 6; i < SETTINGS_OFFSET + SETTINGS_SIZE; i += 4)
+    ok &= (settingslog.Write(i, image + i, 4) == E_SUCCESS);
+  ok &= (settingslog.Write(SETTINGS_OFFSET, image + SETTINGS_OFFSET, 6) == E_SUCCESS);
+  if (commit)
+    ok &= (settingslog.End() == E_SUCCESS);
+
+  return ok;
+}
+
+
+static bool SameSettings(const uint8_t *image) {
+  static uint8_t got[SETTINGS_LOG_CAPACITY];
+
+  if (settingslog.Read(0, got, SETTINGS_LOG_CAPACITY) != E_SUCCESS)
+    return false;
+
+  return memcmp(got, image, SETTINGS_LOG_CAPACITY) == 0;
+}
+
+
+static void SetLiveZ(uint8_t *image, float z) {
+  memcpy(image + SETTINGS_LIVE_Z, &z, 4);
+  SetVersion(image);
+}
+
+
+// power is lost before a save finishes, the old settings are kept
+static bool LoseSave(uint8_t *image) {
+  static uint8_t lost[SETTINGS_LOG_CAPACITY];
+
+  memcpy(lost, image, SETTINGS_LOG_CAPACITY);
+  SetLiveZ(lost, 10.0f);
+  CHECK(SaveSettings(lost, false));
+
+  settingslog.Init();
+  CHECK(SameSettings(image));
+
+  CHECK(SaveSettings(image, true));
+  settingslog.Init();
+  CHECK(SameSettings(image));
+
+  return true;
+}
+
+
+/* power is cut at every step of a save which compacts the log, settings
+ * must be the old or the new ones after rebooting, and saving still works
+ */
+static bool CutSave(uint8_t *image) {
+  static uint8_t snapshot[MARLIN_EEPROM_SIZE];
+  static uint8_t next[SETTINGS_LOG_CAPACITY];
+  uint8_t *eeprom = (uint8_t *)(uintptr_t)FLASH_MARLIN_EEPROM;
+  uint32_t ops;
+  uint32_t old_hits = 0;
+  uint32_t step;
+
+  // save until one of saves compacts
+  for (int i = 0; ; i++) {
+    memcpy(next, image, SETTINGS_LOG_CAPACITY);
+    SetLiveZ(next, 0.01f * i);
+
+    memcpy(snapshot, eeprom, MARLIN_EEPROM_SIZE);
+    SimFlashClearStat();
+    CHECK(SaveSettings(next, true));
+    if (SimFlashStat().erases)
+      break;
+
+    memcpy(image, next, SETTINGS_LOG_CAPACITY);
+  }
+  ops = SimFlashStat().erases + SimFlashStat().programs;
+
+  step = ops / 150 + 1;
+  for (uint32_t cut = 0; cut < ops; cut += step) {
+    // reboot with flash of that moment
+    memcpy(eeprom, snapshot, MARLIN_EEPROM_SIZE);
+    settingslog.Init();
+    SimFlashPowerCut(cut);
+    SaveSettings(next, true);
+    SimFlashPowerCut(-1);
+
+    settingslog.Init();
+    if (SameSettings(image)) {
+      old_hits++;
+    }
+    else if (!SameSettings(next)) {
+      printf("  power cut after %u of %u operations\n", cut, ops);
+      CHECK(SameSettings(next));
+    }
+
+    CHECK(SaveSettings(next, true));
+    settingslog.Init();
+    CHECK(SameSettings(next));
+  }
+
+  printf("  power cut at %u points of %u operations, %u kept old settings\n", (ops + step - 1) / step, ops, old_hits);
+
+  memcpy(image, next, SETTINGS_LOG_CAPACITY);
+
+  return true;
+}
+
+
+static bool RunSettings(uint32_t saves) {
+  static uint8_t image[SETTINGS_LOG_CAPACITY];
+  uint32_t seed = 1;
+  uint32_t erases = 0;
+  uint32_t programs = 0;
+
+  printf("settings: %u bytes, %u live z saves\n", SETTINGS_SIZE, saves);
+
+  // image of old layout, as old firmware programmed it to page 0
+  memset(image, 0xFF, sizeof(image));
+  for (int i = SETTINGS_OFFSET + 6; i < SETTINGS_OFFSET + SETTINGS_SIZE; i++) {
+    seed = seed * 1103515245 + 12345;
+    image[i] = (uint8_t)(seed >> 16);
+  }
+  SetVersion(image);
+
+  FLASH_Unlock();
+  FLASH_ErasePage(FLASH_MARLIN_EEPROM);
+  FLASH_ErasePage(FLASH_MARLIN_EEPROM + SIM_FLASH_PAGE_SIZE);
+  for (int i = 0; i < SETTINGS_LOG_CAPACITY; i += 2)
+    FLASH_ProgramHalfWord(FLASH_MARLIN_EEPROM + i, image[i] | image[i + 1] << 8);
+  FLASH_Lock();
+
+  settingslog.Init();
+  CHECK(SameSettings(image));
+
+  // the first save moves them to log
+  SimFlashClearStat();
+  CHECK(SaveSettings(image, true));
+  CHECK(SimFlashStat().erases == 1);
+  settingslog.Init();
+  CHECK(SameSettings(image));
+  printf("  converted from old layout, %u bytes left in page\n", settingslog.Free());
+
+  for (uint32_t i = 0; i < saves; i++) {
+    SetLiveZ(image, 0.05f * (i % 40));
+
+    SimFlashClearStat();
+    CHECK(SaveSettings(image, true));
+    erases += SimFlashStat().erases;
+    programs += SimFlashStat().programs;
+    CHECK(SimFlashStat().errors == 0);
+    CHECK(SameSettings(image));
+
+    if (i % 16 == 0) {
+      settingslog.Init();
+      CHECK(SameSettings(image));
+    }
+  }
+
+  printf("  %u erases, %u half words programmed, old store took %u erases, %u half words\n",
+          erases, programs, saves * 2, saves * MARLIN_EEPROM_SIZE / 2);
+  CHECK(erases * 10 <= saves);
+
+  CHECK(LoseSave(image));
+  CHECK(CutSave(image));
+
+  return true;
+}
+
+
+static bool SameRecord(PowerLossRecoveryData_t a, PowerLossRecoveryData_t b) {
+  // Load() clears checksum of what it reads
+  a.CheckSum = 0;
+  b.CheckSum = 0;
+  return !memcmp(&a, &b, sizeof(a));
+}
+
+
+// toolhead is set by module discovery in firmware
+struct SimToolhead: public ModuleBase {
+  static void Set(ModuleToolHeadType toolhead) { SetToolhead(toolhead); }
+};
+
+
+// job which has run long enough to journal its record
+static void StartJob(float shift) {
+  pl_recovery.Reset();
+  position_shift[X_AXIS] = shift;
+  feedrate_percentage = 100;
+
+  for (int i = 0; i < 100; i++)
+    pl_recovery.Journal();
+}
+
+
+static void LosePower(int32_t line) {
+  current_position[X_AXIS] = line * 0.1f;
+  pl_recovery.SaveCmdLine(line);
+  pl_recovery.SaveEnv();
+  pl_recovery.WriteFlash();
+}
+
+
+/* record of working status is journaled while working, when power is lost
+ * only the rest of it is programmed, and Load() finds it after reboot
+ */
+static bool RunPowerLoss() {
+  PowerLossRecoveryData_t expect;
+  uint32_t journaled;
+  uint32_t whole;
+  uint32_t cut = 0;
+  uint32_t ops;
+  int ret;
+
+  printf("power loss: record of %u bytes\n", (uint32_t)sizeof(PowerLossRecoveryData_t));
+
+  FLASH_Unlock();
+  FLASH_ErasePage(FLASH_MARLIN_POWERPANIC);
+  FLASH_Lock();
+
+  // area is formatted by the first boot
+  CHECK(pl_recovery.Load() == 2);
+  CHECK(pl_recovery.Load() == 2);
+
+  systemservice.SetCurrentStatus(SYSTAT_WORK);
+  pl_recovery.enable(true);
+
+  StartJob(1.5f);
+  SimFlashClearStat();
+  LosePower(1234);
+  journaled = SimFlashStat().programs;
+  expect = pl_recovery.cur_data_;
+
+  CHECK(pl_recovery.Load() == 0);
+  CHECK(SameRecord(pl_recovery.pre_data_, expect));
+  CHECK(pl_recovery.pre_data_.FilePosition == 1234);
+
+  // stable part is changed after journaling, whole record is programmed
+  StartJob(2.5f);
+  feedrate_percentage = 80;
+  SimFlashClearStat();
+  LosePower(5678);
+  whole = SimFlashStat().programs;
+  expect = pl_recovery.cur_data_;
+
+  CHECK(pl_recovery.Load() == 0);
+  CHECK(SameRecord(pl_recovery.pre_data_, expect));
+  CHECK(pl_recovery.pre_data_.feedrate_percentage == 80);
+
+  printf("  half words programmed when power is lost: %u journaled, %u not\n", journaled, whole);
+  CHECK(journaled < whole);
+
+  // screen drops the record
+  pl_recovery.MaskPowerPanicData();
+  CHECK(pl_recovery.Load() == 1);
+
+  // power is cut before the record is committed
+  for (ops = 0; ; ops++) {
+    StartJob(3.5f);
+    SimFlashPowerCut(ops);
+    LosePower(ops);
+    SimFlashPowerCut(-1);
+    expect = pl_recovery.cur_data_;
+
+    ret = pl_recovery.Load();
+    if (ret == 0) {
+      CHECK(SameRecord(pl_recovery.pre_data_, expect));
+      break;
+    }
+    // half programmed commit flag reads as masked
+    CHECK(ret == 2 || ret == 1);
+    cut++;
+  }
+  printf("  power cut at %u points of writing record, none was taken\n", cut);
+
+  // job on rotary module, B of the rest is planned on the surface again
+  SimToolhead::Set(MODULE_TOOLHEAD_LASER);
+  planner.set_rotary_radius(25);
+  StartJob(4.5f);
+  LosePower(4321);
+  planner.set_rotary_radius(0);
+
+  CHECK(pl_recovery.Load() == 0);
+  CHECK(pl_recovery.pre_data_.rotary_radius == 25);
+  CHECK(pl_recovery.ResumeWork() == E_SUCCESS);
+  CHECK(planner.rotary_radius == 25);
+
+  planner.set_rotary_radius(0);
+
+  // laser output saved is of the block whose line is saved,
+  // not of the last block planned
+  StartJob(5.5f);
+  pl_recovery.SaveCmdLine(4400, 200);
+  // block not from the file doesn't change what we save
+  pl_recovery.SaveCmdLine(INVALID_CMD_LINE, 0);
+  laser.power_pwm(50);
+  pl_recovery.SaveEnv();
+  pl_recovery.WriteFlash();
+  CHECK(pl_recovery.cur_data_.FilePosition == 4400);
+  CHECK(pl_recovery.cur_data_.laser_pwm == 200);
+  CHECK(pl_recovery.Load() == 0);
+  CHECK(pl_recovery.ResumeWork() == E_SUCCESS);
+  CHECK(laser.power_pwm() == 200);
+
+  SimToolhead::Set(MODULE_TOOLHEAD_UNKNOW);
+
+  systemservice.SetCurrentStatus(SYSTAT_IDLE);
+  pl_recovery.enable(false);
+
+  return true;
+}
+
+
+// QuickStopService is not built, run its callbacks as it does after
+// motion is stopped
+static void QuickStop(QuickStopSource source) {
+  systemservice.CallbackPreQS(source);
+  systemservice.CallbackPostQS(source);
+}
+
+
+// ack of SystemService to screen is the last event written to UART
+static bool AckedToScreen(uint8_t op_code) {
+  uint8_t  buffer[256];
+  uint32_t length = SimUartTake(buffer, sizeof(buffer));
+
+  return length > SSTP_PDU_HEADER_SIZE && buffer[length - 3] == EID_SYS_CTRL_ACK &&
+         buffer[length - 2] == op_code && buffer[length - 1] == 0;
+}
+
+
+/* status of SystemService through a job: start, pause, resume and stop,
+ * from PC and from screen, and the transitions it refuses
+ */
+static bool RunSystemStatus() {
+  uint8_t  buffer[256];
+  uint8_t *event;
+  uint16_t length;
+
+  printf("system status: jobs of PC and screen\n");
+
+  sm2_handle->event_group = xEventGroupCreate();
+  SimToolhead::Set(MODULE_TOOLHEAD_LASER);
+  systemservice.Init();
+  systemservice.SetCurrentStatus(SYSTAT_IDLE);
+  // drop what is written to screen before
+  while (SimUartTake(buffer, sizeof(buffer))) {}
+
+  // job of PC is paused and resumed by PC only
+  CHECK(systemservice.ResumeTrigger(TRIGGER_SOURCE_PC) == E_NO_SWITCHING_STA);
+  CHECK(systemservice.StartWork(TRIGGER_SOURCE_PC) == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_WORK);
+  CHECK(systemservice.GetWorkingPort() == WORKING_PORT_PC);
+  CHECK(systemservice.StartWork(TRIGGER_SOURCE_PC) == E_NO_SWITCHING_STA);
+
+  CHECK(systemservice.PauseTrigger(TRIGGER_SOURCE_SC) == E_INVALID_STATE);
+  CHECK(systemservice.PauseTrigger(TRIGGER_SOURCE_PC) == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_PAUSE_TRIG);
+  CHECK(systemservice.PauseTrigger(TRIGGER_SOURCE_PC) == E_NO_SWITCHING_STA);
+  QuickStop(QS_SOURCE_PAUSE);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_PAUSE_FINISH);
+
+  // resuming is done by Marlin task, HMI task only hands it over
+  CHECK(systemservice.ResumeTrigger(TRIGGER_SOURCE_SC) == E_FAILURE);
+  CHECK(systemservice.ResumeTrigger(TRIGGER_SOURCE_PC) == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_RESUME_TRIG);
+  CHECK(marlin_events.Take(event, length));
+  CHECK(length == 2 && event[0] == EID_SYS_CTRL_REQ && event[1] == SYSCTL_OPC_RESUME);
+  marlin_events.Release();
+
+  CHECK(systemservice.ResumeProcess() == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_RESUME_WAITING);
+  CHECK(AckedToScreen(SYSCTL_OPC_RESUME));
+  CHECK(systemservice.ResumeOver() == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_WORK);
+
+  // stop in pause needs no quick stop
+  CHECK(systemservice.PauseTrigger(TRIGGER_SOURCE_PC) == E_SUCCESS);
+  QuickStop(QS_SOURCE_PAUSE);
+  CHECK(systemservice.StopTrigger(TRIGGER_SOURCE_PC, SYSCTL_OPC_STOP) == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_IDLE);
+
+  // job of screen, its pause and stop are acked when quick stop is done
+  CHECK(systemservice.StartWork(TRIGGER_SOURCE_SC) == E_SUCCESS);
+  CHECK(systemservice.GetWorkingPort() == WORKING_PORT_SC);
+  CHECK(systemservice.PauseTrigger(TRIGGER_SOURCE_SC) == E_SUCCESS);
+  QuickStop(QS_SOURCE_PAUSE);
+  CHECK(AckedToScreen(SYSCTL_OPC_PAUSE));
+  CHECK(systemservice.ResumeTrigger(TRIGGER_SOURCE_SC) == E_SUCCESS);
+  CHECK(marlin_events.Take(event, length));
+  marlin_events.Release();
+  CHECK(systemservice.ResumeProcess() == E_SUCCESS);
+  CHECK(systemservice.ResumeOver() == E_SUCCESS);
+
+  CHECK(systemservice.StopTrigger(TRIGGER_SOURCE_SC, SYSCTL_OPC_STOP) == E_SUCCESS);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_END_TRIG);
+  QuickStop(QS_SOURCE_STOP);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_IDLE);
+  CHECK(AckedToScreen(SYSCTL_OPC_STOP));
+
+  // no new job after a fault bans working
+  enable_action_ban(ACTION_BAN_NO_WORKING);
+  CHECK(systemservice.StartWork(TRIGGER_SOURCE_SC) == E_NO_WORKING);
+  disable_action_ban(ACTION_BAN_NO_WORKING);
+  CHECK(systemservice.GetCurrentStatus() == SYSTAT_IDLE);
+
+  SimToolhead::Set(MODULE_TOOLHEAD_UNKNOW);
+
+  return true;
+}
+
+
+// within 0.5%
+#define CLOSE_TO(v, expect) (ABS((float)(v) - (float)(expect)) <= ABS((float)(expect)) * 0.005f)
+
+static block_t *LastBlock() {
+  return &planner.block_buffer[BLOCK_MOD(planner.block_buffer_head - 1)];
+}
+
+static void ResetPlanner(float radius) {
+  static const float steps[] = DEFAULT_AXIS_STEPS_PER_UNIT, feedrate[] = DEFAULT_MAX_FEEDRATE;
+  static const uint32_t accel[] = DEFAULT_MAX_ACCELERATION;
+
+  LOOP_X_TO_EN(i) {
+    planner.settings.axis_steps_per_mm[i] = steps[i];
+    planner.settings.max_feedrate_mm_s[i] = feedrate[i];
+    planner.settings.max_acceleration_mm_per_s2[i] = accel[i];
+  }
+  planner.settings.acceleration = DEFAULT_ACCELERATION;
+  planner.settings.retract_acceleration = DEFAULT_RETRACT_ACCELERATION;
+  planner.settings.travel_acceleration = DEFAULT_TRAVEL_ACCELERATION;
+  planner.settings.min_feedrate_mm_s = DEFAULT_MINIMUMFEEDRATE;
+  planner.settings.min_travel_feedrate_mm_s = DEFAULT_MINTRAVELFEEDRATE;
+  planner.settings.min_segment_time_us = DEFAULT_MINSEGMENTTIME;
+  planner.junction_deviation_mm = JUNCTION_DEVIATION_MM;
+  planner.refresh_positioning();
+  planner.reset_acceleration_rates();
+
+  planner.clear_block_buffer();
+  planner.set_rotary_radius(radius);
+  planner.set_position_mm(0, 0, 0, 0, 0);
+}
+
+/* B is commanded in degrees, with a workpiece radius its feedrate and
+ * acceleration are on the surface, limits of B are still in degrees
+ */
+static bool RunRotaryPlan(float radius) {
+  float mm_per_degree = RADIANS(radius);
+  float steps_per_degree;
+  float speed;
+  float max_accel;
+  block_t *block;
+
+  printf("rotary plan: radius %.1f mm\n", radius);
+
+  ResetPlanner(radius);
+  steps_per_degree = planner.settings.axis_steps_per_mm[B_AXIS];
+
+  // F on the surface, half of the B limit
+  speed = planner.settings.max_feedrate_mm_s[B_AXIS] * mm_per_degree / 2;
+  CHECK(planner.buffer_line(0, 0, 0, 90, 0, speed, 0));
+  block = LastBlock();
+  CHECK(CLOSE_TO(block->millimeters, 90 * mm_per_degree));
+  CHECK(CLOSE_TO(SQRT(block->nominal_speed_sqr), speed));
+  CHECK(CLOSE_TO(block->nominal_rate, speed / mm_per_degree * steps_per_degree));
+  CHECK(CLOSE_TO((float)block->step_event_count / block->nominal_rate, 90 * mm_per_degree / speed));
+  CHECK(block->acceleration_steps_per_s2 <= planner.max_acceleration_steps_per_s2[B_AXIS]);
+  printf("  90 degrees at %.2f mm/s: %u steps/s, %.3f s\n", speed, (uint32_t)block->nominal_rate,
+          (float)block->step_event_count / block->nominal_rate);
+
+  // too fast for B, limited by max feedrate in degrees/s
+  ResetPlanner(radius);
+  CHECK(planner.buffer_line(0, 0, 0, 90, 0, 100, 0));
+  block = LastBlock();
+  CHECK(CLOSE_TO(SQRT(block->nominal_speed_sqr), planner.settings.max_feedrate_mm_s[B_AXIS] * mm_per_degree));
+  CHECK(CLOSE_TO(block->nominal_rate, planner.settings.max_feedrate_mm_s[B_AXIS] * steps_per_degree));
+
+  // 90 degrees corner from X+B to X-B turns B around, cornering takes B
+  // acceleration limit in degrees/s^2 to the surface
+  ResetPlanner(radius);
+  speed = planner.settings.max_feedrate_mm_s[B_AXIS] * mm_per_degree;
+  CHECK(planner.buffer_line(10, 0, 0, 10 / mm_per_degree, 0, speed, 0));
+  CHECK(planner.buffer_line(20, 0, 0, 0, 0, speed, 0));
+  block = LastBlock();
+  max_accel = MIN(block->acceleration, planner.settings.max_acceleration_mm_per_s2[B_AXIS] * mm_per_degree);
+  printf("  corner: max entry %.3f mm/s, acceleration %.1f mm/s^2\n", SQRT(block->max_entry_speed_sqr), max_accel);
+  CHECK(CLOSE_TO(block->max_entry_speed_sqr,
+                 max_accel * JUNCTION_DEVIATION_MM * SQRT(0.5f) / (1 - SQRT(0.5f))));
+
+  ResetPlanner(0);
+  return true;
+}
+
+
+/* packs like pack.py -z, only search is simpler: the latest match for
+ * 3 bytes, so no one is needed to check the unpacker
+ */
+static uint32_t Pack(const uint8_t *raw, uint32_t size, uint8_t *out) {
+  static int32_t last[1 << 16];
+  uint32_t pos = 0, n = FW_PACK_HEADER_SIZE, flag = 0;
+  uint32_t crc = FwUnpacker::Crc32(raw, size);
+  int items = 8;
+
+  for (uint32_t i = 0; i < COUNT(last); i++)
+    last[i] = -1;
+
+  while (pos < size) {
+    uint32_t length = 0, distance = 0;
+
+    if (items == 8) {
+      flag = n;
+      out[n++] = 0;
+      items = 0;
+    }
+
+    if (pos + FW_PACK_LENGTH_MIN <= size) {
+      uint32_t key = (raw[pos] << 8 | raw[pos + 1]) ^ raw[pos + 2] << 4;
+      int32_t from = last[key & 0xFFFF];
+
+      last[key & 0xFFFF] = pos;
+      if (from >= 0 && pos - from <= FW_PACK_DISTANCE_MAX) {
+        while (length < FW_PACK_LENGTH_MAX && pos + length < size && raw[from + length] == raw[pos + length])
+          length++;
+        distance = pos - from;
+      }
+    }
+
+    if (length >= FW_PACK_LENGTH_MIN) {
+      uint32_t code = length - FW_PACK_LENGTH_MIN;
+
+      out[n++] = (distance - 1) >> 8 << 4 | (code < 15? code : 15);
+      out[n++] = (distance - 1) & 0xFF;
+      if (code >= 15)
+        out[n++] = code - 15;
+      pos += length;
+    }
+    else {
+      out[flag] |= 1 << items;
+      out[n++] = raw[pos++];
+    }
+    items++;
+  }
+
+  uint32_t header[4] = {FW_PACK_MAGIC, size, n - FW_PACK_HEADER_SIZE, crc};
+  memcpy(out, header, FW_PACK_HEADER_SIZE);
+
+  return n;
+}
+
+
+// feed packed image in random pieces, as packets of the last one are
+static ErrCode Unpack(FwUnpacker &unpacker, const uint8_t *packed, uint32_t length, uint32_t &seed) {
+  ErrCode ret = E_SUCCESS;
+
+  FLASH_Unlock();
+  for (uint32_t i = 0; i < MARLIN_CODE_SIZE; i += SIM_FLASH_PAGE_SIZE)
+    FLASH_ErasePage(FLASH_UPDATE_CONTENT + i);
+  FLASH_Lock();
+
+  unpacker.Begin(FLASH_UPDATE_CONTENT, MARLIN_CODE_SIZE);
+  for (uint32_t i = 0, piece; i < length && ret == E_SUCCESS; i += piece) {
+    seed = seed * 1103515245 + 12345;
+    piece = (seed >> 16) % 600 + 1;
+    if (piece > length - i)
+      piece = length - i;
+    ret = unpacker.Feed(packed + i, piece);
+  }
+
+  return (ret == E_SUCCESS)? unpacker.End() : ret;
+}
+
+
+/* firmware image is packed and unpacked into flash of update content,
+ * damaged or cut images must be found
+ */
+static bool RunUnpack(uint32_t size) {
+  static uint8_t raw[MARLIN_CODE_SIZE];
+  static uint8_t packed[MARLIN_CODE_SIZE + MARLIN_CODE_SIZE / 8 + FW_PACK_HEADER_SIZE + 1];
+  FwUnpacker unpacker;
+  uint32_t seed = 7;
+  uint32_t length;
+
+  printf("unpack: %u bytes of image\n", size);
+
+  // like code, runs of random bytes copied from a little earlier with
+  // changes, blank areas and some odd sizes
+  for (uint32_t i = 0; i < size; ) {
+    uint32_t run;
+
+    seed = seed * 1103515245 + 12345;
+    run = (seed >> 16) % 300 + 1;
+    if (run > size - i)
+      run = size - i;
+
+    switch ((seed >> 8) % 4) {
+    case 0:
+      memset(raw + i, 0xFF, run);
+      break;
+
+    case 1:
+      for (uint32_t j = 0; j < run; j++) {
+        seed = seed * 1103515245 + 12345;
+        raw[i + j] = seed >> 16;
+      }
+      break;
+
+    default:
+      for (uint32_t j = 0; j < run; j++)
+        raw[i + j] = (i + j >= 1000)? raw[i + j - 1000 + (seed >> 20) % 64] + (j % 29 == 0) : j;
+      break;
+    }
+    i += run;
+  }
+
+  length = Pack(raw, size, packed);
+  printf("  packed to %u bytes, %u%%\n", length, length * 100 / size);
+
+  SimFlashClearStat();
+  CHECK(Unpack(unpacker, packed, length, seed) == E_SUCCESS);
+  CHECK(unpacker.raw_size() == size);
+  CHECK(memcmp((const void *)(uintptr_t)FLASH_UPDATE_CONTENT, raw, size) == 0);
+  CHECK(SimFlashStat().errors == 0);
+  CHECK(SimFlashStat().programs == (size + 1) / 2);
+
+  // a byte is damaged in the middle
+  packed[length / 2] ^= 0x10;
+  CHECK(Unpack(unpacker, packed, length, seed) != E_SUCCESS);
+  packed[length / 2] ^= 0x10;
+
+  // image is cut, or something is after it
+  CHECK(Unpack(unpacker, packed, length - 1, seed) != E_SUCCESS);
+  packed[length] = 0;
+  CHECK(Unpack(unpacker, packed, length + 1, seed) != E_SUCCESS);
+
+  // not a packed image
+  CHECK(!FwUnpacker::IsPacked(raw, size));
+  CHECK(FwUnpacker::IsPacked(packed, length));
+
+  return true;
+}
+
+
+/* bed leveling lookup by cell coefficients, out of the virtual clock
+ */
+static bool RunMesh() {
+  printf("mesh: fixed point cells against float lookup\n");
+  CHECK(SimMeshCheck(20000, true));
+  CHECK(SimMeshCheck(20000, false));
+
+  printf("mesh: bench\n");
+  SimMeshBench(10000000);
+
+  return true;
+}
+
+
+#define GCODE_BIN_LINES_MAX   256
+#define GCODE_BIN_LINE_SIZE   128
+
+struct ParsedCommand {
+  char     letter;
+  int      codenum;
+  uint32_t seen;
+  float    value[26];
+};
+
+// what Marlin takes from the parser after parse()
+static void TakeParsed(ParsedCommand &cmd) {
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.letter = parser.command_letter;
+  cmd.codenum = parser.codenum;
+  for (int i = 0; i < 26; i++) {
+    if (!parser.seen((char)('A' + i)))
+      continue;
+    cmd.seen |= 1UL << i;
+    cmd.value[i] = parser.value_float();
+  }
+}
+
+static bool SameParsed(ParsedCommand &a, ParsedCommand &b) {
+  return a.letter == b.letter && a.codenum == b.codenum && a.seen == b.seen &&
+         !memcmp(a.value, b.value, sizeof(a.value));
+}
+
+/* packs made by scripts/gcode_bin.py are decoded like HandleFileGcodePack()
+ * does, parser must get the same command and values from binary command
+ * as from ASCII line, and text records must be the line itself
+ */
+static bool RunGcodeBin(const char *gcode, const char *packs) {
+  static char    lines[GCODE_BIN_LINES_MAX][GCODE_BIN_LINE_SIZE];
+  static uint8_t pack[FILE_GCODE_PACK_MAX_SIZE + 6];
+  GcodeBinDecoder  decoder;
+  binary_command_t cmd;
+  ParsedCommand    bin, text;
+  uint32_t total = 0;
+  uint32_t index = 0;
+  uint32_t binary = 0;
+  uint32_t first;
+  uint16_t length;
+  uint8_t  count;
+  uint8_t  *record;
+  char     *line;
+  FILE     *f;
+
+  printf("gcode bin: %s decoded from %s\n", gcode, packs);
+
+  f = fopen(gcode, "r");
+  CHECK(f);
+  while (total < GCODE_BIN_LINES_MAX && fgets(lines[total], GCODE_BIN_LINE_SIZE, f)) {
+    lines[total][strcspn(lines[total], "\r\n")] = 0;
+    total++;
+  }
+  fclose(f);
+
+  f = fopen(packs, "rb");
+  CHECK(f);
+  while (fread(&length, 2, 1, f) == 1) {
+    CHECK(length > 6 && length <= sizeof(pack) && fread(pack, 1, length, f) == length);
+
+    first = ((uint32_t)pack[1] << 24) | ((uint32_t)pack[2] << 16) | ((uint32_t)pack[3] << 8) | pack[4];
+    count = pack[5];
+    CHECK(first == index && index + count <= total);
+
+    decoder.Reset();
+    record = pack + 6;
+    for (uint8_t i = 0; i < count; i++, index++) {
+      record = decoder.Decode(record, pack + length, cmd, line);
+      CHECK(record);
+
+      if (line) {
+        CHECK(!strcmp(line, lines[index]));
+        continue;
+      }
+
+      parser.parse((char *)&cmd);
+      TakeParsed(bin);
+      parser.parse(lines[index]);
+      TakeParsed(text);
+      if (!SameParsed(bin, text))
+        printf("  line %u: \"%s\" differs\n", index, lines[index]);
+      CHECK(SameParsed(bin, text));
+      binary++;
+    }
+    CHECK(record == pack + length);
+  }
+  fclose(f);
+
+  printf("  %u lines, %u binary\n", index, binary);
+  CHECK(index == total && binary > 0);
+
+  return true;
+}
+
+
+int main(int argc, char *argv[]) {
+  const char *image = NULL;
+  const char *gcode = NULL;
+  const char *packs = NULL;
+  int failed = 0;
+
+  SimModule linear1(0x00010010, CAN_CH_1);
+  SimModule linear2(0x00010020, CAN_CH_1);
+  SimModule toolhead(0x00020030, CAN_CH_1);
+  SimModule enclosure(0x00030040, CAN_CH_2);
+  SimModule *modules[] = {&linear1, &linear2, &toolhead, &enclosure};
+  uint8_t total = COUNT(modules);
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--flash") && i + 1 < argc) {
+      image = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--gcode-bin") && i + 2 < argc) {
+      gcode = argv[++i];
+      packs = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--verbose")) {
+      SimSetLogLevel(SNAP_DEBUG_LEVEL_VERBOSE);
+    }
+    else {
+      printf("usage: %s [--flash image] [--gcode-bin gcode packs] [--verbose]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (!SimFlashInit(image))
+    return 1;
+
+  hmi.Init(&SimSerial2, HMI_SERIAL_IRQ_PRIORITY);
+  hmi.EnableRxNotify(xTaskGetCurrentTaskHandle());
+
+  canhost.Init();
+  SimCanHostStart();
+  for (int i = 0; i < total; i++) {
+    modules[i]->SetExtEcho(true);
+    SimCanAttach(modules[i]);
+  }
+
+  failed += !RunChecksum();
+  failed += !RunRing();
+  failed += !RunMesh();
+
+  failed += !RunUart(1000, 32, 0);
+  failed += !RunUart(60, 1000, 0);
+  failed += !RunUart(20, SSTP_RECV_BUFFER_SIZE, 0);
+  failed += !RunUart(1000, 32, 3000);
+  failed += !RunUart(20, 1000, 50000);
+
+  failed += !RunEventQueue(300, 300);
+
+  if (gcode)
+    failed += !RunGcodeBin(gcode, packs);
+
+  failed += !RunCan(modules, total, 500, 8, 0);
+  failed += !RunCan(modules, total, 200, 200, 0);
+  failed += !RunCan(modules, total, 500, 32, 2000);
+  failed += !RunCanConcurrent(&linear1, &linear2, 100, 120);
+  failed += !RunCanBatch(modules, total, 100, 120);
+
+  failed += !RunModuleCache(modules, total, image != NULL);
+
+  failed += !RunSettings(300);
+  failed += !RunPowerLoss();
+  failed += !RunSystemStatus();
+  failed += !RunRotaryPlan(20);
+  failed += !RunRotaryPlan(5);
+
+  failed += !RunUnpack(1);
+  failed += !RunUnpack(MARLIN_CODE_SIZE / 3 + 1);
+
+  printf("%d scenarios failed, %llu ms simulated\n", failed, (unsigned long long)(SimNow() / SIM_NS_PER_MS));
+
+  return failed;
+}
@@ -0,0 +1,74 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_H_
+#define SNAPMAKER_SIM_H_
+
+#include <stdint.h>
+
+// Host build of the service layer runs on a virtual clock. There is only one
+// task, the code under test. Peripherals are events on the clock, and they
+// are only run when the task blocks (FreeRTOS APIs with timeout, vTaskDelay)
+// or calls SimRunFor(), so an IRQ never preempts task code in the middle.
+// IRQ handlers are called by peripherals when the event happens, vectors
+// pended in NVIC_BASE->ISPR are run right after that, like tail-chaining
+
+#define SIM_NS_PER_US   (1000ULL)
+#define SIM_NS_PER_MS   (1000000ULL)
+
+typedef void (*SimCallback_t)(void *arg);
+typedef bool (*SimCondition_t)(void *arg);
+typedef void (*SimIrqHandler_t)(void);
+
+struct SimTask;
+
+// virtual time since power on, in ns
+uint64_t SimNow();
+
+// run cb after delay_ns, events at same time are run in order of scheduling
+void SimSchedule(uint64_t delay_ns, SimCallback_t cb, void *arg);
+
+// run events until time is advanced by ns
+void SimRunFor(uint64_t ns);
+
+// run events until cond(arg) is true or timeout, return value of cond
+bool SimWait(SimCondition_t cond, void *arg, uint64_t timeout_ns);
+
+// CPU is busy without taking IRQs, e.g. stalled by erasing flash.
+// events coming due meanwhile are run late, at next SimRunFor()/SimWait()
+void SimStall(uint64_t ns);
+
+// vector of IRQ which may be pended by software
+void SimAttachIrq(int irq, SimIrqHandler_t handler);
+
+// run vectors pended in NVIC, called by peripherals after their IRQs
+void SimServiceIrq();
+
+// task with higher priority than the main task, body runs to the end once
+// after it is notified, so it must not block
+SimTask *SimCreateTask(SimCallback_t body, void *arg);
+
+// print message and exit with failure, for broken assertions
+void SimAssert(const char *file, int line, const char *expr);
+
+// level of logs printed by SnapDebug::Log(), SNAP_DEBUG_LEVEL_MAX to mute all
+void SimSetLogLevel(uint8_t level);
+
+#endif  // #ifndef SNAPMAKER_SIM_H_
@@ -0,0 +1,518 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+#include "sim_can.h"
+
+#include <string.h>
+#include <wirish_time.h>
+#include <libmaple/nvic.h>
+
+#include "module/can_channel.h"
+#include "src/HAL/HAL_GD32F1/HAL_can_STM32F1.h"
+
+// frame length in bits without stuffing, including 3 bits of interframe space
+#define FRAME_BITS(f)   (((f).ide == IDTYPE_EXTID? 67 : 47) + 8 * (((f).rtr == FRAME_REMOTE)? 0 : (f).dlc))
+#define FRAME_NS(f)     ((uint64_t)FRAME_BITS(f) * 1000000000ULL / SIM_CAN_BITRATE)
+
+// std frames from modules, both of reserved and type bits are set, see CanInitFilter()
+#define STD_ID_FROM_MODULE  (0x600)
+
+#define HOST_MAILBOX_NUM    3
+
+extern "C" {
+  void __irq_can1_tx(void);
+  void __irq_can1_rx0(void);
+  void __irq_can1_rx1(void);
+  void __irq_can1_sce(void);
+  void __irq_can2_tx(void);
+  void __irq_can2_rx0(void);
+  void __irq_can2_rx1(void);
+}
+
+typedef struct {
+  bool          requested;
+  uint64_t      seq;
+  SimCanFrame_t frame;
+} SimMailbox_t;
+
+typedef struct {
+  SimMailbox_t  mb[HOST_MAILBOX_NUM];
+  uint8_t       done;       // RQCP of TSR
+  uint8_t       ok;         // TXOK of TSR
+  bool          tx_irq;     // TME interrupt is enabled
+
+  SimCanFrame_t rx[2];      // head of RX FIFOs, taken by CanbusParseData()
+  uint8_t       rx_fmi[2];
+
+  bool          busy;
+  SimCanFrame_t on_bus;
+  int8_t        sender_mb;  // mailbox of main controller, or -1 for module
+  SimModule     *sender;
+  SimModule     *last_module; // module sent the last module frame
+
+  SimCanStat_t  stat;
+} SimCanBus_t;
+
+static SimCanBus_t bus[SIM_CAN_CHANNELS];
+static uint64_t    mb_seq = 0;
+static bool        nart = true;
+
+static SimModule *modules[SIM_CAN_MODULE_MAX];
+static uint8_t   total_modules = 0;
+
+static void StartFrame(uint8_t ch);
+
+
+// lower key wins arbitration: base ID, then IDE, then extended ID, then RTR
+static uint64_t ArbitrationKey(SimCanFrame_t &f) {
+  uint64_t key;
+
+  if (f.ide == IDTYPE_EXTID)
+    key = (uint64_t)(f.id >> 18) << 32 | 1UL << 31 | (f.id & 0x3FFFF) << 1;
+  else
+    key = (uint64_t)f.id << 32;
+
+  return key | f.rtr;
+}
+
+
+static void TxIrq(uint8_t ch) {
+  if (!bus[ch].tx_irq)
+    return;
+
+  if (ch == 0)
+    __irq_can1_tx();
+  else
+    __irq_can2_tx();
+}
+
+
+static void RxIrq(uint8_t ch, uint8_t fifo) {
+  if (ch == 0)
+    fifo? __irq_can1_rx1() : __irq_can1_rx0();
+  else
+    fifo? __irq_can2_rx1() : __irq_can2_rx0();
+}
+
+
+// filters of main controller, see CanInitFilter()
+static void DeliverToHost(uint8_t ch, SimCanFrame_t &f) {
+  uint8_t fifo;
+
+  if (f.ide == IDTYPE_STDID) {
+    if (f.rtr != FRAME_DATA || (f.id & STD_ID_FROM_MODULE) != STD_ID_FROM_MODULE) {
+      bus[ch].stat.dropped++;
+      return;
+    }
+    fifo = 0;
+    bus[ch].rx_fmi[fifo] = 0;
+  }
+  else {
+    if (!(f.id & 1)) {
+      bus[ch].stat.dropped++;
+      return;
+    }
+    fifo = 1;
+    bus[ch].rx_fmi[fifo] = (f.rtr == FRAME_DATA)? 1 : 0;
+  }
+
+  bus[ch].rx[fifo] = f;
+  RxIrq(ch, fifo);
+}
+
+
+static void FrameDone(void *arg) {
+  uint8_t ch = (uint8_t)(uintptr_t)arg;
+  SimCanBus_t &b = bus[ch];
+  SimCanFrame_t f = b.on_bus;
+
+  b.busy = false;
+  b.stat.frames++;
+  b.stat.busy_ns += FRAME_NS(f);
+
+  if (b.sender_mb >= 0) {
+    b.mb[b.sender_mb].requested = false;
+    b.done |= 1 << b.sender_mb;
+    b.ok |= 1 << b.sender_mb;
+    b.stat.host_frames++;
+  }
+  else {
+    b.sender->Sent();
+  }
+
+  // every node gets the frame
+  for (int i = 0; i < total_modules; i++) {
+    if (modules[i]->channel() == ch && modules[i] != b.sender)
+      modules[i]->Receive(f);
+  }
+
+  if (b.sender_mb < 0)
+    DeliverToHost(ch, f);
+  else
+    TxIrq(ch);
+
+  StartFrame(ch);
+}
+
+
+// all nodes having frames start at the same time when bus is idle
+static void StartFrame(uint8_t ch) {
+  SimCanBus_t &b = bus[ch];
+  int8_t    host_mb = -1;
+  SimModule *winner = NULL;
+  SimCanFrame_t *f;
+  uint64_t  key = UINT64_MAX;
+
+  if (b.busy)
+    return;
+
+  // TXFP is enabled, so mailboxes are sent in order of request
+  for (int i = 0; i < HOST_MAILBOX_NUM; i++) {
+    if (b.mb[i].requested && (host_mb < 0 || b.mb[i].seq < b.mb[host_mb].seq))
+      host_mb = i;
+  }
+
+  for (int i = 0; i < total_modules; i++) {
+    if (modules[i]->channel() != ch)
+      continue;
+    f = modules[i]->Pending();
+    if (f && ArbitrationKey(*f) < key) {
+      key = ArbitrationKey(*f);
+      winner = modules[i];
+    }
+  }
+
+  if (host_mb >= 0) {
+    if (!winner || ArbitrationKey(b.mb[host_mb].frame) < key) {
+      b.busy = true;
+      b.on_bus = b.mb[host_mb].frame;
+      b.sender_mb = host_mb;
+      b.sender = NULL;
+      SimSchedule(FRAME_NS(b.on_bus), FrameDone, (void *)(uintptr_t)ch);
+      return;
+    }
+
+    // no retransmission, the request is finished without TXOK
+    if (nart) {
+      b.mb[host_mb].requested = false;
+      b.done |= 1 << host_mb;
+      b.ok &= ~(1 << host_mb);
+      b.stat.host_lost++;
+    }
+  }
+
+  if (winner) {
+    if (b.last_module && b.last_module != winner && b.last_module->Pending())
+      b.stat.interleaved++;
+    b.last_module = winner;
+
+    b.busy = true;
+    b.on_bus = *winner->Pending();
+    b.sender_mb = -1;
+    b.sender = winner;
+    SimSchedule(FRAME_NS(b.on_bus), FrameDone, (void *)(uintptr_t)ch);
+  }
+
+  // TX IRQ of the lost request, after the bus is taken by winner
+  if (host_mb >= 0 && nart && !b.mb[host_mb].requested)
+    TxIrq(ch);
+}
+
+
+static void KickEvent(void *arg) {
+  StartFrame((uint8_t)(uintptr_t)arg);
+}
+
+
+// callers may be in ServiceTx(), so don't call TX IRQ in their context
+void SimCanKick(uint8_t channel) {
+  if (channel < SIM_CAN_CHANNELS && !bus[channel].busy)
+    SimSchedule(0, KickEvent, (void *)(uintptr_t)channel);
+}
+
+
+void SimCanAttach(SimModule *module) {
+  configASSERT(total_modules < SIM_CAN_MODULE_MAX);
+  modules[total_modules++] = module;
+}
+
+
+void SimCanSetNart(bool enable) {
+  nart = enable;
+}
+
+
+SimCanStat_t &SimCanStat(uint8_t channel) {
+  return bus[channel].stat;
+}
+
+
+void SimCanClearStat() {
+  for (int i = 0; i < SIM_CAN_CHANNELS; i++)
+    bus[i].stat = {0, 0, 0, 0, 0, 0};
+}
+
+
+/* HAL of CAN, see HAL_can_STM32F1.cpp */
+void CanInit() {
+  for (int i = 0; i < SIM_CAN_CHANNELS; i++) {
+    bus[i].done = 0;
+    bus[i].ok = 0;
+    bus[i].tx_irq = false;
+    for (int j = 0; j < HOST_MAILBOX_NUM; j++)
+      bus[i].mb[j].requested = false;
+  }
+
+  SimAttachIrq(NVIC_CAN1_SCE_IRQn, __irq_can1_sce);
+}
+
+
+bool CanTxMailboxPut(uint8_t PortNum, uint8_t Mailbox, uint32_t ID, uint8_t IDType, uint8_t FrameType, uint8_t DataLen, uint8_t *pData) {
+  SimCanBus_t &b = bus[PortNum - 1];
+  SimMailbox_t &mb = b.mb[Mailbox];
+
+  if (Mailbox >= HOST_MAILBOX_NUM || mb.requested)
+    return false;
+
+  if (FrameType == FRAME_REMOTE)
+    DataLen = 0;
+  else if (DataLen > 8)
+    DataLen = 8;
+
+  mb.frame.id  = ID;
+  mb.frame.ide = IDType;
+  mb.frame.rtr = FrameType;
+  mb.frame.dlc = DataLen;
+  memcpy(mb.frame.data, pData, DataLen);
+  mb.seq = mb_seq++;
+  mb.requested = true;
+
+  SimCanKick(PortNum - 1);
+
+  return true;
+}
+
+
+uint8_t CanTxMailboxDone(uint8_t PortNum, uint8_t *OkMask) {
+  SimCanBus_t &b = bus[PortNum - 1];
+  uint8_t done = b.done;
+
+  *OkMask = b.ok & done;
+  b.done = 0;
+  b.ok &= ~done;
+
+  return done;
+}
+
+
+void CanTxIrqEnable(uint8_t PortNum) {
+  bus[PortNum - 1].tx_irq = true;
+}
+
+
+static uint8_t ParseData(uint8_t ch, uint32_t *ID, uint8_t *IDType, uint8_t *FrameType, uint8_t *pData, uint8_t *Len, uint8_t FIFONum) {
+  SimCanFrame_t &f = bus[ch].rx[FIFONum];
+
+  *ID = f.id;
+  *IDType = f.ide;
+  // HAL gives RTR bit of RIR
+  *FrameType = (f.rtr == FRAME_REMOTE)? 0x02 : 0;
+  *Len = f.dlc;
+  memcpy(pData, f.data, 8);
+
+  return bus[ch].rx_fmi[FIFONum];
+}
+
+
+uint8_t Canbus1ParseData(uint32_t *ID, uint8_t *IDType, uint8_t *FrameType, uint8_t *pData, uint8_t *Len, uint8_t FIFONum) {
+  return ParseData(0, ID, IDType, FrameType, pData, Len, FIFONum);
+}
+
+
+uint8_t Canbus2ParseData(uint32_t *ID, uint8_t *IDType, uint8_t *FrameType, uint8_t *pData, uint8_t *Len, uint8_t FIFONum) {
+  return ParseData(1, ID, IDType, FrameType, pData, Len, FIFONum);
+}
+
+
+/* virtual modules */
+SimModule::SimModule(uint32_t mac, uint8_t channel) {
+  mac_ = mac & 0x1FFFFFFE;
+  channel_ = channel;
+  rx_.Init(sizeof(rx_buf_), rx_buf_);
+}
+
+
+// replace the ack if req has been scripted
+void SimModule::SetExtAck(uint8_t req, const uint8_t *ack, uint16_t length) {
+  int i;
+
+  for (i = 0; i < total_acks_; i++) {
+    if (acks_[i].req == req)
+      break;
+  }
+
+  configASSERT(i < SIM_CAN_EXT_ACK_MAX && length <= SIM_CAN_EXT_ACK_SIZE);
+
+  acks_[i].req = req;
+  acks_[i].length = length;
+  memcpy(acks_[i].data, ack, length);
+  if (i == total_acks_)
+    total_acks_++;
+}
+
+
+void SimModule::Queue(SimCanFrame_t &frame) {
+  uint16_t next = (tx_w_ + 1) % SIM_CAN_MODULE_TX_SIZE;
+
+  configASSERT(next != tx_r_);
+
+  tx_[tx_w_] = frame;
+  tx_w_ = next;
+  SimCanKick(channel_);
+}
+
+
+SimCanFrame_t *SimModule::Pending() {
+  return (tx_r_ == tx_w_)? NULL : &tx_[tx_r_];
+}
+
+
+void SimModule::Sent() {
+  tx_r_ = (tx_r_ + 1) % SIM_CAN_MODULE_TX_SIZE;
+}
+
+
+// modules always start a SSTP packet in a new frame
+void SimModule::SendExt(uint8_t *data, uint16_t length) {
+  SimCanFrame_t f;
+  uint16_t i;
+
+  sstp_.Package(data, package_, length);
+
+  f.id  = mac_ | 1;
+  f.ide = IDTYPE_EXTID;
+  f.rtr = FRAME_DATA;
+  for (i = 0; i < length; i += f.dlc) {
+    f.dlc = (length - i > 8)? 8 : length - i;
+    memcpy(f.data, package_ + i, f.dlc);
+    Queue(f);
+  }
+}
+
+
+void SimModule::AckEvent(void *arg) {
+  SimModule *m = (SimModule *)arg;
+
+  m->SendExt(m->ack_q_[m->ack_r_], m->ack_q_len_[m->ack_r_]);
+  m->ack_r_ = (m->ack_r_ + 1) % SIM_CAN_ACK_QUEUE_SIZE;
+  m->ack_count_--;
+  m->ext_acks_++;
+}
+
+
+void SimModule::Receive(SimCanFrame_t &frame) {
+  SimCanFrame_t f;
+  uint16_t length;
+  uint8_t  *ack;
+  int      i;
+
+  if (frame.ide != IDTYPE_EXTID)
+    return;
+
+  if (frame.rtr == FRAME_REMOTE) {
+    if (frame.id != SIM_CAN_DISCOVER_ID || millis() < boot_ms_)
+      return;
+    f.id  = mac_ | 1;
+    f.ide = IDTYPE_EXTID;
+    f.rtr = FRAME_REMOTE;
+    f.dlc = 0;
+    Queue(f);
+    return;
+  }
+
+  if (frame.id != mac_)
+    return;
+
+  rx_.InsertMulti(frame.data, frame.dlc);
+  if (sstp_.Parse(rx_, request_, length) != E_SUCCESS)
+    return;
+
+  ext_requests_++;
+
+  if (ack_count_ >= SIM_CAN_ACK_QUEUE_SIZE)
+    return;
+
+  ack = ack_q_[(ack_r_ + ack_count_) % SIM_CAN_ACK_QUEUE_SIZE];
+
+  for (i = 0; i < total_acks_; i++) {
+    if (acks_[i].req == request_[0])
+      break;
+  }
+
+  if (i < total_acks_) {
+    memcpy(ack, acks_[i].data, acks_[i].length);
+    length = acks_[i].length;
+  }
+  else if (echo_) {
+    memcpy(ack, request_, length);
+    ack[0] = request_[0] + 1;
+  }
+  else {
+    return;
+  }
+
+  ack_q_len_[(ack_r_ + ack_count_) % SIM_CAN_ACK_QUEUE_SIZE] = length;
+  ack_count_++;
+  SimSchedule(ack_latency_us_ * SIM_NS_PER_US, AckEvent, this);
+}
+
+
+void SimModule::ReportEvent(void *arg) {
+  SimModule *m = (SimModule *)arg;
+  SimCanFrame_t f;
+
+  if (!m->report_period_us_)
+    return;
+
+  f.id  = m->report_id_ | STD_ID_FROM_MODULE;
+  f.ide = IDTYPE_STDID;
+  f.rtr = FRAME_DATA;
+  f.dlc = m->report_length_;
+  memset(f.data, 0, sizeof(f.data));
+  // sequence in data, so receiver can check order
+  memcpy(f.data, &m->std_reports_, (f.dlc < 4)? f.dlc : 4);
+  m->Queue(f);
+  m->std_reports_++;
+
+  SimSchedule(m->report_period_us_ * SIM_NS_PER_US, ReportEvent, m);
+}
+
+
+void SimModule::ReportStd(uint16_t msg_id, uint8_t length, uint32_t period_us) {
+  bool running = report_period_us_ != 0;
+
+  report_id_ = msg_id & 0x1FF;
+  report_length_ = (length > 8)? 8 : length;
+  report_period_us_ = period_us;
+
+  if (period_us && !running)
+    SimSchedule(period_us * SIM_NS_PER_US, ReportEvent, this);
+}
@@ -0,0 +1,150 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_CAN_H_
+#define SNAPMAKER_SIM_CAN_H_
+
+#include <stdint.h>
+
+#include "common/protocol_sstp.h"
+#include "utils/spsc_ring_buffer.h"
+
+// 36MHz / prescaler 6 / (1 + BS1 14 + BS2 5) tq, see CanInit()
+#define SIM_CAN_BITRATE         300000
+
+#define SIM_CAN_CHANNELS        2
+#define SIM_CAN_MODULE_MAX      16
+#define SIM_CAN_MODULE_TX_SIZE  256
+#define SIM_CAN_EXT_ACK_MAX     16   // scripted acks of one module
+#define SIM_CAN_EXT_ACK_SIZE    64
+#define SIM_CAN_ACK_QUEUE_SIZE  4    // acks waiting for latency
+
+// ext remote frame broadcast by host to ask MAC of modules
+#define SIM_CAN_DISCOVER_ID     0x01
+
+typedef struct {
+  uint32_t id;
+  uint8_t  ide;   // IDTYPE_STDID or IDTYPE_EXTID
+  uint8_t  rtr;   // FRAME_DATA or FRAME_REMOTE
+  uint8_t  dlc;
+  uint8_t  data[8];
+} SimCanFrame_t;
+
+typedef struct {
+  uint32_t frames;      // frames sent on the bus
+  uint32_t host_frames; // by main controller
+  uint32_t host_lost;   // main controller lost arbitration, dropped for NART
+  uint32_t dropped;     // frames not taken by filters of main controller
+  uint32_t interleaved; // module took bus while another one still had frames to send
+  uint64_t busy_ns;
+} SimCanStat_t;
+
+
+/* module on the bus, it answers discovery and SSTP ext commands from the
+ * script set by SetExtAck(), and reports std frames periodically
+ */
+class SimModule {
+  public:
+    // mac is the 29 bits ID, bit 0 is set by module when it sends
+    SimModule(uint32_t mac, uint8_t channel);
+
+    void SetExtAck(uint8_t req, const uint8_t *ack, uint16_t length);
+    // answer commands which have no script with itself, ack id is req + 1
+    void SetExtEcho(bool echo) { echo_ = echo; }
+    // time from getting whole request to start sending ack
+    void SetAckLatency(uint32_t us) { ack_latency_us_ = us; }
+    // module doesn't answer discovery before boot time
+    void SetBootTime(uint32_t ms) { boot_ms_ = ms; }
+
+    // send std frame of msg_id every period_us, 0 to stop
+    void ReportStd(uint16_t msg_id, uint8_t length, uint32_t period_us);
+
+    void Receive(SimCanFrame_t &frame);
+
+    // frame at head of TX queue, NULL if nothing to send
+    SimCanFrame_t *Pending();
+    void Sent();
+
+    uint32_t mac() { return mac_; }
+    uint8_t channel() { return channel_; }
+    uint32_t ext_requests() { return ext_requests_; }
+    uint32_t ext_acks() { return ext_acks_; }
+    uint32_t std_reports() { return std_reports_; }
+
+  private:
+    void Queue(SimCanFrame_t &frame);
+    void SendExt(uint8_t *data, uint16_t length);
+    static void AckEvent(void *arg);
+    static void ReportEvent(void *arg);
+
+  private:
+    uint32_t mac_;
+    uint8_t  channel_;
+    bool     echo_ = false;
+    uint32_t ack_latency_us_ = 100;
+    uint32_t boot_ms_ = 0;
+
+    struct {
+      uint8_t  req;
+      uint16_t length;
+      uint8_t  data[SIM_CAN_EXT_ACK_SIZE];
+    } acks_[SIM_CAN_EXT_ACK_MAX];
+    uint8_t total_acks_ = 0;
+
+    // acks to be sent, echo may be as long as request
+    uint8_t  ack_q_[SIM_CAN_ACK_QUEUE_SIZE][SSTP_RECV_BUFFER_SIZE];
+    uint16_t ack_q_len_[SIM_CAN_ACK_QUEUE_SIZE];
+    uint8_t  ack_r_ = 0;
+    uint8_t  ack_count_ = 0;
+
+    ProtocolSSTP sstp_;
+    SpscRingBuffer<uint8_t> rx_;
+    uint8_t rx_buf_[2 * SSTP_RECV_BUFFER_SIZE];   // power of 2, holds the longest packet
+    uint8_t request_[SSTP_RECV_BUFFER_SIZE];
+    uint8_t package_[SSTP_RECV_BUFFER_SIZE + SSTP_HEADER_SIZE];
+
+    SimCanFrame_t tx_[SIM_CAN_MODULE_TX_SIZE];
+    uint16_t tx_r_ = 0;
+    uint16_t tx_w_ = 0;
+
+    uint16_t report_id_ = 0;
+    uint8_t  report_length_ = 0;
+    uint32_t report_period_us_ = 0;
+
+    uint32_t ext_requests_ = 0;
+    uint32_t ext_acks_ = 0;
+    uint32_t std_reports_ = 0;
+};
+
+void SimCanAttach(SimModule *module);
+
+// frames of modules are ready to be sent, kick the bus if it is idle
+void SimCanKick(uint8_t channel);
+
+// CanInit() enables NART, main controller doesn't retry if it loses arbitration
+void SimCanSetNart(bool nart);
+
+SimCanStat_t &SimCanStat(uint8_t channel);
+void SimCanClearStat();
+
+// run receiver of canhost as a task woken up by CAN IRQs, after canhost.Init()
+void SimCanHostStart();
+
+#endif  // #ifndef SNAPMAKER_SIM_CAN_H_
@@ -0,0 +1,184 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+#include "sim_flash.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <libmaple/libmaple_types.h>
+#include "flash_stm32.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static uint8_t *flash = NULL;
+static bool locked = true;
+static SimFlashStat_t stat;
+static int32_t ops_left = -1;
+
+
+bool SimFlashInit(const char *image) {
+  void *addr = (void *)SIM_FLASH_BASE;
+  int  fd = -1;
+  int  flags = MAP_FIXED_NOREPLACE;
+  bool blank = true;
+
+  if (image) {
+    fd = open(image, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0)
+      blank = (lseek(fd, 0, SEEK_END) == 0);
+    if (fd < 0 || ftruncate(fd, SIM_FLASH_SIZE) != 0) {
+      perror(image);
+      return false;
+    }
+    flags |= MAP_SHARED;
+  }
+  else {
+    flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+  }
+
+  flash = (uint8_t *)mmap(addr, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (fd >= 0)
+    close(fd);
+
+  // old kernel ignores MAP_FIXED_NOREPLACE and may give another address
+  if (flash == MAP_FAILED || flash != addr) {
+    fprintf(stderr, "cannot map flash at 0x%08lX\n", SIM_FLASH_BASE);
+    return false;
+  }
+
+  if (blank)
+    memset(flash, 0xFF, SIM_FLASH_SIZE);
+
+  locked = true;
+
+  return true;
+}
+
+
+SimFlashStat_t &SimFlashStat() {
+  return stat;
+}
+
+
+void SimFlashClearStat() {
+  stat = {0, 0, 0};
+}
+
+
+void SimFlashPowerCut(int32_t ops) {
+  ops_left = ops;
+}
+
+
+// false if power is cut, operations after it are lost
+static bool PowerOn() {
+  if (ops_left == 0)
+    return false;
+
+  if (ops_left > 0)
+    ops_left--;
+
+  return true;
+}
+
+
+/* flash driver of EEPROM library, see flash_stm32.c */
+void FLASH_Unlock(void) {
+  locked = false;
+}
+
+
+void FLASH_Lock(void) {
+  locked = true;
+}
+
+
+FLASH_Status FLASH_WaitForLastOperation(uint32 Timeout) {
+  return FLASH_COMPLETE;
+}
+
+
+FLASH_Status FLASH_ErasePage(uint32 Page_Address) {
+  uint32_t offset = Page_Address - SIM_FLASH_BASE;
+
+  if (!IS_FLASH_ADDRESS(Page_Address) || offset >= SIM_FLASH_SIZE)
+    return FLASH_BAD_ADDRESS;
+
+  if (locked) {
+    stat.errors++;
+    return FLASH_ERROR_WRP;
+  }
+
+  if (!PowerOn())
+    return FLASH_TIMEOUT;
+
+  offset &= ~(SIM_FLASH_PAGE_SIZE - 1);
+  memset(flash + offset, 0xFF, SIM_FLASH_PAGE_SIZE);
+
+  stat.erases++;
+  SimStall(SIM_FLASH_ERASE_US * SIM_NS_PER_US);
+
+  return FLASH_COMPLETE;
+}
+
+
+// like STM32F1, half word must be erased unless it is programmed to 0
+FLASH_Status FLASH_ProgramHalfWord(uint32 Address, uint16 Data) {
+  uint32_t offset = Address - SIM_FLASH_BASE;
+  uint16_t *p;
+
+  if (!IS_FLASH_ADDRESS(Address) || offset >= SIM_FLASH_SIZE || (Address & 1))
+    return FLASH_BAD_ADDRESS;
+
+  p = (uint16_t *)(flash + offset);
+
+  if (locked || (*p != 0xFFFF && Data != 0)) {
+    stat.errors++;
+    return locked? FLASH_ERROR_WRP : FLASH_ERROR_PG;
+  }
+
+  if (!PowerOn())
+    return FLASH_TIMEOUT;
+
+  *p = Data;
+
+  stat.programs++;
+  SimStall(SIM_FLASH_PROGRAM_US * SIM_NS_PER_US);
+
+  return FLASH_COMPLETE;
+}
+
+
+FLASH_Status FLASH_ProgramWord(uint32 Address, uint32 Data) {
+  FLASH_Status status;
+
+  status = FLASH_ProgramHalfWord(Address, (uint16)Data);
+  if (status != FLASH_COMPLETE)
+    return status;
+
+  return FLASH_ProgramHalfWord(Address + 2, (uint16)(Data >> 16));
+}
@@ -0,0 +1,54 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_FLASH_H_
+#define SNAPMAKER_SIM_FLASH_H_
+
+#include <stdint.h>
+
+// flash is mapped at the same address as GD32F105, so code reading it by
+// address works without change
+#define SIM_FLASH_BASE        (0x08000000UL)
+#define SIM_FLASH_SIZE        (1024 * 1024)
+#define SIM_FLASH_PAGE_SIZE   (2048)
+
+// rough cost of flash operations, CPU is stalled meanwhile
+#define SIM_FLASH_ERASE_US    (20000)
+#define SIM_FLASH_PROGRAM_US  (40)    // for every half word
+
+typedef struct {
+  uint32_t erases;
+  uint32_t programs;      // half words
+  uint32_t errors;        // programming bits from 0 to 1, or flash is locked
+} SimFlashStat_t;
+
+/* map flash, it's blank if image is NULL. Otherwise content is kept in image
+ * file, so the next run can boot with flash of this one, like power cycle
+ */
+bool SimFlashInit(const char *image);
+
+SimFlashStat_t &SimFlashStat();
+void SimFlashClearStat();
+
+// power is cut after ops erases or half words programmed, operations
+// after them fail and change nothing. -1 gives power back
+void SimFlashPowerCut(int32_t ops);
+
+#endif  // #ifndef SNAPMAKER_SIM_FLASH_H_
@@ -0,0 +1,62 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+#include "sim_can.h"
+
+#include "module/can_host.h"
+#include "module/module_base.h"
+#include "module/linear.h"
+#include "snapmaker.h"
+
+// can_host.cpp is built as it is. These are what it takes from modules
+// and the board, there are no real modules on the simulated bus, and
+// EventHandler() which initializes them is not run
+
+ModuleBase *static_modules[] = { NULL };
+Linear *linear_p = NULL;
+
+uint16_t ModuleBase::timer_in_static_process_ = 0;
+
+void ModuleBase::ReportMarlinUart() {}
+
+ErrCode ModuleBase::Upgrade(MAC_t *mac, uint8_t total, uint32_t fw_addr, uint32_t length) {
+  return E_FAILURE;
+}
+
+MachineSize Linear::UpdateMachineSize() {
+  return MACHINE_SIZE_UNKNOWN;
+}
+
+void enable_power_domain(uint8_t pd) {}
+void disable_power_domain(uint8_t pd) {}
+
+
+// one pass of ReceiveHandler() for every notification, then callbacks of
+// std commands which EventHandler() would call
+static void ReceiveTask(void *arg) {
+  canhost.DispatchCmds();
+  while (canhost.HandleStdCmd(0));
+}
+
+
+void SimCanHostStart() {
+  can.SetReceiver(SimCreateTask(ReceiveTask, NULL));
+}
@@ -0,0 +1,579 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "MapleFreeRTOS1030.h"
+#include <wirish_time.h>
+#include <libmaple/nvic.h>
+
+#include "common/debug.h"
+
+// events pending on the clock, it's a min heap of (time, seq)
+#define SIM_EVENT_MAX   4096
+
+typedef struct {
+  uint64_t      time;
+  uint64_t      seq;
+  SimCallback_t cb;
+  void          *arg;
+} SimEvent_t;
+
+struct SimTask {
+  uint32_t      notify;
+  SimCallback_t body;     // NULL for main task
+  void          *arg;
+  bool          ready;
+};
+
+struct SimSemaphore {
+  uint32_t count;
+  uint32_t max;
+};
+
+struct SimMessageBuffer {
+  uint8_t  *buf;
+  uint32_t size;
+  uint32_t used;
+  uint32_t r;
+};
+
+struct SimEventGroup {
+  EventBits_t bits;
+  EventBits_t wait;
+  bool        all;
+};
+
+static SimEvent_t events[SIM_EVENT_MAX];
+static uint32_t   total_events = 0;
+static uint64_t   event_seq = 0;
+static uint64_t   now_ns = 0;
+
+static SimIrqHandler_t irq_handlers[NVIC_IRQ_MAX];
+nvic_reg_map sim_nvic;
+
+static SimTask  main_task;
+static uint8_t  log_level = SNAP_DEBUG_LEVEL_INFO;
+
+SnapDebug debug;
+
+
+static inline bool EventBefore(SimEvent_t &a, SimEvent_t &b) {
+  return a.time < b.time || (a.time == b.time && a.seq < b.seq);
+}
+
+
+static void PushEvent(SimEvent_t &e) {
+  uint32_t i;
+  uint32_t parent;
+  SimEvent_t tmp;
+
+  configASSERT(total_events < SIM_EVENT_MAX);
+
+  i = total_events++;
+  events[i] = e;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!EventBefore(events[i], events[parent]))
+      break;
+    tmp = events[i];
+    events[i] = events[parent];
+    events[parent] = tmp;
+    i = parent;
+  }
+}
+
+
+static SimEvent_t PopEvent() {
+  SimEvent_t top = events[0];
+  SimEvent_t tmp;
+  uint32_t i = 0;
+  uint32_t child;
+
+  events[0] = events[--total_events];
+
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= total_events)
+      break;
+    if (child + 1 < total_events && EventBefore(events[child + 1], events[child]))
+      child++;
+    if (!EventBefore(events[child], events[i]))
+      break;
+    tmp = events[i];
+    events[i] = events[child];
+    events[child] = tmp;
+    i = child;
+  }
+
+  return top;
+}
+
+
+// run the next event if it is due before deadline
+static bool RunNextEvent(uint64_t deadline) {
+  SimEvent_t e;
+
+  if (!total_events || events[0].time > deadline)
+    return false;
+
+  e = PopEvent();
+  // it may be late if CPU was stalled
+  if (e.time > now_ns)
+    now_ns = e.time;
+
+  e.cb(e.arg);
+  SimServiceIrq();
+
+  return true;
+}
+
+
+uint64_t SimNow() {
+  return now_ns;
+}
+
+
+void SimSchedule(uint64_t delay_ns, SimCallback_t cb, void *arg) {
+  SimEvent_t e = {now_ns + delay_ns, event_seq++, cb, arg};
+
+  PushEvent(e);
+}
+
+
+void SimRunFor(uint64_t ns) {
+  uint64_t deadline = now_ns + ns;
+
+  while (RunNextEvent(deadline));
+
+  if (deadline > now_ns)
+    now_ns = deadline;
+}
+
+
+bool SimWait(SimCondition_t cond, void *arg, uint64_t timeout_ns) {
+  uint64_t deadline = (timeout_ns == UINT64_MAX)? UINT64_MAX : now_ns + timeout_ns;
+
+  while (!cond(arg)) {
+    if (RunNextEvent(deadline))
+      continue;
+
+    // nothing will happen any more
+    if (deadline == UINT64_MAX)
+      SimAssert(__FILE__, __LINE__, "task blocks forever");
+
+    if (deadline > now_ns)
+      now_ns = deadline;
+    return cond(arg);
+  }
+
+  return true;
+}
+
+
+void SimStall(uint64_t ns) {
+  now_ns += ns;
+}
+
+
+void SimAttachIrq(int irq, SimIrqHandler_t handler) {
+  configASSERT(irq >= 0 && irq < NVIC_IRQ_MAX);
+  irq_handlers[irq] = handler;
+}
+
+
+void SimServiceIrq() {
+  uint32_t pending;
+  int irq;
+  bool again = true;
+
+  // handler may pend another vector
+  while (again) {
+    again = false;
+    for (int i = 0; i < 8; i++) {
+      pending = sim_nvic.ISPR[i] & sim_nvic.ISER[i];
+      while (pending) {
+        irq = i * 32 + __builtin_ctz(pending);
+        pending &= pending - 1;
+        sim_nvic.ISPR[i] &= ~BIT(irq % 32);
+        if (irq < NVIC_IRQ_MAX && irq_handlers[irq])
+          irq_handlers[irq]();
+        again = true;
+      }
+    }
+  }
+}
+
+
+void SimAssert(const char *file, int line, const char *expr) {
+  fprintf(stderr, "%s:%d: assertion failed at %llu us: %s\n", file, line,
+          (unsigned long long)(now_ns / SIM_NS_PER_US), expr);
+  exit(1);
+}
+
+
+void SimSetLogLevel(uint8_t level) {
+  log_level = level;
+}
+
+
+/* time of Arduino core */
+uint32_t millis(void) {
+  return (uint32_t)(now_ns / SIM_NS_PER_MS);
+}
+
+
+uint32_t micros(void) {
+  return (uint32_t)(now_ns / SIM_NS_PER_US);
+}
+
+
+void delay(unsigned long ms) {
+  SimRunFor(ms * SIM_NS_PER_MS);
+}
+
+
+void delay_us(uint32_t us) {
+  SimRunFor(us * SIM_NS_PER_US);
+}
+
+
+/* FreeRTOS, there is only one task which is always running */
+void *pvPortMalloc(size_t size) {
+  return malloc(size);
+}
+
+
+void vPortFree(void *p) {
+  free(p);
+}
+
+
+BaseType_t xTaskGetSchedulerState(void) {
+  return taskSCHEDULER_RUNNING;
+}
+
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(now_ns / (SIM_NS_PER_MS * 1000 / configTICK_RATE_HZ));
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  return &main_task;
+}
+
+
+static inline uint64_t TicksToNs(TickType_t ticks) {
+  if (ticks == portMAX_DELAY)
+    return UINT64_MAX;
+  return (uint64_t)ticks * (SIM_NS_PER_MS * 1000 / configTICK_RATE_HZ);
+}
+
+
+void vTaskDelay(TickType_t ticks) {
+  SimRunFor(TicksToNs(ticks));
+}
+
+
+static void TaskEvent(void *arg) {
+  SimTask *task = (SimTask *)arg;
+
+  task->ready = false;
+  task->notify = 0;
+  task->body(task->arg);
+}
+
+
+SimTask *SimCreateTask(SimCallback_t body, void *arg) {
+  SimTask *task = (SimTask *)pvPortMalloc(sizeof(SimTask));
+
+  configASSERT(task);
+  task->notify = 0;
+  task->body = body;
+  task->arg = arg;
+  task->ready = false;
+
+  return task;
+}
+
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  task->notify++;
+  if (woken)
+    *woken = pdTRUE;
+
+  // switch to it when IRQ returns
+  if (task->body && !task->ready) {
+    task->ready = true;
+    SimSchedule(0, TaskEvent, task);
+  }
+}
+
+
+static bool TaskNotified(void *arg) {
+  return ((SimTask *)arg)->notify > 0;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  uint32_t value;
+
+  if (!SimWait(TaskNotified, &main_task, TicksToNs(ticks)))
+    return 0;
+
+  value = main_task.notify;
+  main_task.notify = clear? 0 : value - 1;
+
+  return value;
+}
+
+
+static SemaphoreHandle_t CreateSemaphore(uint32_t count, uint32_t max) {
+  SimSemaphore *sem = (SimSemaphore *)pvPortMalloc(sizeof(SimSemaphore));
+
+  if (sem) {
+    sem->count = count;
+    sem->max = max;
+  }
+
+  return sem;
+}
+
+
+// no other task can hold it, so it's always free for the only task
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  return CreateSemaphore(1, 1);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+  return CreateSemaphore(0, 1);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  return CreateSemaphore(initial, max);
+}
+
+
+static bool SemaphoreAvailable(void *arg) {
+  return ((SimSemaphore *)arg)->count > 0;
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  if (!SimWait(SemaphoreAvailable, sem, TicksToNs(ticks)))
+    return pdFAIL;
+
+  sem->count--;
+  return pdPASS;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  if (sem->count >= sem->max)
+    return pdFAIL;
+
+  sem->count++;
+  return pdPASS;
+}
+
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+  if (woken)
+    *woken = pdTRUE;
+
+  return xSemaphoreGive(sem);
+}
+
+
+MessageBufferHandle_t xMessageBufferCreate(size_t size) {
+  SimMessageBuffer *mb = (SimMessageBuffer *)pvPortMalloc(sizeof(SimMessageBuffer));
+
+  if (!mb)
+    return NULL;
+
+  mb->buf = (uint8_t *)pvPortMalloc(size);
+  if (!mb->buf) {
+    vPortFree(mb);
+    return NULL;
+  }
+
+  mb->size = size;
+  mb->used = 0;
+  mb->r = 0;
+
+  return mb;
+}
+
+
+static void MessageBufferCopyIn(SimMessageBuffer *mb, const uint8_t *data, uint32_t length) {
+  uint32_t w = (mb->r + mb->used) % mb->size;
+
+  for (uint32_t i = 0; i < length; i++) {
+    mb->buf[w] = data[i];
+    w = (w + 1 < mb->size)? w + 1 : 0;
+  }
+  mb->used += length;
+}
+
+
+static void MessageBufferCopyOut(SimMessageBuffer *mb, uint8_t *data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    data[i] = mb->buf[mb->r];
+    mb->r = (mb->r + 1 < mb->size)? mb->r + 1 : 0;
+  }
+  mb->used -= length;
+}
+
+
+// nobody else can take messages out, so sending never waits for room
+size_t xMessageBufferSend(MessageBufferHandle_t mb, const void *data, size_t length, TickType_t ticks) {
+  uint32_t head = (uint32_t)length;
+
+  if (mb->size - mb->used < length + sizeof(head))
+    return 0;
+
+  MessageBufferCopyIn(mb, (const uint8_t *)&head, sizeof(head));
+  MessageBufferCopyIn(mb, (const uint8_t *)data, length);
+
+  return length;
+}
+
+
+static bool MessageBufferAvailable(void *arg) {
+  return ((SimMessageBuffer *)arg)->used > 0;
+}
+
+
+// message is kept if it is longer than max, as FreeRTOS does
+size_t xMessageBufferReceive(MessageBufferHandle_t mb, void *data, size_t max, TickType_t ticks) {
+  uint32_t head;
+  uint32_t r;
+
+  if (!SimWait(MessageBufferAvailable, mb, TicksToNs(ticks)))
+    return 0;
+
+  r = mb->r;
+  MessageBufferCopyOut(mb, (uint8_t *)&head, sizeof(head));
+  if (head > max) {
+    mb->r = r;
+    mb->used += sizeof(head);
+    return 0;
+  }
+
+  MessageBufferCopyOut(mb, (uint8_t *)data, head);
+
+  return head;
+}
+
+
+BaseType_t xMessageBufferReset(MessageBufferHandle_t mb) {
+  mb->used = 0;
+  mb->r = 0;
+
+  return pdPASS;
+}
+
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  SimEventGroup *group = (SimEventGroup *)pvPortMalloc(sizeof(SimEventGroup));
+
+  if (group)
+    group->bits = 0;
+
+  return group;
+}
+
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  group->bits |= bits;
+  return group->bits;
+}
+
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  EventBits_t old = group->bits;
+
+  group->bits &= ~bits;
+  return old;
+}
+
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  return group->bits;
+}
+
+
+static bool EventBitsSet(void *arg) {
+  SimEventGroup *group = (SimEventGroup *)arg;
+
+  if (group->all)
+    return (group->bits & group->wait) == group->wait;
+  return (group->bits & group->wait) != 0;
+}
+
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t ticks) {
+  EventBits_t value;
+
+  group->wait = bits;
+  group->all = all;
+  SimWait(EventBitsSet, group, TicksToNs(ticks));
+
+  value = group->bits;
+  if (clear && EventBitsSet(group))
+    group->bits &= ~bits;
+
+  return value;
+}
+
+
+/* logs of service layer, debug.cpp needs Marlin for the rest */
+void SnapDebug::Log(SnapDebugLevel level, const char *fmt, ...) {
+  va_list args;
+
+  if (level < log_level)
+    return;
+
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+}
+
+
+void SnapDebug::SetSCGcodeLine(uint32_t l) {
+  info.last_line_num_of_sc_gcode = l;
+}
+
+
+void SnapDebug::CmdChecksumError(bool screen) {
+  if (screen)
+    info.screen_cmd_checksum_err++;
+  else
+    info.pc_cmd_checksum_err++;
+}
@@ -0,0 +1,220 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+
+#include "src/Marlin.h"
+#include "src/gcode/gcode.h"
+#include "src/gcode/queue.h"
+#include "src/module/configuration_store.h"
+#include "src/module/motion.h"
+#include "src/module/planner.h"
+#include "src/module/stepper.h"
+#include "src/module/temperature.h"
+#include "src/feature/runout.h"
+#include "src/feature/bedlevel/bedlevel.h"
+#include HAL_PATH(src/HAL, HAL.h)
+
+#include "snapmaker.h"
+#include "module/enclosure.h"
+#include "module/toolhead_3dp.h"
+#include "module/toolhead_cnc.h"
+#include "module/toolhead_laser.h"
+#include "service/system.h"
+#include "service/quick_stop.h"
+#include "service/bed_level.h"
+#include "hmi/event_handler.h"
+
+// Planner, GCodeParser and PowerLossRecovery are built as they are. These
+// stand for the rest of Marlin and the modules they use. There is no
+// stepper ISR, blocks stay in the planner until the scenario discards them.
+//
+// SystemService is built as it is, the heaters, toolheads and motion its
+// transitions drive do nothing here. QuickStopService is not built, the
+// scenario runs the callbacks of quick stop itself.
+
+/* Marlin */
+float current_position[X_TO_E];
+float position_shift[XN];
+float home_offset[XN];
+float workspace_offset[XN];
+bool relative_mode;
+bool Running = true;
+bool wait_for_heatup = true;
+uint8_t axis_homed, axis_known_position;
+float feedrate_mm_s = MMM_TO_MMS(1500.0f);
+int16_t feedrate_percentage = 100;
+float saved_g0_feedrate_mm_s;
+float saved_g1_feedrate_mm_s;
+
+uint32_t CommandLine[BUFSIZE];
+uint8_t commands_in_queue;
+uint8_t cmd_queue_index_r;
+
+float backlash_distance_mm[XN] = BACKLASH_DISTANCE_MM;
+float backlash_correction = BACKLASH_CORRECTION;
+
+// software machine size, as Marlin.cpp keeps it before linear modules
+// are found
+bool X_DIR = false;
+bool Y_DIR = false;
+bool Z_DIR = false;
+signed char X_HOME_DIR = 1;
+signed char Y_HOME_DIR = 1;
+signed char Z_HOME_DIR = 1;
+float X_MAX_POS = 150;
+float Y_MAX_POS = 150;
+float Z_MAX_POS = 150;
+
+bool GcodeSuite::axis_relative_modes[] = AXIS_RELATIVE_MODES;
+float GcodeSuite::coordinate_system[MAX_COORDINATE_SYSTEMS][XN];
+int8_t GcodeSuite::active_coordinate_system = -1;
+void GcodeSuite::execute_command() {}
+
+void idle() {
+  SimRunFor(SIM_NS_PER_MS);
+}
+
+void disable_all_steppers() {}
+void sync_plan_position() {}
+void sync_plan_position_e() {}
+void clear_command_queue() {}
+void set_bed_leveling_enabled(const bool enable) {}
+void update_workspace_offset(const AxisEnum axis) {}
+void line_to_current_position(const float &fr_mm_s) {}
+void move_to_limited_position(const float (&target)[X_TO_E], const float fr_mm_s) {}
+float bilinear_z_offset(const float raw[XYZ]) { return 0; }
+
+bool MarlinSettings::save() { return true; }
+
+bool FilamentMonitorBase::enabled = false;
+bool FilamentMonitorBase::filament_ran_out = false;
+volatile float RunoutResponseDelayed::runout_mm_countdown[EXTRUDERS];
+float RunoutResponseDelayed::runout_distance_mm = FILAMENT_RUNOUT_DISTANCE_MM;
+
+volatile int32_t Stepper::count_position[NUM_AXIS];
+bool Stepper::abort_current_block;
+
+void Stepper::wake_up() {}
+bool Stepper::is_block_busy(const block_t* const block) { return false; }
+int32_t Stepper::position(const AxisEnum axis) { return count_position[axis]; }
+void Stepper::endstop_triggered(const AxisEnum axis) {}
+int32_t Stepper::triggered_position(const AxisEnum axis) { return count_position[axis]; }
+
+void Stepper::_set_position(const int32_t &a, const int32_t &b, const int32_t &c, const int32_t &d, const int32_t &e) {
+  count_position[X_AXIS] = a;
+  count_position[Y_AXIS] = b;
+  count_position[Z_AXIS] = c;
+  count_position[B_AXIS] = d;
+  count_position[E_AXIS] = e;
+}
+
+hotend_info_t Temperature::temp_hotend[HOTENDS];
+bed_info_t Temperature::temp_bed;
+temp_range_t Temperature::temp_range[HOTENDS];
+bool Temperature::allow_cold_extrude = true;
+int16_t Temperature::extrude_min_temp = EXTRUDE_MINTEMP;
+
+void Temperature::start_watching_heater(const uint8_t e) {}
+void Temperature::start_watching_heater_tempdrop(const uint8_t e) {}
+void Temperature::start_watching_heater_notheated(bool first_heating, const uint8_t e) {}
+void Temperature::start_watching_bed_notheated(bool first_heating) {}
+bool Temperature::wait_for_hotend(const uint8_t target_extruder, const bool no_wait_for_cooling) { return true; }
+bool Temperature::wait_for_bed(const bool no_wait_for_cooling) { return true; }
+
+/* HAL, no timers, all pins are on a port which goes nowhere */
+static gpio_reg_map sim_gpio_regs;
+static gpio_dev sim_gpio = {&sim_gpio_regs};
+stm32_pin_info PIN_MAP[BOARD_NR_GPIO_PINS];
+
+// planner writes enable pins of steppers for every block
+static struct SimPins {
+  SimPins() {
+    for (int i = 0; i < BOARD_NR_GPIO_PINS; i++)
+      PIN_MAP[i].gpio_device = &sim_gpio;
+  }
+} sim_pins;
+
+void gpio_set_mode(gpio_dev *dev, uint8 pin, gpio_pin_mode mode) {}
+timer_dev *get_timer_dev(int number) { return NULL; }
+bool HAL_timer_interrupt_enabled(const uint8_t timer_num) { return false; }
+
+// static freeMemory() in HAL.h is kept in objects built without -O,
+// it wants the heap break of newlib, which the host doesn't have
+extern "C" char *_sbrk(int incr) {
+  static char heap;
+  return &heap;
+}
+
+/* modules and services */
+uint8_t action_ban = 0;
+uint8_t power_ban = 0;
+
+void enable_action_ban(uint8_t ab) { action_ban |= ab; }
+void disable_action_ban(uint8_t ab) { action_ban &= ~ab; }
+void enable_power_ban(uint8_t pd) { power_ban |= pd; }
+
+// event group is created by the scenario, tasks are not
+static SnapmakerHandle sim_sm2_handle;
+SnapmakerHandle_t sm2_handle = &sim_sm2_handle;
+
+// no Marlin task, the scenario takes what SystemService sends to it
+EventQueue marlin_events;
+void clear_hmi_gcode_queue() {}
+
+ModuleToolHeadType ModuleBase::toolhead_ = MODULE_TOOLHEAD_UNKNOW;
+
+// no leveling data to reset here
+void ModuleBase::SetToolhead(ModuleToolHeadType toolhead) { toolhead_ = toolhead; }
+
+ToolHead3DP printer_single(MODULE_DEVICE_ID_3DP_SINGLE);
+ToolHead3DP *printer1 = &printer_single;
+ToolHeadCNC cnc;
+ToolHeadLaser laser;
+Enclosure enclosure;
+
+// modules on the bus are not initialized as any of them
+ErrCode ToolHead3DP::Init(MAC_t &mac, uint8_t mac_index) { return E_FAILURE; }
+void ToolHead3DP::Process() {}
+ErrCode ToolHeadCNC::Init(MAC_t &mac, uint8_t mac_index) { return E_FAILURE; }
+ErrCode ToolHeadLaser::Init(MAC_t &mac, uint8_t mac_index) { return E_FAILURE; }
+void ToolHeadLaser::Process() {}
+ErrCode Enclosure::Init(MAC_t &mac, uint8_t mac_index) { return E_FAILURE; }
+ErrCode Enclosure::PostInit() { return E_SUCCESS; }
+void Enclosure::Process() {}
+
+ErrCode ToolHead3DP::SetFan(uint8_t fan_index, uint8_t speed, uint8_t delay_time) { return E_SUCCESS; }
+ErrCode ToolHead3DP::SetHeater(uint16_t target_temp, uint8_t extrude_index) { return E_SUCCESS; }
+void ToolHead3DP::GetFilamentState() {}
+ErrCode ToolHeadCNC::SetOutput(uint8_t power) { return E_SUCCESS; }
+ErrCode ToolHeadCNC::TurnOn() { return E_SUCCESS; }
+void ToolHeadLaser::TurnOn() {}
+void ToolHeadLaser::TurnOff() {}
+void ToolHeadLaser::SetPower(float power) {}
+void ToolHeadLaser::SetOutput(float power) {}
+uint16_t ToolHeadLaser::tim_pwm() { return 0; }
+
+QuickStopService quickstop;
+BedLevelService levelservice;
+
+ErrCode BedLevelService::UpdateLiveZOffset(float offset) { return E_SUCCESS; }
+void BedLevelService::SaveLiveZOffset() {}
+
+void QuickStopService::Trigger(QuickStopSource new_source, bool from_isr) {}
@@ -0,0 +1,267 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim_mesh.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#include "common/mesh_cells.h"
+
+// same as GRID_MAX_NUM 11 and BILINEAR_SUBDIVISIONS 3 of Marlin
+#define MESH_POINTS       31
+#define MESH_START        20
+#define MESH_SPACING      10
+
+// 1 um, steps of Z are 2.5 um
+#define MESH_TOLERANCE    0.001f
+
+#define BENCH_POINTS      4096
+
+static float z_virt[MESH_POINTS][MESH_POINTS];
+static MeshCell_t table[(MESH_POINTS - 1) * (MESH_POINTS - 1)];
+
+static const float start[2] = {MESH_START, MESH_START};
+static const float spacing[2] = {MESH_SPACING, MESH_SPACING};
+
+
+static uint32_t Random(uint32_t &seed) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+
+// -1.0 to 1.0
+static float RandomUnit(uint32_t &seed) {
+  return (float)(Random(seed) & 0xFFFF) / 32768.0f - 1.0f;
+}
+
+
+/* bilinear_z_offset() of Marlin/src/feature/bedlevel/abl/abl.cpp, with
+ * its caches as members and grid as parameters
+ */
+class ReferenceLookup {
+  public:
+    ReferenceLookup(bool extrapolate): extrapolate_(extrapolate) {}
+
+    float Offset(const float raw[2]) {
+      const int points = MESH_POINTS;
+      const int far_edge_or_box = extrapolate_? 2 : 1;
+      const float factor = 1.0f / MESH_SPACING;
+
+      const float rx = raw[0] - MESH_START,
+                  ry = raw[1] - MESH_START;
+
+      if (last_x != rx) {
+        last_x = rx;
+        ratio_x = rx * factor;
+        float gx = floorf(ratio_x);
+        if (gx < 0) gx = 0;
+        if (gx > points - far_edge_or_box) gx = points - far_edge_or_box;
+        ratio_x -= gx;
+        if (!extrapolate_ && ratio_x < 0) ratio_x = 0;
+        gridx = gx;
+        nextx = (gridx + 1 < points - 1)? gridx + 1 : points - 1;
+      }
+
+      if (last_y != ry || last_gridx != gridx) {
+        if (last_y != ry) {
+          last_y = ry;
+          ratio_y = ry * factor;
+          float gy = floorf(ratio_y);
+          if (gy < 0) gy = 0;
+          if (gy > points - far_edge_or_box) gy = points - far_edge_or_box;
+          ratio_y -= gy;
+          if (!extrapolate_ && ratio_y < 0) ratio_y = 0;
+          gridy = gy;
+          nexty = (gridy + 1 < points - 1)? gridy + 1 : points - 1;
+        }
+
+        if (last_gridx != gridx || last_gridy != gridy) {
+          last_gridx = gridx;
+          last_gridy = gridy;
+          z1 = z_virt[gridx][gridy];
+          d2 = z_virt[gridx][nexty] - z1;
+          z3 = z_virt[nextx][gridy];
+          d4 = z_virt[nextx][nexty] - z3;
+        }
+
+              L = z1 + d2 * ratio_y;
+        const float R = z3 + d4 * ratio_y;
+
+        D = R - L;
+      }
+
+      return L + ratio_x * D;
+    }
+
+  private:
+    bool extrapolate_;
+
+    float z1, d2, z3, d4, L, D, ratio_x, ratio_y,
+          last_x = -999.999, last_y = -999.999;
+
+    int8_t gridx, gridy, nextx, nexty,
+           last_gridx = -99, last_gridy = -99;
+};
+
+
+// tilted and warped bed, within 2 mm
+static void RandomMesh(uint32_t &seed) {
+  float tilt_x = RandomUnit(seed) * 0.003f;
+  float tilt_y = RandomUnit(seed) * 0.003f;
+  float warp = RandomUnit(seed) * 0.5f;
+
+  for (int x = 0; x < MESH_POINTS; x++) {
+    for (int y = 0; y < MESH_POINTS; y++) {
+      float px = x * MESH_SPACING, py = y * MESH_SPACING;
+      z_virt[x][y] = tilt_x * px + tilt_y * py + warp * sinf(px / 97.0f) * cosf(py / 61.0f)
+                   + RandomUnit(seed) * 0.02f;
+    }
+  }
+}
+
+
+bool SimMeshCheck(uint32_t points, bool extrapolate) {
+  const float low = MESH_START - MESH_SPACING;
+  const float range = (MESH_POINTS + 1) * MESH_SPACING;
+  uint32_t seed = 0x2545F491;
+  float worst = 0;
+
+  meshcells.Init(table, sizeof(table) / sizeof(table[0]));
+
+  for (int mesh = 0; mesh < 20; mesh++) {
+    ReferenceLookup reference(extrapolate);
+
+    RandomMesh(seed);
+    if (!meshcells.Build(&z_virt[0][0], MESH_POINTS, MESH_POINTS, MESH_POINTS, start, spacing, extrapolate)) {
+      printf("  mesh %d is not taken\n", mesh);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < points; i++) {
+      float p[2];
+      float error;
+
+      p[0] = low + (RandomUnit(seed) + 1.0f) / 2 * range;
+      p[1] = low + (RandomUnit(seed) + 1.0f) / 2 * range;
+
+      // grid lines and corners too
+      if (i % 8 == 0)
+        p[0] = MESH_START + (Random(seed) % MESH_POINTS) * MESH_SPACING;
+      if (i % 16 == 0)
+        p[1] = MESH_START + (Random(seed) % MESH_POINTS) * MESH_SPACING;
+
+      error = fabsf(meshcells.Offset(p[0], p[1]) - reference.Offset(p));
+      if (error > worst)
+        worst = error;
+
+      if (error > MESH_TOLERANCE) {
+        printf("  (%.3f, %.3f): %.5f but reference is %.5f\n", p[0], p[1], meshcells.Offset(p[0], p[1]),
+                reference.Offset(p));
+        return false;
+      }
+    }
+  }
+
+  printf("  %u points on 20 meshes, worst error %.2f um\n", points * 20, worst * 1000);
+
+  // a point is not probed
+  z_virt[5][7] = NAN;
+  if (meshcells.Build(&z_virt[0][0], MESH_POINTS, MESH_POINTS, MESH_POINTS, start, spacing, extrapolate) ||
+      meshcells.valid()) {
+    printf("  mesh with NAN is taken\n");
+    return false;
+  }
+
+  // too steep for int16 coefficients
+  z_virt[5][7] = 0;
+  z_virt[6][7] = 7.9f;
+  z_virt[7][7] = -7.9f;
+  if (meshcells.Build(&z_virt[0][0], MESH_POINTS, MESH_POINTS, MESH_POINTS, start, spacing, extrapolate)) {
+    printf("  steep mesh is taken\n");
+    return false;
+  }
+
+  return true;
+}
+
+
+// points of leveled segments as planner gives, a few on every line
+static void Segments(float (*points)[2], uint32_t count, uint32_t &seed) {
+  const float low = MESH_START;
+  const float range = (MESH_POINTS - 1) * MESH_SPACING;
+  float from[2], to[2];
+  uint32_t steps = 0, step = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (step == steps) {
+      for (int a = 0; a < 2; a++) {
+        from[a] = low + (RandomUnit(seed) + 1.0f) / 2 * range;
+        to[a] = from[a] + RandomUnit(seed) * 20;
+      }
+      steps = Random(seed) % 16 + 1;
+      step = 0;
+    }
+
+    step++;
+    for (int a = 0; a < 2; a++)
+      points[i][a] = from[a] + (to[a] - from[a]) * step / steps;
+  }
+}
+
+
+void SimMeshBench(uint32_t lookups) {
+  static float points[BENCH_POINTS][2];
+  ReferenceLookup reference(true);
+  uint32_t seed = 0x9E3779B9;
+  float sum = 0;
+
+  RandomMesh(seed);
+  meshcells.Init(table, sizeof(table) / sizeof(table[0]));
+  if (!meshcells.Build(&z_virt[0][0], MESH_POINTS, MESH_POINTS, MESH_POINTS, start, spacing, true))
+    return;
+
+  Segments(points, BENCH_POINTS, seed);
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < lookups; i++)
+    sum += reference.Offset(points[i % BENCH_POINTS]);
+
+  auto t1 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < lookups; i++) {
+    const float *p = points[i % BENCH_POINTS];
+    sum += meshcells.Offset(p[0], p[1]);
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  // don't let compiler drop the loops
+  if (sum == 12345.0f)
+    printf("\n");
+
+  printf("  float lookup %.1f ns, fixed point cells %.1f ns\n",
+          std::chrono::duration<double, std::nano>(t1 - t0).count() / lookups,
+          std::chrono::duration<double, std::nano>(t2 - t1).count() / lookups);
+}
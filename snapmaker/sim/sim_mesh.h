@@ -0,0 +1,36 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_MESH_H_
+#define SNAPMAKER_SIM_MESH_H_
+
+#include <stdint.h>
+
+// MeshCells against float bilinear lookup of Marlin, on a virtual grid of
+// 11 x 11 points with 3 subdivisions. They run out of the virtual clock.
+
+// random meshes and points up to one cell beyond the grid, return false if
+// any offset is off by more than tolerance, or bad meshes are taken
+bool SimMeshCheck(uint32_t points, bool extrapolate);
+
+// wall clock time of lookups along leveled segments, by both of them
+void SimMeshBench(uint32_t lookups);
+
+#endif  // #ifndef SNAPMAKER_SIM_MESH_H_
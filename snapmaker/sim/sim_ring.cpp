@@ -0,0 +1,210 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "utils/ring_buffer.h"
+#include "utils/spsc_ring_buffer.h"
+
+#define STRESS_RING_SIZE    64
+#define STRESS_CHUNK_MAX    24
+
+#define BENCH_RING_SIZE     1024
+#define BENCH_BYTES         (64 * 1024 * 1024)
+
+static uint32_t Random(uint32_t &seed) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+
+static std::atomic<bool> producer_done;
+
+static void StressProducer(SpscRingBuffer<uint32_t> *ring, uint32_t total) {
+  uint32_t chunk[STRESS_CHUNK_MAX];
+  uint32_t seed = 0x12345678;
+  uint32_t next = 0;
+  uint32_t count;
+
+  while (next < total) {
+    count = Random(seed) % STRESS_CHUNK_MAX + 1;
+    if (count > total - next)
+      count = total - next;
+
+    if (count == 1) {
+      count = ring->InsertOne(next)? 1 : 0;
+    }
+    else {
+      for (uint32_t i = 0; i < count; i++)
+        chunk[i] = next + i;
+      count = ring->InsertMulti(chunk, count);
+    }
+
+    // host may have only one core
+    if (!count)
+      std::this_thread::yield();
+    next += count;
+  }
+
+  producer_done = true;
+}
+
+
+bool SimRingStress(uint32_t total) {
+  static uint32_t buffer[STRESS_RING_SIZE];
+  SpscRingBuffer<uint32_t> ring;
+  uint32_t chunk[STRESS_CHUNK_MAX];
+  uint32_t *seg[2];
+  uint32_t seg_len[2];
+  uint32_t seed = 0x9abcdef0;
+  uint32_t next = 0;
+  uint32_t count;
+  uint32_t i;
+  bool     ok = true;
+
+  if (!ring.Init(STRESS_RING_SIZE, buffer))
+    return false;
+
+  producer_done = false;
+  std::thread producer(StressProducer, &ring, total);
+
+  while (ok && next < total) {
+    if (ring.IsEmpty()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    count = Random(seed) % STRESS_CHUNK_MAX + 1;
+
+    switch (Random(seed) % 5) {
+    case 0:
+      if (ring.RemoveOne(chunk[0]))
+        ok = (chunk[0] == next++);
+      break;
+
+    case 1:
+      count = ring.RemoveMulti(chunk, count);
+      for (i = 0; ok && i < count; i++)
+        ok = (chunk[i] == next++);
+      break;
+
+    case 2:
+      // element behind the first one, then take the first one only
+      count = ring.Peek(chunk, 2, 0);
+      if (count == 2)
+        ok = (ring.PeekAt(1) == next + 1 && chunk[1] == next + 1);
+      if (ok && count) {
+        ok = (chunk[0] == next++);
+        ring.Discard(1);
+      }
+      break;
+
+    case 3:
+      count = ring.Peek(chunk, count, 1);
+      for (i = 0; ok && i < count; i++)
+        ok = (chunk[i] == next + 1 + i);
+      break;
+
+    default:
+      if (count > ring.Available())
+        count = ring.Available();
+      ring.Segments(0, count, seg, seg_len);
+      ok = (seg_len[0] + seg_len[1] == count);
+      for (i = 0; ok && i < seg_len[0]; i++)
+        ok = (seg[0][i] == next + i);
+      for (i = 0; ok && i < seg_len[1]; i++)
+        ok = (seg[1][i] == next + seg_len[0] + i);
+      if (ok)
+        next += ring.Discard(count);
+      break;
+    }
+  }
+
+  if (!ok) {
+    printf("  element %u is lost or out of order\n", next);
+    // producer doesn't stop until it inserts all of elements
+    while (producer_done.load() == false) {
+      ring.Reset();
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  return ok && ring.IsEmpty();
+}
+
+
+template <typename Ring>
+static double BenchOne(Ring &ring, uint32_t chunk) {
+  static uint8_t in[BENCH_RING_SIZE];
+  static uint8_t out[BENCH_RING_SIZE];
+  uint32_t sum = 0;
+
+  for (uint32_t i = 0; i < chunk; i++)
+    in[i] = (uint8_t)i;
+
+  auto start = std::chrono::steady_clock::now();
+
+  // keep some bytes in ring buffer, so chunks wrap around the end
+  ring.InsertMulti(in, chunk / 2 + 1);
+  for (uint32_t moved = 0; moved < BENCH_BYTES; moved += chunk) {
+    ring.InsertMulti(in, chunk);
+    ring.RemoveMulti(out, chunk);
+    sum += out[chunk - 1];
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  // don't let compiler drop the loop
+  if (sum == 0xffffffff)
+    printf("\n");
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+
+void SimRingBench(uint32_t chunk) {
+  static uint8_t buffer[BENCH_RING_SIZE];
+  RingBuffer<uint8_t> old_ring;
+  SpscRingBuffer<uint8_t> spsc_ring;
+  double old_s;
+  double spsc_s;
+
+  if (!chunk || chunk > BENCH_RING_SIZE / 2)
+    return;
+
+  old_ring.Init(BENCH_RING_SIZE, buffer);
+  old_s = BenchOne(old_ring, chunk);
+
+  spsc_ring.Init(BENCH_RING_SIZE, buffer);
+  spsc_s = BenchOne(spsc_ring, chunk);
+
+  printf("  %u bytes chunk: RingBuffer %.0f MB/s, SpscRingBuffer %.0f MB/s\n", chunk,
+          BENCH_BYTES / old_s / 1000000, BENCH_BYTES / spsc_s / 1000000);
+}
@@ -0,0 +1,39 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_RING_H_
+#define SNAPMAKER_SIM_RING_H_
+
+#include <stdint.h>
+
+// SpscRingBuffer out of the virtual clock. Producer and consumer are real
+// threads here, so they may run at the same time on different cores, which
+// is harder than ISR and task on Cortex-M3.
+
+// producer and consumer move total elements through a small ring buffer by
+// all operations with random counts, return false if any element is lost,
+// duplicated or out of order
+bool SimRingStress(uint32_t total);
+
+// wall clock time of moving bytes by chunk through SpscRingBuffer and the
+// old RingBuffer in one thread
+void SimRingBench(uint32_t chunk);
+
+#endif  // #ifndef SNAPMAKER_SIM_RING_H_
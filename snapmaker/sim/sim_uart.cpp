@@ -0,0 +1,198 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+#include "sim_uart.h"
+
+#include <stdio.h>
+
+#include "hmi/uart_host.h"
+
+// start bit, 8 data bits and stop bit
+#define UART_FRAME_BITS   10
+#define UART_BYTE_NS      ((uint64_t)UART_FRAME_BITS * 1000000000ULL / baud)
+
+extern "C" {
+  void __irq_usart2(void);
+  void __irq_uart5(void);
+}
+
+usart_reg_map sim_usart2_regs;
+
+static ring_buffer usart2_rb;
+static ring_buffer usart2_wb;
+static usart_dev usart2 = {
+  USART2_BASE,
+  &usart2_rb,
+  &usart2_wb,
+  4500000UL,
+  {0},
+  {0},
+  NVIC_USART2
+};
+
+HardwareSerial SimSerial2(&usart2);
+HardwareSerial Serial(NULL);
+
+// HMI task of firmware works on it, see event_handler.cpp
+UartHost hmi;
+
+static uint32_t baud = 115200;
+static bool     receiving = false;
+static uint64_t last_byte = 0;
+
+static uint8_t  line[SIM_UART_LINE_SIZE];
+static uint32_t line_r = 0;
+static uint32_t line_w = 0;
+
+static uint8_t  output[SIM_UART_LINE_SIZE];
+static uint32_t output_r = 0;
+static uint32_t output_w = 0;
+
+static SimUartStat_t stat;
+
+static void ByteEvent(void *arg);
+
+
+// clear flags as reading DR does, handler always reads DR when RXNE is set
+static void UsartIrq() {
+  if (!(sim_usart2_regs.CR1 & USART_CR1_UE))
+    return;
+
+  __irq_usart2();
+  sim_usart2_regs.SR &= ~(USART_SR_RXNE | USART_SR_IDLE);
+}
+
+
+static void IdleEvent(void *arg) {
+  // new byte came before idle frame is finished
+  if (receiving || SimNow() - last_byte < UART_BYTE_NS)
+    return;
+
+  stat.idle_lines++;
+  if (sim_usart2_regs.CR1 & USART_CR1_IDLEIE) {
+    sim_usart2_regs.SR |= USART_SR_IDLE;
+    UsartIrq();
+  }
+}
+
+
+static void ByteEvent(void *arg) {
+  if (sim_usart2_regs.SR & USART_SR_RXNE)
+    stat.overruns++;
+
+  sim_usart2_regs.DR = line[line_r];
+  line_r = (line_r + 1) % SIM_UART_LINE_SIZE;
+  last_byte = SimNow();
+  stat.rx_bytes++;
+
+  if (sim_usart2_regs.CR1 & USART_CR1_RXNEIE) {
+    sim_usart2_regs.SR |= USART_SR_RXNE;
+    UsartIrq();
+  }
+
+  if (line_r != line_w) {
+    SimSchedule(UART_BYTE_NS, ByteEvent, NULL);
+  }
+  else {
+    receiving = false;
+    SimSchedule(UART_BYTE_NS, IdleEvent, NULL);
+  }
+}
+
+
+void SimUartFeed(const uint8_t *data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    configASSERT((line_w + 1) % SIM_UART_LINE_SIZE != line_r);
+    line[line_w] = data[i];
+    line_w = (line_w + 1) % SIM_UART_LINE_SIZE;
+  }
+
+  if (!receiving && line_r != line_w) {
+    receiving = true;
+    SimSchedule(UART_BYTE_NS, ByteEvent, NULL);
+  }
+}
+
+
+uint32_t SimUartPending() {
+  return (line_w + SIM_UART_LINE_SIZE - line_r) % SIM_UART_LINE_SIZE;
+}
+
+
+uint32_t SimUartTake(uint8_t *out, uint32_t max) {
+  uint32_t i;
+
+  for (i = 0; i < max && output_r != output_w; i++) {
+    out[i] = output[output_r];
+    output_r = (output_r + 1) % SIM_UART_LINE_SIZE;
+  }
+
+  return i;
+}
+
+
+SimUartStat_t &SimUartStat() {
+  return stat;
+}
+
+
+void SimUartClearStat() {
+  stat = {0, 0, 0, 0};
+}
+
+
+/* HardwareSerial of Arduino core */
+void HardwareSerial::begin(uint32 b) {
+  baud = b;
+
+  rb_init(dev_->rb, USART_RX_BUF_SIZE, dev_->rx_buf);
+  rb_init(dev_->wb, USART_TX_BUF_SIZE, dev_->tx_buf);
+
+  dev_->regs->SR  = USART_SR_TXE;
+  dev_->regs->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE | USART_CR1_RXNEIE;
+
+  SimAttachIrq(NVIC_UART5, __irq_uart5);
+}
+
+
+int HardwareSerial::read(void) {
+  return rb_safe_remove(dev_->rb);
+}
+
+
+// time to send isn't simulated, output is only kept for checking
+size_t HardwareSerial::write(uint8 ch) {
+  if (!dev_)
+    return fputc(ch, stdout) != EOF;
+
+  if ((output_w + 1) % SIM_UART_LINE_SIZE == output_r)
+    output_r = (output_r + 1) % SIM_UART_LINE_SIZE;
+
+  output[output_w] = ch;
+  output_w = (output_w + 1) % SIM_UART_LINE_SIZE;
+  stat.tx_bytes++;
+
+  return 1;
+}
+
+
+void HardwareSerial::flush(void) {
+}
@@ -0,0 +1,53 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SIM_UART_H_
+#define SNAPMAKER_SIM_UART_H_
+
+#include <stdint.h>
+
+#include <HardwareSerial.h>
+
+// bytes sent by screen but not on the line yet
+#define SIM_UART_LINE_SIZE    (64 * 1024)
+
+typedef struct {
+  uint32_t rx_bytes;    // bytes arrived at USART
+  uint32_t overruns;    // byte arrived before last one was taken by IRQ
+  uint32_t idle_lines;
+  uint32_t tx_bytes;    // bytes written by firmware
+} SimUartStat_t;
+
+// USART2 connected to screen, it's given to hmi.Init() as the firmware does
+extern HardwareSerial SimSerial2;
+
+// bytes go back to back on the line after bytes queued before
+void SimUartFeed(const uint8_t *data, uint32_t length);
+
+// bytes which are queued but have not arrived at USART
+uint32_t SimUartPending();
+
+// take bytes written by firmware, return count of bytes taken
+uint32_t SimUartTake(uint8_t *out, uint32_t max);
+
+SimUartStat_t &SimUartStat();
+void SimUartClearStat();
+
+#endif  // #ifndef SNAPMAKER_SIM_UART_H_
@@ -22,11 +22,12 @@
 #define SNAPMAKER_CONFIG_H_
 
 // task parameters for can event handler task
-#define CAN_EVENT_HANDLER_PRIORITY    (2)
+#define CAN_EVENT_HANDLER_PRIORITY    (3)
 #define CAN_EVENT_HANDLER_STACK_DEPTH (512)
 
 // task parameters for can receive handler task
-#define CAN_RECEIVE_HANDLER_PRIORITY    (2)
+// it is woken up by CAN IRQ, same priority as marlin loop to get time slice at once
+#define CAN_RECEIVE_HANDLER_PRIORITY    (3)
 #define CAN_RECEIVE_HANDLER_STACK_DEPTH (512)
 
 // task parameters for marlin loop task
@@ -41,6 +42,11 @@
 #define HB_TASK_PRIO (2)
 #define HB_TASK_STACK_DEPTH 512
 
+// task parameters for flash writer of upgrade, it's lower than HMI task,
+// so next packet of firmware is received while one is being programmed
+#define UPGRADE_WRITER_PRIO (2)
+#define UPGRADE_WRITER_STACK_DEPTH 256
+
 // priority for UARTs
 #define EXECUTOR_SERIAL_IRQ_PRIORITY 7
 #define HMI_SERIAL_IRQ_PRIORITY 8
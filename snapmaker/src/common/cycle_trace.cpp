@@ -0,0 +1,197 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cycle_trace.h"
+
+#if (SNAP_CYCLE_TRACE)
+
+#include <string.h>
+
+#include "debug.h"
+#include "../hmi/event_handler.h"
+
+#include "src/inc/MarlinConfig.h"
+
+CycleTrace cycletrace;
+
+
+void CycleTrace::Init() {
+  // enable trace, then enable cycle counter
+  CYCLE_TRACE_DEMCR |= (1 << 24);
+  CYCLE_TRACE_DWT_CYCCNT = 0;
+  CYCLE_TRACE_DWT_CTRL |= 1;
+
+  Clear();
+}
+
+
+void CycleTrace::Record(CycleTraceSection s, uint32_t cycles) {
+  CycleTraceStat_t *stat = &stat_[s];
+  uint32_t bucket = cycles >> CYCLE_TRACE_HIST_SHIFT;
+  uint32_t primask;
+  int i = 0;
+
+  while (bucket && i < CYCLE_TRACE_HIST_SIZE - 1) {
+    bucket >>= 1;
+    i++;
+  }
+
+  // a higher priority ISR may record in the middle, and worst_ is shared
+  // by all sections, so mask IRQs while updating
+  primask = __get_primask();
+  DISABLE_ISRS();
+
+  stat->hist[i]++;
+
+  stat->count++;
+  stat->total += cycles;
+
+  if (cycles < stat->min)
+    stat->min = cycles;
+
+  if (cycles > stat->max)
+    stat->max = cycles;
+
+  // not only new maximums, or the ring stops after the first big spike
+  if (cycles >= stat->max - (stat->max >> CYCLE_TRACE_WORST_SHIFT)) {
+    worst_[worst_w_].section = s;
+    worst_[worst_w_].cycles = cycles;
+    worst_[worst_w_].ms = millis();
+    worst_w_ = (worst_w_ + 1) % CYCLE_TRACE_WORST_SIZE;
+    if (worst_count_ < CYCLE_TRACE_WORST_SIZE)
+      worst_count_++;
+  }
+
+  if (!primask)
+    ENABLE_ISRS();
+}
+
+
+// copy statistics of a section without being torn by ISRs
+void CycleTrace::TakeStat(int s, CycleTraceStat_t &stat) {
+  DISABLE_ISRS();
+  stat = stat_[s];
+  ENABLE_ISRS();
+}
+
+
+// copy recent spikes, newest first
+void CycleTrace::TakeWorst(CycleTraceWorst_t *worst, uint8_t &count) {
+  DISABLE_ISRS();
+  count = worst_count_;
+  for (int i = 1; i <= count; i++)
+    worst[i - 1] = worst_[(worst_w_ + CYCLE_TRACE_WORST_SIZE - i) % CYCLE_TRACE_WORST_SIZE];
+  ENABLE_ISRS();
+}
+
+
+void CycleTrace::Clear() {
+  DISABLE_ISRS();
+  memset(stat_, 0, sizeof(stat_));
+  for (int i = 0; i < CYCLE_TRACE_SECTION_MAX; i++)
+    stat_[i].min = 0xFFFFFFFF;
+
+  worst_w_ = 0;
+  worst_count_ = 0;
+  ENABLE_ISRS();
+}
+
+
+void CycleTrace::Show() {
+  static const char *name[CYCLE_TRACE_SECTION_MAX] = {
+    "stepper isr", "block phase", "temp isr", "can irq"
+  };
+  CycleTraceStat_t  stat;
+  CycleTraceWorst_t worst[CYCLE_TRACE_WORST_SIZE];
+  uint8_t count;
+
+  LOG_I("cycles, F_CPU: %u\n", (uint32_t)F_CPU);
+
+  for (int i = 0; i < CYCLE_TRACE_SECTION_MAX; i++) {
+    TakeStat(i, stat);
+    if (!stat.count) {
+      LOG_I("%s: no sample\n", name[i]);
+      continue;
+    }
+
+    LOG_I("%s: count %u, min %u, max %u, mean %u\n", name[i], stat.count,
+          stat.min, stat.max, (uint32_t)(stat.total / stat.count));
+    LOG_I("  hist: %u %u %u %u %u %u %u %u\n", stat.hist[0], stat.hist[1],
+          stat.hist[2], stat.hist[3], stat.hist[4], stat.hist[5], stat.hist[6], stat.hist[7]);
+  }
+
+  TakeWorst(worst, count);
+  for (int i = 0; i < count; i++)
+    LOG_I("worst: %s, %u cycles at %u ms\n", name[worst[i].section], worst[i].cycles, worst[i].ms);
+}
+
+
+/* payload of the ack:
+ * [F_CPU: 4][sections: 1]
+ * sections * [count: 4][min: 4][max: 4][mean: 4][hist: 4 * 8]
+ * [worst count: 1], worst count * [section: 1][cycles: 4][ms: 4], newest first
+ * clear the statistics after reporting if data[0] of request is 1
+ */
+ErrCode CycleTrace::ReportToHMI(SSTP_Event_t &event) {
+  uint8_t  buffer[5 + CYCLE_TRACE_SECTION_MAX * (16 + 4 * CYCLE_TRACE_HIST_SIZE) +
+                  1 + CYCLE_TRACE_WORST_SIZE * 9];
+  uint16_t i = 0;
+  uint32_t tmp;
+  bool     clear = (event.length > 0 && event.data[0] == 1);
+  CycleTraceStat_t  stat;
+  CycleTraceWorst_t worst[CYCLE_TRACE_WORST_SIZE];
+  uint8_t count;
+
+  tmp = F_CPU;
+  WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, tmp, i);
+  buffer[i++] = CYCLE_TRACE_SECTION_MAX;
+
+  for (int s = 0; s < CYCLE_TRACE_SECTION_MAX; s++) {
+    TakeStat(s, stat);
+    if (!stat.count)
+      stat.min = 0;
+
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, stat.count, i);
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, stat.min, i);
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, stat.max, i);
+    tmp = stat.count? (uint32_t)(stat.total / stat.count) : 0;
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, tmp, i);
+    for (int h = 0; h < CYCLE_TRACE_HIST_SIZE; h++)
+      WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, stat.hist[h], i);
+  }
+
+  TakeWorst(worst, count);
+  buffer[i++] = count;
+  for (int w = 0; w < count; w++) {
+    buffer[i++] = worst[w].section;
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, worst[w].cycles, i);
+    WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, worst[w].ms, i);
+  }
+
+  if (clear)
+    Clear();
+
+  event.data = buffer;
+  event.length = i;
+
+  return hmi.Send(event);
+}
+
+#endif  // #if (SNAP_CYCLE_TRACE)
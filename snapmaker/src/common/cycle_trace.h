@@ -0,0 +1,115 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_CYCLE_TRACE_H_
+#define SNAPMAKER_CYCLE_TRACE_H_
+
+#include <stdint.h>
+
+#include "error.h"
+#include "protocol_sstp.h"
+
+// 1 = trace CPU cycles of hot paths with DWT cycle counter
+// 0 = all of tracing is compiled out
+// may be overridden by -DSNAP_CYCLE_TRACE=1 in build flags
+#ifndef SNAP_CYCLE_TRACE
+#define SNAP_CYCLE_TRACE 0
+#endif
+
+enum CycleTraceSection : uint8_t {
+  CYCLE_TRACE_STEPPER_ISR = 0,
+  CYCLE_TRACE_BLOCK_PHASE,
+  CYCLE_TRACE_TEMP_ISR,
+  CYCLE_TRACE_CAN_IRQ,
+
+  CYCLE_TRACE_SECTION_MAX
+};
+
+#if (SNAP_CYCLE_TRACE)
+
+// bucket i counts cycles in [256 << (i-1), 256 << i), last one is the rest
+#define CYCLE_TRACE_HIST_SIZE     8
+#define CYCLE_TRACE_HIST_SHIFT    8
+
+// recent spikes of all sections, a sample is a spike if it is
+// within max >> CYCLE_TRACE_WORST_SHIFT of the max of its section
+#define CYCLE_TRACE_WORST_SIZE    8
+#define CYCLE_TRACE_WORST_SHIFT   2
+
+// DWT registers of Cortex-M3
+#define CYCLE_TRACE_DEMCR         (*(volatile uint32_t *)0xE000EDFC)
+#define CYCLE_TRACE_DWT_CTRL      (*(volatile uint32_t *)0xE0001000)
+#define CYCLE_TRACE_DWT_CYCCNT    (*(volatile uint32_t *)0xE0001004)
+
+struct CycleTraceStat_t {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+  uint32_t hist[CYCLE_TRACE_HIST_SIZE];
+};
+
+struct CycleTraceWorst_t {
+  uint8_t  section;
+  uint32_t cycles;
+  uint32_t ms;
+};
+
+class CycleTrace {
+  public:
+    void Init();
+
+    static inline uint32_t Now() { return CYCLE_TRACE_DWT_CYCCNT; }
+
+    // called in ISRs of different priorities, keep it short
+    void Record(CycleTraceSection s, uint32_t cycles);
+
+    void Show();
+    void Clear();
+
+    ErrCode ReportToHMI(SSTP_Event_t &event);
+
+  private:
+    void TakeStat(int s, CycleTraceStat_t &stat);
+    void TakeWorst(CycleTraceWorst_t *worst, uint8_t &count);
+
+  private:
+    CycleTraceStat_t stat_[CYCLE_TRACE_SECTION_MAX];
+
+    CycleTraceWorst_t worst_[CYCLE_TRACE_WORST_SIZE];
+    uint8_t worst_w_;
+    uint8_t worst_count_;
+};
+
+extern CycleTrace cycletrace;
+
+#define CYCLE_TRACE_INIT()      cycletrace.Init()
+#define CYCLE_TRACE_BEGIN(s)    const uint32_t cycle_trace_##s = CycleTrace::Now()
+#define CYCLE_TRACE_END(s)      cycletrace.Record(s, CycleTrace::Now() - cycle_trace_##s)
+
+#else
+
+#define CYCLE_TRACE_INIT()
+#define CYCLE_TRACE_BEGIN(s)
+#define CYCLE_TRACE_END(s)
+
+#endif  // #if (SNAP_CYCLE_TRACE)
+
+#endif  // #ifndef SNAPMAKER_CYCLE_TRACE_H_
@@ -0,0 +1,206 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fw_unpacker.h"
+#include "debug.h"
+
+#include "MapleFreeRTOS1030.h"
+#include "flash_stm32.h"
+
+#define RAW_BYTE(addr)  (*((volatile uint8_t *)(addr)))
+
+#define LE_WORD(p)      ((uint32_t)(p)[0] | (uint32_t)(p)[1]<<8 | (uint32_t)(p)[2]<<16 | (uint32_t)(p)[3]<<24)
+
+
+// only one half word in critical section, flash may be used by others
+// between them, so unlock it every time
+static ErrCode ProgramHalfWord(uint32_t addr, uint16_t data) {
+  FLASH_Status status;
+
+  taskENTER_CRITICAL();
+  FLASH_Unlock();
+  status = FLASH_ProgramHalfWord(addr, data);
+  FLASH_Lock();
+  taskEXIT_CRITICAL();
+
+  return (status == FLASH_COMPLETE)? E_SUCCESS : E_HARDWARE;
+}
+
+
+bool FwUnpacker::IsPacked(const uint8_t *data, uint32_t length) {
+  return length >= FW_PACK_HEADER_SIZE && LE_WORD(data) == FW_PACK_MAGIC;
+}
+
+
+// same as zlib crc32()
+uint32_t FwUnpacker::Crc32(const uint8_t *data, uint32_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+
+  for (uint32_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+
+  return ~crc;
+}
+
+
+void FwUnpacker::Begin(uint32_t addr, uint32_t size) {
+  state_ = FW_UNPACK_HEADER;
+  addr_  = addr;
+  size_  = size;
+  in_    = 0;
+  out_   = 0;
+}
+
+
+ErrCode FwUnpacker::Feed(const uint8_t *data, uint32_t length) {
+  ErrCode  ret = E_SUCCESS;
+  uint8_t  byte;
+
+  for (uint32_t i = 0; i < length && ret == E_SUCCESS; i++) {
+    byte = data[i];
+
+    switch (state_) {
+    case FW_UNPACK_HEADER:
+      header_[in_] = byte;
+      if (in_ + 1 < FW_PACK_HEADER_SIZE)
+        break;
+
+      raw_size_    = LE_WORD(header_ + 4);
+      packed_size_ = LE_WORD(header_ + 8);
+      crc_         = LE_WORD(header_ + 12);
+      if (LE_WORD(header_) != FW_PACK_MAGIC || raw_size_ > size_) {
+        LOG_E("invalid packed image, raw size: %u\n", raw_size_);
+        ret = E_INVALID_DATA;
+        break;
+      }
+      state_ = FW_UNPACK_FLAG;
+      break;
+
+    case FW_UNPACK_FLAG:
+      flags_ = byte;
+      items_ = 8;
+      state_ = FW_UNPACK_ITEM;
+      break;
+
+    case FW_UNPACK_ITEM:
+      if (flags_ & 1) {
+        ret = Put(byte);
+        NextItem();
+      }
+      else {
+        match_ = byte;
+        state_ = FW_UNPACK_MATCH;
+      }
+      break;
+
+    case FW_UNPACK_MATCH:
+      distance_ = ((uint16_t)(match_ >> 4) << 8 | byte) + 1;
+      if ((match_ & 0x0F) == 0x0F) {
+        state_ = FW_UNPACK_EXTRA;
+        break;
+      }
+      ret = Copy(distance_, (match_ & 0x0F) + FW_PACK_LENGTH_MIN);
+      NextItem();
+      break;
+
+    case FW_UNPACK_EXTRA:
+      ret = Copy(distance_, FW_PACK_LENGTH_MIN + 15 + byte);
+      NextItem();
+      break;
+
+    default:
+      ret = E_INVALID_STATE;
+      break;
+    }
+
+    in_++;
+  }
+
+  if (ret != E_SUCCESS)
+    state_ = FW_UNPACK_ERROR;
+
+  return ret;
+}
+
+
+ErrCode FwUnpacker::End() {
+  if (state_ == FW_UNPACK_ERROR || state_ == FW_UNPACK_HEADER)
+    return E_INVALID_STATE;
+
+  // the last odd byte
+  if ((out_ & 1) && ProgramHalfWord(addr_ + out_ - 1, 0xFF00 | odd_) != E_SUCCESS)
+    return E_HARDWARE;
+
+  if (out_ != raw_size_ || in_ != FW_PACK_HEADER_SIZE + packed_size_) {
+    LOG_E("packed image is cut, raw: %u of %u, packed: %u of %u\n", out_, raw_size_,
+            in_ - FW_PACK_HEADER_SIZE, packed_size_);
+    return E_INVALID_DATA;
+  }
+
+  // check what is in flash
+  if (Crc32((const uint8_t *)addr_, out_) != crc_) {
+    LOG_E("CRC of unpacked image mismatch\n");
+    return E_INVALID_DATA;
+  }
+
+  return E_SUCCESS;
+}
+
+
+void FwUnpacker::NextItem() {
+  flags_ >>= 1;
+  state_ = (--items_)? FW_UNPACK_ITEM : FW_UNPACK_FLAG;
+}
+
+
+ErrCode FwUnpacker::Put(uint8_t byte) {
+  if (out_ >= raw_size_)
+    return E_INVALID_DATA;
+
+  if (out_++ & 1)
+    return ProgramHalfWord(addr_ + out_ - 2, (uint16_t)byte << 8 | odd_);
+
+  odd_ = byte;
+  return E_SUCCESS;
+}
+
+
+ErrCode FwUnpacker::Copy(uint32_t distance, uint32_t length) {
+  uint32_t from;
+  ErrCode  ret = E_SUCCESS;
+
+  if (distance > out_)
+    return E_INVALID_DATA;
+
+  for (; length > 0 && ret == E_SUCCESS; length--) {
+    from = out_ - distance;
+
+    // the last byte is not programmed if it's odd
+    if ((out_ & 1) && from == out_ - 1)
+      ret = Put(odd_);
+    else
+      ret = Put(RAW_BYTE(addr_ + from));
+  }
+
+  return ret;
+}
@@ -0,0 +1,104 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_FW_UNPACKER_H_
+#define SNAPMAKER_FW_UNPACKER_H_
+
+#include <stdint.h>
+
+#include "error.h"
+
+// packed firmware image, made by snapmaker/scripts/pack.py -z
+//
+// header, little endian: [magic][raw size][packed size][CRC32 of raw image]
+// then LZSS stream: a flag byte and 8 items after it, bit i of flag is
+// for item i, and items after the last byte of raw image are not there
+//   bit is 1: a literal byte
+//   bit is 0: a match, [distance-1 bits 11:8 | length-3][distance-1 bits 7:0],
+//             when length-3 is 15, one more byte is added to length
+// distance is 1 to 4096 and length is 3 to 273.
+//
+// The window is the image already in flash, so no RAM is taken for it.
+#define FW_PACK_MAGIC           (0x315A4D53)  // "SMZ1"
+#define FW_PACK_HEADER_SIZE     (16)
+
+#define FW_PACK_DISTANCE_MAX    (4096)
+#define FW_PACK_LENGTH_MIN      (3)
+#define FW_PACK_LENGTH_MAX      (FW_PACK_LENGTH_MIN + 15 + 255)
+
+
+enum FwUnpackState : uint8_t {
+  FW_UNPACK_HEADER,
+  FW_UNPACK_FLAG,
+  FW_UNPACK_ITEM,
+  FW_UNPACK_MATCH,
+  FW_UNPACK_EXTRA,
+  FW_UNPACK_ERROR
+};
+
+
+class FwUnpacker {
+  public:
+    static bool IsPacked(const uint8_t *data, uint32_t length);
+
+    // raw image is programmed from addr, and it cannot be longer than size,
+    // flash must be erased
+    void Begin(uint32_t addr, uint32_t size);
+
+    // feed the packed image in pieces of any length
+    ErrCode Feed(const uint8_t *data, uint32_t length);
+
+    // all of packed image is fed, check sizes and CRC of raw image in flash
+    ErrCode End();
+
+    uint32_t raw_size() { return out_; }
+
+    static uint32_t Crc32(const uint8_t *data, uint32_t length);
+
+  private:
+    ErrCode Put(uint8_t byte);
+    ErrCode Copy(uint32_t distance, uint32_t length);
+    void NextItem();
+
+  private:
+    FwUnpackState state_;
+
+    uint32_t addr_;
+    uint32_t size_;
+
+    uint8_t  header_[FW_PACK_HEADER_SIZE];
+    uint32_t raw_size_;
+    uint32_t packed_size_;
+    uint32_t crc_;
+
+    // bytes fed and raw bytes out
+    uint32_t in_;
+    uint32_t out_;
+
+    uint8_t  flags_;
+    uint8_t  items_;
+    uint8_t  match_;
+    uint16_t distance_;
+
+    // odd byte of raw image waiting for the next one to make a half word
+    uint8_t  odd_;
+};
+
+#endif  // #ifndef SNAPMAKER_FW_UNPACKER_H_
@@ -0,0 +1,146 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mesh_cells.h"
+
+#include <math.h>
+
+MeshCells meshcells;
+
+#define FRAC_ONE  ((int32_t)1 << MESH_CELL_FRAC_SHIFT)
+
+
+void MeshCells::Init(MeshCell_t *table, uint16_t max) {
+  valid_ = false;
+  table_ = table;
+  max_   = max;
+}
+
+
+// Z of a corner in 1/4096 mm
+static bool ToFixed(float z, int32_t &out) {
+  const float limit = (float)INT16_MAX / (1 << MESH_CELL_Z_SHIFT);
+
+  if (isnan(z) || z > limit || z < -limit)
+    return false;
+
+  out = (int32_t)lroundf(z * (1 << MESH_CELL_Z_SHIFT));
+  return true;
+}
+
+
+static bool ToCoefficient(int32_t value, int16_t &out) {
+  if (value > INT16_MAX || value < INT16_MIN)
+    return false;
+
+  out = value;
+  return true;
+}
+
+
+bool MeshCells::Build(const float *z, uint16_t stride, uint8_t nx, uint8_t ny,
+                      const float start[2], const float spacing[2], bool extrapolate) {
+  int32_t z00, z10, z01, z11;
+  MeshCell_t *cell;
+
+  // readers check it before touching table
+  valid_ = false;
+
+  if (!table_ || nx < 2 || ny < 2 || (nx - 1) * (ny - 1) > max_ ||
+      !(spacing[0] > 0) || !(spacing[1] > 0))
+    return false;
+
+  for (uint8_t x = 0; x < nx - 1; x++) {
+    for (uint8_t y = 0; y < ny - 1; y++) {
+      if (!ToFixed(z[x * stride + y], z00) || !ToFixed(z[(x + 1) * stride + y], z10) ||
+          !ToFixed(z[x * stride + y + 1], z01) || !ToFixed(z[(x + 1) * stride + y + 1], z11))
+        return false;
+
+      cell = table_ + x * (ny - 1) + y;
+      if (!ToCoefficient(z00, cell->z0) || !ToCoefficient(z10 - z00, cell->dzdx) ||
+          !ToCoefficient(z01 - z00, cell->dzdy) || !ToCoefficient(z11 - z10 - z01 + z00, cell->dzdxy))
+        return false;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    start_[i] = start[i];
+    scale_[i] = FRAC_ONE / spacing[i];
+  }
+  cells_[0] = nx - 1;
+  cells_[1] = ny - 1;
+  extrapolate_ = extrapolate;
+
+  valid_ = true;
+
+  return true;
+}
+
+
+// position in Q16 cells from the left-front corner of its cell
+int32_t MeshCells::Locate(float pos, uint8_t axis, uint8_t &cell) {
+  const float max = (float)MESH_CELL_EXTENT_MAX * FRAC_ONE;
+  float   scaled = (pos - start_[axis]) * scale_[axis];
+  int32_t fixed, index;
+
+  if (scaled > max)
+    scaled = max;
+  else if (scaled < -max)
+    scaled = -max;
+
+  // it's truncated, but shifting floors it, so cell is same as FLOOR()
+  // of float lookup, and fraction is at most one Q16 step off
+  fixed = (int32_t)scaled;
+
+  index = fixed >> MESH_CELL_FRAC_SHIFT;
+  if (index < 0)
+    index = 0;
+  else if (index > cells_[axis] - 1)
+    index = cells_[axis] - 1;
+
+  cell = index;
+  fixed -= index << MESH_CELL_FRAC_SHIFT;
+
+  // heights at edges are kept beyond the grid
+  if (!extrapolate_) {
+    if (fixed < 0)
+      fixed = 0;
+    else if (fixed > FRAC_ONE)
+      fixed = FRAC_ONE;
+  }
+
+  return fixed;
+}
+
+
+float MeshCells::Offset(float x, float y) {
+  uint8_t cx, cy;
+  int32_t fx = Locate(x, 0, cx);
+  int32_t fy = Locate(y, 1, cy);
+  const MeshCell_t &cell = table_[cx * cells_[1] + cy];
+
+  // extrapolated fractions may be far beyond 1, so products are in 64 bits
+  int64_t sum = (int64_t)cell.dzdx * fx + (int64_t)cell.dzdy * fy
+              + (((int64_t)cell.dzdxy * fx) >> MESH_CELL_FRAC_SHIFT) * fy;
+
+  sum = ((int64_t)cell.z0 << MESH_CELL_FRAC_SHIFT) + sum + (FRAC_ONE >> 1);
+
+  return (float)(sum >> MESH_CELL_FRAC_SHIFT) * (1.0f / (1 << MESH_CELL_Z_SHIFT));
+}
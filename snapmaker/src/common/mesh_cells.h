@@ -0,0 +1,89 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_MESH_CELLS_H_
+#define SNAPMAKER_MESH_CELLS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// cells of bilinear leveling mesh as coefficients, so looking up Z takes
+// integer math only after position is scaled to the grid:
+//   z = z0 + dzdx * fx + dzdy * fy + dzdxy * fx * fy
+// fx and fy are position in the cell from 0 to 1, in Q16.
+//
+// Z of corners is rounded to 1/4096 mm first and coefficients are got
+// from them, so neighbour cells still meet exactly at the edge. Corners
+// must be within +/-8 mm.
+#define MESH_CELL_Z_SHIFT       (12)
+#define MESH_CELL_FRAC_SHIFT    (16)
+
+// far positions are clamped to this many cells from the grid, so the
+// scaled position stays in int32
+#define MESH_CELL_EXTENT_MAX    (4096)
+
+typedef struct {
+  int16_t z0;     // left-front
+  int16_t dzdx;   // right-front - left-front
+  int16_t dzdy;   // left-back - left-front
+  int16_t dzdxy;  // twist of the cell
+} MeshCell_t;
+
+
+class MeshCells {
+  public:
+    // table has room for max cells
+    void Init(MeshCell_t *table, uint16_t max);
+
+    // z of point (x, y) of grid is z[x * stride + y], there are nx * ny
+    // points, start and spacing are in mm. Beyond the grid, edge cells are
+    // extended if extrapolate, otherwise edge heights are kept.
+    // Return false if mesh has NAN, is too big or too steep for the
+    // table, then it is not valid
+    bool Build(const float *z, uint16_t stride, uint8_t nx, uint8_t ny,
+               const float start[2], const float spacing[2], bool extrapolate);
+
+    void Invalidate() { valid_ = false; }
+    bool valid() { return valid_; }
+
+    // Z offset at (x, y) in mm, table must be valid
+    float Offset(float x, float y);
+
+  private:
+    int32_t Locate(float pos, uint8_t axis, uint8_t &cell);
+
+  private:
+    MeshCell_t *table_ = NULL;
+    uint16_t max_ = 0;
+
+    volatile bool valid_ = false;
+    bool extrapolate_;
+
+    // cells on each axis
+    uint8_t cells_[2];
+    float start_[2];
+
+    // Q16 cells per mm
+    float scale_[2];
+};
+
+extern MeshCells meshcells;
+
+#endif  // #ifndef SNAPMAKER_MESH_CELLS_H_
@@ -21,169 +21,218 @@
 #include "protocol_sstp.h"
 #include "debug.h"
 
-#include <libmaple/ring_buffer.h>
+#include <string.h>
 #include "MapleFreeRTOS1030.h"
 
 // marlin headers
+#include "src/inc/MarlinConfig.h"
 #include "src/core/serial.h"
 #include "src/libs/hex_print_routines.h"
 
 #define LOG_HEAD  "SSTP: "
-#define TIMEOUT_FOR_HEADER      (2)
-#define TIMEOUT_FOR_NEXT_BYTE   (1)
-
-// min br = 115200bps, = 14.4 bytes/ms
-// max data length = 516 bytes in transferring FW
-// so, max MS to wait = 516 / 14.4 = 36ms
-#define DELAY_MS_FOR_DATA       (5)
-#define TIMEOUT_COUNT_FOR_DATA  (100/DELAY_MS_FOR_DATA)
-
-/* checkout event from UART RX ring buffer
- * Note that we may call this function many times
- * for one complete event
+
+
+/* checkout event from RX ring buffer without copying it out.
+ * Note that we may call this function many times for one complete event,
+ * every call only scans the new bytes, and checksum of data field is
+ * calculated at the same time. If we get E_SUCCESS, data field will stay
+ * in ring buffer until Release() is called.
+ * Header is kept in header_ and dropped from ring once it's checked, so
+ * data field may take the whole ring buffer.
  */
-ErrCode ProtocolSSTP::Parse(ring_buffer *rb, uint8_t *out, uint16_t &size) {
-  int16_t   c = -1;
-  int       i;
-  uint16_t  timeout = 0;
-  uint16_t  length = 0;
-  uint16_t  calc_chk = 0;
-  uint16_t  recv_chk = 0;
-
-  // no enough bytes for one command
-  if (rb_full_count(rb) < SSTP_PDU_HEADER_SIZE)
-    return E_NO_RESRC;
-
-  // ok, we have enough bytes, now find SOF
-  // if no SOF in all available bytes, return with same state
-  do {
-    c = rb_safe_remove(rb);
-      if (c == SSTP_PDU_SOF_H) {
-        c = rb_safe_remove(rb);
-        if (c == SSTP_PDU_SOF_L) {
-          break;
-        }
-        else {
-          continue;
-        }
-      }
-  } while (c != -1);
+ErrCode ProtocolSSTP::Peek(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view) {
+  uint32_t avail = ring.Available();
+  uint16_t end;
+  uint16_t calc_chk;
+  uint16_t recv_chk;
+  uint8_t  *seg[2];
+  uint32_t seg_len[2];
+  uint32_t run;
+  bool     dropped = false;
+  ErrCode  err;
 
-  if (c == -1) {
-    // not found SOF
-    return E_NO_SOF;
-  }
+  switch (state_) {
+  case PROTOCOL_SSTP_STATE_IDLE:
+    // find SOF, drop all bytes before it
+    for (;;) {
+      if (avail < SSTP_PDU_SOF_SIZE)
+        return dropped? E_NO_SOF : E_NO_RESRC;
 
-  // if it doesn't have enough bytes in ring buffer for header, just return
-  while (rb_full_count(rb) < (SSTP_PDU_HEADER_SIZE - 1)) {
-    vTaskDelay(pdMS_TO_TICKS(1));
-    if (++timeout > TIMEOUT_FOR_HEADER) {
-      SERIAL_ECHOLN(LOG_HEAD "timeout to wait for PDU header");
-      return E_NO_HEADER;
+      if (ring.PeekAt(0) == SSTP_PDU_SOF_H && ring.PeekAt(1) == SSTP_PDU_SOF_L)
+        break;
+
+      ring.Discard(1);
+      avail--;
+      dropped = true;
     }
-  }
 
-  // arrive here, we got SOF, and also have enough bytes for one command header
-  // so just start actually check if we got correct header.
-  // read all of header
-  for (i = 2; i < (SSTP_PDU_HEADER_SIZE); i++) {
-    timeout = 0;
-    do {
-      c = rb_safe_remove(rb);
-      if (c != -1)
-        break;
-      else {
-        vTaskDelay(pdMS_TO_TICKS(1));
-        if (++timeout > TIMEOUT_FOR_NEXT_BYTE) {
-          SERIAL_ECHOLNPAIR(LOG_HEAD "not enough bytes for header, just got ", i);
-          return E_NO_HEADER;
-        }
-      }
-    } while (1);
-    header_[i] = (uint8_t)c;
-  }
+    state_ = PROTOCOL_SSTP_STATE_FOUND_SOF;
+    stamp_ = xTaskGetTickCount();
 
-  // now we know the length, just check if we have correct data length
-  length = (uint16_t)(header_[SSTP_PDU_IDX_DATA_LEN_H]<<8 | header_[SSTP_PDU_IDX_DATA_LEN_L]);
-  // 1. check if we got normal length
-  if (length > SSTP_RECV_BUFFER_SIZE) {
-    SERIAL_ECHOLNPAIR(LOG_HEAD "length out of range, recv: ", hex_word(length));
-    return E_INVALID_DATA_LENGTH;
-  }
+  case PROTOCOL_SSTP_STATE_FOUND_SOF:
+    if (avail < SSTP_HEADER_SIZE) {
+      if ((xTaskGetTickCount() - stamp_) > pdMS_TO_TICKS(SSTP_VIEW_TIMEOUT_MS)) {
+        SERIAL_ECHOLN(LOG_HEAD "timeout to wait for PDU header");
+        err = E_TIMEOUT;
+        goto out_resync;
+      }
+      return E_NO_HEADER;
+    }
 
-  // 2. verify the length with checksum
-  c = header_[SSTP_PDU_IDX_DATA_LEN_H]^header_[SSTP_PDU_IDX_DATA_LEN_L];
-  if (header_[SSTP_PDU_IDX_LEN_CHK] != (uint8_t)c) {
-    SERIAL_ECHOLNPAIR(LOG_HEAD "length checksum error, recv: ", hex_byte(header_[SSTP_PDU_IDX_LEN_CHK]), "calc: ", hex_byte((uint8_t)c));
-    return E_INVALID_DATA_LENGTH;
-  }
+    ring.Peek(header_, SSTP_HEADER_SIZE);
 
-  // ok, got correct length, checkout the command checksum then switch state
-  recv_chk = (uint16_t)(header_[SSTP_PDU_IDX_CHKSUM_H]<<8 | header_[SSTP_PDU_IDX_CHKSUM_L]);
+    // confirm the checksum of length
+    if (header_[SSTP_PDU_IDX_LEN_CHK] != (uint8_t)(header_[SSTP_PDU_IDX_DATA_LEN_H]^header_[SSTP_PDU_IDX_DATA_LEN_L])) {
+      SERIAL_ECHOLNPAIR(LOG_HEAD "length checksum error, recv: ", hex_byte(header_[SSTP_PDU_IDX_LEN_CHK]));
+      err = E_INVALID_DATA_LENGTH;
+      goto out_resync;
+    }
 
-  timeout = 0;
-  while (rb_full_count(rb) < length) {
-    vTaskDelay(pdMS_TO_TICKS(DELAY_MS_FOR_DATA));
-    if (++timeout > TIMEOUT_COUNT_FOR_DATA) {
-      SERIAL_ECHOLNPAIR(LOG_HEAD "not enough bytes for data: ", length);
-      return E_NO_DATA;
+    // whole data field must be able to stay in ring buffer
+    length_ = header_[SSTP_PDU_IDX_DATA_LEN_H]<<8 | header_[SSTP_PDU_IDX_DATA_LEN_L];
+    if (length_ > SSTP_RECV_BUFFER_SIZE || length_ > ring.size()) {
+      SERIAL_ECHOLNPAIR(LOG_HEAD "length out of range, recv: ", hex_word(length_));
+      err = E_INVALID_DATA_LENGTH;
+      goto out_resync;
     }
-  }
 
-  // read all data field in UART RX buffer
-  for (int i = 0; i < length; i++) {
-    timeout = 0;
-    do {
-      c = rb_safe_remove(rb);
-      if (c != -1)
+    ring.Discard(SSTP_HEADER_SIZE);
+    avail -= SSTP_HEADER_SIZE;
+
+    state_ = PROTOCOL_SSTP_STATE_GOT_LENGTH;
+    scanned_ = 0;
+    sum_ = 0;
+
+  case PROTOCOL_SSTP_STATE_GOT_LENGTH:
+    end = avail;
+    if (end > length_)
+      end = length_;
+
+    // same as CalcChecksum(): big-endian half words, the odd tail byte is
+    // added as low byte. Sum the contiguous part of new bytes by word
+    while (scanned_ < end) {
+      if ((length_ & 1) && scanned_ == length_ - 1) {
+        sum_ += ring.PeekAt(scanned_);
+        scanned_++;
         break;
-      else {
-        vTaskDelay(pdMS_TO_TICKS(1));
-        if (++timeout > TIMEOUT_FOR_NEXT_BYTE) {
-          SERIAL_ECHOLN(LOG_HEAD "timeout wait for next byte of data");
-          return E_NO_DATA;
-        }
       }
-    } while (1);
-    out[i] = (uint8_t)c;
-  }
 
-  calc_chk = CalcChecksum(out, length);
+      // wait for the other byte of half word
+      if (end - scanned_ < 2)
+        break;
+
+      ring.Segments(scanned_, (end - scanned_) & ~1, seg, seg_len);
 
-  // calc checksum of data
-  if (calc_chk != recv_chk) {
-    SNAP_DEBUG_CMD_CHECKSUM_ERROR(true);
-    SERIAL_ECHOLNPAIR(LOG_HEAD "uncorrect calc checksum: ", hex_word(calc_chk), ", recv chksum: ", hex_word(recv_chk));
-    if (length > 0) {
-      SERIAL_ECHO(LOG_HEAD "content:");
-      for (int i = 0; i < length; i++) {
-        SERIAL_ECHOPAIR(" ", hex_byte(out[i]));
+      run = seg_len[0] & ~1;
+      if (run) {
+        sum_ = SumHalfWords(seg[0], run, sum_);
+        scanned_ += run;
+      }
+      else {
+        // half word wraps around the end of ring buffer
+        sum_ += (uint32_t)ring.PeekAt(scanned_) << 8 |
+                ring.PeekAt(scanned_ + 1);
+        scanned_ += 2;
       }
-      SERIAL_EOL();
-      SERIAL_EOL();
     }
-    return E_INVALID_DATA;
+
+    if (scanned_ < length_) {
+      if ((xTaskGetTickCount() - stamp_) > pdMS_TO_TICKS(SSTP_VIEW_TIMEOUT_MS)) {
+        SERIAL_ECHOLNPAIR(LOG_HEAD "not enough bytes for data: ", length_);
+        // header has been dropped, find next SOF from data field
+        state_ = PROTOCOL_SSTP_STATE_IDLE;
+        return E_TIMEOUT;
+      }
+      return E_NO_DATA;
+    }
+
+    calc_chk = 0;
+    if (length_) {
+      while (sum_ > 0xffff)
+        sum_ = ((sum_ >> 16) & 0xffff) + (sum_ & 0xffff);
+      calc_chk = (uint16_t)~sum_;
+    }
+
+    recv_chk = (uint16_t)(header_[SSTP_PDU_IDX_CHKSUM_H]<<8 | header_[SSTP_PDU_IDX_CHKSUM_L]);
+    if (calc_chk != recv_chk) {
+      SNAP_DEBUG_CMD_CHECKSUM_ERROR(true);
+      SERIAL_ECHOLNPAIR(LOG_HEAD "uncorrect calc checksum: ", hex_word(calc_chk), ", recv chksum: ", hex_word(recv_chk));
+      // length is verified, so drop the whole event
+      ring.Discard(length_);
+      state_ = PROTOCOL_SSTP_STATE_IDLE;
+      return E_INVALID_DATA;
+    }
+
+    state_ = PROTOCOL_SSTP_STATE_GOT_DATA;
+
+  case PROTOCOL_SSTP_STATE_GOT_DATA:
+    // caller didn't release last event, just give it again
+    MakeView(ring, view);
+    return E_SUCCESS;
+
+  default:
+    break;
   }
 
-  // now we get an available command
-  size = length;
+  state_ = PROTOCOL_SSTP_STATE_IDLE;
+  return E_INVALID_STATE;
+
+out_resync:
+  // drop SOF_H, then we can find next SOF
+  ring.Discard(1);
+  state_ = PROTOCOL_SSTP_STATE_IDLE;
+  return err;
+}
+
 
-  return E_SUCCESS;
+void ProtocolSSTP::MakeView(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view) {
+  uint32_t seg_len[2];
+
+  ring.Segments(0, length_, view.seg, seg_len);
+  view.seg_len[0] = (uint16_t)seg_len[0];
+  view.seg_len[1] = (uint16_t)seg_len[1];
+  view.length = length_;
+}
+
+
+/* remove the event got by Peek() from ring buffer
+ * Note that RX ISR drops new bytes when ring buffer is full,
+ * so release the event as soon as possible
+ */
+void ProtocolSSTP::Release(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view) {
+  if (state_ != PROTOCOL_SSTP_STATE_GOT_DATA)
+    return;
+
+  ring.Discard(view.length);
+  state_ = PROTOCOL_SSTP_STATE_IDLE;
+}
+
+
+uint16_t ProtocolSSTP::CopyView(SSTP_View_t &view, uint8_t *out) {
+  memcpy(out, view.seg[0], view.seg_len[0]);
+  if (view.seg_len[1])
+    memcpy(out + view.seg_len[0], view.seg[1], view.seg_len[1]);
+
+  return view.length;
 }
 
-ErrCode ProtocolSSTP::Parse(RingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &length) {
+ErrCode ProtocolSSTP::Parse(SpscRingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &length) {
   uint16_t calc_chk = 0;
 
 
   switch (state_) {
   case PROTOCOL_SSTP_STATE_IDLE:
-    // SOF has 2 bytes, so try to read 2 bytes
-    if (ring.RemoveMulti(header_, (int32_t)SSTP_PDU_SOF_SIZE) != SSTP_PDU_SOF_SIZE)
+    // SOF has 2 bytes, check them before removing
+    if (ring.Available() < SSTP_PDU_SOF_SIZE)
       return E_NO_RESRC;
 
-    // check if we got SOF
-    if (header_[0] != SSTP_PDU_SOF_H || header_[1] != SSTP_PDU_SOF_L)
+    // drop one byte if no SOF, so SOF_L of last try can be SOF_H of next try
+    if (ring.PeekAt(0) != SSTP_PDU_SOF_H || ring.PeekAt(1) != SSTP_PDU_SOF_L) {
+      ring.Discard(1);
       return E_NO_SOF;
+    }
+
+    ring.RemoveMulti(header_, SSTP_PDU_SOF_SIZE);
 
     state_ = PROTOCOL_SSTP_STATE_FOUND_SOF;
     timeout_ = 0;
@@ -198,7 +247,7 @@ ErrCode ProtocolSSTP::Parse(RingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &l
       return E_NO_HEADER;
     }
 
-    ring.RemoveMulti(header_ + SSTP_PDU_SOF_SIZE, (int32_t)(SSTP_HEADER_SIZE - SSTP_PDU_SOF_SIZE));
+    ring.RemoveMulti(header_ + SSTP_PDU_SOF_SIZE, SSTP_HEADER_SIZE - SSTP_PDU_SOF_SIZE);
 
     // confirm the checksum of length_
     if (header_[SSTP_PDU_IDX_LEN_CHK] != (uint8_t)(header_[SSTP_PDU_IDX_DATA_LEN_H]^header_[SSTP_PDU_IDX_DATA_LEN_L])) {
@@ -225,7 +274,7 @@ ErrCode ProtocolSSTP::Parse(RingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &l
       return E_NO_DATA;
     }
 
-    ring.RemoveMulti(out, (int32_t)length_);
+    ring.RemoveMulti(out, length_);
 
     calc_chk = CalcChecksum(out, length_);
     state_ = PROTOCOL_SSTP_STATE_IDLE;
@@ -247,6 +296,25 @@ ErrCode ProtocolSSTP::Parse(RingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &l
 }
 
 
+ErrCode ProtocolSSTP::Check(uint8_t *packet, uint16_t length) {
+  uint16_t data_length;
+
+  if (length < SSTP_HEADER_SIZE || packet[0] != SSTP_PDU_SOF_H || packet[1] != SSTP_PDU_SOF_L)
+    return E_NO_SOF;
+
+  data_length = packet[SSTP_PDU_IDX_DATA_LEN_H]<<8 | packet[SSTP_PDU_IDX_DATA_LEN_L];
+  if (packet[SSTP_PDU_IDX_LEN_CHK] != (uint8_t)(packet[SSTP_PDU_IDX_DATA_LEN_H]^packet[SSTP_PDU_IDX_DATA_LEN_L]) ||
+      data_length + SSTP_HEADER_SIZE != length)
+    return E_INVALID_DATA_LENGTH;
+
+  if (CalcChecksum(packet + SSTP_HEADER_SIZE, data_length) !=
+      (uint16_t)(packet[SSTP_PDU_IDX_CHKSUM_H]<<8 | packet[SSTP_PDU_IDX_CHKSUM_L]))
+    return E_INVALID_DATA;
+
+  return E_SUCCESS;
+}
+
+
 ErrCode ProtocolSSTP::Package(uint8_t *in, uint8_t *out, uint16_t &length) {
   uint16_t checksum;
   uint16_t index = 0;
@@ -278,7 +346,69 @@ ErrCode ProtocolSSTP::Package(uint8_t *in, uint8_t *out, uint16_t &length) {
 }
 
 
+/* add big-endian half words of buffer to sum, length should be even.
+ * It loads 4 words per loop and adds them as little-endian half words,
+ * the carries are kept in 64 bits accumulator (ADDS/ADC on Cortex-M3).
+ * One's complement sum doesn't care about byte order, so swapping the
+ * folded sum (REV16) gives the big-endian one.
+ */
+uint32_t ProtocolSSTP::SumHalfWords(const uint8_t *buffer, uint32_t length, uint32_t sum) {
+  uint64_t acc = 0;
+  uint32_t w[4];
+  uint16_t hw;
+
+  // Cortex-M3 supports unaligned LDR, memcpy() will be compiled to it
+  while (length >= 16) {
+    memcpy(w, buffer, 16);
+    acc += w[0];
+    acc += w[1];
+    acc += w[2];
+    acc += w[3];
+    buffer += 16;
+    length -= 16;
+  }
+
+  while (length >= 4) {
+    memcpy(w, buffer, 4);
+    acc += w[0];
+    buffer += 4;
+    length -= 4;
+  }
+
+  if (length >= 2) {
+    memcpy(&hw, buffer, 2);
+    acc += hw;
+  }
+
+  while (acc > 0xffff)
+    acc = (acc >> 16) + (acc & 0xffff);
+
+  return sum + __builtin_bswap16((uint16_t)acc);
+}
+
+
 uint16_t ProtocolSSTP::CalcChecksum(uint8_t *buffer, uint16_t length) {
+  uint32_t checksum;
+
+  if (!length || !buffer)
+    return 0;
+
+  checksum = SumHalfWords(buffer, length & ~1, 0);
+
+  if (length % 2)
+    checksum += buffer[length - 1];
+
+  while (checksum > 0xffff)
+    checksum = ((checksum >> 16) & 0xffff) + (checksum & 0xffff);
+
+  checksum = ~checksum;
+
+  return (uint16_t)checksum;
+}
+
+
+// byte by byte version, keep it to verify CalcChecksum()
+uint16_t ProtocolSSTP::CalcChecksumRef(uint8_t *buffer, uint16_t length) {
   uint32_t volatile checksum = 0;
 
   if (!length || !buffer)
@@ -299,6 +429,60 @@ uint16_t ProtocolSSTP::CalcChecksum(uint8_t *buffer, uint16_t length) {
 }
 
 
+void ProtocolSSTP::VerifyChecksum(uint32_t rounds) {
+  uint8_t  *buffer;
+  uint32_t seed = 0x12345678;
+  uint32_t time_ref = 0;
+  uint32_t time_new = 0;
+  uint32_t bytes = 0;
+  uint32_t errors = 0;
+  uint32_t start;
+  uint16_t length;
+  uint16_t offset;
+  uint16_t chk_ref;
+  uint16_t chk_new;
+
+  // one more word to test unaligned buffer
+  buffer = (uint8_t *)pvPortMalloc(SSTP_RECV_BUFFER_SIZE + 4);
+  if (!buffer) {
+    LOG_E("no memory to verify checksum\n");
+    return;
+  }
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    seed = seed * 1103515245 + 12345;
+    length = (seed >> 8) % (SSTP_RECV_BUFFER_SIZE + 1);
+    offset = (seed >> 24) & 3;
+
+    for (int j = 0; j < length; j++) {
+      seed = seed * 1103515245 + 12345;
+      buffer[offset + j] = (uint8_t)(seed >> 16);
+    }
+
+    start = micros();
+    chk_ref = CalcChecksumRef(buffer + offset, length);
+    time_ref += micros() - start;
+
+    start = micros();
+    chk_new = CalcChecksum(buffer + offset, length);
+    time_new += micros() - start;
+
+    bytes += length;
+
+    if (chk_ref != chk_new) {
+      if (++errors < 10)
+        LOG_E("checksum mismatch, len: %u, off: %u, ref: 0x%04X, new: 0x%04X\n",
+              length, offset, chk_ref, chk_new);
+    }
+  }
+
+  vPortFree(buffer);
+
+  LOG_I("checksum: %u rounds, %u bytes, %u errors\n", rounds, bytes, errors);
+  LOG_I("reference: %u us, word: %u us\n", time_ref, time_new);
+}
+
+
 uint16_t ProtocolSSTP::CalcChecksum(SSTP_Event_t &event) {
   uint32_t volatile checksum = 0;
   uint16_t size = event.length;
@@ -339,8 +523,7 @@ uint16_t ProtocolSSTP::CalcChecksum(SSTP_Event_t &event) {
   }
 
 
-  for (int j = start; j < (size - 1); j = j + 2)
-    checksum += (uint32_t)(event.data[j] << 8 | event.data[j + 1]);
+  checksum = SumHalfWords(event.data + start, (size - start) & ~1, checksum);
 
   if ((size - start) % 2) {
     checksum += event.data[size - 1];
@@ -22,9 +22,7 @@
 #define SNAPMAKER_PROTOCOL_SSTP_H_
 
 #include "error.h"
-#include "../utils/ring_buffer.h"
-
-#include <libmaple/ring_buffer.h>
+#include "../utils/spsc_ring_buffer.h"
 
 // protocol relative macros
 #define SSTP_PDU_SOF_H   0xAA
@@ -73,6 +71,10 @@
 
 #define SSTP_RECV_BUFFER_SIZE (1024)
 
+// min br = 115200bps, = 14.4 bytes/ms, max data length is 1024 bytes
+// so we need about 71ms to receive the longest event
+#define SSTP_VIEW_TIMEOUT_MS  (100)
+
 // convert lcoal word to the bytes in protocol data unit
 #define WORD_TO_PDU_BYTES(buff, var)  do { \
                                         (buff)[0] = (uint8_t)((var)>>24 & 0x000000FF);  \
@@ -125,27 +127,55 @@ typedef struct {
 } SSTP_Event_t;
 
 
+// data field of an event which is still in the RX ring buffer.
+// it may wrap around the end of ring buffer, so it has two segments,
+// seg_len[1] is 0 if data is contiguous
+typedef struct {
+  uint8_t  *seg[2];
+  uint16_t seg_len[2];
+  uint16_t length;
+} SSTP_View_t;
+
+
 class ProtocolSSTP {
   public:
     ProtocolSSTP() {
       timeout_ = 0;
       length_ = 0;
+      scanned_ = 0;
+      sum_ = 0;
+      stamp_ = 0;
       state_ = PROTOCOL_SSTP_STATE_IDLE;
     }
 
-    ErrCode Parse(RingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &length);
-    ErrCode Parse(ring_buffer *rb, uint8_t *out, uint16_t &length);
+    ErrCode Parse(SpscRingBuffer<uint8_t> &ring, uint8_t *out, uint16_t &length);
+
+    // parse event in place, without removing it from ring buffer
+    ErrCode Peek(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view);
+    void Release(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view);
+    void Reset() { state_ = PROTOCOL_SSTP_STATE_IDLE; }
+
+    static uint16_t CopyView(SSTP_View_t &view, uint8_t *out);
+
+    // check a whole packet in linear buffer, such as one put together by CAN IRQ
+    static ErrCode Check(uint8_t *packet, uint16_t length);
 
     ErrCode Package(uint8_t *in_data, uint8_t *out, uint16_t &length);
 
     uint16_t CalcChecksum(SSTP_Event_t &event);
 
+    // compare CalcChecksum() with reference and measure both of them
+    static void VerifyChecksum(uint32_t rounds);
+
   public:
     bool is_waiting_gcode = false;
     bool is_laser_on = false;
 
   private:
-    uint16_t CalcChecksum(uint8_t *buffer, uint16_t length);
+    static uint16_t CalcChecksum(uint8_t *buffer, uint16_t length);
+    static uint16_t CalcChecksumRef(uint8_t *buffer, uint16_t length);
+    static uint32_t SumHalfWords(const uint8_t *buffer, uint32_t length, uint32_t sum);
+    void MakeView(SpscRingBuffer<uint8_t> &ring, SSTP_View_t &view);
 
 
   private:
@@ -155,6 +185,11 @@ class ProtocolSSTP {
     uint8_t  header_[SSTP_HEADER_SIZE];
     uint16_t length_;
     uint32_t timeout_;
+
+    // for parsing in place
+    uint16_t scanned_;
+    uint32_t sum_;
+    uint32_t stamp_;
 };
 
 
@@ -0,0 +1,425 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "settings_log.h"
+#include "debug.h"
+
+#include "src/core/macros.h"
+
+#include "flash_stm32.h"
+#include <string.h>
+
+#define LOG_WORD(addr)          (*((volatile uint32_t *)(addr)))
+#define LOG_HALF(addr)          (*((volatile uint16_t *)(addr)))
+
+#define LOG_PAGE_SIZE           (2048)
+#define LOG_PAGE0               (FLASH_MARLIN_EEPROM)
+#define LOG_PAGE1               (FLASH_MARLIN_EEPROM + LOG_PAGE_SIZE)
+#define LOG_HEADER_SIZE         (8)
+
+#define LOG_LENGTH(length)      ((length) & ~SETTINGS_LOG_COMMIT)
+#define LOG_ALIGN(length)       (((length) + 1) & ~1)
+// [offset][length][data][check]
+#define LOG_RECORD_SIZE(length) (LOG_ALIGN(length) + 6)
+
+// a gap of unchanged bytes shorter than head and check of a record is
+// cheaper to be programmed again than to start a new record
+#define LOG_GAP_MAX             (6)
+
+// every chunk of image may take a record after compacting, plus a commit
+#define LOG_COMPACTED_MAX       (LOG_HEADER_SIZE + LOG_RECORD_SIZE(0) + \
+                                  (SETTINGS_LOG_CAPACITY / SETTINGS_LOG_RECORD_MAX) * LOG_RECORD_SIZE(SETTINGS_LOG_RECORD_MAX))
+
+static_assert(2 * LOG_PAGE_SIZE == MARLIN_EEPROM_SIZE, "settings log takes 2 pages of EEPROM area");
+static_assert(SETTINGS_LOG_CAPACITY % SETTINGS_LOG_RECORD_MAX == 0, "capacity must be chunks of records");
+static_assert(LOG_COMPACTED_MAX + LOG_RECORD_SIZE(SETTINGS_LOG_RECORD_MAX) <= LOG_PAGE_SIZE,
+              "compacted settings must leave room for a record");
+
+SettingsLog settingslog;
+
+
+// Fletcher-16, its sums never get 0xFF, so check is never an erased half word
+static uint16_t Check(uint16_t offset, uint16_t length, const uint8_t *data) {
+  uint8_t  head[4] = {(uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)length, (uint8_t)(length >> 8)};
+  uint32_t sum1 = 0;
+  uint32_t sum2 = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    sum1 = (sum1 + head[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+
+  length = LOG_LENGTH(length);
+  for (i = 0; i < length; i++) {
+    sum1 = (sum1 + data[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+
+  return (uint16_t)(sum2 << 8 | sum1);
+}
+
+
+// copy part of src which is in [offset, offset + length) to data
+static void Overlay(uint8_t *data, uint32_t offset, uint32_t length,
+                    const uint8_t *src, uint32_t src_offset, uint32_t src_length) {
+  uint32_t start = src_offset > offset? src_offset : offset;
+  uint32_t end = src_offset + src_length;
+
+  if (end > offset + length)
+    end = offset + length;
+
+  if (start < end)
+    memcpy(data + start - offset, src + start - src_offset, end - start);
+}
+
+
+void SettingsLog::Init() {
+  bool     valid0 = (LOG_WORD(LOG_PAGE0) == SETTINGS_LOG_MAGIC);
+  bool     valid1 = (LOG_WORD(LOG_PAGE1) == SETTINGS_LOG_MAGIC);
+  uint32_t addr;
+  uint32_t page_end;
+  uint16_t length;
+
+  inited_ = true;
+  in_session_ = false;
+  dirty_ = false;
+  uncommitted_ = false;
+  run_length_ = 0;
+
+  // old page is kept after compacting until it's erased for the next one
+  if (valid0 && valid1)
+    page_ = ((int32_t)(LOG_WORD(LOG_PAGE1 + 4) - LOG_WORD(LOG_PAGE0 + 4)) > 0)? LOG_PAGE1 : LOG_PAGE0;
+  else if (valid0)
+    page_ = LOG_PAGE0;
+  else if (valid1)
+    page_ = LOG_PAGE1;
+  else
+    page_ = 0;
+
+  if (!page_) {
+    LOG_I("settings are in old layout\n");
+    sequence_ = 0;
+    end_ = 0;
+    committed_ = 0;
+    return;
+  }
+
+  sequence_ = LOG_WORD(page_ + 4);
+  page_end = page_ + LOG_PAGE_SIZE;
+  end_ = page_ + LOG_HEADER_SIZE;
+
+  for (addr = end_; addr + LOG_RECORD_SIZE(0) <= page_end; ) {
+    if (LOG_HALF(addr) == 0xFFFF)
+      break;
+
+    length = LOG_HALF(addr + 2);
+    if (LOG_LENGTH(length) > SETTINGS_LOG_RECORD_MAX ||
+        LOG_HALF(addr) + LOG_LENGTH(length) > SETTINGS_LOG_CAPACITY ||
+        addr + LOG_RECORD_SIZE(LOG_LENGTH(length)) > page_end)
+      break;
+
+    if (LOG_HALF(addr + LOG_RECORD_SIZE(LOG_LENGTH(length)) - 2) !=
+        Check(LOG_HALF(addr), length, (const uint8_t *)(addr + 4)))
+      break;
+
+    addr += LOG_RECORD_SIZE(LOG_LENGTH(length));
+    if (length & SETTINGS_LOG_COMMIT)
+      end_ = addr;
+  }
+
+  if (addr != end_ || (addr + 2 <= page_end && LOG_HALF(addr) != 0xFFFF)) {
+    LOG_I("settings log: records not committed at 0x%08X\n", end_);
+    dirty_ = true;
+  }
+
+  committed_ = end_;
+}
+
+
+void SettingsLog::Begin() {
+  if (!inited_)
+    Init();
+
+  in_session_ = true;
+}
+
+
+ErrCode SettingsLog::End() {
+  in_session_ = false;
+  return Flush(true);
+}
+
+
+uint32_t SettingsLog::Free() {
+  if (!inited_)
+    Init();
+
+  return page_? page_ + LOG_PAGE_SIZE - end_ : 0;
+}
+
+
+ErrCode SettingsLog::Read(uint32_t offset, uint8_t *data, uint32_t length) {
+  if (offset + length > SETTINGS_LOG_CAPACITY)
+    return E_PARAM;
+
+  if (!inited_)
+    Init();
+
+  ReadImage(offset, data, length);
+
+  return E_SUCCESS;
+}
+
+
+ErrCode SettingsLog::Write(uint32_t offset, const uint8_t *data, uint32_t length) {
+  uint8_t  stored[SETTINGS_LOG_RECORD_MAX];
+  uint32_t i, j, n;
+  ErrCode  ret;
+
+  if (offset + length > SETTINGS_LOG_CAPACITY)
+    return E_PARAM;
+
+  if (!inited_)
+    Init();
+
+  for (i = 0; i < length; i += n) {
+    n = length - i;
+    if (n > SETTINGS_LOG_RECORD_MAX)
+      n = SETTINGS_LOG_RECORD_MAX;
+
+    ReadImage(offset + i, stored, n);
+
+    for (j = 0; j < n; j++) {
+      if (stored[j] == data[i + j])
+        continue;
+
+      ret = Put(offset + i + j, data[i + j]);
+      if (ret != E_SUCCESS)
+        return ret;
+    }
+  }
+
+  // write out of session takes effect at once
+  if (!in_session_)
+    return Flush(true);
+
+  return E_SUCCESS;
+}
+
+
+// bytes in [offset, offset + length) as they are now, including records
+// and bytes not committed yet, or as they were at the last commit
+void SettingsLog::ReadImage(uint32_t offset, uint8_t *data, uint32_t length, bool committed) {
+  uint32_t end = committed? committed_ : end_;
+  uint32_t addr;
+  uint16_t n;
+
+  if (!page_) {
+    memcpy(data, (const uint8_t *)(LOG_PAGE0 + offset), length);
+  }
+  else {
+    memset(data, 0xFF, length);
+
+    for (addr = page_ + LOG_HEADER_SIZE; addr < end; addr += LOG_RECORD_SIZE(n)) {
+      n = LOG_LENGTH(LOG_HALF(addr + 2));
+      Overlay(data, offset, length, (const uint8_t *)(addr + 4), LOG_HALF(addr), n);
+    }
+  }
+
+  if (!committed)
+    Overlay(data, offset, length, run_, run_offset_, run_length_);
+}
+
+
+ErrCode SettingsLog::Put(uint32_t offset, uint8_t value) {
+  uint32_t run_end = run_offset_ + run_length_;
+  ErrCode  ret;
+
+  if (run_length_ && offset >= run_offset_ && offset < run_end) {
+    run_[offset - run_offset_] = value;
+    return E_SUCCESS;
+  }
+
+  if (run_length_ && offset >= run_end && offset - run_end < LOG_GAP_MAX &&
+      offset - run_offset_ < SETTINGS_LOG_RECORD_MAX) {
+    // bytes of gap are not in run_, so reading image doesn't overlap it
+    ReadImage(run_end, run_ + run_length_, offset - run_end);
+  }
+  else {
+    ret = Flush(false);
+    if (ret != E_SUCCESS)
+      return ret;
+
+    run_offset_ = offset;
+  }
+
+  run_[offset - run_offset_] = value;
+  run_length_ = offset - run_offset_ + 1;
+
+  return E_SUCCESS;
+}
+
+
+// program changed bytes as a record, it's committed if commit is true,
+// commit without changed bytes makes records of this session take effect
+ErrCode SettingsLog::Flush(bool commit) {
+  ErrCode ret = E_SUCCESS;
+
+  if (!run_length_ && !(commit && uncommitted_))
+    return E_SUCCESS;
+
+  FLASH_Unlock();
+
+  // bytes in run_ are taken by compacting
+  if (!page_ || dirty_ || end_ + LOG_RECORD_SIZE(run_length_) > page_ + LOG_PAGE_SIZE)
+    ret = Compact();
+
+  if (ret == E_SUCCESS && (run_length_ || (commit && uncommitted_))) {
+    ret = Program(end_, run_offset_, run_length_ | (commit? SETTINGS_LOG_COMMIT : 0), run_);
+    if (ret == E_SUCCESS) {
+      run_length_ = 0;
+      uncommitted_ = !commit;
+      if (commit)
+        committed_ = end_;
+    }
+    else {
+      dirty_ = true;
+    }
+  }
+
+  FLASH_Lock();
+
+  return ret;
+}
+
+
+// program a record and move addr to the end of it, flash is unlocked
+ErrCode SettingsLog::Program(uint32_t &addr, uint16_t offset, uint16_t length, const uint8_t *data) {
+  uint16_t check = Check(offset, length, data);
+  uint32_t next = addr + LOG_RECORD_SIZE(LOG_LENGTH(length));
+  uint32_t i;
+  uint16_t half;
+
+  if (FLASH_ProgramHalfWord(addr, offset) != FLASH_COMPLETE ||
+      FLASH_ProgramHalfWord(addr + 2, length) != FLASH_COMPLETE)
+    return E_HARDWARE;
+
+  length = LOG_LENGTH(length);
+  for (i = 0; i < length; i += 2) {
+    half = data[i];
+    half |= (i + 1 < length)? (uint16_t)data[i + 1] << 8 : 0xFF00;
+    if (FLASH_ProgramHalfWord(addr + 4 + i, half) != FLASH_COMPLETE)
+      return E_HARDWARE;
+  }
+
+  if (FLASH_ProgramHalfWord(next - 2, check) != FLASH_COMPLETE)
+    return E_HARDWARE;
+
+  addr = next;
+
+  return E_SUCCESS;
+}
+
+
+// range [first, last) of chunk which differs from base, base is NULL for
+// bytes never written, return false if nothing differs
+static bool Changed(const uint8_t *chunk, const uint8_t *base, uint32_t &first, uint32_t &last) {
+  for (first = 0; first < SETTINGS_LOG_RECORD_MAX && chunk[first] == (base? base[first] : 0xFF); first++);
+  if (first == SETTINGS_LOG_RECORD_MAX)
+    return false;
+
+  for (last = SETTINGS_LOG_RECORD_MAX; chunk[last - 1] == (base? base[last - 1] : 0xFF); last--);
+
+  return true;
+}
+
+
+// copy committed image to the other page and commit it, then changes not
+// committed, including bytes in run_, follow as records without commit.
+// If they cannot fit in page together, all are committed. The page becomes
+// active by programming magic at last, flash is unlocked
+ErrCode SettingsLog::Compact() {
+  // image in old layout is in page 0, so it goes to page 1
+  uint32_t target = (page_ == LOG_PAGE1)? LOG_PAGE0 : LOG_PAGE1;
+  uint32_t addr = target + LOG_HEADER_SIZE;
+  uint32_t commit_end;
+  uint8_t  stored[SETTINGS_LOG_RECORD_MAX];
+  uint8_t  now[SETTINGS_LOG_RECORD_MAX];
+  uint32_t offset;
+  uint32_t first, last;
+  uint32_t size = LOG_HEADER_SIZE + LOG_RECORD_SIZE(0);
+  bool     split;
+
+  for (offset = 0; offset < SETTINGS_LOG_CAPACITY; offset += SETTINGS_LOG_RECORD_MAX) {
+    ReadImage(offset, stored, SETTINGS_LOG_RECORD_MAX, true);
+    ReadImage(offset, now, SETTINGS_LOG_RECORD_MAX);
+    if (Changed(stored, NULL, first, last))
+      size += LOG_RECORD_SIZE(last - first);
+    if (Changed(now, stored, first, last))
+      size += LOG_RECORD_SIZE(last - first);
+  }
+
+  // leave room for committing them
+  split = (size + LOG_RECORD_SIZE(0) <= LOG_PAGE_SIZE);
+
+  if (FLASH_ErasePage(target) != FLASH_COMPLETE)
+    goto error;
+
+  for (offset = 0; offset < SETTINGS_LOG_CAPACITY; offset += SETTINGS_LOG_RECORD_MAX) {
+    ReadImage(offset, stored, SETTINGS_LOG_RECORD_MAX, split);
+    if (Changed(stored, NULL, first, last) &&
+        Program(addr, offset + first, last - first, stored + first) != E_SUCCESS)
+      goto error;
+  }
+
+  if (Program(addr, 0, SETTINGS_LOG_COMMIT, NULL) != E_SUCCESS)
+    goto error;
+  commit_end = addr;
+
+  for (offset = 0; split && offset < SETTINGS_LOG_CAPACITY; offset += SETTINGS_LOG_RECORD_MAX) {
+    ReadImage(offset, stored, SETTINGS_LOG_RECORD_MAX, true);
+    ReadImage(offset, now, SETTINGS_LOG_RECORD_MAX);
+    if (Changed(now, stored, first, last) &&
+        Program(addr, offset + first, last - first, now + first) != E_SUCCESS)
+      goto error;
+  }
+
+  if (FLASH_ProgramWord(target + 4, sequence_ + 1) != FLASH_COMPLETE ||
+      FLASH_ProgramWord(target, SETTINGS_LOG_MAGIC) != FLASH_COMPLETE)
+    goto error;
+
+  LOG_I("settings compacted to 0x%08X, %u bytes\n", target, addr - target);
+
+  page_ = target;
+  sequence_++;
+  end_ = addr;
+  committed_ = commit_end;
+  dirty_ = false;
+  uncommitted_ = (end_ != committed_);
+  run_length_ = 0;
+
+  return E_SUCCESS;
+
+error:
+  // active page is not touched, compacting will be tried again
+  LOG_E("failed to compact settings to 0x%08X\n", target);
+  return E_HARDWARE;
+}
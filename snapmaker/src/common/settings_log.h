@@ -0,0 +1,107 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_SETTINGS_LOG_H_
+#define SNAPMAKER_SETTINGS_LOG_H_
+
+#include <stdint.h>
+
+#include "error.h"
+
+// settings of Marlin are kept in the 2 EEPROM pages as a log, saving
+// appends only the bytes which are changed, and live bytes are compacted
+// to the other page when the active one is full. Reads go to flash.
+//
+// layout of the page:
+// [magic][sequence] then records: [offset][length][data, half word aligned][check]
+// all fields of record are half words and check is programmed at last, so a
+// record cut by power loss fails checking. Records take effect when one with
+// SETTINGS_LOG_COMMIT in its length is found after them. When both pages
+// are valid, the one with bigger sequence is active.
+//
+// bytes never written read as 0xFF. If no page is valid, settings are
+// still in old layout, that is page 0 holds image of them as it is.
+#define SETTINGS_LOG_MAGIC        (0x534C0001)
+#define SETTINGS_LOG_COMMIT       (0x8000)
+
+// bytes of settings can be stored, compacted image of them must leave
+// room for records in the page
+#define SETTINGS_LOG_CAPACITY     (1536)
+
+// changed bytes near to each other are merged into a record up to this
+#define SETTINGS_LOG_RECORD_MAX   (64)
+
+
+class SettingsLog {
+  public:
+    // find the active page and the end of records, it's called by the
+    // first access, call it again to drop state in RAM like rebooting
+    void Init();
+
+    // writes between Begin() and End() take effect together at End()
+    void Begin();
+    ErrCode End();
+
+    // only bytes different from stored ones are appended
+    ErrCode Write(uint32_t offset, const uint8_t *data, uint32_t length);
+    ErrCode Read(uint32_t offset, uint8_t *data, uint32_t length);
+
+    // bytes left in active page for records
+    uint32_t Free();
+
+    uint32_t capacity() { return SETTINGS_LOG_CAPACITY; }
+
+  private:
+    void ReadImage(uint32_t offset, uint8_t *data, uint32_t length, bool committed = false);
+    ErrCode Put(uint32_t offset, uint8_t value);
+    ErrCode Flush(bool commit);
+    ErrCode Program(uint32_t &addr, uint16_t offset, uint16_t length, const uint8_t *data);
+    ErrCode Compact();
+
+  private:
+    bool inited_ = false;
+    bool in_session_ = false;
+
+    // records after the last commit are left by power loss, or programming
+    // them failed, page must be compacted before appending more
+    bool dirty_;
+
+    // records without commit were appended in this session
+    bool uncommitted_;
+
+    // 0 if settings are in old layout
+    uint32_t page_;
+    uint32_t sequence_;
+
+    // where next record is programmed, records before it are valid
+    uint32_t end_;
+
+    // end of the last committed record
+    uint32_t committed_;
+
+    // changed bytes not programmed yet
+    uint16_t run_offset_;
+    uint16_t run_length_;
+    uint8_t  run_[SETTINGS_LOG_RECORD_MAX];
+};
+
+extern SettingsLog settingslog;
+
+#endif  // #ifndef SNAPMAKER_SETTINGS_LOG_H_
@@ -21,11 +21,16 @@
 
 #include "../common/debug.h"
 #include "../common/config.h"
+#include "../common/protocol_sstp.h"
+#include "../common/cycle_trace.h"
 
 #include "../service/system.h"
+#include "../module/can_host.h"
+#include "../hmi/event_handler.h"
 
 #include "src/gcode/gcode.h"
 #include "src/gcode/queue.h"
+#include "src/module/planner.h"
 #include "src/core/macros.h"
 
 #if HAS_POSITION_SHIFT
@@ -94,6 +99,48 @@ void GcodeSuite::M2000() {
     }
     systemservice.ClearExceptionByFaultFlag(1<<(l-1));
     break;
+
+  case 5:
+    // show latency of CAN receiving, clear it with R1
+    canhost.ShowLatency();
+    if (parser.byteval('R', (uint8_t)0))
+      canhost.ClearLatency();
+    break;
+
+  case 6:
+    // verify checksum of SSTP with random payloads, L is rounds
+    ProtocolSSTP::VerifyChecksum((uint32_t)parser.ushortval('L', (uint16_t)1000));
+    break;
+
+  case 7:
+    // show CPU cycles of ISRs, clear them with R1
+#if (SNAP_CYCLE_TRACE)
+    cycletrace.Show();
+    if (parser.byteval('R', (uint8_t)0))
+      cycletrace.Clear();
+#else
+    LOG_I("cycle trace is disabled, set SNAP_CYCLE_TRACE to enable it\n");
+#endif
+    break;
+
+  case 8:
+    // show events rate and wakeup latency of HMI task, clear them with R1
+    hmi.ShowRxStat();
+    if (parser.byteval('R', (uint8_t)0))
+      hmi.ClearRxStat();
+    break;
+
+  case 9:
+    // show time stamps of booting
+    canhost.ShowBootStamp();
+    break;
+
+  case 10:
+    // show RAM taken by planner blocks, and what's left in heap
+    LOG_I("planner: %u blocks of %u bytes, %u bytes, %s rates\n", (uint32_t)BLOCK_BUFFER_SIZE, (uint32_t)sizeof(block_t),
+            (uint32_t)(sizeof(block_t) * BLOCK_BUFFER_SIZE), sizeof(block_rate_t) == 2? "16-bit" : "32-bit");
+    LOG_I("heap: %u bytes free, min %u bytes\n", (uint32_t)xPortGetFreeHeapSize(), (uint32_t)xPortGetMinimumEverFreeHeapSize());
+    break;
   }
 
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../common/config.h"
+
+#include "../module/rotary_module.h"
+
+// marlin headers
+#include "src/gcode/gcode.h"
+
+/*
+ * Rotary mode of B axis
+ *   R: radius of workpiece in mm, B moves are planned by distance on its
+ *      surface, so F is the surface speed. R0 turns it off, B degrees are
+ *      taken as mm again
+ *
+ * Report current radius without R, eg. M2002 R20
+ */
+void GcodeSuite::M2002() {
+  if (parser.seen('R')) {
+    const float r = parser.value_linear_units();
+
+    switch (rotaryModule.SetRadius(r)) {
+    case E_SUCCESS:
+      break;
+
+    case E_PARAM:
+      SERIAL_ECHOLNPAIR("Error: invalid radius: ", r);
+      return;
+
+    default:
+      SERIAL_ECHOLN("Error: rotary module is not online.");
+      return;
+    }
+  }
+
+  if (rotaryModule.radius() > 0)
+    SERIAL_ECHOLNPAIR("Rotary mode: radius ", rotaryModule.radius(), " mm");
+  else
+    SERIAL_ECHOLN("Rotary mode: off");
+}
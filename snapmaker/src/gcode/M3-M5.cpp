@@ -63,6 +63,17 @@
  
 void GcodeSuite::M3_M4(const bool is_M4) {
 
+  // laser output is changed by stepper ISR when the sync block is reached,
+  // won't stop the head at every power change in greyscale
+  if (laser.IsOnline()) {
+    if(parser.seen('P'))
+      laser.SetPower(parser.value_float());
+
+    laser.PlanOn();
+    planner.buffer_sync_block(BLOCK_FLAG_LASER_PWM);
+    return;
+  }
+
   planner.synchronize();   // wait until previous movement commands (G0/G0/G2/G3) have completed before playing with the spindle
 
   /**
@@ -71,15 +82,7 @@ void GcodeSuite::M3_M4(const bool is_M4) {
    * Then needed to AND the uint16_t result with 0x00FF to make sure we only wrote the byte of interest.
    */
  
-  if(laser.IsOnline()) {
-    if(parser.seen('P')) {
-      laser.SetOutput(parser.value_float());
-    }
-    else {
-      laser.TurnOn();
-    }
-  }
-  else if(cnc.IsOnline()) {
+  if(cnc.IsOnline()) {
     if(parser.seen('P'))
       cnc.SetOutput(parser.value_float());
     else
@@ -91,12 +94,15 @@ void GcodeSuite::M3_M4(const bool is_M4) {
  * M5 turn off spindle
  */
 void GcodeSuite::M5() {
-  planner.synchronize();
-  //set_spindle_laser_enabled(false);
   if(laser.IsOnline()) {
-    laser.TurnOff();
+    laser.PlanOff();
+    planner.buffer_sync_block(BLOCK_FLAG_LASER_PWM);
+    return;
   }
-  else if(cnc.IsOnline()) {
+
+  planner.synchronize();
+  //set_spindle_laser_enabled(false);
+  if(cnc.IsOnline()) {
     cnc.TurnOff();
   }
 }
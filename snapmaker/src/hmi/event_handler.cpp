@@ -19,8 +19,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "event_handler.h"
+#include "gcode_bin.h"
 
 #include "../common/debug.h"
+#include "../common/cycle_trace.h"
 
 #include "../module/module_base.h"
 #include "../module/can_host.h"
@@ -65,12 +67,18 @@ struct EventCallback_t {
 
 
 UartHost hmi;
+EventQueue marlin_events;
 
-uint8_t hmi_commands_in_queue = 0, hmi_cmd_queue_index_r = 0,
-        hmi_cmd_queue_index_w = 0;
-char hmi_command_queue[HMI_BUFSIZE][MAX_CMD_SIZE];
-uint8_t hmi_send_opcode_queue[HMI_BUFSIZE];
-uint32_t hmi_commandline_queue[HMI_BUFSIZE];
+// HMI gcode queue, every line is packed into the arena as a record:
+// [length][opcode][line, 4 bytes][text, length bytes][NUL]
+// record won't wrap around the end of arena, if no enough room at the end,
+// a pad byte is left there and the record is put at the beginning
+#define HMI_CMD_RECORD_HEAD   6
+#define HMI_CMD_RECORD_PAD    0xFF
+
+uint8_t hmi_commands_in_queue = 0;
+static uint16_t hmi_cmd_arena_r = 0, hmi_cmd_arena_w = 0;
+static uint8_t hmi_cmd_arena[HMI_CMD_ARENA_SIZE];
 
 extern bool send_ok[BUFSIZE];
 bool   Screen_send_ok[BUFSIZE];
@@ -79,6 +87,67 @@ uint32_t CommandLine[BUFSIZE] = { INVALID_CMD_LINE };
 
 extern uint8_t cmd_queue_index_w; // Ring buffer write position
 
+// packs of file gcode which are not acked to screen yet, in order of arrival
+struct FileGcodePack {
+  uint32_t first;
+  uint32_t last;
+  uint8_t  remain;  // lines of this pack which are not finished
+  uint8_t  ack;     // event id to ack this pack
+};
+
+#define FILE_GCODE_PACK_TRACK_SIZE  (HMI_CMD_LINES_MAX + BUFSIZE + FILE_GCODE_PACK_WINDOW)
+
+static FileGcodePack pack_track[FILE_GCODE_PACK_TRACK_SIZE];
+static uint8_t pack_track_head = 0, pack_track_count = 0;
+
+// pack which still has lines waiting for free slot in HMI queue
+static char     *pack_pending_cursor = NULL;
+static uint32_t pack_pending_line = 0;
+static uint8_t  pack_pending_remain = 0;
+static bool     pack_pending_bin = false;
+static uint8_t  *pack_pending_end = NULL;
+
+// values of words are carried from line to line in binary pack
+static GcodeBinDecoder bin_decoder;
+
+static void FinishFileGcodePackLine(uint32_t line);
+
+
+/**
+ * Reserve room for a record of HMI gcode queue
+ * para size: size of text, including NUL
+ * return: pointer to the record, or NULL if no enough room
+ */
+static uint8_t *hmi_cmd_reserve(uint16_t size) {
+  uint16_t need = HMI_CMD_RECORD_HEAD + size;
+  uint8_t  *record;
+
+  if (hmi_commands_in_queue == 0)
+    hmi_cmd_arena_r = hmi_cmd_arena_w = 0;
+  else if (hmi_commands_in_queue >= HMI_CMD_LINES_MAX)
+    return NULL;
+
+  if (hmi_commands_in_queue == 0 || hmi_cmd_arena_w > hmi_cmd_arena_r) {
+    // free room is at the end and the beginning of arena
+    if (HMI_CMD_ARENA_SIZE - hmi_cmd_arena_w < need) {
+      if (hmi_cmd_arena_r < need)
+        return NULL;
+
+      if (hmi_cmd_arena_w < HMI_CMD_ARENA_SIZE)
+        hmi_cmd_arena[hmi_cmd_arena_w] = HMI_CMD_RECORD_PAD;
+      hmi_cmd_arena_w = 0;
+    }
+  }
+  else if (hmi_cmd_arena_r - hmi_cmd_arena_w < need) {
+    return NULL;
+  }
+
+  record = hmi_cmd_arena + hmi_cmd_arena_w;
+  hmi_cmd_arena_w += need;
+
+  return record;
+}
+
 
 /**
  *SC20 queue the gcdoe
@@ -88,43 +157,88 @@ extern uint8_t cmd_queue_index_w; // Ring buffer write position
  * execution guaranteed
  */
 void enqueue_hmi_to_marlin() {
+  uint8_t *record;
+
   // guaranteed buffer available, shouldn't be missed, or screen status won't
   // sync. fetch as much command as possible
   while (commands_in_queue < BUFSIZE && hmi_commands_in_queue > 0) {
+    if (hmi_cmd_arena_r >= HMI_CMD_ARENA_SIZE ||
+        hmi_cmd_arena[hmi_cmd_arena_r] == HMI_CMD_RECORD_PAD)
+      hmi_cmd_arena_r = 0;
+
     // fetch from buffer queue
-    strcpy(command_queue[cmd_queue_index_w],
-           hmi_command_queue[hmi_cmd_queue_index_r]);
+    record = hmi_cmd_arena + hmi_cmd_arena_r;
+    memcpy(command_queue[cmd_queue_index_w], record + HMI_CMD_RECORD_HEAD, record[0] + 1);
     Screen_send_ok[cmd_queue_index_w] = true;
-    Screen_send_ok_opcode[cmd_queue_index_w] =
-        hmi_send_opcode_queue[hmi_cmd_queue_index_r];
-    CommandLine[cmd_queue_index_w] =
-        hmi_commandline_queue[hmi_cmd_queue_index_r];
+    Screen_send_ok_opcode[cmd_queue_index_w] = record[1];
+    memcpy(&CommandLine[cmd_queue_index_w], record + 2, sizeof(uint32_t));
     send_ok[cmd_queue_index_w] = false;
     cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
 
-    hmi_cmd_queue_index_r = (hmi_cmd_queue_index_r + 1) % HMI_BUFSIZE;
+    hmi_cmd_arena_r += HMI_CMD_RECORD_HEAD + record[0] + 1;
     hmi_commands_in_queue--;
     commands_in_queue++;
   }
 }
 
 
+/**
+ * Put a command to Marlin queue, or HMI queue if Marlin queue is full.
+ * Only single line events come to HMI queue, their event is released when
+ * next one is taken, lines of pack wait in their event for Marlin queue
+ * para cmd: text or binary command, may have NUL inside if it is binary
+ * para length: length of command, NUL at the end is not included
+ */
+static void EnqueueHmiCommand(const char *cmd, uint8_t length, uint32_t line,
+                              uint8_t opcode) {
+  char *slot;
+  uint8_t *record;
+
+  // if no line is waiting in HMI queue, copy the line to Marlin queue
+  // directly, needn't to copy it again in enqueue_hmi_to_marlin()
+  if (hmi_commands_in_queue == 0 && commands_in_queue < BUFSIZE) {
+    slot = command_queue[cmd_queue_index_w];
+    memcpy(slot, cmd, length);
+    slot[length] = 0;
+
+    Screen_send_ok[cmd_queue_index_w] = true;
+    Screen_send_ok_opcode[cmd_queue_index_w] = opcode;
+    CommandLine[cmd_queue_index_w] = line;
+    send_ok[cmd_queue_index_w] = false;
+    cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
+    commands_in_queue++;
+    return;
+  }
+
+  record = hmi_cmd_reserve(length + 1);
+  if (!record) {
+    LOG_E("HMI gcode buffer is full, losing line: %u\n", line);
+    return;
+  }
+
+  record[0] = length;
+  record[1] = opcode;
+  memcpy(record + 2, &line, sizeof(uint32_t));
+  memcpy(record + HMI_CMD_RECORD_HEAD, cmd, length);
+  record[HMI_CMD_RECORD_HEAD + length] = 0;
+  hmi_commands_in_queue++;
+}
+
+
 void Screen_enqueue_and_echo_commands(char *pgcode, uint32_t line,
                                       uint8_t opcode) {
   int i;
+#if ENABLED(PREPARSED_COMMAND_QUEUE)
+  binary_command_t cmd;
+#endif
 
   // we put HMI command to Marlin queue firstly
   // to avoid jumping directly, we check the condition before call it
   if (commands_in_queue < BUFSIZE && hmi_commands_in_queue > 0)
     enqueue_hmi_to_marlin();
 
-  if (hmi_commands_in_queue >= HMI_BUFSIZE) {
-    LOG_E("HMI gcode buffer is full, losing line: %u\n", line);
-    return;
-  }
-
-  // ignore comment
-  if (pgcode[0] == ';') {
+  // ignore comment, and text which may be taken as binary command
+  if (pgcode[0] == ';' || pgcode[0] == GCODE_BIN_MARK) {
     ack_gcode_event(opcode, line);
     return;
   }
@@ -132,25 +246,25 @@ void Screen_enqueue_and_echo_commands(char *pgcode, uint32_t line,
   // won't put comment part to queue, and limit cmd size to MAX_CMD_SIZE
   for (i = 0; i < MAX_CMD_SIZE; i++) {
     if (pgcode[i] == '\n' || pgcode[i] == '\r' || pgcode[i] == 0 ||
-        pgcode[i] == ';') {
-      hmi_command_queue[hmi_cmd_queue_index_w][i] = 0;
+        pgcode[i] == ';')
       break;
-    }
-    hmi_command_queue[hmi_cmd_queue_index_w][i] = pgcode[i];
   }
 
   if (i >= MAX_CMD_SIZE) {
-    hmi_command_queue[hmi_cmd_queue_index_w][MAX_CMD_SIZE - 1] = 0;
-    LOG_E("line[%u] too long: %s\n", line,
-          hmi_command_queue[hmi_cmd_queue_index_w]);
+    LOG_E("line[%u] too long: %.*s\n", line, MAX_CMD_SIZE - 1, pgcode);
     ack_gcode_event(opcode, line);
     return;
   }
 
-  hmi_commandline_queue[hmi_cmd_queue_index_w] = line;
-  hmi_send_opcode_queue[hmi_cmd_queue_index_w] = opcode;
-  hmi_cmd_queue_index_w = (hmi_cmd_queue_index_w + 1) % HMI_BUFSIZE;
-  hmi_commands_in_queue++;
+#if ENABLED(PREPARSED_COMMAND_QUEUE)
+  // parse it now, Marlin needn't parse it before executing
+  if (GCodeParser::compile(pgcode, cmd)) {
+    EnqueueHmiCommand((char *)&cmd, GCODE_BIN_SIZE(cmd.count), line, opcode);
+    return;
+  }
+#endif
+
+  EnqueueHmiCommand(pgcode, (uint8_t)i, line, opcode);
 }
 
 
@@ -167,7 +281,12 @@ bool ok_to_HMI() {
  * Clear the Marlin command queue
  */
 void clear_hmi_gcode_queue() {
-  hmi_cmd_queue_index_r = hmi_cmd_queue_index_w = hmi_commands_in_queue = 0;
+  hmi_cmd_arena_r = hmi_cmd_arena_w = hmi_commands_in_queue = 0;
+
+  pack_track_head = pack_track_count = 0;
+  pack_pending_remain = 0;
+  pack_pending_cursor = NULL;
+  pack_pending_bin = false;
 }
 
 
@@ -175,6 +294,12 @@ void ack_gcode_event(uint8_t event_id, uint32_t line) {
   SSTP_Event_t event = {event_id, SSTP_INVALID_OP_CODE};
   uint8_t buffer[4];
 
+  // lines from pack are acked by range, when all lines of the pack are finished
+  if (event_id == EID_FILE_GCODE_PACK_ACK || event_id == EID_FILE_GCODE_BIN_ACK) {
+    FinishFileGcodePackLine(line);
+    return;
+  }
+
   event.length = 4;
   event.data = buffer;
 
@@ -251,6 +376,263 @@ static ErrCode HandleFileGcode(uint8_t *event_buff, uint16_t size) {
 }
 
 
+static void AckFileGcodePack(uint8_t ack, uint32_t first, uint32_t last) {
+  SSTP_Event_t event = {ack, SSTP_INVALID_OP_CODE};
+  uint8_t buffer[8];
+
+  event.length = 8;
+  event.data = buffer;
+
+  WORD_TO_PDU_BYTES(buffer, first);
+  WORD_TO_PDU_BYTES(buffer + 4, last);
+
+  SNAP_DEBUG_SET_GCODE_LINE(last);
+
+  hmi.Send(event);
+}
+
+
+/**
+ * Ack all finished packs at the head of track queue with one event,
+ * packs behind an unfinished one are kept to make sure screen gets
+ * acks in order of lines. Text and binary packs are acked separately.
+ */
+static void FlushFileGcodePack() {
+  FileGcodePack *pack;
+  uint32_t first = 0;
+  uint32_t last = 0;
+  uint8_t  ack = EID_FILE_GCODE_PACK_ACK;
+  bool     finished = false;
+
+  while (pack_track_count && pack_track[pack_track_head].remain == 0) {
+    pack = &pack_track[pack_track_head];
+    if (finished && pack->ack != ack) {
+      AckFileGcodePack(ack, first, last);
+      finished = false;
+    }
+
+    if (!finished) {
+      first = pack->first;
+      ack = pack->ack;
+      finished = true;
+    }
+    last = pack->last;
+
+    pack_track_head = (pack_track_head + 1) % FILE_GCODE_PACK_TRACK_SIZE;
+    pack_track_count--;
+  }
+
+  if (finished)
+    AckFileGcodePack(ack, first, last);
+}
+
+
+static void FinishFileGcodePackLine(uint32_t line) {
+  FileGcodePack *pack;
+
+  for (int i = 0; i < pack_track_count; i++) {
+    pack = &pack_track[(pack_track_head + i) % FILE_GCODE_PACK_TRACK_SIZE];
+    if (line >= pack->first && line <= pack->last) {
+      if (pack->remain)
+        pack->remain--;
+      break;
+    }
+  }
+
+  FlushFileGcodePack();
+}
+
+
+/**
+ * Put lines of pending pack to HMI queue as many as possible
+ * return E_BUSY if HMI queue is full before all lines are enqueued
+ */
+static ErrCode EnqueueFileGcodePack() {
+  binary_command_t cmd;
+  char *next;
+  char *text;
+
+  while (pack_pending_remain) {
+    // the pack stays in marlin_events until all lines are enqueued, so
+    // lines are copied to Marlin queue straight, not to HMI queue firstly
+    if (hmi_commands_in_queue > 0)
+      enqueue_hmi_to_marlin();
+    if (hmi_commands_in_queue > 0 || commands_in_queue >= BUFSIZE)
+      return E_BUSY;
+
+    if (pack_pending_bin) {
+      // records have been checked when we got the pack
+      next = (char *)bin_decoder.Decode((uint8_t *)pack_pending_cursor, pack_pending_end, cmd, text);
+      if (text) {
+        Screen_enqueue_and_echo_commands(text, pack_pending_line, EID_FILE_GCODE_BIN_ACK);
+      }
+      else {
+        EnqueueHmiCommand((char *)&cmd, GCODE_BIN_SIZE(cmd.count), pack_pending_line, EID_FILE_GCODE_BIN_ACK);
+      }
+    }
+    else {
+      next = strchr(pack_pending_cursor, '\n');
+      if (next)
+        *next++ = 0;
+
+      Screen_enqueue_and_echo_commands(pack_pending_cursor, pack_pending_line, EID_FILE_GCODE_PACK_ACK);
+    }
+
+    pack_pending_cursor = next;
+    pack_pending_line++;
+    pack_pending_remain--;
+  }
+
+  pack_pending_cursor = NULL;
+
+  return E_SUCCESS;
+}
+
+
+/**
+ * Count records in binary pack, return 0 if any record is broken
+ */
+static uint8_t CountFileGcodeBin(uint8_t *records, uint8_t *end) {
+  GcodeBinDecoder decoder;
+  binary_command_t cmd;
+  char    *text;
+  uint8_t lines = 0;
+
+  decoder.Reset();
+
+  while (records < end) {
+    records = decoder.Decode(records, end, cmd, text);
+    if (!records || ++lines > FILE_GCODE_PACK_MAX_LINES)
+      return 0;
+  }
+
+  return lines;
+}
+
+
+/**
+ * Handle text pack or binary pack of file gcode
+ * para ack: EID_FILE_GCODE_PACK_ACK or EID_FILE_GCODE_BIN_ACK
+ */
+static ErrCode HandleFileGcodePack(uint8_t *event_buff, uint16_t size, uint8_t ack) {
+  binary_command_t cmd;
+  uint32_t first;
+  uint32_t last;
+  uint32_t cur_line;
+  uint8_t  count;
+  uint8_t  lines;
+  char     *text;
+  char     *cursor;
+  uint8_t  *end = event_buff + size;
+
+  SysStatus   cur_sta = systemservice.GetCurrentStatus();
+  WorkingPort port = systemservice.GetWorkingPort();
+
+  if (port != WORKING_PORT_SC) {
+    LOG_E("working port is not SC for file gcode!\n");
+    return E_INVALID_STATE;
+  }
+
+  if (cur_sta != SYSTAT_WORK && cur_sta != SYSTAT_RESUME_WAITING) {
+    LOG_E("not handle file Gcode in this status: %u\n", cur_sta);
+    return E_INVALID_STATE;
+  }
+
+  if (size < 7 || size > (FILE_GCODE_PACK_MAX_SIZE + 6)) {
+    LOG_E("invalid gcode pack size: %u\n", size);
+    return E_PARAM;
+  }
+
+  // checkout the first line number and count of lines
+  PDU_TO_LOCAL_WORD(first, event_buff+1);
+  count = event_buff[5];
+
+  event_buff[size] = 0;
+  text = (char *)(event_buff + 6);
+
+  // make sure we have same number of lines as declared
+  if (ack == EID_FILE_GCODE_BIN_ACK) {
+    lines = CountFileGcodeBin((uint8_t *)text, end);
+  }
+  else {
+    lines = 1;
+    for (cursor = text; *cursor; cursor++) {
+      if (*cursor == '\n' && *(cursor + 1))
+        lines++;
+    }
+  }
+
+  if (count == 0 || count > FILE_GCODE_PACK_MAX_LINES || count != lines) {
+    LOG_E("invalid gcode pack, count: %u, lines: %u\n", count, lines);
+    return E_PARAM;
+  }
+
+  last = first + count - 1;
+  cur_line = systemservice.current_line();
+
+  if (last <= cur_line && cur_line != 0) {
+    // screen may lost our last ack, just ack it again
+    if (last == cur_line) {
+      if (last == debug.GetSCGcodeLine())
+        AckFileGcodePack(ack, first, last);
+    }
+    else {
+      LOG_E("recv pack[%u-%u] less than cur line[%u]\n", first, last, cur_line);
+    }
+    return E_SUCCESS;
+  }
+
+  // values of binary words are from previous lines, decode them even they are skipped
+  if (ack == EID_FILE_GCODE_BIN_ACK)
+    bin_decoder.Reset();
+
+  // skip the lines which have been received
+  if (cur_line != 0) {
+    while (first <= cur_line) {
+      if (ack == EID_FILE_GCODE_BIN_ACK)
+        text = (char *)bin_decoder.Decode((uint8_t *)text, end, cmd, cursor);
+      else
+        text = strchr(text, '\n') + 1;
+      first++;
+      count--;
+    }
+  }
+
+  if (pack_track_count >= FILE_GCODE_PACK_TRACK_SIZE) {
+    LOG_E("too many gcode packs, drop pack[%u-%u]\n", first, last);
+    return E_NO_RESRC;
+  }
+
+  systemservice.current_line(last);
+  systemservice.hmi_cmd_timeout(millis());
+
+  if (systemservice.is_waiting_gcode) {
+    if (systemservice.is_laser_on) {
+      systemservice.is_laser_on = false;
+      laser.TurnOn();
+    }
+  }
+
+  if (cur_sta == SYSTAT_RESUME_WAITING) {
+    if (systemservice.ResumeOver() != E_SUCCESS) {
+      AckFileGcodePack(ack, first, last);
+      return E_SUCCESS;
+    }
+  }
+
+  pack_track[(pack_track_head + pack_track_count) % FILE_GCODE_PACK_TRACK_SIZE] = {first, last, count, ack};
+  pack_track_count++;
+
+  pack_pending_cursor = text;
+  pack_pending_line = first;
+  pack_pending_remain = count;
+  pack_pending_bin = (ack == EID_FILE_GCODE_BIN_ACK);
+  pack_pending_end = end;
+
+  return EnqueueFileGcodePack();
+}
+
+
 static ErrCode SendStatus(SSTP_Event_t &event) {
   // won't send status to HMI while upgrading external module
   if (upgrade.GetState() != UPGRADE_STA_UPGRADING_EM)
@@ -618,6 +1000,12 @@ static ErrCode GetLinearModuleLead(SSTP_Event_t &event) {
   return linear_p->GetLead(event);
 }
 
+#if (SNAP_CYCLE_TRACE)
+static ErrCode GetCycleTrace(SSTP_Event_t &event) {
+  return cycletrace.ReportToHMI(event);
+}
+#endif
+
 EventCallback_t debug_event_cb[DEBUG_OPC_MAX] = {
   UNDEFINED_CALLBACK,
   /* [DEBUG_OPC_SET_MODULE_MAC]        =  */{EVENT_ATTR_DEFAULT,  SetModuleMAC},
@@ -625,7 +1013,12 @@ EventCallback_t debug_event_cb[DEBUG_OPC_MAX] = {
   /* [DEBUG_OPC_SET_LINEAR_LENGTH]     =  */{EVENT_ATTR_DEFAULT,  SetLinearModuleLength},
   /* [DEBUG_OPC_GET_LINEAR_LENGTH]     =  */{EVENT_ATTR_DEFAULT,  GetLinearModuleLength},
   /* [DEBUG_OPC_SET_LINEAR_LEAD]       =  */{EVENT_ATTR_DEFAULT,  SetLinearModuleLead},
-  /* [DEBUG_OPC_GET_LINEAR_LEAD]       =  */{EVENT_ATTR_DEFAULT,  GetLinearModuleLead}
+  /* [DEBUG_OPC_GET_LINEAR_LEAD]       =  */{EVENT_ATTR_DEFAULT,  GetLinearModuleLead},
+#if (SNAP_CYCLE_TRACE)
+  /* [DEBUG_OPC_GET_CYCLE_TRACE]       =  */{EVENT_ATTR_DEFAULT,  GetCycleTrace}
+#else
+  UNDEFINED_CALLBACK
+#endif
 };
 
 
@@ -669,6 +1062,48 @@ EventCallback_t upgrade_event_cb[UPGRADE_OPC_MAX] = {
 };
 
 
+/* copy G-code event from UART RX buffer of HMI to marlin_events, not to
+ * event buffer of HMI task firstly, and Marlin task handles it in place.
+ * Other events will return error, caller should checkout it and call
+ * DispatchEvent()
+ */
+ErrCode ForwardGcodeEvent(SSTP_View_t &view) {
+  uint8_t id;
+
+  if (!view.length)
+    return E_NO_RESRC;
+
+  id = view.seg[0][EVENT_IDX_EVENT_ID];
+
+  switch (id) {
+  case EID_GCODE_REQ:
+  case EID_FILE_GCODE_REQ:
+  case EID_FILE_GCODE_PACK_REQ:
+  case EID_FILE_GCODE_BIN_REQ:
+    break;
+
+  default:
+    return E_INVALID_CMD;
+  }
+
+  if (quickstop.isTriggered())
+    LOG_I("Got G[%u] in QS\n", id);
+  // blocked 100ms for max duration to wait
+  if (marlin_events.Send(view, configTICK_RATE_HZ/10) != E_SUCCESS)
+    LOG_E("no room for G[%u], dropped\n", id);
+  return E_SUCCESS;
+}
+
+
+// event in HMI task's buffer, Marlin task will handle it
+static ErrCode SendMarlinEvent(DispatcherParam_t param) {
+  SSTP_View_t view = {{param->event_buff, NULL}, {param->size, 0}, param->size};
+
+  // blocked 100ms for max duration to wait
+  return marlin_events.Send(view, configTICK_RATE_HZ/10);
+}
+
+
 // need to known which task we running with
 // then we won't send out event again
 ErrCode DispatchEvent(DispatcherParam_t param) {
@@ -685,16 +1120,13 @@ ErrCode DispatchEvent(DispatcherParam_t param) {
 
   // if we are running in Marlin task, need to get command from the queue
   if (param->owner == TASK_OWN_MARLIN) {
-    if (xMessageBufferIsEmpty(param->event_queue))
-      return E_NO_RESRC;
-
-    param->size = (uint16_t)xMessageBufferReceive(param->event_queue, param->event_buff,
-                              SSTP_RECV_BUFFER_SIZE, 0);
+    // lines of last pack are still in the queue, enqueue them before
+    // we take next event, which releases the last one
+    if (pack_pending_remain)
+      return EnqueueFileGcodePack();
 
-    if (!param->size) {
-      LOG_E("No data read from event queue!\n");
+    if (!marlin_events.Take(param->event_buff, param->size))
       return E_NO_RESRC;
-    }
   }
 
   event.id = param->event_buff[EVENT_IDX_EVENT_ID];
@@ -716,6 +1148,22 @@ ErrCode DispatchEvent(DispatcherParam_t param) {
       send_to_marlin = true;
     break;
 
+  case EID_FILE_GCODE_PACK_REQ:
+    if (param->owner == TASK_OWN_MARLIN) {
+      return HandleFileGcodePack(param->event_buff, param->size, EID_FILE_GCODE_PACK_ACK);
+    }
+    else
+      send_to_marlin = true;
+    break;
+
+  case EID_FILE_GCODE_BIN_REQ:
+    if (param->owner == TASK_OWN_MARLIN) {
+      return HandleFileGcodePack(param->event_buff, param->size, EID_FILE_GCODE_BIN_ACK);
+    }
+    else
+      send_to_marlin = true;
+    break;
+
   case EID_SYS_CTRL_REQ:
     callbacks = sysctl_event_cb;
 #if DEBUG_EVENT_HANDLER
@@ -765,10 +1213,10 @@ ErrCode DispatchEvent(DispatcherParam_t param) {
 #if DEBUG_EVENT_HANDLER
     SERIAL_ECHOLNPAIR("new gcode, eid: ", event.id);
 #endif
-    // blocked 100ms for max duration to wait
     if (quickstop.isTriggered())
       LOG_I("Got G[%u] in QS\n", event.id);
-    xMessageBufferSend(param->event_queue, param->event_buff, param->size, configTICK_RATE_HZ/10);
+    if (SendMarlinEvent(param) != E_SUCCESS)
+      LOG_E("no room for G[%u], dropped\n", event.id);
     return E_SUCCESS;
   }
 
@@ -811,7 +1259,8 @@ ErrCode DispatchEvent(DispatcherParam_t param) {
 #endif
     if (quickstop.isTriggered())
       LOG_I("Got E[%x:%x] in QS\n", event.id, event.op_code);
-    xMessageBufferSend(param->event_queue, param->event_buff, param->size, configTICK_RATE_HZ/10);
+    if (SendMarlinEvent(param) != E_SUCCESS)
+      LOG_E("no room for E[%x:%x], dropped\n", event.id, event.op_code);
     return E_SUCCESS;
   }
 #if DEBUG_EVENT_HANDLER
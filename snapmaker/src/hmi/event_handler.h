@@ -24,6 +24,7 @@
 #include "../common/error.h"
 
 #include "uart_host.h"
+#include "event_queue.h"
 
 // event IDs
 // gcode from PC
@@ -146,6 +147,26 @@ enum AddonOpc: uint8_t {
 };
 
 
+// pack of consecutive gcode lines from file
+// REQ: [first line: 4 bytes][line count: 1 byte][lines separated by '\n']
+// ACK: [first line: 4 bytes][last line: 4 bytes], covers all lines in range
+#define EID_FILE_GCODE_PACK_REQ   0x13
+#define EID_FILE_GCODE_PACK_ACK   0x14
+
+// max data length of one pack, and max number of outstanding packs from
+// screen. All outstanding packs should fit in event queue of Marlin task.
+#define FILE_GCODE_PACK_MAX_SIZE  (320)
+#define FILE_GCODE_PACK_MAX_LINES (32)
+#define FILE_GCODE_PACK_WINDOW    (3)
+
+// pack of consecutive gcode lines from file in binary encoding, see gcode_bin.h
+// REQ: [first line: 4 bytes][line count: 1 byte][records of lines]
+// ACK: same as EID_FILE_GCODE_PACK_ACK
+// size and window are same as text pack
+#define EID_FILE_GCODE_BIN_REQ    0x15
+#define EID_FILE_GCODE_BIN_ACK    0x16
+
+
 // debug command set
 #define EID_DEBUG_REQ     0x99
 #define EID_DEBUG_ACK     0x9a
@@ -159,6 +180,7 @@ enum DebugOpc: uint8_t {
 
   DEBUG_OPC_SET_LINEAR_LEAD = 5,
   DEBUG_OPC_GET_LINEAR_LEAD,
+  DEBUG_OPC_GET_CYCLE_TRACE,
 
   DEBUG_OPC_MAX
 };
@@ -200,15 +222,17 @@ struct DispatcherParam {
   TaskOwner owner;
   uint8_t   *event_buff;
   uint16_t  size;
-  MessageBufferHandle_t event_queue;
 };
 
 typedef struct DispatcherParam* DispatcherParam_t;
 
 ErrCode DispatchEvent(DispatcherParam_t param);
+ErrCode ForwardGcodeEvent(SSTP_View_t &view);
 void clear_hmi_gcode_queue();
 void ack_gcode_event(uint8_t event_id, uint32_t line);
 
 extern UartHost hmi;
+// events sent by HMI task and handled by Marlin task
+extern EventQueue marlin_events;
 
 #endif  //#ifndef EVENT_HANDLER_H_
@@ -0,0 +1,121 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_queue.h"
+
+#include <string.h>
+
+
+ErrCode EventQueue::Send(SSTP_View_t &view, TickType_t wait) {
+  uint32_t   need = EVENT_QUEUE_RECORD_HEAD + view.length + 1;
+  uint32_t   pos = w_ % EVENT_QUEUE_SIZE;
+  uint32_t   skip = 0;
+  uint16_t   head;
+  uint8_t    *record;
+  TickType_t start = xTaskGetTickCount();
+
+  // record must fit behind any pad even if queue is empty,
+  // G-code events are much shorter than this
+  if (2 * need - 1 > EVENT_QUEUE_SIZE)
+    return E_PARAM;
+
+  // no enough room at the end, start from the beginning
+  if (EVENT_QUEUE_SIZE - pos < need)
+    skip = EVENT_QUEUE_SIZE - pos;
+
+  // receiver gives room back in order
+  while (w_ + skip + need - __atomic_load_n(&r_, __ATOMIC_ACQUIRE) > EVENT_QUEUE_SIZE) {
+    if ((xTaskGetTickCount() - start) >= wait)
+      return E_NO_RESRC;
+    vTaskDelay(1);
+  }
+
+  if (skip) {
+    if (skip >= EVENT_QUEUE_RECORD_HEAD) {
+      head = EVENT_QUEUE_RECORD_PAD;
+      memcpy(arena_ + pos, &head, EVENT_QUEUE_RECORD_HEAD);
+    }
+    pos = 0;
+  }
+
+  record = arena_ + pos;
+  head = view.length;
+  memcpy(record, &head, EVENT_QUEUE_RECORD_HEAD);
+  ProtocolSSTP::CopyView(view, record + EVENT_QUEUE_RECORD_HEAD);
+  record[EVENT_QUEUE_RECORD_HEAD + view.length] = 0;
+
+  // publish the record after it's written
+  __atomic_store_n(&w_, w_ + skip + need, __ATOMIC_RELEASE);
+
+  return E_SUCCESS;
+}
+
+
+bool EventQueue::Take(uint8_t *&event, uint16_t &length) {
+  uint32_t r = r_;
+  uint32_t pos;
+  uint16_t head;
+  bool     got = false;
+
+  if (taken_)
+    r += taken_;
+  taken_ = 0;
+
+  while (r != __atomic_load_n(&w_, __ATOMIC_ACQUIRE)) {
+    pos = r % EVENT_QUEUE_SIZE;
+
+    head = EVENT_QUEUE_RECORD_PAD;
+    if (EVENT_QUEUE_SIZE - pos >= EVENT_QUEUE_RECORD_HEAD)
+      memcpy(&head, arena_ + pos, EVENT_QUEUE_RECORD_HEAD);
+
+    if (head == EVENT_QUEUE_RECORD_PAD) {
+      r += EVENT_QUEUE_SIZE - pos;
+      continue;
+    }
+
+    // dropped by Flush()
+    if ((int32_t)(__atomic_load_n(&flush_, __ATOMIC_ACQUIRE) - r) > 0) {
+      r += EVENT_QUEUE_RECORD_HEAD + head + 1;
+      continue;
+    }
+
+    event = arena_ + pos + EVENT_QUEUE_RECORD_HEAD;
+    length = head;
+    taken_ = EVENT_QUEUE_RECORD_HEAD + head + 1;
+    got = true;
+    break;
+  }
+
+  // room before the event is free now
+  __atomic_store_n(&r_, r, __ATOMIC_RELEASE);
+
+  return got;
+}
+
+
+void EventQueue::Release() {
+  __atomic_store_n(&r_, r_ + taken_, __ATOMIC_RELEASE);
+  taken_ = 0;
+}
+
+
+void EventQueue::Flush() {
+  __atomic_store_n(&flush_, __atomic_load_n(&w_, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
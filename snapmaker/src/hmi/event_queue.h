@@ -0,0 +1,74 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_EVENT_QUEUE_H_
+#define SNAPMAKER_EVENT_QUEUE_H_
+
+#include "MapleFreeRTOS1030.h"
+
+#include "../common/error.h"
+#include "../common/protocol_sstp.h"
+
+// holds the G-code pack being handled and the window of packs behind it,
+// must be power of 2
+#define EVENT_QUEUE_SIZE          (2 * SSTP_RECV_BUFFER_SIZE)
+
+// every event is a record in the arena: [length, 2 bytes][event][NUL]
+// record doesn't wrap around the end of arena, if no enough room at the
+// end, a pad is left there and the record is put at the beginning
+#define EVENT_QUEUE_RECORD_HEAD   2
+#define EVENT_QUEUE_RECORD_PAD    0xFFFF
+
+/* Events handed from HMI task to Marlin task. Sender copies event out of
+ * UART RX buffer into the queue, receiver handles it in place and gives
+ * the room back after that. So a line is copied twice on the way: into
+ * the queue, then into Marlin queue.
+ * Event isn't left in UART RX buffer for Marlin task: HMI task gives
+ * room of the buffer back in order, an event waiting there for Marlin
+ * would hold acks, heartbeats and other events behind it, and screen
+ * would keep sending to a full buffer while Marlin runs a long command.
+ * Only one task sends and only one task receives, Flush() may be called
+ * by any task.
+ */
+class EventQueue {
+  public:
+    // wait up to wait ticks for room, E_NO_RESRC if there is still no room
+    ErrCode Send(SSTP_View_t &view, TickType_t wait);
+
+    // the earliest event which is not dropped by Flush(), it stays in the
+    // queue until Release() or next Take(). There is NUL behind it.
+    // Return: false if there is no event
+    bool Take(uint8_t *&event, uint16_t &length);
+    void Release();
+
+    // drop events sent before, the one which has been taken is not affected
+    void Flush();
+
+  private:
+    uint8_t  arena_[EVENT_QUEUE_SIZE];
+
+    // free running, only sender writes w_ and only receiver writes r_
+    uint32_t w_ = 0;
+    uint32_t r_ = 0;
+    uint32_t flush_ = 0;    // events before it are dropped
+    uint16_t taken_ = 0;    // record size of the event taken, 0 if none
+};
+
+#endif  // #ifndef SNAPMAKER_EVENT_QUEUE_H_
@@ -0,0 +1,109 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "gcode_bin.h"
+
+#include <string.h>
+
+static const struct {
+  char     letter;
+  uint16_t codenum;
+} gcode_bin_opc[GCODE_BIN_OPC_MAX] = {
+  {'G', 0}, {'G', 1}, {'G', 4}, {'M', 3}, {'M', 4}, {'M', 5}, {'M', 106}, {'M', 107}
+};
+
+static const char gcode_bin_letter[GCODE_BIN_WORDS_MAX] = {
+  'X', 'Y', 'Z', 'B', 'E', 'F', 'S', 'P'
+};
+
+static const float gcode_bin_scale[GCODE_BIN_WORDS_MAX] = {
+  1000, 1000, 1000, 1000, 100000, 100, 1000, 1000
+};
+
+
+void GcodeBinDecoder::Reset() {
+  memset(last_, 0, sizeof(last_));
+}
+
+
+uint8_t *GcodeBinDecoder::Decode(uint8_t *record, uint8_t *end, binary_command_t &cmd, char *&text) {
+  uint8_t  opc;
+  uint8_t  present;
+  uint8_t  changed;
+  uint32_t zigzag;
+  uint8_t  shift;
+  int32_t  value;
+
+  text = NULL;
+
+  if (record >= end)
+    return NULL;
+
+  opc = *record++;
+
+  if (opc == GCODE_BIN_OPC_TEXT) {
+    text = (char *)record;
+    while (record < end && *record)
+      record++;
+
+    // text must end with NUL in the pack
+    return (record < end)? record + 1 : NULL;
+  }
+
+  if (opc >= GCODE_BIN_OPC_MAX || end - record < 2)
+    return NULL;
+
+  present = *record++;
+  changed = *record++;
+  if (changed & ~present)
+    return NULL;
+
+  cmd.mark    = GCODE_BIN_MARK;
+  cmd.letter  = gcode_bin_opc[opc].letter;
+  cmd.codenum = gcode_bin_opc[opc].codenum;
+  cmd.count   = 0;
+
+  for (int i = 0; i < GCODE_BIN_WORDS_MAX; i++) {
+    if (changed & (1 << i)) {
+      zigzag = 0;
+      shift = 0;
+      do {
+        if (record >= end || shift > 28)
+          return NULL;
+        zigzag |= (uint32_t)(*record & 0x7F) << shift;
+        shift += 7;
+      } while (*record++ & 0x80);
+
+      value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+      value = (int32_t)((uint32_t)last_[i] + (uint32_t)value);
+      if (value >= GCODE_BIN_FIXED_MAX || value <= -GCODE_BIN_FIXED_MAX)
+        return NULL;
+      last_[i] = value;
+    }
+
+    if (present & (1 << i)) {
+      cmd.word[cmd.count].letter = gcode_bin_letter[i];
+      cmd.word[cmd.count].value  = (float)last_[i] / gcode_bin_scale[i];
+      cmd.count++;
+    }
+  }
+
+  return record;
+}
@@ -0,0 +1,73 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_GCODE_BIN_H_
+#define SNAPMAKER_GCODE_BIN_H_
+
+#include <stdint.h>
+
+#include "src/gcode/parser.h"
+
+#if DISABLED(FASTER_GCODE_PARSER)
+  #error "Binary file gcode needs FASTER_GCODE_PARSER to take values from binary command."
+#endif
+
+// record of one line in EID_FILE_GCODE_BIN_REQ:
+// [opcode][present words][changed words][delta of changed words]
+// or [GCODE_BIN_OPC_TEXT][text of line][NUL] for line we cannot encode
+//
+// bit n of word masks is for gcode_bin_letter[n]. Value of word is kept as
+// fixed point integer, delta to last value of the word in the same pack is
+// sent as zigzag varint. Present word which is not changed takes last value.
+// Values of all words are 0 at the beginning of every pack.
+enum GcodeBinOpc: uint8_t {
+  GCODE_BIN_OPC_G0,
+  GCODE_BIN_OPC_G1,
+  GCODE_BIN_OPC_G4,
+  GCODE_BIN_OPC_M3,
+  GCODE_BIN_OPC_M4,
+  GCODE_BIN_OPC_M5,
+  GCODE_BIN_OPC_M106,
+  GCODE_BIN_OPC_M107,
+
+  GCODE_BIN_OPC_MAX,
+
+  GCODE_BIN_OPC_TEXT = 0xFF
+};
+
+// value of word is (float)fixed / scale. Encoder only uses binary record
+// when it equals strtof() of the text, or the line is sent as text.
+// absolute value of fixed point is less than 2^30, so delta fits in int32
+#define GCODE_BIN_FIXED_MAX   (1L<<30)
+
+
+class GcodeBinDecoder {
+  public:
+    void Reset();
+
+    // decode a record to binary command, or set text if it is text record
+    // return pointer to next record, NULL if record is broken
+    uint8_t *Decode(uint8_t *record, uint8_t *end, binary_command_t &cmd, char *&text);
+
+  private:
+    int32_t last_[GCODE_BIN_WORDS_MAX];
+};
+
+#endif  // #ifndef SNAPMAKER_GCODE_BIN_H_
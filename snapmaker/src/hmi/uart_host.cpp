@@ -19,9 +19,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <libmaple/usart.h>
+#include <wirish_time.h>
 #include "src/core/serial.h"
 
 #include "../common/debug.h"
+#include "event_handler.h"
 #include "uart_host.h"
 
 #define HOST_DEBUG  0
@@ -33,42 +35,180 @@ void UartHost::Init(HardwareSerial *serial, uint8_t interrupt_prio) {
 
   struct usart_dev* dev = serial->c_dev();
 
-  buffer = (uint8_t *)pvPortMalloc(1024);
+  buffer = (uint8_t *)pvPortMalloc(HMI_RX_BUFFER_SIZE);
   configASSERT(buffer);
 
-  cmd_buffer_.Init(1024, buffer);
+  rx_.Init(HMI_RX_BUFFER_SIZE, buffer);
 
-  serial->begin(115200);
+  // RxIrq() may be called once UART is started
+  serial_ = serial;
+  rb_   = dev->rb;
+  wb_   = dev->wb;
+  regs_ = dev->regs;
+  rx_by_irq_ = (regs_ == USART2_BASE);
 
-  nvic_irq_set_priority(dev->irq_num, interrupt_prio);
+  ClearRxStat();
 
-  serial_ = serial;
+  serial->begin(115200);
 
-  rb_ = dev->rb;
+  nvic_irq_set_priority(dev->irq_num, interrupt_prio);
 
   mlock_uart_ = xSemaphoreCreateMutex();
   configASSERT(mlock_uart_);
 }
 
 
+void UartHost::EnableRxNotify(TaskHandle_t receiver) {
+  // only IRQ handler of USART2 is routed to hmi.RxIrq()
+  configASSERT(this == &hmi && regs_ == USART2_BASE);
+
+  receiver_ = receiver;
+
+  nvic_irq_set_priority(HMI_RX_NOTIFY_IRQ, HMI_RX_NOTIFY_IRQ_PRIO);
+  nvic_irq_enable(HMI_RX_NOTIFY_IRQ);
+
+  regs_->CR1 |= USART_CR1_IDLEIE;
+}
+
+
+/* same as usart_irq() of libmaple, except that it puts bytes to rx_,
+ * and notifies receiver when line is idle or got enough bytes.
+ * rx_ is never overwritten, an event in it may be still in use by
+ * receiver, so new bytes are dropped when it's full
+ */
+void UartHost::RxIrq() {
+  usart_reg_map *regs = regs_;
+  uint32_t sr = regs->SR;
+  bool notify = false;
+
+  if ((regs->CR1 & USART_CR1_RXNEIE) && (sr & USART_SR_RXNE)) {
+    if (!rx_.InsertOne((uint8_t)regs->DR))
+      stat_.drops++;
+    if (++rx_bytes_ >= HMI_RX_NOTIFY_THRESHOLD || rx_.Free() < HMI_RX_NOTIFY_ROOM)
+      notify = true;
+  }
+
+  // IDLE is cleared by reading SR then DR, if DR has been read above, it's cleared
+  // already. Otherwise check RXNE again to avoid losing the byte arrived just now
+  if (sr & USART_SR_IDLE) {
+    if (!(sr & USART_SR_RXNE)) {
+      if (regs->SR & USART_SR_RXNE) {
+        if (!rx_.InsertOne((uint8_t)regs->DR))
+          stat_.drops++;
+      }
+      else
+        (void)regs->DR;
+    }
+    notify = true;
+  }
+
+  if ((regs->CR1 & USART_CR1_TXEIE) && (regs->SR & USART_SR_TXE)) {
+    if (!rb_is_empty(wb_))
+      regs->DR = rb_remove(wb_);
+    else
+      regs->CR1 &= ~((uint32)USART_CR1_TXEIE);
+  }
+
+  if (notify && receiver_) {
+    rx_bytes_ = 0;
+    // only stamp the first notify before receiver is woken up
+    if (!notified_) {
+      notified_ = true;
+      notify_stamp_ = micros();
+    }
+    NVIC_BASE->ISPR[HMI_RX_NOTIFY_IRQ / 32] = BIT(HMI_RX_NOTIFY_IRQ % 32);
+  }
+}
+
+
+void UartHost::RxNotifyIrq() {
+  BaseType_t woken = pdFALSE;
+
+  vTaskNotifyGiveFromISR(receiver_, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+
+void UartHost::RecordWakeup() {
+  uint32_t us;
+
+  if (!notified_)
+    return;
+
+  us = micros() - notify_stamp_;
+  notified_ = false;
+
+  stat_.wakeups++;
+  stat_.wait_last = us;
+  if (us > stat_.wait_max)
+    stat_.wait_max = us;
+  stat_.wait_total += us;
+}
+
+
+void UartHost::RecordEvent() {
+  uint32_t now = millis();
+
+  stat_.events++;
+  rate_count_++;
+
+  if (now - rate_start_ >= 1000) {
+    stat_.rate = rate_count_;
+    if (rate_count_ > stat_.rate_max)
+      stat_.rate_max = rate_count_;
+    rate_count_ = 0;
+    rate_start_ = now;
+  }
+}
+
+
+void UartHost::ShowRxStat() {
+  HmiRxStat_t s = stat_;
+
+  // rate is updated by next event, it's stale if no event in last second
+  if (millis() - rate_start_ >= 2000)
+    s.rate = 0;
+
+  LOG_I("HMI: %u events, %u events/s, max %u events/s\n", s.events, s.rate, s.rate_max);
+  LOG_I("HMI: %u bytes dropped for full RX buffer\n", s.drops);
+  LOG_I("HMI: %u wakeups, wait last %u us, max %u us, avg %u us\n", s.wakeups, s.wait_last, s.wait_max,
+          s.wakeups? (uint32_t)(s.wait_total / s.wakeups) : 0);
+}
+
+
+void UartHost::ClearRxStat() {
+  stat_ = {0, 0, 0, 0, 0, 0, 0, 0};
+  rate_count_ = 0;
+  rate_start_ = millis();
+}
+
+
+// move bytes received by IRQ handler of libmaple to rx_
+void UartHost::PullRx() {
+  if (rx_by_irq_)
+    return;
+
+  while (!rb_is_empty(rb_) && !rx_.IsFull())
+    rx_.InsertOne(rb_remove(rb_));
+}
+
+
 /* checkout event from UART RX ring buffer
  * Note that we may call this function many times
  * for one complete event
  */
 ErrCode UartHost::CheckoutCmd(uint8_t *cmd, uint16_t &length) {
-  // int c = -1;
-
-  // for (;;) {
-  //   c = serial_->read();
-  //   if (c == -1)
-  //     break;
+  SSTP_View_t view;
+  ErrCode ret;
 
-  //   cmd_buffer_.InsertOne((uint8_t)c);
-  // }
+  ret = PeekCmd(view);
+  if (ret != E_SUCCESS)
+    return ret;
 
-  // return sstp_.Parse(cmd_buffer_, cmd, length);
+  length = ProtocolSSTP::CopyView(view, cmd);
+  ReleaseCmd(view);
 
-  return sstp_.Parse(rb_, cmd, length);
+  return E_SUCCESS;
 }
 
 
@@ -79,7 +219,8 @@ void UartHost::FlushOutput() {
 
 void UartHost::FlushInput() {
   while (serial_->read() != -1);
-  cmd_buffer_.Reset();
+  rx_.Reset();
+  sstp_.Reset();
 }
 
 
@@ -138,4 +279,18 @@ ErrCode UartHost::Send(SSTP_Event_t &event) {
     xSemaphoreGive(mlock_uart_);
 
   return E_SUCCESS;
-}
\ No newline at end of file
+}
+
+extern "C" {
+
+// HMI is on USART2, take over the IRQ handler of libmaple to detect idle line
+void __irq_usart2(void) {
+  hmi.RxIrq();
+}
+
+// UART5 isn't used, its vector is used to notify HMI task
+void __irq_uart5(void) {
+  hmi.RxNotifyIrq();
+}
+
+}
@@ -24,12 +24,40 @@
 #include <stdio.h>
 
 #include <HardwareSerial.h>
+#include <libmaple/nvic.h>
+#include <libmaple/usart.h>
 #include "MapleFreeRTOS1030.h"
 
 #include "../common/error.h"
 #include "../common/protocol_sstp.h"
 
-#include "../utils/ring_buffer.h"
+#include "../utils/spsc_ring_buffer.h"
+
+// RX IRQ of HMI UART is above the syscall priority of FreeRTOS, so it pends
+// this unused IRQ to wake up HMI task
+#define HMI_RX_NOTIFY_IRQ         NVIC_UART5
+#define HMI_RX_NOTIFY_IRQ_PRIO    configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+
+// when Screen keeps streaming without idle line, also wake up HMI task
+// after receiving so many bytes
+#define HMI_RX_NOTIFY_THRESHOLD   128
+// size of RX buffer, must be power of 2
+#define HMI_RX_BUFFER_SIZE        1024
+
+// events are parsed in place, so a long event may fill up RX buffer before
+// the next threshold. Wake up HMI task on every byte when it's almost full
+#define HMI_RX_NOTIFY_ROOM        32
+
+typedef struct {
+  uint32_t events;      // events checked out by HMI task
+  uint32_t rate;        // events in last second
+  uint32_t rate_max;
+  uint32_t drops;       // bytes dropped by RX IRQ for full buffer
+  uint32_t wakeups;     // times HMI task is woken up by RX
+  uint32_t wait_last;   // from RX notify to HMI task running, in us
+  uint32_t wait_max;
+  uint64_t wait_total;
+} HmiRxStat_t;
 
 class UartHost {
 
@@ -38,18 +66,51 @@ public:
 
   ErrCode CheckoutCmd(uint8_t *cmd, uint16_t &length);
 
+  // get event without copying it out of UART RX buffer
+  ErrCode PeekCmd(SSTP_View_t &view) { PullRx(); return sstp_.Peek(rx_, view); }
+  void ReleaseCmd(SSTP_View_t &view) { sstp_.Release(rx_, view); }
+
   ErrCode Send(SSTP_Event_t &e);
 
   void FlushOutput();
   void FlushInput();
 
+  // wake up receiver task when getting idle line or enough bytes
+  // only for the UART whose IRQ handler is routed to RxIrq()
+  void EnableRxNotify(TaskHandle_t receiver);
+  void RxIrq();
+  void RxNotifyIrq();
+
+  void RecordWakeup();
+  void RecordEvent();
+  void ShowRxStat();
+  void ClearRxStat();
+  HmiRxStat_t &rx_stat() { return stat_; }
+
+private:
+  void PullRx();
+
 private:
   HardwareSerial *serial_;
   ring_buffer    *rb_;
+  ring_buffer    *wb_;
+  usart_reg_map  *regs_ = NULL;
+
+  TaskHandle_t receiver_ = NULL;
+  uint16_t rx_bytes_ = 0;
+  uint32_t notify_stamp_ = 0;
+  bool     notified_ = false;
+
+  HmiRxStat_t stat_;
+  uint32_t rate_count_ = 0;
+  uint32_t rate_start_ = 0;
 
   ProtocolSSTP sstp_;
 
-  RingBuffer<uint8_t> cmd_buffer_;
+  // RX bytes are put here by RxIrq(), or moved from rb_ by PullRx() if
+  // IRQ handler of the UART is the default one of libmaple
+  SpscRingBuffer<uint8_t> rx_;
+  bool rx_by_irq_ = false;
 
   // lock for HMI uart
   SemaphoreHandle_t mlock_uart_ = NULL;
@@ -18,15 +18,27 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <string.h>
+#include <libmaple/nvic.h>
+
 #include "can_channel.h"
 #include "../common/config.h"
 #include "../common/debug.h"
+#include "../common/protocol_sstp.h"
+#include "../common/cycle_trace.h"
 
 #include "src/inc/MarlinConfig.h"
 #include HAL_PATH(src/HAL, HAL_can_STM32F1.h)
 
 CanChannel can;
 
+static_assert(!(CAN_MAC_QUEUE_SIZE & (CAN_MAC_QUEUE_SIZE - 1)), "CAN_MAC_QUEUE_SIZE must be power of 2");
+static_assert(!(CAN_EXT_SLOT_NUM & (CAN_EXT_SLOT_NUM - 1)), "CAN_EXT_SLOT_NUM must be power of 2");
+
+static inline void PendRxNotify() {
+  NVIC_BASE->ISPR[CAN_RX_NOTIFY_IRQ / 32] = BIT(CAN_RX_NOTIFY_IRQ % 32);
+}
+
 ErrCode CanChannel::Init(CANIrqCallback_t irq_cb) {
   void *tmp = NULL;
 
@@ -34,13 +46,16 @@ ErrCode CanChannel::Init(CANIrqCallback_t irq_cb) {
   if (!tmp) {
     return E_NO_MEM;
   }
-  mac_id_.Init((int32_t)CAN_MAC_QUEUE_SIZE, (uint32_t *)tmp);
+  mac_id_.Init(CAN_MAC_QUEUE_SIZE, (uint32_t *)tmp);
 
-  tmp = pvPortMalloc(CAN_EXT_CMD_QUEUE_SIZE);
-  if (!tmp) {
+  ext_slot_ = (CanExtSlot_t *)pvPortMalloc(CAN_EXT_SLOT_NUM * sizeof(CanExtSlot_t));
+  if (!ext_slot_) {
     return E_NO_MEM;
   }
-  ext_cmd_.Init((int32_t)CAN_EXT_CMD_QUEUE_SIZE, (uint8_t *)tmp);
+  for (int i = 0; i < CAN_EXT_SLOT_NUM; i++)
+    ext_slot_[i].state = CAN_EXT_SLOT_FREE;
+  ext_ready_.Init(CAN_EXT_SLOT_NUM, ext_ready_buf_);
+  ext_dropped_ = 0;
 
   std_cmd_w_ = 0;
   std_cmd_r_ = 0;
@@ -51,67 +66,273 @@ ErrCode CanChannel::Init(CANIrqCallback_t irq_cb) {
     configASSERT(lock_[i]);
   }
 
+  for (int i = 0; i < CAN_CH_MAX; i++) {
+    tx_r_[i] = 0;
+    tx_w_[i] = 0;
+    tx_mb_count_[i] = 0;
+    tx_failed_[i] = false;
+    tx_errors_[i] = 0;
+    tx_waiting_[i] = false;
+    tx_room_[i] = xSemaphoreCreateBinary();
+    configASSERT(tx_room_[i]);
+  }
+
+  sync_lock_ = xSemaphoreCreateMutex();
+  configASSERT(sync_lock_);
+  sync_done_ = xSemaphoreCreateBinary();
+  configASSERT(sync_done_);
+  sync_seq_ = 0;
+
   irq_cb_ = irq_cb;
 
+  nvic_irq_set_priority(CAN_RX_NOTIFY_IRQ, CAN_RX_NOTIFY_IRQ_PRIO);
+  nvic_irq_enable(CAN_RX_NOTIFY_IRQ);
+
+  nvic_irq_set_priority(NVIC_CAN1_TX_IRQn, CAN_TX_IRQ_PRIO);
+  nvic_irq_enable(NVIC_CAN1_TX_IRQn);
+  nvic_irq_set_priority(NVIC_CAN2_TX_IRQn, CAN_TX_IRQ_PRIO);
+  nvic_irq_enable(NVIC_CAN2_TX_IRQn);
+
   CanInit();
 
+  // CanInit() resets the controllers, so enable TX IRQ after it
+  CanTxIrqEnable(1);
+  CanTxIrqEnable(2);
+
   return E_SUCCESS;
 }
 
 
-ErrCode CanChannel::Write(CanPacket_t &packet) {
-  BaseType_t ret_lock = pdFAIL;
-  uint32_t   ret_send = 0;
+/* handle finished mailboxes and move queued frames into free mailboxes,
+ * called by TX IRQ, or by writer in critical section.
+ * return true if some frames are taken out of TX queue
+ */
+bool CanChannel::ServiceTx(CanChannelNumber ch) {
+  uint8_t done;
+  uint8_t ok;
+  uint8_t mb;
+  uint8_t remain = 0;
+  uint8_t used = 0;
+  bool    taken = false;
+
+  done = CanTxMailboxDone(ch + 1, &ok);
+
+  // frames are sent in order of request, so handle them in the same order
+  for (int i = 0; i < tx_mb_count_[ch]; i++) {
+    mb = tx_mb_order_[ch][i];
+    if (!(done & (1 << mb))) {
+      tx_mb_order_[ch][remain++] = mb;
+      continue;
+    }
 
-  if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
-    ret_lock = xSemaphoreTake(lock_[packet.ch], portMAX_DELAY);
+    CanTxFrame_t &frame = tx_mb_[ch][mb];
+    if (!(ok & (1 << mb))) {
+      tx_failed_[ch] = true;
+      tx_errors_[ch]++;
+    }
 
-  switch (packet.ft) {
-  case CAN_FRAME_STD_DATA:
-    if (packet.length > 8) {
-      if (ret_lock == pdPASS)
-        xSemaphoreGive(lock_[packet.ch]);
+    if (frame.last) {
+      if (frame.cb)
+        frame.cb(frame.arg, !tx_failed_[ch]);
+      tx_failed_[ch] = false;
+    }
+  }
+  tx_mb_count_[ch] = remain;
 
-      return E_PARAM;
+  for (int i = 0; i < tx_mb_count_[ch]; i++)
+    used |= 1 << tx_mb_order_[ch][i];
+
+  for (mb = 0; mb < CAN_TX_MAILBOX_NUM && tx_r_[ch] != tx_w_[ch]; mb++) {
+    if (used & (1 << mb))
+      continue;
+
+    CanTxFrame_t &frame = tx_q_[ch][tx_r_[ch]];
+    if (!CanTxMailboxPut(ch + 1, mb, frame.id, frame.id_type, frame.frame_type, frame.length, frame.data))
+      continue;
+
+    tx_mb_[ch][mb] = frame;
+    tx_mb_order_[ch][tx_mb_count_[ch]++] = mb;
+
+    tx_r_[ch] = (tx_r_[ch] + 1 < CAN_TX_QUEUE_SIZE)? tx_r_[ch] + 1 : 0;
+    taken = true;
+  }
+
+  return taken;
+}
+
+
+// put one frame into TX queue, wait for room if queue is full
+bool CanChannel::PushFrame(CanChannelNumber ch, CanTxFrame_t &frame) {
+  uint8_t  next;
+  bool     queued;
+  uint32_t start = millis();
+
+  for (;;) {
+    taskENTER_CRITICAL();
+
+    next = (tx_w_[ch] + 1 < CAN_TX_QUEUE_SIZE)? tx_w_[ch] + 1 : 0;
+    queued = (next != tx_r_[ch]);
+    if (queued) {
+      tx_q_[ch][tx_w_[ch]] = frame;
+      tx_w_[ch] = next;
     }
+    else {
+      tx_waiting_[ch] = true;
+    }
+
+    // kick mailboxes, TX IRQ will take over the rest
+    ServiceTx(ch);
+
+    taskEXIT_CRITICAL();
+
+    if (queued)
+      return true;
+
+    if ((millis() - start) > CAN_TX_TIMEOUT_MS)
+      return false;
+
+    // before scheduler is running, TX IRQ is masked, just keep polling
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+      xSemaphoreTake(tx_room_[ch], pdMS_TO_TICKS(CAN_TX_TIMEOUT_MS));
+  }
+}
+
+
+ErrCode CanChannel::Write(CanPacket_t &packet, CanTxCallback_t cb, void *arg) {
+  BaseType_t   ret_lock = pdFAIL;
+  ErrCode      ret = E_SUCCESS;
+  CanTxFrame_t frame;
+  int32_t      i = 0;
+  uint32_t     start;
 
-    ret_send = CanSendPacked(packet.id, IDTYPE_STDID, packet.ch + 1, FRAME_DATA, packet.length, packet.data);
+  if (packet.ch >= CAN_CH_MAX)
+    return E_PARAM;
 
+  frame.id = packet.id;
+
+  switch (packet.ft) {
+  case CAN_FRAME_STD_DATA:
+    if (packet.length > 8)
+      return E_PARAM;
+    frame.id_type    = IDTYPE_STDID;
+    frame.frame_type = FRAME_DATA;
     break;
 
   case CAN_FRAME_EXT_DATA:
-    for (int32_t  i = 0; i < packet.length; i += 8) {
-      if (packet.length - i > 8)
-        ret_send = CanSendPacked(packet.id, IDTYPE_EXTID, packet.ch + 1, FRAME_DATA, 8, packet.data + i);
-      else
-        ret_send = CanSendPacked(packet.id, IDTYPE_EXTID, packet.ch + 1, FRAME_DATA, packet.length - i, packet.data + i);
-    }
+    frame.id_type    = IDTYPE_EXTID;
+    frame.frame_type = FRAME_DATA;
     break;
 
   case CAN_FRAME_EXT_REMOTE:
-    ret_send = CanSendPacked(packet.id, IDTYPE_EXTID, packet.ch + 1, FRAME_REMOTE, 0, 0);
+    frame.id_type    = IDTYPE_EXTID;
+    frame.frame_type = FRAME_REMOTE;
     break;
 
   case CAN_FRAME_STD_REMOTE:
-    ret_send = CanSendPacked(packet.id, IDTYPE_STDID, packet.ch + 1, FRAME_REMOTE, 0, 0);
+    frame.id_type    = IDTYPE_STDID;
+    frame.frame_type = FRAME_REMOTE;
     break;
 
   default:
-    break;
+    return E_PARAM;
   }
 
-  if (ret_lock == pdPASS) {
+  // keep frames of one packet together in TX queue
+  if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+    ret_lock = xSemaphoreTake(lock_[packet.ch], portMAX_DELAY);
+
+  // remote frame and empty data frame are sent as one frame
+  do {
+    frame.length = 0;
+    if (frame.frame_type == FRAME_DATA) {
+      frame.length = (packet.length - i > 8)? 8 : packet.length - i;
+      memcpy(frame.data, packet.data + i, frame.length);
+      i += frame.length;
+    }
+
+    frame.last = (frame.frame_type == FRAME_REMOTE || i >= packet.length);
+    frame.cb   = frame.last? cb : NULL;
+    frame.arg  = arg;
+
+    if (!PushFrame(packet.ch, frame)) {
+      LOG_E("[CH%u:0x%X] TX queue is full\n", packet.ch + 1, packet.id);
+      ret = E_BUSY;
+      break;
+    }
+  } while (!frame.last);
+
+  if (ret_lock == pdPASS)
     xSemaphoreGive(lock_[packet.ch]);
+
+  // no TX IRQ before scheduler is running, send out all frames now
+  if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+    start = millis();
+    while (tx_r_[packet.ch] != tx_w_[packet.ch] || tx_mb_count_[packet.ch]) {
+      if ((millis() - start) > CAN_TX_TIMEOUT_MS)
+        break;
+
+      taskENTER_CRITICAL();
+      ServiceTx(packet.ch);
+      taskEXIT_CRITICAL();
+    }
   }
 
-  if (!ret_send) {
-    //LOG_I("[CH%u:0x%X] send ok\n", packet.ch + 1, packet.id);
-    return E_SUCCESS;
+  return ret;
+}
+
+
+void CanChannel::SyncTxDone(void *arg, bool ok) {
+  BaseType_t woken = pdFALSE;
+
+  // late callback of a timed out packet
+  if ((uint32_t)(uintptr_t)arg != can.sync_seq_)
+    return;
+
+  can.sync_ok_ = ok;
+  xSemaphoreGiveFromISR(can.sync_done_, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+
+ErrCode CanChannel::WriteSync(CanPacket_t &packet, uint32_t timeout_ms) {
+  ErrCode ret;
+
+  // Write() has polled all frames out, but cannot tell result
+  if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+    return Write(packet);
+
+  xSemaphoreTake(sync_lock_, portMAX_DELAY);
+
+  sync_seq_++;
+  sync_ok_ = false;
+  xSemaphoreTake(sync_done_, 0);
+
+  ret = Write(packet, SyncTxDone, (void *)(uintptr_t)sync_seq_);
+  if (ret == E_SUCCESS) {
+    if (xSemaphoreTake(sync_done_, pdMS_TO_TICKS(timeout_ms)) != pdPASS)
+      ret = E_TIMEOUT;
+    else if (!sync_ok_)
+      ret = E_FAILURE;
   }
-  else {
-    //LOG_I("[CH%u:0x%X] failed to send can packet: 0x%X\n", packet.ch + 1, packet.id, ret_send);
-    return E_FAILURE;
+
+  // ignore callback of this packet if it's timed out
+  sync_seq_++;
+
+  xSemaphoreGive(sync_lock_);
+
+  return ret;
+}
+
+
+void CanChannel::TxIrq(CanChannelNumber ch) {
+  BaseType_t woken = pdFALSE;
+
+  if (ServiceTx(ch) && tx_waiting_[ch]) {
+    tx_waiting_[ch] = false;
+    xSemaphoreGiveFromISR(tx_room_[ch], &woken);
   }
+
+  portYIELD_FROM_ISR(woken);
 }
 
 
@@ -121,10 +342,10 @@ int32_t CanChannel::Available(CanFrameType ft) {
     return CAN_STD_CMD_QUEUE_SIZE - std_cmd_in_q_;
 
   case CAN_FRAME_EXT_DATA:
-    return ext_cmd_.Available();
+    return (int32_t)ext_ready_.Available();
 
   case CAN_FRAME_EXT_REMOTE:
-    return mac_id_.Available();
+    return (int32_t)mac_id_.Available();
 
   default:
     break;
@@ -134,6 +355,32 @@ int32_t CanChannel::Available(CanFrameType ft) {
 }
 
 
+uint8_t *CanChannel::PeekExtPacket(uint32_t &src, uint16_t &length, uint32_t &stamp) {
+  uint8_t index;
+
+  if (!ext_ready_.Peek(&index, 1))
+    return NULL;
+
+  CanExtSlot_t &slot = ext_slot_[index];
+  src    = slot.src;
+  length = slot.total;
+  stamp  = slot.stamp;
+
+  return slot.packet;
+}
+
+
+void CanChannel::ReleaseExtPacket() {
+  uint8_t index;
+
+  if (!ext_ready_.RemoveOne(index))
+    return;
+
+  // RX IRQ may fill it again right after this, we have done with its data
+  __atomic_store_n(&ext_slot_[index].state, CAN_EXT_SLOT_FREE, __ATOMIC_RELEASE);
+}
+
+
 int32_t CanChannel::Read(CanFrameType ft, uint8_t *buffer, int32_t l) {
   int32_t i = 0;
 
@@ -153,6 +400,7 @@ int32_t CanChannel::Read(CanFrameType ft, uint8_t *buffer, int32_t l) {
     for (i = 0; i < CAN_STD_CMD_ELEMENT_SIZE; i++) {
       buffer[i] = tmp_pu8[i];
     }
+    std_cmd_stamp_ = std_cmd_rx_time_[std_cmd_r_];
 
     if (++std_cmd_r_ >= CAN_STD_CMD_QUEUE_SIZE)
       std_cmd_r_ = 0;
@@ -161,11 +409,8 @@ int32_t CanChannel::Read(CanFrameType ft, uint8_t *buffer, int32_t l) {
 
     return CAN_STD_CMD_ELEMENT_SIZE;
 
-  case CAN_FRAME_EXT_DATA:
-    return ext_cmd_.RemoveMulti(buffer, l);
-
   case CAN_FRAME_EXT_REMOTE:
-    return mac_id_.RemoveMulti((uint32_t *)buffer, l);
+    return (int32_t)mac_id_.RemoveMulti((uint32_t *)buffer, l);
 
   default:
     break;
@@ -219,9 +464,11 @@ void CanChannel::Irq(CanChannelNumber ch,  uint8_t fifo_index) {
         for (i = 0; i < length; i++) {
           std_cmd_[std_cmd_w_].data[i] = std_data_frame.data[i];
         }
+        std_cmd_rx_time_[std_cmd_w_] = micros();
         if (++std_cmd_w_ >= CAN_STD_CMD_QUEUE_SIZE)
           std_cmd_w_ = 0;
         std_cmd_in_q_++;
+        PendRxNotify();
       }
     }
 
@@ -233,14 +480,13 @@ void CanChannel::Irq(CanChannelNumber ch,  uint8_t fifo_index) {
 
   // extended data frame
   if (id_type == IDTYPE_EXTID && filter_index) {
-    // if (std_data_frame.data[0] == 0xAA &&
-    //     std_data_frame.data[1] == 0x55) {
-    //   // to tell upper level the sender, put can_id in following
-    //   ext_cmd_.InsertMulti((uint8_t *)&can_id, 4);
-    // }
-
-    ext_cmd_.InsertMulti(std_data_frame.data, length);
+    // channel in bit[29] as MAC does, so senders on both channels have their own slots
+    if (ch == CAN_CH_1)
+      can_id &= ~(1<<29);
+    else
+      can_id |= (1<<29);
 
+    ReceiveExtFrame(can_id, std_data_frame.data, length);
     return;
   }
 
@@ -262,35 +508,121 @@ void CanChannel::Irq(CanChannelNumber ch,  uint8_t fifo_index) {
 }
 
 
+/* put ext data frame into the slot of its sender, wake up receive task
+ * when the packet is complete. Called by RX IRQs of both channels, which
+ * never preempt each other
+ */
+void CanChannel::ReceiveExtFrame(uint32_t src, uint8_t *data, uint8_t length) {
+  CanExtSlot_t *slot = NULL;
+  CanExtSlot_t *free_slot = NULL;
+  uint32_t now = micros();
+  uint8_t  state;
+  uint16_t total;
+
+  for (int i = 0; i < CAN_EXT_SLOT_NUM; i++) {
+    CanExtSlot_t &s = ext_slot_[i];
+
+    // receive task frees slot after it has read the packet
+    state = __atomic_load_n(&s.state, __ATOMIC_ACQUIRE);
+
+    // sender stopped in the middle of packet
+    if (state == CAN_EXT_SLOT_FILLING && (now - s.stamp) > CAN_EXT_SLOT_TIMEOUT_US) {
+      s.state = CAN_EXT_SLOT_FREE;
+      state = CAN_EXT_SLOT_FREE;
+      ext_dropped_++;
+    }
+
+    if (state == CAN_EXT_SLOT_FILLING && s.src == src)
+      slot = &s;
+    else if (state == CAN_EXT_SLOT_FREE && !free_slot)
+      free_slot = &s;
+  }
+
+  // modules always start a SSTP packet in a new frame, frames without
+  // SOF and header are the rest of a dropped one
+  if (!slot) {
+    if (length <= SSTP_PDU_IDX_LEN_CHK || data[0] != SSTP_PDU_SOF_H || data[1] != SSTP_PDU_SOF_L ||
+        data[SSTP_PDU_IDX_LEN_CHK] != (uint8_t)(data[SSTP_PDU_IDX_DATA_LEN_H]^data[SSTP_PDU_IDX_DATA_LEN_L]))
+      return;
+
+    total = SSTP_HEADER_SIZE + (data[SSTP_PDU_IDX_DATA_LEN_H]<<8 | data[SSTP_PDU_IDX_DATA_LEN_L]);
+    if (!free_slot || total > sizeof(free_slot->packet)) {
+      ext_dropped_++;
+      return;
+    }
+
+    slot = free_slot;
+    slot->src    = src;
+    slot->length = 0;
+    slot->total  = total;
+    slot->state  = CAN_EXT_SLOT_FILLING;
+  }
+
+  if (length > slot->total - slot->length)
+    length = slot->total - slot->length;
+  memcpy(slot->packet + slot->length, data, length);
+  slot->length += length;
+  slot->stamp = now;
+
+  if (slot->length < slot->total)
+    return;
+
+  // there are never more ready slots than room of ext_ready_
+  slot->state = CAN_EXT_SLOT_READY;
+  ext_ready_.InsertOne((uint8_t)(slot - ext_slot_));
+  PendRxNotify();
+}
+
+
+// runs in the low priority vector pended by Irq(), wake up receive task
+void CanChannel::NotifyIrq() {
+  BaseType_t woken = pdFALSE;
+
+  if (!receiver_)
+    return;
+
+  vTaskNotifyGiveFromISR(receiver_, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+
 extern "C"
 {
 
 void __irq_can1_tx(void) {
+  can.TxIrq(CAN_CH_1);
 }
 
 void __irq_can1_rx0(void) {
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_CAN_IRQ);
   can.Irq(CAN_CH_1, 0);
+  CYCLE_TRACE_END(CYCLE_TRACE_CAN_IRQ);
 }
 
 void __irq_can1_rx1(void) {
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_CAN_IRQ);
   can.Irq(CAN_CH_1, 1);
+  CYCLE_TRACE_END(CYCLE_TRACE_CAN_IRQ);
 }
 
 void __irq_can1_sce(void) {
+  can.NotifyIrq();
 }
 
 void __irq_can2_tx(void) {
+  can.TxIrq(CAN_CH_2);
 }
 
 void __irq_can2_rx0(void) {
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_CAN_IRQ);
   can.Irq(CAN_CH_2, 0);
+  CYCLE_TRACE_END(CYCLE_TRACE_CAN_IRQ);
 }
 
 void __irq_can2_rx1(void) {
+  CYCLE_TRACE_BEGIN(CYCLE_TRACE_CAN_IRQ);
   can.Irq(CAN_CH_2, 1);
-}
-
-void __irq_can2_sce(void) {
+  CYCLE_TRACE_END(CYCLE_TRACE_CAN_IRQ);
 }
 
 }
\ No newline at end of file
@@ -24,8 +24,11 @@
 #include "MapleFreeRTOS1030.h"
 
 #include "../common/error.h"
-#include "../utils/ring_buffer.h"
+#include "../common/protocol_sstp.h"
+#include "../utils/spsc_ring_buffer.h"
 
+// queues filled by RX1 IRQs of both channels, they have the same priority
+// so never preempt each other. Sizes must be power of 2
 #define CAN_MAC_QUEUE_SIZE        16
 
 #define CAN_STD_CMD_QUEUE_SIZE    10
@@ -33,6 +36,30 @@
 
 #define CAN_EXT_CMD_QUEUE_SIZE    1024
 
+// modules may send SSTP packets at the same time, so ext frames of them
+// interleave on the bus. Every sender has its own slot to put its packet
+// together, a packet longer than a slot is dropped, so is a partial one
+// whose sender keeps quiet for CAN_EXT_SLOT_TIMEOUT_US
+#define CAN_EXT_SLOT_NUM          8
+#define CAN_EXT_SLOT_DATA_SIZE    256
+#define CAN_EXT_SLOT_TIMEOUT_US   100000
+
+// CAN RX IRQs run above configMAX_SYSCALL_INTERRUPT_PRIORITY, so they cannot
+// call FreeRTOS APIs. They pend this unused vector (CAN1 SCE, whose error
+// interrupts are never enabled), which runs at the syscall ceiling and
+// notifies the receive task
+#define CAN_RX_NOTIFY_IRQ         NVIC_CAN1_SCE_IRQn
+#define CAN_RX_NOTIFY_IRQ_PRIO    configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+
+// frames waiting for TX mailboxes, for every channel
+#define CAN_TX_QUEUE_SIZE         32
+#define CAN_TX_MAILBOX_NUM        3
+// TX IRQs wake up writers waiting for room of TX queue, so they must not be
+// above the syscall ceiling
+#define CAN_TX_IRQ_PRIO           configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+// max time to wait for room of TX queue, or for a sync packet to be sent out
+#define CAN_TX_TIMEOUT_MS         500
+
 
 enum CanFrameType {
   CAN_FRAME_STD,
@@ -82,32 +109,118 @@ typedef struct CanStdDataFrame {
 
 typedef bool (*CANIrqCallback_t)(CanStdDataFrame_t &cmd);
 
+
+enum CanExtSlotState {
+  CAN_EXT_SLOT_FREE,
+  CAN_EXT_SLOT_FILLING,   // owned by RX IRQ
+  CAN_EXT_SLOT_READY      // owned by receive task until it's released
+};
+
+typedef struct {
+  uint8_t   state;
+  uint32_t  src;      // CAN ID of sender, bit[29] is channel
+  uint16_t  length;   // bytes have been received
+  uint16_t  total;    // header and data field
+  uint32_t  stamp;    // micros() when the last frame arrived
+  uint8_t   packet[SSTP_HEADER_SIZE + CAN_EXT_SLOT_DATA_SIZE];
+} CanExtSlot_t;
+
+// called in TX IRQ when the last frame of a packet is done, ok is false if
+// any frame of the packet failed. Only FromISR APIs can be called in it
+typedef void (*CanTxCallback_t)(void *arg, bool ok);
+
+typedef struct CanTxFrame {
+  uint32_t        id;
+  uint8_t         id_type;
+  uint8_t         frame_type;
+  uint8_t         length;
+  bool            last;   // last frame of the packet
+  uint8_t         data[8];
+  CanTxCallback_t cb;     // only for the last frame
+  void            *arg;
+} CanTxFrame_t;
+
 class CanChannel {
   public:
     ErrCode Init(CANIrqCallback_t irq_cb);
 
-    ErrCode Write(CanPacket_t &packet);
+    // queue the packet and return, frames are sent by TX IRQ
+    ErrCode Write(CanPacket_t &packet, CanTxCallback_t cb = NULL, void *arg = NULL);
+    // queue the packet and wait until it is sent out or failed
+    ErrCode WriteSync(CanPacket_t &packet, uint32_t timeout_ms = CAN_TX_TIMEOUT_MS);
 
     int32_t Read(CanFrameType ft, uint8_t *pdu, int32_t l);
 
     int32_t Available(CanFrameType ft);
 
     void Irq(CanChannelNumber ch, uint8_t fifo_index);
+    void NotifyIrq();
+    void TxIrq(CanChannelNumber ch);
 
-    RingBuffer<uint8_t> &ext_cmd() { return ext_cmd_; }
+    uint32_t tx_errors(CanChannelNumber ch) { return tx_errors_[ch]; }
+
+    // task to be notified when new frame is queued
+    void SetReceiver(TaskHandle_t task) { receiver_ = task; }
+
+    // the earliest complete SSTP packet, with its sender and when its last
+    // frame arrived. It stays in the slot until ReleaseExtPacket() is called
+    // Return: NULL if there is no complete packet
+    uint8_t *PeekExtPacket(uint32_t &src, uint16_t &length, uint32_t &stamp);
+    void ReleaseExtPacket();
+
+    // packets dropped as no slot for them, or they didn't complete
+    uint32_t ext_dropped() { return ext_dropped_; }
+
+    // micros() when the std frame returned by last Read() arrived
+    uint32_t std_cmd_stamp() { return std_cmd_stamp_; }
 
   private:
-    RingBuffer<uint32_t> mac_id_;
-    RingBuffer<uint8_t> ext_cmd_;
+    void ReceiveExtFrame(uint32_t src, uint8_t *data, uint8_t length);
+
+  private:
+    SpscRingBuffer<uint32_t> mac_id_;
+
+    CanExtSlot_t *ext_slot_;
+    SpscRingBuffer<uint8_t> ext_ready_;   // index of complete slots, in order
+    uint8_t ext_ready_buf_[CAN_EXT_SLOT_NUM];
+    uint32_t ext_dropped_;
 
     CanStdDataFrame_t std_cmd_[CAN_STD_CMD_QUEUE_SIZE];
     uint8_t std_cmd_r_;
     uint8_t std_cmd_w_;
     uint8_t std_cmd_in_q_;
+    uint32_t std_cmd_rx_time_[CAN_STD_CMD_QUEUE_SIZE];
+    uint32_t std_cmd_stamp_;
 
     CANIrqCallback_t irq_cb_;
+    TaskHandle_t receiver_ = NULL;
 
     SemaphoreHandle_t lock_[CAN_CH_MAX];
+
+  private:
+    bool PushFrame(CanChannelNumber ch, CanTxFrame_t &frame);
+    bool ServiceTx(CanChannelNumber ch);
+    static void SyncTxDone(void *arg, bool ok);
+
+    CanTxFrame_t tx_q_[CAN_CH_MAX][CAN_TX_QUEUE_SIZE];
+    volatile uint8_t tx_r_[CAN_CH_MAX];
+    volatile uint8_t tx_w_[CAN_CH_MAX];
+
+    // frames in mailboxes, in order of being requested
+    CanTxFrame_t tx_mb_[CAN_CH_MAX][CAN_TX_MAILBOX_NUM];
+    uint8_t tx_mb_order_[CAN_CH_MAX][CAN_TX_MAILBOX_NUM];
+    uint8_t tx_mb_count_[CAN_CH_MAX];
+
+    bool tx_failed_[CAN_CH_MAX];    // some frame of current packet failed
+    uint32_t tx_errors_[CAN_CH_MAX];
+
+    volatile bool tx_waiting_[CAN_CH_MAX];
+    SemaphoreHandle_t tx_room_[CAN_CH_MAX];
+
+    SemaphoreHandle_t sync_lock_;
+    SemaphoreHandle_t sync_done_;
+    volatile uint32_t sync_seq_;
+    volatile bool sync_ok_;
 };
 
 extern CanChannel can;
@@ -20,6 +20,7 @@
  */
 #include "can_host.h"
 #include "linear.h"
+#include "module_cache.h"
 #include "../common/debug.h"
 #include "../snapmaker.h"
 
@@ -81,7 +82,8 @@ ErrCode CanHost::Init() {
   total_mac_ = 0;
 
   // init parameters for standard command
-  std_cmd_q_ = xMessageBufferCreate(CAN_STD_CMD_QUEUE_SIZE * CAN_STD_CMD_ELEMENT_SIZE);
+  // every message carries its length and arriving time
+  std_cmd_q_ = xMessageBufferCreate(CAN_STD_CMD_QUEUE_SIZE * (CAN_STD_CMD_ELEMENT_SIZE + 8));
   configASSERT(std_cmd_q_);
 
   for (i = 0; i < CAN_STD_WAIT_QUEUE_MAX; i++) {
@@ -95,17 +97,26 @@ ErrCode CanHost::Init() {
   ext_cmd_q_ = xMessageBufferCreate(CAN_EXT_CMD_QUEUE_SIZE);
   configASSERT(ext_cmd_q_);
 
-  // alloc continuous memory for the temp buffer of parser
-  parser_buffer_  = (uint8_t *)pvPortMalloc(520);
-  configASSERT(parser_buffer_);
-
   package_buffer_ = (uint8_t *)pvPortMalloc(1024);
   configASSERT(package_buffer_);
+  package_lock_ = xSemaphoreCreateMutex();
+  configASSERT(package_lock_);
+
+  for (i = 0; i < CAN_EXT_WAIT_QUEUE_MAX; i++) {
+    ext_wait_q_[i].cmd     = SSTP_INVALID_EVENT_ID;
+    ext_wait_q_[i].mac.val = MODULE_MAC_ID_INVALID;
+    ext_wait_q_[i].queue   = xMessageBufferCreate(CAN_EXT_WAIT_BUFFER_SIZE);
+    configASSERT(ext_wait_q_[i].queue);
+  }
+  ext_wait_lock_ = xSemaphoreCreateMutex();
+  configASSERT(ext_wait_lock_);
+  ext_wait_free_ = xSemaphoreCreateCounting(CAN_EXT_WAIT_QUEUE_MAX, CAN_EXT_WAIT_QUEUE_MAX);
+  configASSERT(ext_wait_free_);
 
-  ext_wait_q_.cmd    = SSTP_INVALID_EVENT_ID;
-  // ext_wait_q_.mac.val = MODULE_MAC_ID_INVALID;
-  ext_wait_q_.queue  = xMessageBufferCreate(CAN_EXT_CMD_QUEUE_SIZE);
-  ext_wait_lock_     = xSemaphoreCreateMutex();
+  ClearLatency();
+
+  for (i = 0; i < BOOT_PHASE_MAX; i++)
+    boot_stamp_[i] = 0;
 
   // init can channels
   if (can.Init(CANIrqCallback) != E_SUCCESS)
@@ -235,8 +246,13 @@ ErrCode CanHost::SendExtCmd(CanExtCmd_t &cmd) {
   uint16_t length = cmd.length;
   packet.data = package_buffer_;
 
-  if (proto_sstp_.Package(cmd.data, packet.data, length) != E_SUCCESS)
+  // package_buffer_ is shared by all tasks sending ext command
+  xSemaphoreTake(package_lock_, portMAX_DELAY);
+
+  if (proto_sstp_.Package(cmd.data, packet.data, length) != E_SUCCESS) {
+    xSemaphoreGive(package_lock_);
     return E_FAILURE;
+  }
 
   packet.length = length;
   packet.id     = cmd.mac.bits.id;
@@ -244,30 +260,65 @@ ErrCode CanHost::SendExtCmd(CanExtCmd_t &cmd) {
   packet.ft     = CAN_FRAME_EXT_DATA;
 
   ret = can.Write(packet);
+
+  xSemaphoreGive(package_lock_);
   return ret;
 }
 
 
+/* Get a free node of wait queue for ack of (mac, cmd),
+ * wait up to timeout_ms if all nodes are in use
+ */
+CanExtWaitNode_t *CanHost::AttachExtWaiter(MAC_t &mac, uint16_t cmd, uint32_t timeout_ms) {
+  CanExtWaitNode_t *node = NULL;
+
+  if (xSemaphoreTake(ext_wait_free_, pdMS_TO_TICKS(timeout_ms)) != pdPASS)
+    return NULL;
+
+  xSemaphoreTake(ext_wait_lock_, portMAX_DELAY);
+  for (int i = 0; i < CAN_EXT_WAIT_QUEUE_MAX; i++) {
+    if (ext_wait_q_[i].cmd == SSTP_INVALID_EVENT_ID) {
+      node = &ext_wait_q_[i];
+      node->mac.val = MODULE_MAC_ID_INVALID;
+      node->mac.bits.id = mac.bits.id;
+      node->cmd = cmd;
+      // drop stale ack which came after last waiter gave up
+      xMessageBufferReset(node->queue);
+      break;
+    }
+  }
+  xSemaphoreGive(ext_wait_lock_);
+
+  return node;
+}
+
+
+void CanHost::DetachExtWaiter(CanExtWaitNode_t *node) {
+  xSemaphoreTake(ext_wait_lock_, portMAX_DELAY);
+  node->cmd = SSTP_INVALID_EVENT_ID;
+  node->mac.val = MODULE_MAC_ID_INVALID;
+  xSemaphoreGive(ext_wait_lock_);
+
+  xSemaphoreGive(ext_wait_free_);
+}
+
+
 ErrCode CanHost::SendExtCmdSync(CanExtCmd_t &cmd, uint32_t timeout_ms, uint8_t retry) {
   ErrCode   ret = E_SUCCESS;
   uint16_t tmp_u16;
+  CanExtWaitNode_t *node;
 
-  xSemaphoreTake(ext_wait_lock_, 0);
-    // check if we have free node in wait queue
-    // if (ext_wait_q_.mac.val == MODULE_MAC_ID_INVALID) {
-    //   // got free node, set the mac to make it be used
-    //   ext_wait_q_.mac.bits.id = cmd.mac.bits.id;
-    //   // ack = req + 1
-    if (ext_wait_q_.cmd == SSTP_INVALID_EVENT_ID) {
-      ext_wait_q_.cmd = cmd.data[MODULE_EXT_CMD_INDEX_ID] + 1;
-    }
-    else {
-      xSemaphoreGive(ext_wait_lock_);
-      return E_NO_RESRC;
-    }
-  xSemaphoreGive(ext_wait_lock_);
+  uint8_t  req[2] = {cmd.data[MODULE_EXT_CMD_INDEX_ID], cmd.data[MODULE_EXT_CMD_INDEX_DATA]};
+  uint16_t req_length = cmd.length;
+
+  if (modulecache.Get(cmd))
+    return E_SUCCESS;
+
+  // ack = req + 1
+  node = AttachExtWaiter(cmd.mac, cmd.data[MODULE_EXT_CMD_INDEX_ID] + 1, timeout_ms);
+  if (!node)
+    return E_NO_RESRC;
 
-  // no free node in wait queue
   for (; retry > 0; retry--) {
     ret = SendExtCmd(cmd);
     if (ret != E_SUCCESS) {
@@ -275,8 +326,8 @@ ErrCode CanHost::SendExtCmdSync(CanExtCmd_t &cmd, uint32_t timeout_ms, uint8_t r
       continue;
     }
 
-  // just receive data field
-    tmp_u16 = xMessageBufferReceive(ext_wait_q_.queue, cmd.data, CAN_EXT_CMD_QUEUE_SIZE, pdMS_TO_TICKS(timeout_ms));
+    // just receive data field
+    tmp_u16 = xMessageBufferReceive(node->queue, cmd.data, CAN_EXT_WAIT_BUFFER_SIZE, pdMS_TO_TICKS(timeout_ms));
 
     if (!tmp_u16) {
       ret = E_TIMEOUT;
@@ -284,23 +335,146 @@ ErrCode CanHost::SendExtCmdSync(CanExtCmd_t &cmd, uint32_t timeout_ms, uint8_t r
     }
     else {
       cmd.length = tmp_u16;
+      modulecache.Put(cmd.mac, req, req_length, cmd.data, cmd.length);
       break;
     }
   }
 
-  // release node of wait queue
-  xSemaphoreTake(ext_wait_lock_, 0);
-  // ext_wait_q_.mac.val = MODULE_MAC_ID_INVALID;
-  ext_wait_q_.cmd = SSTP_INVALID_EVENT_ID;
-  xSemaphoreGive(ext_wait_lock_);
+  DetachExtWaiter(node);
 
   return ret;
 }
 
 
+/* Send a group of ext commands and wait for their acks together, so that
+ * modules handle them in parallel instead of one round trip after another.
+ * Commands in one group must not have same (mac, cmd), and data of every
+ * command should be able to hold ack of size bytes.
+ * Result of cmds[i] is put in rets[i], length of its ack in cmds[i].length
+ */
+void CanHost::SendExtCmdBatch(CanExtCmd_t *cmds, ErrCode *rets, uint8_t count, uint16_t size,
+                                uint32_t timeout_ms, uint8_t retry) {
+  CanExtWaitNode_t *node[CAN_EXT_WAIT_QUEUE_MAX];
+  uint8_t  req[CAN_EXT_WAIT_QUEUE_MAX][2];
+  uint16_t req_length[CAN_EXT_WAIT_QUEUE_MAX];
+  uint8_t  order[CAN_EXT_WAIT_QUEUE_MAX];
+  uint8_t  base;
+  uint8_t  total;
+  uint8_t  done;
+  uint16_t tmp_u16;
+  int      i;
+  int      j;
+  int      r;
+
+  TickType_t deadline;
+  TickType_t now;
+
+  // we have only CAN_EXT_WAIT_QUEUE_MAX waiters, so send them by chunks
+  for (base = 0; base < count; base += total) {
+    total = count - base;
+    if (total > CAN_EXT_WAIT_QUEUE_MAX)
+      total = CAN_EXT_WAIT_QUEUE_MAX;
+
+    done = 0;
+    for (i = 0; i < total; i++) {
+      req[i][0]     = cmds[base + i].data[MODULE_EXT_CMD_INDEX_ID];
+      req[i][1]     = cmds[base + i].data[MODULE_EXT_CMD_INDEX_DATA];
+      req_length[i] = cmds[base + i].length;
+
+      if (modulecache.Get(cmds[base + i])) {
+        node[i] = NULL;
+        rets[base + i] = E_SUCCESS;
+        done |= 1<<i;
+        continue;
+      }
+
+      // ack = req + 1
+      node[i] = AttachExtWaiter(cmds[base + i].mac, cmds[base + i].data[MODULE_EXT_CMD_INDEX_ID] + 1, timeout_ms);
+      if (node[i]) {
+        rets[base + i] = E_TIMEOUT;
+      }
+      else {
+        rets[base + i] = E_NO_RESRC;
+        done |= 1<<i;
+      }
+
+      // CAN doesn't resend frame which lost arbitration, and ack of a module
+      // with lower ID wins over our request to a module with higher ID,
+      // so requests are sent from the highest ID down
+      for (j = i; j > 0 && cmds[base + order[j - 1]].mac.bits.id < cmds[base + i].mac.bits.id; j--)
+        order[j] = order[j - 1];
+      order[j] = i;
+    }
+
+    for (r = 0; r < retry && done != (1<<total) - 1; r++) {
+      // all requests are on the bus before we wait for the first ack
+      for (j = 0; j < total; j++) {
+        i = order[j];
+        if (done & (1<<i))
+          continue;
+
+        if (SendExtCmd(cmds[base + i]) == E_SUCCESS)
+          rets[base + i] = E_TIMEOUT;
+        else
+          rets[base + i] = E_FAILURE;
+      }
+
+      // acks share one deadline
+      deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+      for (i = 0; i < total; i++) {
+        if ((done & (1<<i)) || rets[base + i] != E_TIMEOUT)
+          continue;
+
+        now = xTaskGetTickCount();
+        tmp_u16 = xMessageBufferReceive(node[i]->queue, cmds[base + i].data, size,
+                                          ((int32_t)(deadline - now) > 0)? deadline - now : 0);
+        if (tmp_u16) {
+          cmds[base + i].length = tmp_u16;
+          modulecache.Put(cmds[base + i].mac, req[i], req_length[i], cmds[base + i].data, tmp_u16);
+          rets[base + i] = E_SUCCESS;
+          done |= 1<<i;
+        }
+      }
+    }
+
+    for (i = 0; i < total; i++) {
+      if (node[i])
+        DetachExtWaiter(node[i]);
+    }
+  }
+}
+
+
+/* Take one ext command which nobody is waiting for
+ * Return:
+ *  length of command, 0 if timeout
+ */
+uint16_t CanHost::ReceiveExtCmd(MAC_t &mac, uint8_t *data, uint16_t size, uint32_t timeout_ms) {
+  uint16_t length;
+
+  // message from ReceiveHandler() is [sender MAC 4B][command]
+  length = xMessageBufferReceive(ext_cmd_q_, data, size, pdMS_TO_TICKS(timeout_ms));
+  if (length <= 4)
+    return 0;
+
+  memcpy(&mac.val, data, 4);
+
+  length -= 4;
+  memmove(data, data + 4, length);
+
+  return length;
+}
+
+
+void CanHost::FlushExtCmd() {
+  xMessageBufferReset(ext_cmd_q_);
+}
+
+
 ErrCode CanHost::WaitExtCmdAck(CanExtCmd_t &cmd, uint32_t timeout_ms, uint8_t retry) {
   uint16_t tmp_u16;
   uint8_t  cmd_id;
+  MAC_t    mac;
 
   if (!cmd.data)
     return E_PARAM;
@@ -308,20 +482,14 @@ ErrCode CanHost::WaitExtCmdAck(CanExtCmd_t &cmd, uint32_t timeout_ms, uint8_t re
   cmd_id = cmd.data[MODULE_EXT_CMD_INDEX_ID];
 
   for (; retry > 0; retry--) {
-    // handle extended command secondly
-    tmp_u16 = xMessageBufferReceive(ext_cmd_q_, cmd.data, cmd.length, pdMS_TO_TICKS(timeout_ms));
+    tmp_u16 = ReceiveExtCmd(mac, cmd.data, cmd.length, timeout_ms);
     if (!tmp_u16)
       continue;
 
-    if (cmd.data[MODULE_EXT_CMD_INDEX_ID] != cmd_id)
+    if (mac.bits.id != cmd.mac.bits.id || cmd.data[MODULE_EXT_CMD_INDEX_ID] != cmd_id)
       continue;
 
-    // tmp_u16 = xMessageBufferReceive(ext_cmd_q_, &mac, 4, pdMS_TO_TICKS(timeout_ms));
-    // if (tmp_u16 != 4)
-    //   continue;
-
-    // if (cmd.mac.bits.id != mac.bits.id || cmd.data[MODULE_EXT_CMD_INDEX_DATA] != cmd_id)
-    //   continue;
+    cmd.length = tmp_u16;
 
     return E_SUCCESS;
   }
@@ -345,75 +513,232 @@ void CanHost::SetReceiverSpeed(RECEIVER_SPEED_E speed) {
 }
 
 
-/* To check if we got new event form CAN ISR
- * This function should be put in a independent task
- *
- */
-void CanHost::ReceiveHandler(void *parameter) {
-  CanStdDataFrame_t  std_cmd;
-  uint16_t tmp_u16;
+// std latency is recorded by both of ReceiveHandler() and EventHandler(),
+// and stats are read by other tasks, so update them in critical section
+void CanHost::RecordLatency(CanLatency_t &latency, uint32_t stamp) {
+  uint32_t us = micros() - stamp;
+
+  taskENTER_CRITICAL();
+  latency.last = us;
+  if (us > latency.max)
+    latency.max = us;
+  latency.total += us;
+  latency.count++;
+  taskEXIT_CRITICAL();
+}
+
+
+void CanHost::ShowLatency() {
+  CanLatency_t std_l;
+  CanLatency_t ext_l;
+
+  taskENTER_CRITICAL();
+  std_l = std_latency_;
+  ext_l = ext_latency_;
+  taskEXIT_CRITICAL();
 
-  MessageBufferHandle_t tmp_q;
+  LOG_I("CAN std: %u frames, last %u us, max %u us, avg %u us\n", std_l.count, std_l.last, std_l.max,
+          std_l.count? (uint32_t)(std_l.total / std_l.count) : 0);
+  LOG_I("CAN ext: %u frames, last %u us, max %u us, avg %u us\n", ext_l.count, ext_l.last, ext_l.max,
+          ext_l.count? (uint32_t)(ext_l.total / ext_l.count) : 0);
+  LOG_I("CAN TX failed frames: CH1 %u, CH2 %u\n", can.tx_errors(CAN_CH_1), can.tx_errors(CAN_CH_2));
+  LOG_I("CAN RX dropped ext packets: %u\n", can.ext_dropped());
+}
+
+
+void CanHost::ClearLatency() {
+  taskENTER_CRITICAL();
+  std_latency_ = {0, 0, 0, 0};
+  ext_latency_ = {0, 0, 0, 0};
+  taskEXIT_CRITICAL();
+}
+
+
+// route one std command from CAN channel to its waiter or EventHandler()
+// return false if there is no std command
+bool CanHost::DispatchStdCmd() {
+  CanStdCmdEvent_t std_cmd;
+  MessageBufferHandle_t tmp_q = NULL;
 
   int i;
 
+  if (can.Read(CAN_FRAME_STD_DATA, (uint8_t *)&std_cmd.frame, CAN_STD_CMD_ELEMENT_SIZE) != CAN_STD_CMD_ELEMENT_SIZE)
+    return false;
+
+  std_cmd.stamp = can.std_cmd_stamp();
+
+  // check if there is some one is wait for this message
+  xSemaphoreTake(std_wait_lock_, 0);
+  for (i = 0; i < CAN_STD_WAIT_QUEUE_MAX; i++) {
+    if (std_wait_q_[i].message == std_cmd.frame.id.bits.msg_id) {
+      tmp_q = std_wait_q_[i].queue;
+      break;
+    }
+  }
+  xSemaphoreGive(std_wait_lock_);
+
+  if (!tmp_q) {
+    // send message to EventHandler(), latency is recorded when callback is called
+    xMessageBufferSend(std_cmd_q_, &std_cmd, 4 + 2 + std_cmd.frame.id.bits.length, pdMS_TO_TICKS(100));
+  }
+  else {
+    // send message to SendStdMessageSync(), skip message id, which is the 2 bytes in begining
+    xMessageBufferSend(tmp_q, std_cmd.frame.data, std_cmd.frame.id.bits.length, pdMS_TO_TICKS(100));
+    RecordLatency(std_latency_, std_cmd.stamp);
+  }
+
+  return true;
+}
+
+
+// route one complete ext command from CAN channel to its waiter or EventHandler()
+// return false if there is no complete command
+bool CanHost::DispatchExtCmd() {
+  MessageBufferHandle_t tmp_q = NULL;
+  uint8_t  *packet;
+  uint8_t  *cmd;
+  uint16_t tmp_u16;
+  uint32_t stamp;
+  MAC_t    src;
+
+  // packet is parsed in the slot it's put together by CAN IRQ
+  packet = can.PeekExtPacket(src.val, tmp_u16, stamp);
+  if (!packet)
+    return false;
+
+  // drop it, maybe there are more behind it
+  if (ProtocolSSTP::Check(packet, tmp_u16) != E_SUCCESS) {
+    can.ReleaseExtPacket();
+    return true;
+  }
+
+  cmd = packet + SSTP_HEADER_SIZE;
+  tmp_u16 -= SSTP_HEADER_SIZE;
+
+  xSemaphoreTake(ext_wait_lock_, portMAX_DELAY);
+  // check if there is some one is wait for this ack from this module
+  for (int i = 0; i < CAN_EXT_WAIT_QUEUE_MAX; i++) {
+    if (ext_wait_q_[i].cmd == cmd[MODULE_EXT_CMD_INDEX_ID] &&
+        ext_wait_q_[i].mac.bits.id == src.bits.id) {
+      tmp_q = ext_wait_q_[i].queue;
+      break;
+    }
+  }
+  xSemaphoreGive(ext_wait_lock_);
+
+  if (tmp_q) {
+    // send message to SendExtMessageSync(), just send data field, because it knows the event id and opcode
+    xMessageBufferSend(tmp_q, cmd, tmp_u16, 0);
+  }
+  else {
+    // send message to EventHandler(), tell it who send the command in the
+    // last 4 bytes of header, which has been checked
+    // don't block here if nobody is taking them, or all acks will be delayed
+    memcpy(cmd - 4, &src.val, 4);
+    xMessageBufferSend(ext_cmd_q_, cmd - 4, tmp_u16 + 4, 0);
+  }
+
+  can.ReleaseExtPacket();
+
+  // the last frame of this command came in last
+  RecordLatency(ext_latency_, stamp);
+
+  return true;
+}
+
+
+/* To dispatch new frames from CAN ISR
+ * This function should be put in a independent task, it is
+ * woken up by CanChannel::NotifyIrq() once new frame arrives
+ */
+void CanHost::ReceiveHandler(void *parameter) {
+  can.SetReceiver(((SnapmakerHandle_t)parameter)->can_recv);
+
   for (;;) {
-    tmp_q = NULL;
+    // the timeout is a fallback in case notification is lost
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(receiver_speed_));
 
-    // 1. check Std command
-    if (can.Read(CAN_FRAME_STD_DATA, (uint8_t *)&std_cmd, CAN_STD_CMD_ELEMENT_SIZE) == CAN_STD_CMD_ELEMENT_SIZE) {
-      // check if there is some one is wait for this message
+    DispatchCmds();
+  }
+}
 
-      xSemaphoreTake(std_wait_lock_, 0);
-      for (i = 0; i < CAN_STD_WAIT_QUEUE_MAX; i++) {
-        if (std_wait_q_[i].message == std_cmd.id.bits.msg_id) {
-          tmp_q = std_wait_q_[i].queue;
-          break;
-        }
-      }
-      xSemaphoreGive(std_wait_lock_);
 
-      if (!tmp_q) {
-        // send message to EventHandler()
-        xMessageBufferSend(std_cmd_q_, &std_cmd, 2 + std_cmd.id.bits.length, pdMS_TO_TICKS(100));
-      }
-      else {
-        // send message to SendStdMessageSync(), skip message id, which is the 2 bytes in begining
-        xMessageBufferSend(tmp_q, std_cmd.data, std_cmd.id.bits.length, pdMS_TO_TICKS(100));
-      }
+// drain all frames we have got
+void CanHost::DispatchCmds() {
+  bool got;
+
+  do {
+    got = DispatchStdCmd();
+    got = DispatchExtCmd() || got;
+  } while (got);
+}
+
+
+/* Broadcast MAC request on both channels until all modules have answered.
+ * Modules which are still booting miss the first request, so ask again every
+ * CAN_DISCOVER_INTERVAL_MS, and stop when no new module shows up in
+ * CAN_DISCOVER_QUIET_MS after the first one, or CAN_DISCOVER_TIMEOUT_MS.
+ * Return:
+ *  count of modules put in macs
+ */
+uint8_t CanHost::DiscoverModules(MAC_t *macs, uint8_t max) {
+  CanPacket_t pkt = {CAN_CH_1, CAN_FRAME_EXT_REMOTE, 0x01, 0, 0};
+  MAC_t    mac;
+  uint8_t  total = 0;
+  uint8_t  channels = 0;
+  bool     ending = false;
+  int      i;
+
+  uint32_t start = millis();
+  uint32_t last_new = start;
+  uint32_t last_req = start - CAN_DISCOVER_INTERVAL_MS;
+
+  LOG_I("Scanning modules ...\n");
+
+  for (;;) {
+    if (!ending && millis() - last_req >= CAN_DISCOVER_INTERVAL_MS) {
+      last_req = millis();
+      pkt.ch = CAN_CH_2;
+      can.Write(pkt);
+      pkt.ch = CAN_CH_1;
+      can.Write(pkt);
     }
 
-    // 2. check extended command
-    if (proto_sstp_.Parse(can.ext_cmd(), parser_buffer_, tmp_u16) == E_SUCCESS) {
-      // if we got a complete command in the ring buffer, one MAC id will be in the following 4 bytes
-      // need to check it out, then we know who send us the command
-      // can.ext_cmd().RemoveMulti((uint8_t *)&mac, 4);
-
-      xSemaphoreTake(ext_wait_lock_, 0);
-      // check if there is some one is wait for this ack
-      // if (ext_wait_q_.mac.bits.id == mac.bits.id &&
-      //     ext_wait_q_.cmd == parser_buffer_[MODULE_EXT_CMD_INDEX_ID])
-      if (ext_wait_q_.cmd == parser_buffer_[MODULE_EXT_CMD_INDEX_ID]) {
-        tmp_q = ext_wait_q_.queue;
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    while (can.Read(CAN_FRAME_EXT_REMOTE, (uint8_t *)&mac, 1)) {
+      // every module answers all the requests, only take the first answer
+      for (i = 0; i < total; i++) {
+        if (macs[i].bits.id == mac.bits.id)
+          break;
       }
-      xSemaphoreGive(ext_wait_lock_);
 
+      if (i < total || total >= max)
+        continue;
 
-      if (tmp_q) {
-        // send message to SendExtMessageSync(), just send data field, because it knows the event id and opcode
-        // LOG_V("sync ext cmd: %u\n", parser_buffer_[MODULE_EXT_CMD_INDEX_ID]);
-        xMessageBufferSend(tmp_q, parser_buffer_, tmp_u16, pdMS_TO_TICKS(100));
-      }
-      else {
-        // send message to EventHandler()
-        xMessageBufferSend(ext_cmd_q_, parser_buffer_, tmp_u16, pdMS_TO_TICKS(100));
-        // LOG_V("async ext cmd: %u\n", parser_buffer_[MODULE_EXT_CMD_INDEX_ID]);
-        // xMessageBufferSend(ext_cmd_q_, &mac, 4, pdMS_TO_TICKS(100));
-      }
+      macs[total++] = mac;
+      channels |= 1<<mac.bits.channel;
+      last_new = millis();
     }
 
-    vTaskDelay(pdMS_TO_TICKS(receiver_speed_));
+    // answers of the last request have been taken
+    if (ending)
+      break;
+
+    // stop asking, then take answers of the last request
+    if ((total && millis() - last_new >= CAN_DISCOVER_QUIET_MS) || millis() - start >= CAN_DISCOVER_TIMEOUT_MS)
+      ending = true;
   }
+
+  if (!(channels & (1<<CAN_CH_2)))
+    LOG_E("No module on CAN%u!\n", 2);
+
+  if (!(channels & (1<<CAN_CH_1)))
+    LOG_E("No module on CAN%u!\n", 1);
+
+  LOG_I("Got %u modules in %u ms\n", total, millis() - start);
+
+  return total;
 }
 
 
@@ -421,31 +746,36 @@ void CanHost::ReceiveHandler(void *parameter) {
  * This function should be perfromed in a independent task
  * */
 void CanHost::EventHandler(void *parameter) {
-  CanStdDataFrame_t  std_cmd;
-  uint16_t length = 0;
   MAC_t   mac;
 
+  TickType_t now;
+  TickType_t next_process;
+  TickType_t wait;
+
   EventGroupHandle_t event_group = ((SnapmakerHandle_t)parameter)->event_group;
 
-  CanPacket_t pkt = {CAN_CH_2, CAN_FRAME_EXT_REMOTE, 0x01, 0, 0};
+  MAC_t    macs[MODULE_SUPPORT_CONNECTED_MAX];
+  uint32_t ver_hash[MODULE_SUPPORT_CONNECTED_MAX];
+  uint8_t  total;
 
-  LOG_I("Scanning modules ...\n");
-  vTaskDelay(pdMS_TO_TICKS(2000));
+  StampBoot(BOOT_PHASE_DISCOVER);
+  total = DiscoverModules(macs, MODULE_SUPPORT_CONNECTED_MAX);
+  StampBoot(BOOT_PHASE_DISCOVERED);
 
-  if (can.Write(pkt) != E_SUCCESS)
-    LOG_E("No module on CAN%u!\n", 2);
-  // delay 1s, to get all mac form CAN2
+  ShowModuleVersions(macs, total, ver_hash);
 
-  pkt.ch = CAN_CH_1;
-  if (can.Write(pkt) != E_SUCCESS)
-    LOG_E("No module on CAN%u!\n", 1);
+  // same modules with same firmware, take their descriptors from cache
+  modulecache.Begin(macs, ver_hash, total);
+  PrefetchFunctionIds(macs, total);
 
-  vTaskDelay(pdMS_TO_TICKS(1000));
+  // let static modules query their modules together before initializing them one by one
+  for (int i = 0; static_modules[i] != NULL; i++) {
+    static_modules[i]->PreInit(macs, total);
+  }
 
-  // read all mac
-  while (can.Read(CAN_FRAME_EXT_REMOTE, (uint8_t *)&mac, 1)) {
-    LOG_I("\nNew Module: 0x%08X\n", mac.val);
-    InitModules(mac);
+  for (int i = 0; i < total; i++) {
+    LOG_I("\nNew Module: 0x%08X\n", macs[i].val);
+    InitModules(macs[i], false);
   }
 
   linear_p->UpdateMachineSize();
@@ -453,39 +783,66 @@ void CanHost::EventHandler(void *parameter) {
   for (int i = 0; static_modules[i] != NULL; i++) {
       static_modules[i]->PostInit();
   }
+  modulecache.End();
+  StampBoot(BOOT_PHASE_INITED);
+
   // broadcase modules have been initialized
   xEventGroupSetBits(event_group, EVENT_GROUP_MODULE_READY);
 
+  next_process = xTaskGetTickCount();
+
   for (;;) {
     if (can.Read(CAN_FRAME_EXT_REMOTE, (uint8_t *)&mac, 1)) {
       LOG_I("New Module: 0x%08X\n", mac.val);
       InitModules(mac);
     }
 
-    for (;;) {
-      // check if we got standard command from modules
-      length = xMessageBufferReceive(std_cmd_q_, &std_cmd, sizeof(CanStdDataFrame_t), 0);
-      if (!length)
-        break;
-
-      // check if someone register callback for this message
-      uint16_t message_id = std_cmd.id.bits.msg_id;
-      if (message_id >= MODULE_SUPPORT_MESSAGE_ID_MAX)
-        continue;
+    // modules are processed every receiver_speed_ ms, std commands are
+    // handled as soon as they come in between
+    now = xTaskGetTickCount();
+    if ((int32_t)(next_process - now) <= 0) {
+      ModuleBase::StaticProcess();
+      for (int i = 0; static_modules[i] != NULL; i++)
+        static_modules[i]->Process();
 
-      if (map_message_function_[message_id].cb) {
-        map_message_function_[message_id].cb(std_cmd);
-      }
+      // check one descriptor we took from cache every time
+      modulecache.ValidateStep();
 
-      // if no callback, maybe need to send it to screen?
+      next_process = now + pdMS_TO_TICKS(receiver_speed_);
+      wait = pdMS_TO_TICKS(receiver_speed_);
+    }
+    else {
+      wait = next_process - now;
     }
 
-    ModuleBase::StaticProcess();
-    for (int i = 0; static_modules[i] != NULL; i++)
-      static_modules[i]->Process();
+    // check if we got standard command from modules
+    HandleStdCmd(wait);
+  }
+}
+
+
+/* Take one std command queued by ReceiveHandler() and call its callback
+ * Return:
+ *  false if there is no std command in wait ticks
+ */
+bool CanHost::HandleStdCmd(TickType_t wait) {
+  CanStdCmdEvent_t std_cmd;
+
+  if (!xMessageBufferReceive(std_cmd_q_, &std_cmd, sizeof(CanStdCmdEvent_t), wait))
+    return false;
 
-    vTaskDelay(pdMS_TO_TICKS(receiver_speed_));
+  // check if someone register callback for this message
+  uint16_t message_id = std_cmd.frame.id.bits.msg_id;
+  if (message_id >= MODULE_SUPPORT_MESSAGE_ID_MAX)
+    return true;
+
+  if (map_message_function_[message_id].cb) {
+    RecordLatency(std_latency_, std_cmd.stamp);
+    map_message_function_[message_id].cb(std_cmd.frame);
   }
+
+  // if no callback, maybe need to send it to screen?
+  return true;
 }
 
 
@@ -546,7 +903,89 @@ void CanHost::ShowModuleVersion(MAC_t mac) {
   }
 }
 
-ErrCode CanHost::InitModules(MAC_t &mac) {
+// query versions of all modules together, and hash them if ver_hash is given
+void CanHost::ShowModuleVersions(MAC_t *macs, uint8_t count, uint32_t *ver_hash) {
+  CanExtCmd_t cmd[CAN_EXT_WAIT_QUEUE_MAX];
+  ErrCode     ret[CAN_EXT_WAIT_QUEUE_MAX];
+  char        buffer[CAN_EXT_WAIT_QUEUE_MAX][50];
+
+  uint8_t base;
+  uint8_t total;
+  int     i;
+
+  for (base = 0; base < count; base += total) {
+    total = count - base;
+    if (total > CAN_EXT_WAIT_QUEUE_MAX)
+      total = CAN_EXT_WAIT_QUEUE_MAX;
+
+    for (i = 0; i < total; i++) {
+      cmd[i].mac     = macs[base + i];
+      cmd[i].data    = (uint8_t *)buffer[i];
+      cmd[i].data[0] = MODULE_EXT_CMD_VERSION_REQ;
+      cmd[i].length  = 1;
+    }
+
+    // leave one byte for terminator
+    SendExtCmdBatch(cmd, ret, total, sizeof(buffer[0]) - 1, 500);
+
+    for (i = 0; i < total; i++) {
+      if (ver_hash)
+        ver_hash[base + i] = (ret[i] == E_SUCCESS)? ModuleCache::HashVersion(cmd[i].data, cmd[i].length) : 0;
+
+      if (ret[i] != E_SUCCESS) {
+        LOG_I("Module 0x%08X: failed to get ver\n", cmd[i].mac.bits.id);
+      }
+      else {
+        buffer[i][cmd[i].length] = 0;
+        LOG_I("Module 0x%08X: %s\n", cmd[i].mac.bits.id, buffer[i] + 2);
+      }
+    }
+  }
+}
+
+
+/* Ask function ids of all modules together while module cache is learning,
+ * Init() of every module takes them from cache instead of asking its module
+ * one round trip after another. If cache is hit, they are there already.
+ */
+void CanHost::PrefetchFunctionIds(MAC_t *macs, uint8_t count) {
+  CanExtCmd_t cmd[CAN_EXT_WAIT_QUEUE_MAX];
+  ErrCode     ret[CAN_EXT_WAIT_QUEUE_MAX];
+  uint8_t     buffer[CAN_EXT_WAIT_QUEUE_MAX][MODULE_CACHE_ACK_MAX];
+
+  uint8_t base;
+  uint8_t total;
+  int     i;
+
+  if (modulecache.state() != MODULE_CACHE_STATE_LEARN)
+    return;
+
+  for (base = 0; base < count; base += total) {
+    total = count - base;
+    if (total > CAN_EXT_WAIT_QUEUE_MAX)
+      total = CAN_EXT_WAIT_QUEUE_MAX;
+
+    for (i = 0; i < total; i++) {
+      cmd[i].mac     = macs[base + i];
+      cmd[i].data    = buffer[i];
+      cmd[i].data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_FUNCID_REQ;
+      cmd[i].length  = 1;
+    }
+
+    // module which doesn't answer is asked again by its Init()
+    SendExtCmdBatch(cmd, ret, total, sizeof(buffer[0]), 500);
+  }
+}
+
+
+void CanHost::ShowBootStamp() {
+  LOG_I("Boot: discover %u ms, discovered %u ms, inited %u ms, ready %u ms\n",
+          boot_stamp_[BOOT_PHASE_DISCOVER], boot_stamp_[BOOT_PHASE_DISCOVERED],
+          boot_stamp_[BOOT_PHASE_INITED], boot_stamp_[BOOT_PHASE_READY]);
+}
+
+
+ErrCode CanHost::InitModules(MAC_t &mac, bool show_version) {
   int      i;
   uint16_t device_id = MODULE_GET_DEVICE_ID(mac.val);
   ErrCode  ret;
@@ -557,7 +996,8 @@ ErrCode CanHost::InitModules(MAC_t &mac) {
   if (total_mac_ >= MODULE_SUPPORT_CONNECTED_MAX)
     return E_NO_RESRC;
 
-  ShowModuleVersion(mac);
+  if (show_version)
+    ShowModuleVersion(mac);
   // check if this mac is configured
   for (i = 0; i < total_mac_; i++) {
     if (mac.bits.id == mac_[i].bits.id) {
@@ -664,6 +1104,7 @@ ErrCode CanHost::BindMessageID(CanExtCmd_t &cmd, message_id_t *msg_buffer) {
   cmd.data = map_buffer;
   cmd.length = 4*i + 2;
 
+  // we don't wait for ack, binding takes no round trip
   return SendExtCmd(cmd);
 }
 
@@ -765,17 +1206,18 @@ assign_message_id:
 
 ErrCode CanHost::UpgradeModules(uint32_t fw_addr, uint32_t length) {
   int   i;
-  
+
   SetReceiverSpeed(RECEIVER_SPEED_HIGH);
-  // upgrade dynamic modules
-  for (i = 0; i < MODULE_SUPPORT_CONNECTED_MAX; i++) {
 
-    // to the end of mac
+  // to the end of mac
+  for (i = 0; i < MODULE_SUPPORT_CONNECTED_MAX; i++) {
     if (mac_[i].val == MODULE_MAC_ID_INVALID)
       break;
-
-    ModuleBase::Upgrade(mac_[i], fw_addr, length);
   }
+
+  // upgrade all modules on both channels at the same time
+  ModuleBase::Upgrade(mac_, i, fw_addr, length);
+
   SetReceiverSpeed(RECEIVER_SPEED_NORMAL);
   // Waiting module to enter app
   vTaskDelay(pdMS_TO_TICKS(200));
@@ -790,11 +1232,11 @@ ErrCode CanHost::UpgradeModules(uint32_t fw_addr, uint32_t length) {
 
   LOG_I("Scanning modules ...\n");
 
-  if (can.Write(pkt) != E_SUCCESS)
+  if (can.WriteSync(pkt) != E_SUCCESS)
     LOG_E("No module on CAN%u!\n", 2);
 
   pkt.ch = CAN_CH_1;
-  if (can.Write(pkt) != E_SUCCESS)
+  if (can.WriteSync(pkt) != E_SUCCESS)
     LOG_E("No module on CAN%u!\n", 1);
 
 
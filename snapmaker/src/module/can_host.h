@@ -25,12 +25,21 @@
 #include "../common/protocol_sstp.h"
 
 #include "MapleFreeRTOS1030.h"
+#include <wirish_time.h>
 
 #include "can_channel.h"
 #include "module_base.h"
 
 
 #define CAN_STD_WAIT_QUEUE_MAX    (4)
+#define CAN_EXT_WAIT_QUEUE_MAX    (4)
+#define CAN_EXT_WAIT_BUFFER_SIZE  (256)
+
+// modules answer broadcast of MAC request after they boot up, keep asking
+// until no new module shows up in CAN_DISCOVER_QUIET_MS
+#define CAN_DISCOVER_INTERVAL_MS  (100)
+#define CAN_DISCOVER_QUIET_MS     (500)
+#define CAN_DISCOVER_TIMEOUT_MS   (3000)
 
 #define CAN_RECV_SPEED_NORMAL 10  // ms
 #define CAN_RECV_SPEED_HIGH 1  // ms
@@ -38,6 +47,22 @@
 typedef void (*CanStdCmdCallback_t)(CanStdDataFrame_t &cmd);
 
 
+// std command passed from ReceiveHandler() to EventHandler()
+typedef struct {
+  uint32_t          stamp;  // micros() when frame arrived in IRQ
+  CanStdDataFrame_t frame;
+} CanStdCmdEvent_t;
+
+
+// latency from frame arriving in IRQ to being dispatched, in us
+typedef struct {
+  uint32_t count;
+  uint32_t last;
+  uint32_t max;
+  uint64_t total;
+} CanLatency_t;
+
+
 typedef struct {
   Function_t          function;
   CanStdCmdCallback_t cb;
@@ -71,11 +96,21 @@ typedef struct {
 
 
 typedef struct {
-  // MAC_t     mac;   /* MAC ID of module which we are waiting for */
+  MAC_t     mac;   /* MAC ID of module which we are waiting for */
   uint16_t  cmd;   /* command we are waiting for its ack */
   MessageBufferHandle_t queue;
 } CanExtWaitNode_t;
 
+// time stamps of booting, in ms since power on
+typedef enum {
+  BOOT_PHASE_DISCOVER,    // start to discover modules
+  BOOT_PHASE_DISCOVERED,  // all modules answered
+  BOOT_PHASE_INITED,      // all modules are initialized
+  BOOT_PHASE_READY,       // main loop starts to take commands
+
+  BOOT_PHASE_MAX
+} BootPhase_t;
+
 typedef enum {
   RECEIVER_SPEED_NORMAL,
   RECEIVER_SPEED_HIGH,
@@ -92,7 +127,11 @@ class CanHost {
 
     ErrCode SendExtCmd(CanExtCmd_t &cmd);
     ErrCode SendExtCmdSync(CanExtCmd_t &cmd, uint32_t timeout_ms=0, uint8_t retry=1);
+    void SendExtCmdBatch(CanExtCmd_t *cmds, ErrCode *rets, uint8_t count, uint16_t size,
+                          uint32_t timeout_ms=0, uint8_t retry=1);
     ErrCode WaitExtCmdAck(CanExtCmd_t &cmd, uint32_t timeout_ms=0, uint8_t retry=1);
+    uint16_t ReceiveExtCmd(MAC_t &mac, uint8_t *data, uint16_t size, uint32_t timeout_ms=0);
+    void FlushExtCmd();
 
     void SendHeartbeat();
     void SendEmergencyStop();
@@ -100,6 +139,10 @@ class CanHost {
     void ReceiveHandler(void *parameter);
     void EventHandler(void *parameter);
 
+    // one pass of the loops above, for the host build which can't block in them
+    void DispatchCmds();
+    bool HandleStdCmd(TickType_t wait);
+
     ErrCode UpgradeModules(uint32_t fw_addr, uint32_t length);
 
     message_id_t RegisterFunction(Function_t const &function, CanStdCmdCallback_t callback);
@@ -108,7 +151,16 @@ class CanHost {
 
     ErrCode BindMessageID(CanExtCmd_t &cmd, message_id_t *msg_buffer);
     void ShowModuleVersion(MAC_t mac);
+    void ShowModuleVersions(MAC_t *macs, uint8_t count, uint32_t *ver_hash=NULL);
+    void PrefetchFunctionIds(MAC_t *macs, uint8_t count);
     void SetReceiverSpeed(RECEIVER_SPEED_E speed);
+
+    void ShowLatency();
+    void ClearLatency();
+
+    void StampBoot(BootPhase_t phase) { if (phase < BOOT_PHASE_MAX) boot_stamp_[phase] = millis(); }
+    void ShowBootStamp();
+
     uint32_t mac(uint8_t index) {
       if (index < total_mac_)
         return mac_[index].val;
@@ -120,13 +172,20 @@ class CanHost {
     message_id_t GetMessageID(func_id_t function_id, uint8_t sub_index = 0);
     ErrCode BindMessageID(MAC_t &mac, uint8_t mac_index);
 
-    ErrCode InitModules(MAC_t &mac);
+    uint8_t DiscoverModules(MAC_t *macs, uint8_t max);
+    ErrCode InitModules(MAC_t &mac, bool show_version=true);
     ErrCode InitDynamicModule(MAC_t &mac, uint8_t mac_index);
 
     ErrCode AssignMessageRegion();
 
     ErrCode HandleExtCmd(uint8_t *cmd, uint16_t length);
 
+    CanExtWaitNode_t *AttachExtWaiter(MAC_t &mac, uint16_t cmd, uint32_t timeout_ms);
+    void DetachExtWaiter(CanExtWaitNode_t *node);
+
+    void RecordLatency(CanLatency_t &latency, uint32_t stamp);
+    bool DispatchStdCmd();
+    bool DispatchExtCmd();
 
   private:
     // command queue from ReceiveHandler() to EventHandler for standard command
@@ -136,13 +195,19 @@ class CanHost {
 
     // parameters for extended command
     ProtocolSSTP proto_sstp_;           // SSTP protocol instance
-    uint8_t      *parser_buffer_;       // buffer for parser of SSTP protocol
     uint8_t      *package_buffer_;      // buffer for packager of SSTP protocol
+    xSemaphoreHandle package_lock_;
     MessageBufferHandle_t ext_cmd_q_;   // command queue from ReceiveHandler() to EventHandler for extend command
-    CanExtWaitNode_t      ext_wait_q_;
+    CanExtWaitNode_t      ext_wait_q_[CAN_EXT_WAIT_QUEUE_MAX];
     xSemaphoreHandle      ext_wait_lock_;
+    xSemaphoreHandle      ext_wait_free_; // counts free nodes in ext_wait_q_
     uint8_t receiver_speed_ = CAN_RECV_SPEED_NORMAL;
 
+    CanLatency_t std_latency_;  // std frame to callback in EventHandler()
+    CanLatency_t ext_latency_;  // complete ext frame to its waiter or queue
+
+    uint32_t boot_stamp_[BOOT_PHASE_MAX];
+
     // map for message id and function id
     MessageMap_t  map_message_function_[MODULE_SUPPORT_MESSAGE_ID_MAX];
     uint16_t      total_message_id_;
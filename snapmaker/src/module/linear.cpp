@@ -19,6 +19,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "linear.h"
+#include "module_cache.h"
 
 #include "../common/config.h"
 #include "../common/debug.h"
@@ -27,19 +28,123 @@
 // marlin headers
 #include "src/inc/MarlinConfig.h"
 #include "src/module/endstops.h"
+#include "src/module/planner.h"
+#include "src/module/stepper.h"
+
+#include <libmaple/nvic.h>
 
 Linear linear(MODULE_DEVICE_ID_LINEAR);
 Linear linear_tmc(MODULE_DEVICE_ID_LINEAR_TMC);
 
 Linear *linear_p = &linear;
 
+/* Detect axes of all our linear modules at one time, every DIR pin is
+ * raised only once and all modules which are unknown are asked together.
+ * Length and lead of all of them are asked together too while module cache
+ * is learning, then Init() takes them from cache.
+ */
+ErrCode Linear::PreInit(MAC_t *macs, uint8_t total) {
+  CanExtCmd_t cmd[LINEAR_AXIS_MAX];
+  ErrCode     ret[LINEAR_AXIS_MAX];
+  uint8_t     buffer[LINEAR_AXIS_MAX][16];
+  uint8_t     index[LINEAR_AXIS_MAX];
+
+  uint8_t count = 0;
+  uint8_t n;
+
+  int i;
+  int j;
+  int pins[3] = {X_DIR_PIN, Y_DIR_PIN, Z_DIR_PIN};
+  uint8_t reqs[2] = {MODULE_EXT_CMD_LINEAR_LENGTH_REQ, MODULE_EXT_CMD_LINEAR_LEAD_REQ};
+
+  for (i = 0; i < total && count < LINEAR_AXIS_MAX; i++) {
+    if (MODULE_GET_DEVICE_ID(macs[i].val) != device_id_)
+      continue;
+
+    detected_mac_[count]  = macs[i].val;
+    detected_axis_[count] = LINEAR_AXIS_UNKNOWN;
+    count++;
+  }
+
+  if (!count)
+    return E_SUCCESS;
+
+  WRITE(X_DIR_PIN, LOW);
+  WRITE(Y_DIR_PIN, LOW);
+  WRITE(Z_DIR_PIN, LOW);
+
+  for (i = LINEAR_AXIS_X1; i <= LINEAR_AXIS_Z1; i++)  {
+    WRITE(pins[i], HIGH);
+
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    n = 0;
+    for (j = 0; j < count; j++) {
+      if (detected_axis_[j] != LINEAR_AXIS_UNKNOWN)
+        continue;
+
+      cmd[n].mac.val = detected_mac_[j];
+      cmd[n].data    = buffer[n];
+      cmd[n].data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_CONFIG_REQ;
+      cmd[n].data[MODULE_EXT_CMD_INDEX_DATA] = i;
+      cmd[n].length  = 2;
+      index[n++]     = j;
+    }
+
+    canhost.SendExtCmdBatch(cmd, ret, n, sizeof(buffer[0]), 500);
+
+    for (j = 0; j < n; j++) {
+      if (ret[j] == E_SUCCESS && cmd[j].data[MODULE_EXT_CMD_INDEX_DATA] == 1) {
+        detected_axis_[index[j]]    = i;
+        detected_endstop_[index[j]] = cmd[j].data[MODULE_EXT_CMD_INDEX_DATA + 3];
+      }
+    }
+
+    WRITE(pins[i], LOW);
+  }
+
+  if (modulecache.state() != MODULE_CACHE_STATE_LEARN)
+    return E_SUCCESS;
+
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < count; j++) {
+      cmd[j].mac.val = detected_mac_[j];
+      cmd[j].data    = buffer[j];
+      cmd[j].data[MODULE_EXT_CMD_INDEX_ID]   = reqs[i];
+      cmd[j].data[MODULE_EXT_CMD_INDEX_DATA] = 0;
+      cmd[j].length  = 2;
+    }
+
+    canhost.SendExtCmdBatch(cmd, ret, count, sizeof(buffer[0]), 500);
+  }
+
+  return E_SUCCESS;
+}
+
+
 LinearAxisType Linear::DetectAxis(MAC_t &mac, uint8_t &endstop) {
   CanExtCmd_t cmd;
   uint8_t     buffer[16];
+  MAC_t       detected;
 
   int i;
   int pins[3] = {X_DIR_PIN, Y_DIR_PIN, Z_DIR_PIN};
 
+  // take result of PreInit() if we have, it is used only once
+  for (i = 0; i < LINEAR_AXIS_MAX; i++) {
+    detected.val = detected_mac_[i];
+    if (detected.val == MODULE_MAC_ID_INVALID || detected.bits.id != mac.bits.id)
+      continue;
+
+    detected_mac_[i] = MODULE_MAC_ID_INVALID;
+    if (detected_axis_[i] < LINEAR_AXIS_UNKNOWN) {
+      endstop = detected_endstop_[i];
+      return (LinearAxisType)detected_axis_[i];
+    }
+    // module didn't answer, try again
+    break;
+  }
+
   cmd.mac    = mac;
   cmd.data   = buffer;
 
@@ -79,36 +184,81 @@ LinearAxisType Linear::DetectAxis(MAC_t &mac, uint8_t &endstop) {
 }
 
 
+// state of endstop which means it is triggered, index is EndstopEnum
+static const uint8_t endstop_hit_state[LINEAR_ENDSTOP_LATCH_MAX] = {
+  !X_MIN_ENDSTOP_INVERTING, !Y_MIN_ENDSTOP_INVERTING, !Z_MIN_ENDSTOP_INVERTING, !Z_MIN_PROBE_ENDSTOP_INVERTING,
+  !X_MAX_ENDSTOP_INVERTING, !Y_MAX_ENDSTOP_INVERTING, !Z_MAX_ENDSTOP_INVERTING
+};
+
+
+void Linear::UpdateEndstop(uint8_t index, uint8_t state) {
+  SetEndstopBit(index, state);
+
+  // latch position of the axis when endstop is triggered firstly after arming,
+  // index of MIN endstop equals to its axis, MAX endstops start from X_MAX
+  if (index < LINEAR_ENDSTOP_LATCH_MAX && index != Z_MIN_PROBE &&
+      (!!state) == endstop_hit_state[index] && !(endstop_latched_ & (1<<index))) {
+    endstop_latch_[index] = stepper.isr_position((AxisEnum)((index >= X_MAX)? index - X_MAX : index));
+    endstop_latched_ |= 1<<index;
+  }
+
+  // let Endstops::update() check it right now instead of waiting for next poll
+  NVIC_BASE->ISPR[LINEAR_ENDSTOP_IRQ / 32] = BIT(LINEAR_ENDSTOP_IRQ % 32);
+}
+
+
+float Linear::EndstopOverrun(uint8_t axis, int8_t dir) {
+  uint8_t index = (dir > 0)? X_MAX + axis : axis;
+  float   overrun;
+
+  if (axis > Z_AXIS || !(endstop_latched_ & (1<<index)))
+    return 0;
+
+  overrun = (stepper.position((AxisEnum)axis) - endstop_latch_[index]) * planner.steps_to_mm[axis];
+
+  // must be moving towards the endstop
+  if (overrun * dir < 0 || ABS(overrun) > LINEAR_ENDSTOP_OVERRUN_MAX)
+    return 0;
+
+  return overrun;
+}
+
+
 static void LinearCallbackEndstopX1(CanStdDataFrame_t &cmd) {
   switch (linear_p->machine_size())
   {
   case MACHINE_SIZE_A250:
   case MACHINE_SIZE_A350:
-    linear_p->SetEndstopBit(X_MIN, cmd.data[0]);
+    linear_p->UpdateEndstop(X_MIN, cmd.data[0]);
     break;
 
   case MACHINE_SIZE_A150:
   default:
-    linear_p->SetEndstopBit(X_MAX, cmd.data[0]);
+    linear_p->UpdateEndstop(X_MAX, cmd.data[0]);
     break;
   }
 }
 
 
 static void LinearCallbackEndstopY1(CanStdDataFrame_t &cmd) {
-  linear_p->SetEndstopBit(Y_MAX, cmd.data[0]);
+  linear_p->UpdateEndstop(Y_MAX, cmd.data[0]);
 }
 
 static void LinearCallbackEndstopY2(CanStdDataFrame_t &cmd) {
-  linear_p->SetEndstopBit(Y_MAX, cmd.data[0]);
+  linear_p->UpdateEndstop(Y_MAX, cmd.data[0]);
 }
 
 static void LinearCallbackEndstopZ1(CanStdDataFrame_t &cmd) {
-  linear_p->SetEndstopBit(Z_MAX, cmd.data[0]);
+  linear_p->UpdateEndstop(Z_MAX, cmd.data[0]);
 }
 
 static void LinearCallbackEndstopZ2(CanStdDataFrame_t &cmd) {
-  linear_p->SetEndstopBit(Z_MAX, cmd.data[0]);
+  linear_p->UpdateEndstop(Z_MAX, cmd.data[0]);
+}
+
+
+extern "C" void __irq_can2_sce(void) {
+  endstops.update();
 }
 
 
@@ -116,11 +266,12 @@ ErrCode Linear::Init(MAC_t &mac, uint8_t mac_index) {
   uint8_t   type;
   uint8_t   endstop;
 
-  CanExtCmd_t cmd;
-  uint8_t     func_buffer[16];
+  CanExtCmd_t cmd[3];
+  ErrCode     ret[3];
+  uint8_t     buffer[3][MODULE_FUNCTION_MAX_IN_ONE*2 + 2];
 
   Function_t    function;
-  message_id_t  message_id[4];
+  message_id_t  message_id[MODULE_FUNCTION_MAX_IN_ONE];
 
   CanStdCmdCallback_t cb = NULL;
   int i;
@@ -147,33 +298,30 @@ ErrCode Linear::Init(MAC_t &mac, uint8_t mac_index) {
 
   mac_index_[type] = mac_index;
 
-  cmd.mac    = mac;
-  cmd.data   = func_buffer;
-
-  // try to get linear length
-  cmd.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_LINEAR_LENGTH_REQ;
-  cmd.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
-  cmd.length = 2;
-  if (canhost.SendExtCmdSync(cmd, 500, 2) != E_SUCCESS)
-    return E_FAILURE;
-  length_[type] = (uint16_t)((cmd.data[2]<<24 | cmd.data[3]<<16 | cmd.data[4]<<8 | cmd.data[5]) / 1000);
+  for (i = 0; i < 3; i++) {
+    cmd[i].mac  = mac;
+    cmd[i].data = buffer[i];
+    cmd[i].data[MODULE_EXT_CMD_INDEX_DATA] = 0;
+    cmd[i].length = 2;
+  }
 
-  // try to get linear lead
-  cmd.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_LINEAR_LEAD_REQ;
-  cmd.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
-  cmd.length = 2;
-  if (canhost.SendExtCmdSync(cmd, 500, 2) != E_SUCCESS)
-    return E_FAILURE;
-  lead_[type] = (uint16_t)((cmd.data[2]<<24 | cmd.data[3]<<16 | cmd.data[4]<<8 | cmd.data[5]) / 1000);
+  // get linear length, lead and function ids from module in one round trip,
+  // or from module cache if PreInit() and CanHost have asked them
+  cmd[0].data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_LINEAR_LENGTH_REQ;
+  cmd[1].data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_LINEAR_LEAD_REQ;
+  cmd[2].data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_FUNCID_REQ;
+  cmd[2].length = 1;
 
-  LOG_I("\tlength: %u mm, lead: %u mm\n", length_[type], (200 * 16 / lead_[type]));
+  canhost.SendExtCmdBatch(cmd, ret, 3, sizeof(buffer[0]), 500, 2);
+  for (i = 0; i < 3; i++) {
+    if (ret[i] != E_SUCCESS)
+      return E_FAILURE;
+  }
 
-  cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_FUNCID_REQ;
-  cmd.length = 1;
+  length_[type] = (uint16_t)((buffer[0][2]<<24 | buffer[0][3]<<16 | buffer[0][4]<<8 | buffer[0][5]) / 1000);
+  lead_[type]   = (uint16_t)((buffer[1][2]<<24 | buffer[1][3]<<16 | buffer[1][4]<<8 | buffer[1][5]) / 1000);
 
-  // try to get function ids from module
-  if (canhost.SendExtCmdSync(cmd, 500, 2) != E_SUCCESS)
-    return E_FAILURE;
+  LOG_I("\tlength: %u mm, lead: %u mm\n", length_[type], (200 * 16 / lead_[type]));
 
   switch (type) {
   case LINEAR_AXIS_X1:
@@ -199,17 +347,20 @@ ErrCode Linear::Init(MAC_t &mac, uint8_t mac_index) {
     break;
   }
 
-  function.channel   = cmd.mac.bits.channel;
+  function.channel   = mac.bits.channel;
   function.sub_index = type;
   function.mac_index = mac_index;
   function.priority  = MODULE_FUNC_PRIORITY_DEFAULT;
 
-  if (cmd.data[MODULE_EXT_CMD_INDEX_DATA] > MODULE_FUNCTION_MAX_IN_ONE)
-    cmd.data[MODULE_EXT_CMD_INDEX_DATA] = MODULE_FUNCTION_MAX_IN_ONE;
+  nvic_irq_set_priority(LINEAR_ENDSTOP_IRQ, LINEAR_ENDSTOP_IRQ_PRIO);
+  nvic_irq_enable(LINEAR_ENDSTOP_IRQ);
+
+  if (cmd[2].data[MODULE_EXT_CMD_INDEX_DATA] > MODULE_FUNCTION_MAX_IN_ONE)
+    cmd[2].data[MODULE_EXT_CMD_INDEX_DATA] = MODULE_FUNCTION_MAX_IN_ONE;
 
   // register function ids to can host, it will assign message id
-  for (i = 0; i < cmd.data[MODULE_EXT_CMD_INDEX_DATA]; i++) {
-    function.id = (cmd.data[i*2 + 2]<<8 | cmd.data[i*2 + 3]);
+  for (i = 0; i < cmd[2].data[MODULE_EXT_CMD_INDEX_DATA]; i++) {
+    function.id = (cmd[2].data[i*2 + 2]<<8 | cmd[2].data[i*2 + 3]);
     if (function.id == MODULE_FUNC_ENDSTOP_STATE) {
       // just register callback for endstop
       // cache the message id for endstop for inquiring status of endstop later
@@ -224,7 +375,7 @@ ErrCode Linear::Init(MAC_t &mac, uint8_t mac_index) {
 
   linear_p = this;
 
-  return canhost.BindMessageID(cmd, message_id);
+  return canhost.BindMessageID(cmd[2], message_id);
 }
 
 ErrCode Linear::CheckModuleType() {
@@ -464,6 +615,10 @@ out:
   cmd.mac.val = canhost.mac(mac_index_[i]);
   event.data[0] = canhost.SendExtCmdSync(cmd, 500);
 
+  // cached length or lead is changed
+  if (event.data[0] == E_SUCCESS)
+    modulecache.Invalidate();
+
 error:
   return hmi.Send(event);
 }
@@ -24,6 +24,17 @@
 #include "module_base.h"
 #include "can_host.h"
 
+// endstop frames are handled in CAN RX IRQ, which pends this unused vector
+// to run Endstops::update() at once. It has the same priority as temperature
+// ISR, where endstops are polled, so they never preempt each other
+#define LINEAR_ENDSTOP_IRQ        NVIC_CAN2_SCE_IRQn
+#define LINEAR_ENDSTOP_IRQ_PRIO   TEMP_TIMER_IRQ_PRIO
+
+// ignore overrun larger than this, the latched position must be stale
+#define LINEAR_ENDSTOP_OVERRUN_MAX  2.0f
+// endstops from X_MIN to Z_MAX of EndstopEnum can be latched
+#define LINEAR_ENDSTOP_LATCH_MAX    7
+
 // to be compact with EndstopEnum
 enum LinearAxisType{
   LINEAR_AXIS_X1,
@@ -55,11 +66,13 @@ class Linear: public ModuleBase  {
         mac_index_[i]   = MODULE_MAC_INDEX_INVALID;
         endstop_msg_[i] = MODULE_MESSAGE_ID_INVALID;
         length_[i]      = 0;
+        detected_mac_[i] = MODULE_MAC_ID_INVALID;
       }
       machine_size_ = MACHINE_SIZE_UNKNOWN;
       endstop_      = 0xFFFFFFFF;
     }
 
+    ErrCode PreInit(MAC_t *macs, uint8_t total);
     ErrCode Init(MAC_t &mac, uint8_t mac_index);
 
     ErrCode CheckModuleType();
@@ -96,6 +109,14 @@ class Linear: public ModuleBase  {
     }
     bool GetEndstopBit(uint8_t index) { return (endstop_>>index & 0x1);}
 
+    // called in CAN RX IRQ when got state of endstop
+    void UpdateEndstop(uint8_t index, uint8_t state);
+
+    // start to latch stepper position when endstops are triggered
+    void ArmEndstopLatch() { endstop_latched_ = 0; }
+    // distance in mm the axis has moved since its endstop was triggered
+    float EndstopOverrun(uint8_t axis, int8_t dir);
+
     uint32_t endstop() { return endstop_; }
 
     MachineSize machine_size() { return machine_size_; }
@@ -114,6 +135,15 @@ class Linear: public ModuleBase  {
     message_id_t  endstop_msg_[LINEAR_AXIS_MAX];
     uint32_t      endstop_;
 
+    // axes detected together in PreInit(), taken by Init()
+    uint32_t      detected_mac_[LINEAR_AXIS_MAX];
+    uint8_t       detected_axis_[LINEAR_AXIS_MAX];
+    uint8_t       detected_endstop_[LINEAR_AXIS_MAX];
+
+    // stepper position when endstop was triggered, index is EndstopEnum
+    volatile uint32_t endstop_latched_ = 0;
+    int32_t       endstop_latch_[LINEAR_ENDSTOP_LATCH_MAX];
+
     MachineSize   machine_size_;
 };
 
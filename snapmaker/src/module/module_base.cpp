@@ -50,123 +50,273 @@ uint16_t ModuleBase::timer_in_static_process_ = 0;
 ModuleToolHeadType ModuleBase::toolhead_ = MODULE_TOOLHEAD_UNKNOW;
 
 
-ErrCode ModuleBase::Upgrade(MAC_t &mac, uint32_t fw_addr, uint32_t fw_length) {
-  ErrCode     ret;
-  CanExtCmd_t cmd;
+// ack from module will be routed to node of this module
+static void UpgradeSendReq(ModuleUpgradeNode_t &node, CanExtCmd_t &cmd, uint8_t retry, uint32_t timeout_ms) {
+  cmd.mac = node.mac;
+  canhost.SendExtCmd(cmd);
 
-  uint32_t tmp_u32;
-  int      i;
+  node.retry    = retry;
+  node.deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+}
+
+
+static void UpgradeReportProgress(ModuleUpgradeNode_t &node, uint8_t progress, bool force=false) {
+  // don't flood screen, report every 5 percent
+  if (!force && progress < node.progress + 5)
+    return;
+
+  node.progress = progress;
+  upgrade.SendModuleUpgradeStatus(UPGRADE_STA_UPGRADING_EM, node.mac.val, progress);
+}
 
-  uint16_t total_packet;
-  uint16_t packet_length;
-  uint16_t packet_index;
 
-  cmd.mac  = mac;
-  cmd.data = (uint8_t *)pvPortMalloc(528);
-  if (!cmd.data) {
+/* Upgrade modules in parallel
+ * Every module pulls packets by its own pace, we just serve the
+ * requests from all modules in one loop, so modules on CAN1 and
+ * CAN2 are upgraded at the same time
+ */
+ErrCode ModuleBase::Upgrade(MAC_t *mac, uint8_t total, uint32_t fw_addr, uint32_t fw_length) {
+  ModuleUpgradeNode_t *nodes;
+  CanExtCmd_t tx;
+  uint8_t    *rx;
+  MAC_t       rx_mac;
+  uint8_t     version[VERSION_STRING_SIZE + 2];
+  uint8_t     version_length;
+
+  uint32_t    tmp_u32;
+  TickType_t  now;
+  TickType_t  wait;
+  int         i;
+  int         active;
+  ErrCode     ret = E_SUCCESS;
+
+  uint16_t    total_packet;
+  uint16_t    content_packet;
+  uint16_t    packet_length;
+  uint16_t    packet_index;
+  uint16_t    length;
+
+  if (!total)
+    return E_SUCCESS;
+
+  nodes   = (ModuleUpgradeNode_t *)pvPortMalloc(total * sizeof(ModuleUpgradeNode_t));
+  tx.data = (uint8_t *)pvPortMalloc(528);
+  rx      = (uint8_t *)pvPortMalloc(4 + 528);
+  if (!nodes || !tx.data || !rx) {
     LOG_I("Failed to apply mem\n");
-    return E_NO_MEM;
+    ret = E_NO_MEM;
+    goto out;
   }
 
-  LOG_I("\nStart upgrading: 0x%08X\n", mac.val);
-
-  cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_START_UPGRADE_REQ;
+  // upgrade request: [id][flag][version]
+  version[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_START_UPGRADE_REQ;
 
   // read flag in fw
   tmp_u32 = *((uint32_t *)(fw_addr + UPGRADE_FW_OFFSET_FLAG));
-  cmd.data[MODULE_EXT_CMD_INDEX_DATA] = (uint8_t)tmp_u32;
+  version[MODULE_EXT_CMD_INDEX_DATA] = (uint8_t)tmp_u32;
 
   // read version
   for (i = 0; i < VERSION_STRING_SIZE; i++) {
-    cmd.data[2+i] = *((uint8_t *)(fw_addr + UPGRADE_FW_OFFSET_VERSION + i));
-    if (cmd.data[2+i] == 0)
+    version[2+i] = *((uint8_t *)(fw_addr + UPGRADE_FW_OFFSET_VERSION + i));
+    if (version[2+i] == 0)
       break;
   }
-  cmd.length = 2 + i;
+  version_length = 2 + i;
 
-  // 1. send upgrade request to module
-  ret = canhost.SendExtCmdSync(cmd, 1000, 2);
-  if (ret != E_SUCCESS) {
-    LOG_I("Failed to req upgrade\n");
-    goto out;
-  }
+  total_packet = fw_length / UPGRADE_FW_OFFSET_FW_SIZE;
+  if (fw_length % UPGRADE_FW_OFFSET_FW_SIZE)
+    total_packet++;
 
-  // module reject to be upgraded
-  if (cmd.data[MODULE_EXT_CMD_INDEX_DATA] != 1) {
-    ret = E_SAME_STATE;
-    LOG_I("Reject to be upgraded\n");
-    goto out;
-  }
+  // module tells us when it got all packets, this is just for progress
+  if (fw_length > UPGRADE_FW_OFFSET_FW_CONTENT)
+    content_packet = (fw_length - UPGRADE_FW_OFFSET_FW_CONTENT + MODULE_UPGRADE_PACKET_SIZE - 1) / MODULE_UPGRADE_PACKET_SIZE;
+  else
+    content_packet = 1;
 
-  // 2. waiting for module become ready to receive fw
-  cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_UPGRADE_STATUS_REQ;
-  cmd.length = 1;
-  ret = canhost.SendExtCmdSync(cmd, 500, 10);
-  if (ret != E_SUCCESS) {
-    LOG_I("Failed to get up status\n");
-    goto out;
-  }
-  // timeout to be ready
-  if (cmd.data[MODULE_EXT_CMD_INDEX_DATA] != 1) {
-    LOG_I("Timeout to be ready\n");
-    ret = E_INVALID_STATE;
-    goto out;
+  // drop commands left in queue, all acks we need come in after this
+  canhost.FlushExtCmd();
+
+  // 1. send upgrade request to all modules
+  for (i = 0; i < total; i++) {
+    nodes[i].mac      = mac[i];
+    nodes[i].step     = MODULE_UPGRADE_STEP_START;
+    nodes[i].progress = 0;
+
+    LOG_I("Start upgrading: 0x%08X\n", mac[i].val);
+
+    memcpy(tx.data, version, version_length);
+    tx.length = version_length;
+    UpgradeSendReq(nodes[i], tx, 1, 1000);
   }
 
-  // 3. broadcast we are going to start upgrading one module
-  cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_INFORM_UPGRADE_START;
-  cmd.length = 1;
-  canhost.SendExtCmd(cmd);
+  active = total;
 
-  total_packet = fw_length / UPGRADE_FW_OFFSET_FW_SIZE;
-  if (fw_length % UPGRADE_FW_OFFSET_FW_SIZE)
-    total_packet++;
+  while (active > 0) {
+    // wait until the nearest deadline
+    now  = xTaskGetTickCount();
+    wait = portMAX_DELAY;
+    for (i = 0; i < total; i++) {
+      if (nodes[i].step >= MODULE_UPGRADE_STEP_DONE)
+        continue;
 
-  for (;;) {
-    // 4. wait packet request from module
-    cmd.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_TRANS_FW_ACK;
-    cmd.length = 528;
-    ret = canhost.WaitExtCmdAck(cmd, 500, 10);
-    if (ret != E_SUCCESS) {
-      LOG_I("Time out to get pack\n");
-      goto out;
+      if ((int32_t)(nodes[i].deadline - now) <= 0) {
+        wait = 0;
+        break;
+      }
+
+      if (nodes[i].deadline - now < wait)
+        wait = nodes[i].deadline - now;
     }
 
-    // packet index from module
-    packet_index = cmd.data[2]<<8 | cmd.data[3];
-    if (packet_index  >= total_packet) {
-      break;
+    length = canhost.ReceiveExtCmd(rx_mac, rx, 4 + 528, wait * portTICK_PERIOD_MS);
+
+    for (i = 0; length && i < total; i++) {
+      if (nodes[i].mac.bits.id == rx_mac.bits.id)
+        break;
     }
 
-    // length of this packet
-    if (fw_length - packet_index * MODULE_UPGRADE_PACKET_SIZE < MODULE_UPGRADE_PACKET_SIZE)
-      packet_length = tmp_u32 % MODULE_UPGRADE_PACKET_SIZE;
-    else
-      packet_length = MODULE_UPGRADE_PACKET_SIZE;
+    // got command from one of modules being upgraded
+    if (length && i < total) {
+      ModuleUpgradeNode_t &node = nodes[i];
+
+      switch (node.step) {
+      case MODULE_UPGRADE_STEP_START:
+        if (rx[MODULE_EXT_CMD_INDEX_ID] != MODULE_EXT_CMD_START_UPGRADE_ACK)
+          break;
+
+        // module reject to be upgraded
+        if (rx[MODULE_EXT_CMD_INDEX_DATA] != 1) {
+          LOG_I("0x%08X: Reject to be upgraded\n", node.mac.val);
+          node.step = MODULE_UPGRADE_STEP_REJECT;
+          active--;
+          break;
+        }
 
-    // start address of this packet
-    tmp_u32 = fw_addr + 2048 + packet_index * MODULE_UPGRADE_PACKET_SIZE;
+        // 2. waiting for module become ready to receive fw
+        tx.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_UPGRADE_STATUS_REQ;
+        tx.length = 1;
+        node.step = MODULE_UPGRADE_STEP_READY;
+        UpgradeSendReq(node, tx, 9, 500);
+        break;
+
+      case MODULE_UPGRADE_STEP_READY:
+        if (rx[MODULE_EXT_CMD_INDEX_ID] != MODULE_EXT_CMD_GET_UPGRADE_STATUS_ACK)
+          break;
+
+        // timeout to be ready
+        if (rx[MODULE_EXT_CMD_INDEX_DATA] != 1) {
+          LOG_I("0x%08X: Timeout to be ready\n", node.mac.val);
+          node.step = MODULE_UPGRADE_STEP_FAILED;
+          UpgradeReportProgress(node, MODULE_UPGRADE_PROGRESS_FAILED, true);
+          ret = E_INVALID_STATE;
+          active--;
+          break;
+        }
+
+        // 3. inform module we are going to start upgrading it
+        tx.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_INFORM_UPGRADE_START;
+        tx.length = 1;
+        node.step = MODULE_UPGRADE_STEP_TRANS;
+        UpgradeSendReq(node, tx, 9, 500);
+        UpgradeReportProgress(node, 0, true);
+        break;
+
+      case MODULE_UPGRADE_STEP_TRANS:
+        // 4. packet request from module
+        if (rx[MODULE_EXT_CMD_INDEX_ID] != MODULE_EXT_CMD_TRANS_FW_ACK)
+          break;
+
+        // packet index from module
+        packet_index = rx[2]<<8 | rx[3];
+        if (packet_index >= total_packet) {
+          LOG_I("0x%08X: Done\n", node.mac.val);
+          // 6. request to end upgrading
+          tx.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_END_UPGRADE_REQ;
+          tx.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
+          tx.length = 2;
+          tx.mac = node.mac;
+          canhost.SendExtCmd(tx);
+
+          node.step = MODULE_UPGRADE_STEP_DONE;
+          UpgradeReportProgress(node, 100, true);
+          active--;
+          break;
+        }
 
-    for (i = 0; i < packet_length; i++) {
-      cmd.data[2 + i] = *((uint8_t*)(tmp_u32 + i));
+        // length of this packet
+        if (fw_length - packet_index * MODULE_UPGRADE_PACKET_SIZE < MODULE_UPGRADE_PACKET_SIZE)
+          packet_length = fw_length % MODULE_UPGRADE_PACKET_SIZE;
+        else
+          packet_length = MODULE_UPGRADE_PACKET_SIZE;
+
+        // 5. send packet to module
+        tx.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_TRANS_FW_REQ;
+        tx.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
+        memcpy(tx.data + 2, (uint8_t *)(fw_addr + UPGRADE_FW_OFFSET_FW_CONTENT + packet_index * MODULE_UPGRADE_PACKET_SIZE), packet_length);
+        tx.length = 2 + packet_length;
+        UpgradeSendReq(node, tx, 9, 500);
+        UpgradeReportProgress(node, packet_index < content_packet? (uint32_t)packet_index * 100 / content_packet : 99);
+        break;
+
+      default:
+        break;
+      }
     }
 
-    // 5. send packet to module
-    cmd.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_TRANS_FW_REQ;
-    cmd.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
-    cmd.length = 2 + packet_length;
-    canhost.SendExtCmd(cmd);
-  }
+    // check if modules have no response
+    now = xTaskGetTickCount();
+    for (i = 0; i < total; i++) {
+      ModuleUpgradeNode_t &node = nodes[i];
+
+      if (node.step >= MODULE_UPGRADE_STEP_DONE || (int32_t)(node.deadline - now) > 0)
+        continue;
+
+      if (node.retry == 0) {
+        LOG_I("0x%08X: Timeout in step %u\n", node.mac.val, node.step);
+        node.step = MODULE_UPGRADE_STEP_FAILED;
+        UpgradeReportProgress(node, MODULE_UPGRADE_PROGRESS_FAILED, true);
+        ret = E_TIMEOUT;
+        active--;
+        continue;
+      }
 
-  LOG_I("Done\n");
-  // 6. request to end upgrading
-  cmd.data[MODULE_EXT_CMD_INDEX_ID]   = MODULE_EXT_CMD_END_UPGRADE_REQ;
-  cmd.data[MODULE_EXT_CMD_INDEX_DATA] = 0;
-  cmd.length = 2;
-  canhost.SendExtCmd(cmd);
+      node.retry--;
+
+      switch (node.step) {
+      case MODULE_UPGRADE_STEP_START:
+        memcpy(tx.data, version, version_length);
+        tx.length = version_length;
+        tx.mac = node.mac;
+        canhost.SendExtCmd(tx);
+        node.deadline = now + pdMS_TO_TICKS(1000);
+        break;
+
+      case MODULE_UPGRADE_STEP_READY:
+        tx.data[MODULE_EXT_CMD_INDEX_ID] = MODULE_EXT_CMD_GET_UPGRADE_STATUS_REQ;
+        tx.length = 1;
+        tx.mac = node.mac;
+        canhost.SendExtCmd(tx);
+        node.deadline = now + pdMS_TO_TICKS(500);
+        break;
+
+      case MODULE_UPGRADE_STEP_TRANS:
+        // module will request the packet again, just wait
+        node.deadline = now + pdMS_TO_TICKS(500);
+        break;
+
+      default:
+        break;
+      }
+    }
+  }
 
 out:
-  vPortFree(cmd.data);
+  if (rx)
+    vPortFree(rx);
+  if (tx.data)
+    vPortFree(tx.data);
+  if (nodes)
+    vPortFree(nodes);
 
   return ret;
 }
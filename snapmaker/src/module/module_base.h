@@ -48,6 +48,7 @@
 #define MODULE_SUPPORT_SAME_DEVICE_MAX  (8)
 
 #define MODULE_UPGRADE_PACKET_SIZE      (128)
+#define MODULE_UPGRADE_PROGRESS_FAILED  (0xFF)
 
 #define MODULE_TYPE_STATIC  (1)
 #define MODULE_TYPE_DYNAMIC (0)
@@ -228,6 +229,23 @@ enum ModuleToolHeadType {
   MODULE_TOOLHEAD_LASER
 };
 
+enum ModuleUpgradeStep: uint8_t {
+  MODULE_UPGRADE_STEP_START,    // wait for ack of upgrade request
+  MODULE_UPGRADE_STEP_READY,    // wait for module to be ready to receive fw
+  MODULE_UPGRADE_STEP_TRANS,    // serve packets requested by module
+  MODULE_UPGRADE_STEP_DONE,
+  MODULE_UPGRADE_STEP_REJECT,   // module don't need this fw
+  MODULE_UPGRADE_STEP_FAILED
+};
+
+typedef struct {
+  MAC_t      mac;
+  uint8_t    step;
+  uint8_t    retry;     // times to resend request or wait again when timeout
+  uint8_t    progress;  // percent of packets sent
+  TickType_t deadline;  // tick to give up waiting for module in current step
+} ModuleUpgradeNode_t;
+
 enum LockMarlinUartSource {
   LOCK_SOURCE_NONE,
   LOCK_SOURCE_ENCLOSURE,
@@ -238,7 +256,7 @@ class ModuleBase {
   public:
     ModuleBase(uint16_t id): device_id_(id) {}
 
-    static ErrCode Upgrade(MAC_t &mac, uint32_t fw_addr, uint32_t length);
+    static ErrCode Upgrade(MAC_t *mac, uint8_t total, uint32_t fw_addr, uint32_t length);
     static ErrCode InitModule8p(MAC_t &mac, int dir_pin, uint8_t index);
 
     static ModuleToolHeadType toolhead() { return toolhead_; }
@@ -259,6 +277,7 @@ class ModuleBase {
     static ErrCode SetMAC(SSTP_Event_t &event);
     static ErrCode GetMAC(SSTP_Event_t &event);
 
+    virtual ErrCode PreInit(MAC_t *macs, uint8_t total) { return E_SUCCESS; }  // Called before modules are initialized one by one
     virtual ErrCode Init(MAC_t &mac, uint8_t mac_index) { return E_SUCCESS; }
     virtual ErrCode PostInit() { return E_SUCCESS; }  // Called after all modules are initialized
     virtual void Process() { return; }
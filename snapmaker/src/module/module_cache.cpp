@@ -0,0 +1,299 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "module_cache.h"
+#include "can_host.h"
+
+#include "../common/debug.h"
+
+#include "src/core/macros.h"
+
+#include "flash_stm32.h"
+#include <string.h>
+
+#define CACHE_WORD(addr)        (*((volatile uint32_t *)(addr)))
+
+#define CACHE_MAGIC_ADDR        (FLASH_MODULE_CACHE)
+#define CACHE_COMMIT_ADDR       (FLASH_MODULE_CACHE + 4)
+#define CACHE_TOTAL_ADDR        (FLASH_MODULE_CACHE + 8)
+#define CACHE_ENTRY_ADDR(i)     (FLASH_MODULE_CACHE + 12 + (uint32_t)(i) * 8)
+#define CACHE_RECORD_ADDR       (CACHE_ENTRY_ADDR(MODULE_SUPPORT_CONNECTED_MAX))
+#define CACHE_END_ADDR          (FLASH_MODULE_CACHE + MODULE_CACHE_SIZE)
+
+// header of record: [request][param][length of request][length of ack]
+#define CACHE_KEY(req, param)   ((uint32_t)(req)<<24 | (uint32_t)(param)<<16)
+#define CACHE_KEY_MASK          (0xFFFF0000)
+#define CACHE_REQ_LENGTH(head)  (((head)>>8) & 0xFF)
+#define CACHE_ACK_LENGTH(head)  ((head) & 0xFF)
+#define CACHE_ALIGN(length)     (((length) + 3) & ~3)
+
+ModuleCache modulecache;
+
+
+uint32_t ModuleCache::HashVersion(uint8_t *ack, uint16_t length) {
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+
+  for (int i = 0; i < length; i++) {
+    hash ^= ack[i];
+    hash *= 16777619UL;
+  }
+
+  // 0 means we didn't get version
+  return hash? hash : 1;
+}
+
+
+// only requests whose acks never change without us are cached
+bool ModuleCache::Cacheable(uint8_t *req, uint16_t req_length) {
+  switch (req[MODULE_EXT_CMD_INDEX_ID]) {
+  case MODULE_EXT_CMD_GET_FUNCID_REQ:
+    return req_length == 1;
+
+  // param 0 is to get, 1 is to set
+  case MODULE_EXT_CMD_LINEAR_LENGTH_REQ:
+  case MODULE_EXT_CMD_LINEAR_LEAD_REQ:
+    return req_length == 2 && req[MODULE_EXT_CMD_INDEX_DATA] == 0;
+
+  default:
+    return false;
+  }
+}
+
+
+bool ModuleCache::Match(MAC_t *macs, uint32_t *ver_hash, uint8_t total) {
+  uint32_t mac;
+  int      i;
+  int      j;
+
+  if (CACHE_WORD(CACHE_MAGIC_ADDR) != MODULE_CACHE_MAGIC ||
+      CACHE_WORD(CACHE_COMMIT_ADDR) != MODULE_CACHE_COMMIT ||
+      CACHE_WORD(CACHE_TOTAL_ADDR) != total)
+    return false;
+
+  // MACs are unique, so same total and all found means same set
+  for (i = 0; i < total; i++) {
+    mac = macs[i].val & MODULE_CACHE_MAC_MASK;
+
+    for (j = 0; j < total; j++) {
+      if (CACHE_WORD(CACHE_ENTRY_ADDR(j)) == mac)
+        break;
+    }
+
+    if (j >= total || CACHE_WORD(CACHE_ENTRY_ADDR(j) + 4) != ver_hash[i])
+      return false;
+  }
+
+  return true;
+}
+
+
+uint32_t ModuleCache::FindRecord(uint32_t mac, uint32_t key) {
+  uint32_t addr = CACHE_RECORD_ADDR;
+  uint32_t head;
+
+  while (addr + 8 <= CACHE_END_ADDR) {
+    if (CACHE_WORD(addr) == MODULE_CACHE_NONE)
+      break;
+
+    head = CACHE_WORD(addr + 4);
+    if (CACHE_WORD(addr) == mac && (head & CACHE_KEY_MASK) == key)
+      return addr;
+
+    addr += 8 + CACHE_ALIGN(CACHE_ACK_LENGTH(head));
+  }
+
+  return 0;
+}
+
+
+void ModuleCache::Begin(MAC_t *macs, uint32_t *ver_hash, uint8_t total) {
+  int i;
+
+  state_ = MODULE_CACHE_STATE_OFF;
+
+  if (!total || total > MODULE_SUPPORT_CONNECTED_MAX)
+    return;
+
+  // cannot tell if firmware of modules is changed
+  for (i = 0; i < total; i++) {
+    if (!ver_hash[i]) {
+      LOG_I("Module cache: lack version of 0x%08X\n", macs[i].val);
+      return;
+    }
+  }
+
+  if (Match(macs, ver_hash, total)) {
+    LOG_I("Module cache: hit\n");
+    state_ = MODULE_CACHE_STATE_HIT;
+    return;
+  }
+
+  LOG_I("Module cache: modules changed, learning\n");
+
+  // no module is talking to us now, stalling CPU by erasing is harmless
+  FLASH_Unlock();
+  FLASH_ErasePage(FLASH_MODULE_CACHE);
+  FLASH_ProgramWord(CACHE_MAGIC_ADDR, MODULE_CACHE_MAGIC);
+  FLASH_ProgramWord(CACHE_TOTAL_ADDR, total);
+  for (i = 0; i < total; i++) {
+    FLASH_ProgramWord(CACHE_ENTRY_ADDR(i), macs[i].val & MODULE_CACHE_MAC_MASK);
+    FLASH_ProgramWord(CACHE_ENTRY_ADDR(i) + 4, ver_hash[i]);
+  }
+  FLASH_Lock();
+
+  record_addr_ = CACHE_RECORD_ADDR;
+  state_ = MODULE_CACHE_STATE_LEARN;
+}
+
+
+void ModuleCache::End() {
+  switch (state_) {
+  case MODULE_CACHE_STATE_LEARN:
+    FLASH_Unlock();
+    FLASH_ProgramWord(CACHE_COMMIT_ADDR, MODULE_CACHE_COMMIT);
+    FLASH_Lock();
+    state_ = MODULE_CACHE_STATE_OFF;
+    break;
+
+  case MODULE_CACHE_STATE_HIT:
+    // check what we took from cache in background
+    record_addr_ = CACHE_RECORD_ADDR;
+    state_ = MODULE_CACHE_STATE_VALIDATE;
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+bool ModuleCache::Get(CanExtCmd_t &cmd) {
+  uint32_t addr;
+  uint32_t head;
+
+  // in learning, acks got in this boot are taken, so what is asked for
+  // all modules together is not asked again module by module
+  if ((state_ != MODULE_CACHE_STATE_HIT && state_ != MODULE_CACHE_STATE_LEARN) ||
+      !Cacheable(cmd.data, cmd.length))
+    return false;
+
+  addr = FindRecord(cmd.mac.val & MODULE_CACHE_MAC_MASK,
+                    CACHE_KEY(cmd.data[MODULE_EXT_CMD_INDEX_ID], (cmd.length > 1)? cmd.data[MODULE_EXT_CMD_INDEX_DATA] : 0));
+  if (!addr)
+    return false;
+
+  head = CACHE_WORD(addr + 4);
+  cmd.length = CACHE_ACK_LENGTH(head);
+  memcpy(cmd.data, (void *)(addr + 8), cmd.length);
+
+  return true;
+}
+
+
+void ModuleCache::Put(MAC_t &mac, uint8_t *req, uint16_t req_length, uint8_t *ack, uint16_t ack_length) {
+  uint32_t key;
+  uint32_t u32data;
+  uint32_t addr;
+  int      i;
+  int      j;
+
+  if (state_ != MODULE_CACHE_STATE_LEARN || !Cacheable(req, req_length))
+    return;
+
+  if (ack_length > MODULE_CACHE_ACK_MAX || record_addr_ + 8 + CACHE_ALIGN(ack_length) > CACHE_END_ADDR)
+    return;
+
+  key = CACHE_KEY(req[MODULE_EXT_CMD_INDEX_ID], (req_length > 1)? req[MODULE_EXT_CMD_INDEX_DATA] : 0);
+
+  // asked again by retry
+  if (FindRecord(mac.val & MODULE_CACHE_MAC_MASK, key))
+    return;
+
+  addr = record_addr_;
+
+  FLASH_Unlock();
+  FLASH_ProgramWord(addr + 4, key | req_length<<8 | ack_length);
+  for (i = 0; i < ack_length; i += 4) {
+    u32data = 0xFFFFFFFF;
+    for (j = 0; j < 4 && i + j < ack_length; j++) {
+      u32data &= ~(0xFFUL << (j * 8));
+      u32data |= (uint32_t)ack[i + j] << (j * 8);
+    }
+    FLASH_ProgramWord(addr + 8 + i, u32data);
+  }
+  // record is visible after its MAC is programmed
+  FLASH_ProgramWord(addr, mac.val & MODULE_CACHE_MAC_MASK);
+  FLASH_Lock();
+
+  record_addr_ = addr + 8 + CACHE_ALIGN(ack_length);
+}
+
+
+bool ModuleCache::ValidateStep() {
+  CanExtCmd_t cmd;
+  // SendExtCmdSync() may take an ack of this size, even if we never cache it
+  uint8_t     buffer[CAN_EXT_WAIT_BUFFER_SIZE];
+  uint32_t    head;
+  uint16_t    length;
+
+  if (state_ != MODULE_CACHE_STATE_VALIDATE)
+    return false;
+
+  if (record_addr_ + 8 > CACHE_END_ADDR || CACHE_WORD(record_addr_) == MODULE_CACHE_NONE) {
+    LOG_I("Module cache: validated\n");
+    state_ = MODULE_CACHE_STATE_OFF;
+    return false;
+  }
+
+  head   = CACHE_WORD(record_addr_ + 4);
+  length = CACHE_ACK_LENGTH(head);
+
+  cmd.mac.val = CACHE_WORD(record_addr_);
+  cmd.data    = buffer;
+  cmd.data[MODULE_EXT_CMD_INDEX_ID]   = head >> 24;
+  cmd.data[MODULE_EXT_CMD_INDEX_DATA] = head >> 16;
+  cmd.length  = CACHE_REQ_LENGTH(head);
+
+  // module may be removed, it doesn't mean cache is wrong
+  if (canhost.SendExtCmdSync(cmd, 500) == E_SUCCESS &&
+      (cmd.length != length || memcmp(buffer, (void *)(record_addr_ + 8), length))) {
+    LOG_E("Module cache: stale ack of 0x%08X for request %u\n", cmd.mac.val, head >> 24);
+    Invalidate();
+    return false;
+  }
+
+  record_addr_ += 8 + CACHE_ALIGN(length);
+
+  return true;
+}
+
+
+void ModuleCache::Invalidate() {
+  state_ = MODULE_CACHE_STATE_OFF;
+
+  if (CACHE_WORD(CACHE_COMMIT_ADDR) != MODULE_CACHE_COMMIT)
+    return;
+
+  // 0 can be programmed over any value
+  FLASH_Unlock();
+  FLASH_ProgramWord(CACHE_COMMIT_ADDR, 0);
+  FLASH_Lock();
+}
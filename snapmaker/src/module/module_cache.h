@@ -0,0 +1,89 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_MODULE_CACHE_H_
+#define SNAPMAKER_MODULE_CACHE_H_
+
+#include "../common/error.h"
+
+#include "can_host.h"
+
+// acks of static requests from modules are cached in flash, so a known
+// set of modules can be brought up without asking them again
+//
+// layout of the page:
+// [magic][commit][total][mac, hash of version] * MODULE_SUPPORT_CONNECTED_MAX
+// then records: [mac][request, param, length of request and ack][ack, word aligned]
+#define MODULE_CACHE_MAGIC        (0x4D430001)
+#define MODULE_CACHE_COMMIT       (0x5555AAAA)
+#define MODULE_CACHE_NONE         (0xFFFFFFFF)
+
+// id and channel of MAC, topology is changed if channel is changed
+#define MODULE_CACHE_MAC_MASK     (0x3FFFFFFF)
+
+// size of biggest ack we cache, ack of function ids
+#define MODULE_CACHE_ACK_MAX      (MODULE_FUNCTION_MAX_IN_ONE*2 + 2)
+
+
+typedef enum {
+  MODULE_CACHE_STATE_OFF,       // not used in this boot
+  MODULE_CACHE_STATE_LEARN,     // acks are recorded when modules answer, and taken if asked again
+  MODULE_CACHE_STATE_HIT,       // acks are taken from cache
+  MODULE_CACHE_STATE_VALIDATE,  // checking cache with modules after booting
+} ModuleCacheState;
+
+
+class ModuleCache {
+  public:
+    // called after discovering modules, hashes are from acks of version
+    void Begin(MAC_t *macs, uint32_t *ver_hash, uint8_t total);
+    // called after all modules are initialized
+    void End();
+
+    // take ack of cmd from cache, return false if it is not cached
+    bool Get(CanExtCmd_t &cmd);
+    // record ack of request, req is the first 2 bytes of request
+    void Put(MAC_t &mac, uint8_t *req, uint16_t req_length, uint8_t *ack, uint16_t ack_length);
+
+    // check one record with its module every call, return false when finished
+    bool ValidateStep();
+
+    // make cache invalid, modules will be asked again in next boot
+    void Invalidate();
+
+    static uint32_t HashVersion(uint8_t *ack, uint16_t length);
+
+    ModuleCacheState state() { return state_; }
+
+  private:
+    bool Cacheable(uint8_t *req, uint16_t req_length);
+    bool Match(MAC_t *macs, uint32_t *ver_hash, uint8_t total);
+    uint32_t FindRecord(uint32_t mac, uint32_t key);
+
+  private:
+    ModuleCacheState state_ = MODULE_CACHE_STATE_OFF;
+
+    // where next record is programmed in learning, or checked in validating
+    uint32_t record_addr_;
+};
+
+extern ModuleCache modulecache;
+
+#endif  // #ifndef SNAPMAKER_MODULE_CACHE_H_
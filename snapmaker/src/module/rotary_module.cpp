@@ -1,5 +1,6 @@
 #include "rotary_module.h"
 #include "src/inc/MarlinConfig.h"
+#include "src/module/planner.h"
 
 RotaryModule rotaryModule;
 
@@ -36,3 +37,22 @@ ErrCode RotaryModule::Init(MAC_t &mac, uint8_t mac_index) {
   return E_SUCCESS;
 }
 
+
+ErrCode RotaryModule::SetRadius(float radius) {
+  if (radius < 0)
+    return E_PARAM;
+
+  if (radius > 0 && status_ != ROTATE_ONLINE)
+    return E_INVALID_STATE;
+
+  // blocks in queue were planned with the old radius
+  planner.synchronize();
+  planner.set_rotary_radius(radius);
+
+  return E_SUCCESS;
+}
+
+
+float RotaryModule::radius() {
+  return planner.rotary_radius;
+}
@@ -56,6 +56,13 @@ class RotaryModule: public ModuleBase {
      */
     ROTATE_STATE_E status() {return status_;}
     void status(ROTATE_STATE_E s) {status_ = s;}
+
+    /**
+     * Radius of workpiece in mm, B moves are planned by distance on its
+     * surface. 0 turns it off, then B degrees are taken as mm.
+     */
+    ErrCode SetRadius(float radius);
+    float radius();
   private:
     ROTATE_STATE_E status_ = ROTATE_OFFLINE;
 };
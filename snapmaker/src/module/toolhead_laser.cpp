@@ -135,6 +135,7 @@ void ToolHeadLaser::TurnOn() {
 
   state_ = TOOLHEAD_LASER_STATE_ON;
   CheckFan(power_pwm_);
+  planner_pwm_ = power_pwm_;
   tim_pwm(power_pwm_);
 }
 
@@ -145,10 +146,50 @@ void ToolHeadLaser::TurnOff() {
 
   state_ = TOOLHEAD_LASER_STATE_OFF;
   CheckFan(0);
+  planner_pwm_ = 0;
   tim_pwm(0);
 }
 
 
+void ToolHeadLaser::PlanOn() {
+  if (state_ == TOOLHEAD_LASER_STATE_OFFLINE)
+    return;
+
+  state_ = TOOLHEAD_LASER_STATE_ON;
+  CheckFan(power_pwm_);
+  planner_pwm_ = power_pwm_;
+}
+
+
+void ToolHeadLaser::PlanOff() {
+  if (state_ == TOOLHEAD_LASER_STATE_OFFLINE)
+    return;
+
+  state_ = TOOLHEAD_LASER_STATE_OFF;
+  CheckFan(0);
+  planner_pwm_ = 0;
+}
+
+
+void ToolHeadLaser::PlanPower(float power) {
+  SetPower(power);
+
+  if (state_ == TOOLHEAD_LASER_STATE_ON) {
+    CheckFan(power_pwm_);
+    planner_pwm_ = power_pwm_;
+  }
+}
+
+
+void ToolHeadLaser::ApplyBlockPwm(uint16_t pwm) {
+  // block may be planned before power limit is changed
+  if (pwm > power_limit_pwm_)
+    pwm = power_limit_pwm_;
+
+  TimSetPwm(pwm);
+}
+
+
 void ToolHeadLaser::SetOutput(float power) {
   SetPower(power);
   TurnOn();
@@ -170,6 +211,12 @@ void ToolHeadLaser::SetPower(float power) {
   integer = (int)power;
   decimal = power - integer;
 
+  // avoid reading beyond the table for full power
+  if (integer >= TOOLHEAD_LASER_POWER_NORMAL_LIMIT) {
+    power_pwm_ = power_table[TOOLHEAD_LASER_POWER_NORMAL_LIMIT];
+    return;
+  }
+
   power_pwm_ = (uint16_t)(power_table[integer] + (power_table[integer + 1] - power_table[integer]) * decimal);
 }
 
@@ -182,7 +229,10 @@ void ToolHeadLaser::SetPowerLimit(float limit) {
 
   power_limit_ = limit;
 
-  SetPower(power_val_);
+  SetPower(limit);
+  power_limit_pwm_ = power_pwm_;
+
+  SetPower(cur_power);
   power_val_ = cur_power;
 
   // check if we need to change current output
@@ -88,6 +88,8 @@ class ToolHeadLaser: public ModuleBase {
       power_limit_ = 100;
       power_pwm_   = 0;
       power_val_   = 0;
+      planner_pwm_ = 0;
+      power_limit_pwm_ = 255;
       mac_index_   = MODULE_MAC_INDEX_INVALID;
 
       state_ = TOOLHEAD_LASER_STATE_OFFLINE;
@@ -113,6 +115,13 @@ class ToolHeadLaser: public ModuleBase {
     void SetOutput(float power);      // change power_val_, power_pwm_ and actual output
     void SetPowerLimit(float limit);  // change power_val_, power_pwm_ and power_limit_, may change actual output if current output is beyond limit
 
+    // following APIs change output with planner: output is changed by stepper ISR
+    // when following blocks start, so no need to synchronize planner
+    void PlanOn();                    // output power_pwm_ from next block
+    void PlanOff();                   // turn off output from next block
+    void PlanPower(float power);      // change power_val_, power_pwm_ and output of next block if laser is on
+    void ApplyBlockPwm(uint16_t pwm); // called by stepper ISR when a block with laser output starts
+
     void TryCloseFan();
     bool IsOnline(uint8_t sub_index = 0) { return mac_index_ != MODULE_MAC_INDEX_INVALID; }
 
@@ -136,6 +145,7 @@ class ToolHeadLaser: public ModuleBase {
 
     uint16_t power_pwm() { return power_pwm_; };
     void power_pwm(uint16_t pwm) { power_pwm_ = pwm; }
+    uint16_t planner_pwm() { return planner_pwm_; }
     uint16_t tim_pwm();
     void tim_pwm(uint16_t pwm);
 
@@ -166,6 +176,8 @@ class ToolHeadLaser: public ModuleBase {
     float power_limit_;
 
     uint16_t power_pwm_;
+    uint16_t planner_pwm_;      // output for new planned blocks
+    uint16_t power_limit_pwm_;  // max output for blocks planned before changing limit
 
     uint8_t  fan_state_;
     uint16_t fan_tick_;
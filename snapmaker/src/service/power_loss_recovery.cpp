@@ -47,10 +47,51 @@
 
 #include HAL_PATH(src/HAL, HAL.h)
 
+#include <stddef.h>
+#include <libmaple/nvic.h>
 
-#define FLASH_PAGE_SIZE				2048
-#define FLASH_RECORD_PAGES		(MARLIN_POWERPANIC_SIZE / 2048)
-#define RECORD_COUNT_PER_PAGE	(FLASH_PAGE_SIZE / (sizeof(PowerLossRecoveryData_t) + 8))
+
+/* layout of power-loss area in flash:
+ * page 0: index, word 0 is magic, then one word for every record which is
+ *         begun, its value is the index of record. Entries are programmed in
+ *         order, so we can find the newest record by binary search.
+ * page 1...: records, every record is [begin flag][commit flag][data]
+ * The area is only erased when we are not working.
+ */
+#define FLASH_PAGE_SIZE       2048
+#define FLASH_RECORD_PAGES    (MARLIN_POWERPANIC_SIZE / 2048)
+
+#define PL_INDEX_ADDR         (FLASH_MARLIN_POWERPANIC)
+#define PL_INDEX_MAGIC        (0x504C0000 | (uint32_t)sizeof(PowerLossRecoveryData_t))
+#define PL_INDEX_COUNT        (FLASH_PAGE_SIZE / 4 - 1)
+
+#define PL_RECORD_ADDR        (FLASH_MARLIN_POWERPANIC + FLASH_PAGE_SIZE)
+#define PL_RECORD_SIZE        (sizeof(PowerLossRecoveryData_t) + 8)
+#define PL_RECORD_COUNT       ((MARLIN_POWERPANIC_SIZE - FLASH_PAGE_SIZE) / PL_RECORD_SIZE)
+#define PL_RECORD_BEGIN       (0x5555)
+#define PL_RECORD_COMMIT      (0x5555)
+#define PL_RECORD_NONE        (0xFFFF)
+
+// format the area when starting new job, if free records are less than it
+#define PL_RECORD_RESERVE     (8)
+
+// size of the part which is journaled before power-loss
+#define PL_STABLE_SIZE        (offsetof(PowerLossRecoveryData_t, CheckSum))
+
+// interval to check if stable part is changed, uint: 10ms
+#define PL_JOURNAL_INTERVAL   (100)
+// words to program every 10ms, programming flash will stall the CPU
+#define PL_JOURNAL_STEP_WORDS (2)
+
+static_assert(PL_STABLE_SIZE % 4 == 0, "CheckSum of power-loss data must be word aligned");
+static_assert(PL_RECORD_COUNT < PL_INDEX_COUNT, "too many power-loss records for index page");
+
+// cpsid of nvic_globalirq_disable() doesn't stop compiler from using what
+// it read before, state changed by ISRs must be read again after it
+#define PL_COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define PL_RECORD(i)          (PL_RECORD_ADDR + (uint32_t)(i) * PL_RECORD_SIZE)
+#define PL_INDEX(i)           (PL_INDEX_ADDR + 4 + (uint32_t)(i) * 4)
 
 PowerLossRecovery pl_recovery;
 
@@ -108,6 +149,43 @@ void PowerLossRecovery::Init(void) {
 }
 
 
+ /**
+ * program words to flash, flash should be unlocked
+ */
+static void ProgramWords(uint32_t addr, uint8_t *pBuff, uint32_t size) {
+  uint32_t u32data;
+
+  for (uint32_t i = 0; i < size; i = i + 4) {
+    u32data = (pBuff[i + 3] << 24) | (pBuff[i + 2] << 16) | (pBuff[i + 1] << 8) | pBuff[i];
+    FLASH_ProgramWord(addr, u32data);
+    addr = addr + 4;
+  }
+}
+
+
+ /**
+ * erase all power-loss area, and write magic of index
+ */
+void PowerLossRecovery::Format(void) {
+  uint32_t addr = FLASH_MARLIN_POWERPANIC;
+
+  FLASH_Unlock();
+  for (int i = 0; i < FLASH_RECORD_PAGES; i++) {
+    FLASH_ErasePage(addr);
+    addr += FLASH_PAGE_SIZE;
+  }
+  FLASH_ProgramWord(PL_INDEX_ADDR, PL_INDEX_MAGIC);
+  FLASH_Lock();
+
+  next_slot_ = 0;
+  next_index_ = 0;
+  pre_slot_ = PL_RECORD_NONE;
+  journal_slot_ = PL_RECORD_NONE;
+
+  LOG_I("PL: formatted flash\n");
+}
+
+
  /**
  *Load power panic data from flash
  *return:
@@ -117,180 +195,139 @@ void PowerLossRecovery::Init(void) {
  */
 int PowerLossRecovery::Load(void)
 {
-  uint8_t *pSrcBuff, *pDstBuff;
-	uint32_t i;
-	uint32_t tmpIndex;
-	uint32_t addr;
-	uint32_t RecordSize;
-	uint32_t TotalCount;
-	uint32_t Flag;
-  int ret = 0;
-
-	// size of one record, prefix 8 bytes
-	RecordSize = (sizeof(PowerLossRecoveryData_t) + 8);
-
-	// total records which can be saved
-	TotalCount = RECORD_COUNT_PER_PAGE * FLASH_RECORD_PAGES;
-  tmpIndex = 0;
-
-	// find the first free block
-	for (i = 0; i < TotalCount; i++) {
-		// start addr for every record
-		addr = (i / RECORD_COUNT_PER_PAGE) * 2048 + (i % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC;
-
-		// read the start flag
-		Flag = *((uint32_t*)addr);
-
-		if (Flag == 0xffffffff) {
-			// tmpIndex point to a possible Non-free block, if i==0, it will ponit to the last block
-			tmpIndex = (i + TotalCount - 1) % TotalCount;
-			break;
-		}
-	}
+  uint32_t low, high, mid;
+  uint32_t addr;
+  uint32_t slot;
+  uint32_t Flag;
+  uint32_t Checksum;
+  uint32_t tmpChecksum;
+  uint8_t  *pBuff;
+  int ret;
 
-	LOG_I("PL: first free block index: %d\n", tmpIndex);
+  pre_slot_ = PL_RECORD_NONE;
+  journal_slot_ = PL_RECORD_NONE;
+  pre_data_.Valid = 0;
 
-	// try to find a non-free block
-	for (i = 0; i < TotalCount; i++)
-	{
-		// start address of one block
-		addr = (tmpIndex / RECORD_COUNT_PER_PAGE) * 2048 + (tmpIndex % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC;
-		Flag = *((uint32_t*)addr);
+  // data written by old layout or flash was damaged
+  if (*((uint32_t *)PL_INDEX_ADDR) != PL_INDEX_MAGIC) {
+    LOG_I("PL: no index\n");
+    Format();
+    return 2;
+  }
 
-		// if its start flag is not 0xffffffff, it is a non-free block
-		if (Flag != 0xffffffff)
-			break;
+  // entries are programmed in order, find the first free entry
+  low = 0;
+  high = PL_INDEX_COUNT;
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (*((uint32_t *)PL_INDEX(mid)) == 0xffffffff)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+  next_index_ = low;
 
-		// index tmpIndex forward until finding a non-free block or i reach TotalCount
-		// if i reach TotalCount, it indicates all block is free
-		tmpIndex = (tmpIndex + TotalCount - 1) % TotalCount;
-	}
+  if (next_index_ == 0) {
+    // never recording any power-loss data
+    next_slot_ = 0;
+    LOG_I("PL: no any data\n");
+    return 2;
+  }
 
-	LOG_I("PL: first non-free block index: %d\n", tmpIndex);
+  slot = *((uint32_t *)PL_INDEX(next_index_ - 1));
+  if (slot >= PL_RECORD_COUNT || *((uint32_t *)PL_RECORD(slot)) != PL_RECORD_BEGIN) {
+    LOG_E("PL: invalid index entry[%u]: 0x%X\n", next_index_ - 1, slot);
+    Format();
+    return 1;
+  }
 
-	// check the last value of flag
-	if(Flag == 0xffffffff) {
-		// arrive here we know the flash area is empty, never recording any power-loss data
-		// make index to be 0
-		WriteIndex = 0;
-		// make flag to be invalid
-		pre_data_.Valid = 0;
-		// return value
-		ret = 2;
+  next_slot_ = slot + 1;
+  LOG_I("PL: newest record: %u, next: %u\n", slot, next_slot_);
 
-		LOG_I("PL: no any data\n");
-	}
-	else {
-		// arrive here we may have avalible power-loss data
-
-		// check firstly whether this block is masked
-		addr = (tmpIndex / RECORD_COUNT_PER_PAGE) * 2048 + (tmpIndex % RECORD_COUNT_PER_PAGE) * RecordSize + 4 + FLASH_MARLIN_POWERPANIC;
-		Flag = *((uint32_t*)addr);
-		if(Flag != 0x5555) {
-			// alright, this block has been masked by Screen
-			LOG_I("PL: data has been masked\n");
-			// make data to be invalid
-			pre_data_.Valid = 0;
-			ret = 1;
-		}
-		else {
-			// Good, it seems we have new power-loss data, have a look at whether it is available
-			// read the data to buffer
-			addr = (tmpIndex / RECORD_COUNT_PER_PAGE) * 2048 + (tmpIndex % RECORD_COUNT_PER_PAGE) * RecordSize + 8 + FLASH_MARLIN_POWERPANIC;
-			pSrcBuff = (uint8_t*)addr;
-			pDstBuff = (uint8_t*)&pre_data_;
-			for (i = 0; i < sizeof(PowerLossRecoveryData_t); i++)
-				*pDstBuff++ = *pSrcBuff++;
-
-			// calculate checksum
-			uint32_t Checksum;
-			uint32_t tmpChecksum;
-			tmpChecksum = pre_data_.CheckSum;
-			pre_data_.CheckSum = 0;
-			Checksum = 0;
-			pSrcBuff = (uint8_t*)&pre_data_;
-			for (i = 0; i < sizeof(PowerLossRecoveryData_t); i++)
-				Checksum += pSrcBuff[i];
-			//Checksum = Checksum - (uint8_t)(cur_data_.CheckSum >> 24) - (uint8_t)(cur_data_.CheckSum >> 16) - (uint8_t)(cur_data_.CheckSum >> 8) -
-			// (uint8_t)(cur_data_.CheckSum);
-
-			if (Checksum != tmpChecksum) {
-				// shit! uncorrent checksum, flash was damaged?
-				LOG_E("PL: Error checksum[0x%08x] for power-loss data, should be [0x%08x]\n", tmpChecksum, Checksum);
-
-				// anyway, we mask this block
-				FLASH_Unlock();
-				addr = (tmpIndex / RECORD_COUNT_PER_PAGE) * 2048 + (WriteIndex % RECORD_COUNT_PER_PAGE) * RecordSize + 4 + FLASH_MARLIN_POWERPANIC;
-				FLASH_ProgramWord(addr, 0);
-				FLASH_Lock();
-				// make data to be invalid
-				pre_data_.Valid = 0;
-				ret = 1;
-			}
-			else {
-				// correct checksum
-				pre_data_.Valid = 1;
-			}
-		}
+  Flag = *((uint32_t *)(PL_RECORD(slot) + 4));
+  if (Flag == 0xffffffff) {
+    // record of last job was never committed, no power-loss in last job
+    LOG_I("PL: no data of last job\n");
+    ret = 2;
+  }
+  else if (Flag != PL_RECORD_COMMIT) {
+    // alright, this block has been masked by Screen
+    LOG_I("PL: data has been masked\n");
+    ret = 1;
+  }
+  else {
+    // Good, it seems we have new power-loss data, have a look at whether it is available
+    memcpy(&pre_data_, (void *)(PL_RECORD(slot) + 8), sizeof(PowerLossRecoveryData_t));
+
+    tmpChecksum = pre_data_.CheckSum;
+    pre_data_.CheckSum = 0;
+    Checksum = 0;
+    pBuff = (uint8_t*)&pre_data_;
+    for (uint32_t i = 0; i < sizeof(PowerLossRecoveryData_t); i++)
+      Checksum += pBuff[i];
+
+    if (Checksum != tmpChecksum) {
+      // shit! uncorrent checksum, flash was damaged?
+      LOG_E("PL: Error checksum[0x%08x] for power-loss data, should be [0x%08x]\n", tmpChecksum, Checksum);
+
+      // anyway, we mask this block
+      FLASH_Unlock();
+      FLASH_ProgramWord(PL_RECORD(slot) + 4, 0);
+      FLASH_Lock();
+      pre_data_.Valid = 0;
+      ret = 1;
+    }
+    else {
+      // correct checksum
+      pre_data_.Valid = 1;
+      pre_slot_ = slot;
+      ret = 0;
+    }
+  }
 
-		// make write index to point next block
-		WriteIndex = (tmpIndex + 1) % TotalCount;
-		LOG_I("PL: next write index: %u\n", WriteIndex);
-
-		// check if need to erase flash page
-		if ((WriteIndex % RECORD_COUNT_PER_PAGE) == 0)
-		{
-			// NOTE that: when WriteIndex point to the 2nd or 3rd pages firstly, this will be executed at every power-on.
-			// Because its previous block is not free, that is to say, the start flag is not 0xffffffff
-			// Though this may be executed many times, the flash is only erased when it is not empty.
-			// So it's no need to check if we need to erase flash at every power-on. Just do it.
-			FLASH_Unlock();
-			addr = (WriteIndex / RECORD_COUNT_PER_PAGE) * 2048 + (WriteIndex % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC;
-			FLASH_ErasePage(addr);
-			FLASH_Lock();
-
-			LOG_I("PL: erased next page, addr: 0x%X\n", addr);
-		}
-	}
+  // no data need to be kept, make room for next job now
+  if (ret != 0 && next_slot_ + PL_RECORD_RESERVE > PL_RECORD_COUNT)
+    Format();
 
   return ret;
 }
 
  /**
  * save the power panic data to flash
+ * if stable part has been journaled, only program the rest of record
  */
 void PowerLossRecovery::WriteFlash(void)
 {
   uint32_t addr;
-	uint32_t RecordSize;
-	uint32_t u32data;
-	uint8_t *pBuff;
-
-  //记录大小
-  RecordSize = (sizeof(PowerLossRecoveryData_t) + 8);
-  pBuff = (uint8_t *)&cur_data_;
+  uint8_t  *pBuff = (uint8_t *)&cur_data_;
 
-	//写一半标识
-	addr = (WriteIndex / RECORD_COUNT_PER_PAGE) * 2048 + (WriteIndex % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC;
-	u32data = 0x5555;
-	FLASH_Unlock();
-	FLASH_ProgramWord(addr, u32data);
+  FLASH_Unlock();
 
-	//地址
-	addr = (WriteIndex / RECORD_COUNT_PER_PAGE) * 2048 + (WriteIndex % RECORD_COUNT_PER_PAGE) * RecordSize + 8 + FLASH_MARLIN_POWERPANIC;
+  if (journal_slot_ != PL_RECORD_NONE && journal_written_ >= PL_STABLE_SIZE &&
+      memcmp(&cur_data_, &journal_, PL_STABLE_SIZE) == 0) {
+    addr = PL_RECORD(journal_slot_);
+    ProgramWords(addr + 8 + PL_STABLE_SIZE, pBuff + PL_STABLE_SIZE,
+                 sizeof(PowerLossRecoveryData_t) - PL_STABLE_SIZE);
+  }
+  else if (next_slot_ < PL_RECORD_COUNT && next_index_ < PL_INDEX_COUNT) {
+    // stable part is changed after journaling, write whole record
+    addr = PL_RECORD(next_slot_);
+    FLASH_ProgramWord(addr, PL_RECORD_BEGIN);
+    FLASH_ProgramWord(PL_INDEX(next_index_), next_slot_);
+    ProgramWords(addr + 8, pBuff, sizeof(PowerLossRecoveryData_t));
+    next_slot_++;
+    next_index_++;
+  }
+  else {
+    FLASH_Lock();
+    return;
+  }
 
-	for(uint32_t i=0;i<sizeof(PowerLossRecoveryData_t);i=i+4)
-	{
-		u32data = (pBuff[i + 3] << 24) | (pBuff[i + 2] << 16) | (pBuff[i + 1] << 8) | pBuff[i];
-		FLASH_ProgramWord(addr, u32data);
-		addr = addr + 4;
-	}
+  // commit the record
+  FLASH_ProgramWord(addr + 4, PL_RECORD_COMMIT);
+  FLASH_Lock();
 
-	//写完整标识
-	addr = (WriteIndex / RECORD_COUNT_PER_PAGE) * 2048 + (WriteIndex % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC + 4;
-	u32data = 0x5555;
-	FLASH_ProgramWord(addr, u32data);
-	FLASH_Lock();
+  journal_slot_ = PL_RECORD_NONE;
 }
 
  /**
@@ -298,16 +335,7 @@ void PowerLossRecovery::WriteFlash(void)
  */
 void PowerLossRecovery::ClearPowerPanicData(void)
 {
-  uint32_t addr;
-
-	addr = FLASH_MARLIN_POWERPANIC;
-	FLASH_Unlock();
-	for(int i=0; i<FLASH_RECORD_PAGES; i++)
-	{
-		FLASH_ErasePage(addr);
-		addr += 2048;
-	}
-	FLASH_Lock();
+  Format();
 }
 
  /**
@@ -315,54 +343,159 @@ void PowerLossRecovery::ClearPowerPanicData(void)
  */
 void PowerLossRecovery::MaskPowerPanicData(void)
 {
-	uint32_t RecordSize;
-	uint32_t TotalCount;
-	uint32_t addr;
-	uint16_t preIndex;
-
-	//记录大小
-	RecordSize = (sizeof(PowerLossRecoveryData_t) + 8);
-	//记录总空间
-	TotalCount = RECORD_COUNT_PER_PAGE * FLASH_RECORD_PAGES;
-
-	preIndex = (WriteIndex + TotalCount - 1) % TotalCount;
-
-	//计算地址
-	addr = (preIndex / RECORD_COUNT_PER_PAGE) * 2048 + (preIndex % RECORD_COUNT_PER_PAGE) * RecordSize + FLASH_MARLIN_POWERPANIC + 4;
-	FLASH_Unlock();
-	FLASH_ProgramWord(addr, 0);
-	FLASH_Lock();
+  if (pre_slot_ == PL_RECORD_NONE)
+    return;
+
+  FLASH_Unlock();
+  FLASH_ProgramWord(PL_RECORD(pre_slot_) + 4, 0);
+  FLASH_Lock();
+
+  pre_slot_ = PL_RECORD_NONE;
 }
 
 /*
- * save current working status to power panic data
- * return:
- *    0  - sucess
- *    -1 - failed
+ * journal stable part of current working status into a new record,
+ * then only a few words need to be programmed when power-loss.
+ * it's called by heartbeat task every 10ms, and programs a few words
+ * every time to limit the stall of CPU
  */
-int PowerLossRecovery::SaveEnv(void) {
-  int     i = 0;
-  uint8_t *pBuff;
+void PowerLossRecovery::Journal(void) {
+  PowerLossRecoveryData_t tmp;
+  uint32_t addr;
+  uint16_t slot;
 
-	LOOP_XN(idx) cur_data_.position_shift[idx] = position_shift[idx];
+  if (!enabled_ || quickstop.isTriggered() || systemservice.GetCurrentStatus() != SYSTAT_WORK)
+    return;
 
-	cur_data_.FilePosition = last_line_;
+  if (journal_slot_ != PL_RECORD_NONE && journal_written_ < PL_STABLE_SIZE) {
+    // don't let power-loss ISR program flash at the same time, and leave
+    // the record alone if the ISR came before us and has written it
+    nvic_globalirq_disable();
+    PL_COMPILER_BARRIER();
+    if (!quickstop.isTriggered() && journal_slot_ != PL_RECORD_NONE) {
+      addr = PL_RECORD(journal_slot_) + 8 + journal_written_;
+      FLASH_Unlock();
+      for (int i = 0; i < PL_JOURNAL_STEP_WORDS && journal_written_ < PL_STABLE_SIZE; i++) {
+        ProgramWords(addr, (uint8_t *)&journal_ + journal_written_, 4);
+        addr += 4;
+        journal_written_ += 4;
+      }
+      FLASH_Lock();
+    }
+    nvic_globalirq_enable();
+    return;
+  }
 
-	cur_data_.axes_relative_mode = relative_mode;
+  if (++journal_tick_ < PL_JOURNAL_INTERVAL)
+    return;
+  journal_tick_ = 0;
+
+  tmp = cur_data_;
+  SaveStableEnv(tmp);
+
+  if (journal_slot_ != PL_RECORD_NONE && memcmp(&tmp, &journal_, PL_STABLE_SIZE) == 0)
+    return;
+
+  nvic_globalirq_disable();
+  PL_COMPILER_BARRIER();
+
+  // power-loss ISR came after the check above, and has written the record
+  if (quickstop.isTriggered()) {
+    nvic_globalirq_enable();
+    return;
+  }
+
+  // keep the last record for WriteFlash() to write whole record
+  if (next_slot_ + 1 >= PL_RECORD_COUNT || next_index_ >= PL_INDEX_COUNT) {
+    journal_slot_ = PL_RECORD_NONE;
+    nvic_globalirq_enable();
+    return;
+  }
+
+  slot = next_slot_++;
+  journal_ = tmp;
+  journal_written_ = 0;
+  journal_slot_ = slot;
+
+  FLASH_Unlock();
+  FLASH_ProgramWord(PL_RECORD(slot), PL_RECORD_BEGIN);
+  FLASH_ProgramWord(PL_INDEX(next_index_++), slot);
+  FLASH_Lock();
+
+  nvic_globalirq_enable();
+}
+
+/*
+ * save the fields which don't change frequently
+ */
+void PowerLossRecovery::SaveStableEnv(PowerLossRecoveryData_t &data) {
+  int i;
+
+	LOOP_XN(idx) data.position_shift[idx] = position_shift[idx];
 
-	LOOP_X_TO_E(idx) cur_data_.axis_relative_modes[idx] = gcode.axis_relative_modes[idx];
+	data.axes_relative_mode = relative_mode;
 
-  cur_data_.toolhead = ModuleBase::toolhead();
+	LOOP_X_TO_E(idx) data.axis_relative_modes[idx] = gcode.axis_relative_modes[idx];
 
-  cur_data_.PrintFeedRate = saved_g1_feedrate_mm_s;
-  cur_data_.TravelFeedRate = saved_g0_feedrate_mm_s;
-	cur_data_.feedrate_percentage = feedrate_percentage;
+  data.toolhead = ModuleBase::toolhead();
+
+  data.PrintFeedRate = saved_g1_feedrate_mm_s;
+  data.TravelFeedRate = saved_g0_feedrate_mm_s;
+	data.feedrate_percentage = feedrate_percentage;
 
 	// if live z offset was changed when working, record it
 	if (levelservice.live_z_offset_updated())
-		cur_data_.live_z_offset = levelservice.live_z_offset();
+		data.live_z_offset = levelservice.live_z_offset();
 	else
-		cur_data_.live_z_offset = 0;
+		data.live_z_offset = 0;
+
+	data.rotary_radius = planner.rotary_radius;
+
+  if (ModuleBase::toolhead() == MODULE_TOOLHEAD_3DP) {
+    for (i = 0; i < PP_FAN_COUNT; i++)
+      data.FanSpeed[i] = printer1->fan_speed(i);
+    // extruders' temperature
+    HOTEND_LOOP() data.HeaterTemp[e] = thermalManager.temp_hotend[e].target;
+    // heated bed
+    data.BedTamp = thermalManager.temp_bed.target;
+  }
+
+#if (MOTHERBOARD == BOARD_SNAPMAKER1)
+  if (data.GCodeSource == GCODE_SOURCE_UDISK) {
+  }
+  else {
+    // 0xff will reduce the write times for the flash
+    memset((void *)data.FileName, 0xFF, PP_FILE_NAME_LEN);
+    data.FileName[0] = 0;
+	}
+#elif (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
+	if (systemservice.GetWorkingPort() == WORKING_PORT_SC) {
+		data.GCodeSource = GCODE_SOURCE_SCREEN;
+	}
+	else {
+		data.GCodeSource = GCODE_SOURCE_PC;
+	}
+#endif
+
+  data.active_coordinate_system = gcode.active_coordinate_system;
+
+  data.Valid = 1;
+}
+
+/*
+ * save current working status to power panic data
+ * return:
+ *    0  - sucess
+ *    -1 - failed
+ */
+int PowerLossRecovery::SaveEnv(void) {
+  int     i = 0;
+  uint8_t *pBuff;
+  uint32_t checksum = 0;
+
+  SaveStableEnv(cur_data_);
+
+	cur_data_.FilePosition = last_line_;
 
   cur_data_.accumulator = print_job_timer.duration();
 
@@ -380,49 +513,23 @@ int PowerLossRecovery::SaveEnv(void) {
 
 	case MODULE_TOOLHEAD_LASER:
 		cur_data_.laser_percent = laser.power();
-		cur_data_.laser_pwm = laser.power_pwm();
+		// power_pwm() is of the last planned block, save output of the
+		// block whose line we save
+		cur_data_.laser_pwm = last_pwm_;
 	break;
 
-  case MODULE_TOOLHEAD_3DP:
-    for (i = 0; i < PP_FAN_COUNT; i++)
-      cur_data_.FanSpeed[i] = printer1->fan_speed(i);
-    // extruders' temperature
-    HOTEND_LOOP() cur_data_.HeaterTemp[e] = thermalManager.temp_hotend[e].target;
-    // heated bed
-    cur_data_.BedTamp = thermalManager.temp_bed.target;
-    break;
-
 	default:
 		break;
 	}
 
-#if (MOTHERBOARD == BOARD_SNAPMAKER1)
-  if (cur_data_.GCodeSource == GCODE_SOURCE_UDISK) {
-  }
-  else {
-    // 0xff will reduce the write times for the flash
-    memset((void *)cur_data_.FileName, 0xFF, PP_FILE_NAME_LEN);
-    cur_data_.FileName[0] = 0;
-	}
-#elif (MOTHERBOARD == BOARD_SNAPMAKER_2_0)
-	if (systemservice.GetWorkingPort() == WORKING_PORT_SC) {
-		cur_data_.GCodeSource = GCODE_SOURCE_SCREEN;
-	}
-	else {
-		cur_data_.GCodeSource = GCODE_SOURCE_PC;
-	}
-#endif
-
-  cur_data_.active_coordinate_system = gcode.active_coordinate_system;
-
-  cur_data_.Valid = 1;
-
 	// checksum need to be calculate at the end,
-	// when all data will not be changed again
+	// when all data will not be changed again.
+	// CheckSum is in the middle of record, sum it as 0 as Load() does
 	pBuff = (uint8_t*)&cur_data_;
 	cur_data_.CheckSum = 0;
 	for(i = 0; i < (int)sizeof(PowerLossRecoveryData_t); i++)
-		cur_data_.CheckSum += pBuff[i];
+		checksum += pBuff[i];
+	cur_data_.CheckSum = checksum;
 
   return 0;
 }
@@ -539,6 +646,8 @@ void PowerLossRecovery::ResumeLaser() {
 
 	// just change laser power but not enable output
 	laser.SetPower(pre_data_.laser_percent);
+	if (pre_data_.laser_pwm > 0)
+		laser.power_pwm(pre_data_.laser_pwm);
 }
 
 
@@ -625,6 +734,10 @@ ErrCode PowerLossRecovery::ResumeWork() {
 		break;
 	}
 
+	// B moves of the rest of job are planned on the surface of workpiece
+	planner.set_rotary_radius(pre_data_.rotary_radius);
+	LOG_I("rotary radius: %.2f\n", pre_data_.rotary_radius);
+
 	current_position[B_AXIS] = pre_data_.PositionData[B_AXIS];
 	sync_plan_position();
 
@@ -654,6 +767,15 @@ void PowerLossRecovery::Reset() {
 	for (i=0; i<size; i++) {
 		*ptr++ = 0;
 	}
+
+  last_pwm_ = 0;
+
+  // new job, records in flash are useless, make sure we have enough room
+  // for journal. we are not working now, so it's ok to erase flash
+  journal_slot_ = PL_RECORD_NONE;
+  journal_tick_ = PL_JOURNAL_INTERVAL;
+  if (next_slot_ + PL_RECORD_RESERVE > PL_RECORD_COUNT)
+    Format();
 }
 
 void PowerLossRecovery::enable(bool onoff) {
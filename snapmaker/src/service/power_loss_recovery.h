@@ -38,30 +38,20 @@ typedef enum {
 
 // delay for debounce, uint: ms, for now we use 10ms
 #define POWERPANIC_DEBOUNCE	10
+// fields before CheckSum don't change frequently in a job, they are journaled
+// into flash when they change. When power-loss, only CheckSum and fields
+// after it are programmed, then the record is committed
 typedef struct __attribute__((aligned (4))) {
-	// checksum of this section
-	uint32_t CheckSum;
 	// temperature of extrucders
 	int16_t HeaterTemp[PP_HEATER];
+	// target temperature of heat bed
+	int16_t BedTamp;
 	// speed of work
 	float PrintFeedRate;
 	// speed of travel
 	float TravelFeedRate;
-	// CNC power
-	uint8_t cnc_power;
-	// laser Power
-	float laser_percent;
-	uint16_t laser_pwm;
-	// target temperature of heat bed
-	int16_t BedTamp;
-	// position of stepper on last move
-	float PositionData[NUM_AXIS];
 	// position shift between home offset and workspace offset
 	float position_shift[XN];
-	// line number of last gcode
-	int FilePosition;
-	//
-	uint32_t accumulator;
 	// fans' speed
 	uint8_t FanSpeed[PP_FAN_COUNT];
 	// if this section is valid
@@ -83,6 +73,22 @@ typedef struct __attribute__((aligned (4))) {
 
 	int16_t feedrate_percentage;
 	float   live_z_offset;
+	// workpiece radius on rotary module, 0 if B is not rotary
+	float   rotary_radius;
+
+	// checksum of this section
+	uint32_t CheckSum;
+	// CNC power
+	uint8_t cnc_power;
+	// laser Power
+	float laser_percent;
+	uint16_t laser_pwm;
+	// position of stepper on last move
+	float PositionData[NUM_AXIS];
+	// line number of last gcode
+	int FilePosition;
+	//
+	uint32_t accumulator;
 } PowerLossRecoveryData_t;
 
 
@@ -90,6 +96,7 @@ class PowerLossRecovery {
 	public:
     PowerLossRecovery(){};
     void Init(void);
+    int  Load(void);
     void WriteFlash(void);
     void ClearPowerPanicData(void);
     void MaskPowerPanicData(void);
@@ -107,6 +114,17 @@ class PowerLossRecovery {
         last_line_ = l;
     }
 
+    /*
+    * same as above, but also latch laser output of the block,
+    * so the power we save goes with the line we save
+    */
+    void FORCE_INLINE SaveCmdLine(uint32_t l, uint16_t pwm) {
+      if (l != INVALID_CMD_LINE) {
+        last_line_ = l;
+        last_pwm_ = pwm;
+      }
+    }
+
 	void Reset(void);
 	void Check(void);
 
@@ -116,14 +134,30 @@ class PowerLossRecovery {
 	PowerLossRecoveryData_t cur_data_;
 	PowerLossRecoveryData_t pre_data_;
 
+    // journal stable part of record when working, called every 10ms
+    void Journal(void);
+
 	private:
-    uint32_t WriteIndex;
+    // next free record and index entry in flash
+    uint16_t next_slot_;
+    uint16_t next_index_;
+    // record loaded when power-on
+    uint16_t pre_slot_;
+
+    // record which stable part is being / has been journaled
+    uint16_t journal_slot_;
+    uint16_t journal_written_;
+    uint16_t journal_tick_;
+    PowerLossRecoveryData_t journal_;
+
     uint32_t last_line_;
+    uint16_t last_pwm_;
 		millis_t last_powerloss_;
 
     bool enabled_;
 
-    int Load(void);
+    void Format(void);
+    void SaveStableEnv(PowerLossRecoveryData_t &data);
 
     void Resume3DP();
     void ResumeCNC();
@@ -123,7 +123,7 @@ bool QuickStopService::CheckInISR(block_t *blk) {
     */
     case QS_SOURCE_PAUSE:
       if (blk)
-        pl_recovery.SaveCmdLine(blk->filePos);
+        pl_recovery.SaveCmdLine(blk->filePos, blk->laser_pwm);
 
       // if power-loss appear atfer finishing PAUSE, won't save env again
       if (systemservice.GetCurrentStatus() != SYSTAT_PAUSE_FINISH)
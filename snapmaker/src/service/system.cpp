@@ -122,7 +122,7 @@ ErrCode SystemService::PauseTrigger(TriggerSource type)
   }
 
   // clear event in queue to marlin
-  xMessageBufferReset(sm2_handle->event_queue);
+  marlin_events.Flush();
 
   quickstop.Trigger(QS_SOURCE_PAUSE);
 
@@ -361,7 +361,8 @@ ErrCode SystemService::ResumeTrigger(TriggerSource source) {
   }
 
   // send event to marlin task to handle
-  if (xMessageBufferSend(sm2_handle->event_queue, event, 2, pdMS_TO_TICKS(100))) {
+  SSTP_View_t view = {{event, NULL}, {2, 0}, 2};
+  if (marlin_events.Send(view, pdMS_TO_TICKS(100)) == E_SUCCESS) {
     cur_status_ = SYSTAT_RESUME_TRIG;
     return E_SUCCESS;
   }
@@ -27,6 +27,7 @@
 #include "upgrade.h"
 #include "system.h"
 #include "flash_stm32.h"
+#include <string.h>
 
 #include "src/Marlin.h"
 #include HAL_PATH(src/HAL, HAL_watchdog_STM32F1.h)
@@ -36,6 +37,28 @@ UpgradeService upgrade;
 
 #define LOG_HEAD  "UP: "
 
+
+static void UpgradeWriter(void *param) {
+  for (;;) {
+    // one notification for every received packet
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    ((UpgradeService *)param)->WriteFW();
+  }
+}
+
+
+// erase pages one by one, so other tasks can run between them
+static void ErasePages(uint32_t addr, uint32_t size) {
+  for (uint32_t i = 0; i < size; i += 2048) {
+    taskENTER_CRITICAL();
+    FLASH_Unlock();
+    FLASH_ErasePage(addr + i);
+    FLASH_Lock();
+    taskEXIT_CRITICAL();
+  }
+}
+
+
 ErrCode UpgradeService::RequestNextPacket() {
   SSTP_Event_t event = {EID_UPGRADE_ACK, UPGRADE_OPC_TRANS_FW};
 
@@ -53,8 +76,6 @@ ErrCode UpgradeService::RequestNextPacket() {
 
 ErrCode UpgradeService::StartUpgrade(SSTP_Event_t &event) {
   ErrCode err = E_SUCCESS;
-  uint32_t addr;
-  uint8_t pages;
 
   event.data = &err;
   event.length = 1;
@@ -75,31 +96,30 @@ ErrCode UpgradeService::StartUpgrade(SSTP_Event_t &event) {
     return hmi.Send(event);
   }
 
-  taskENTER_CRITICAL();
-  FLASH_Unlock();
+  if (StartWriter() != E_SUCCESS || WaitWriter() != E_SUCCESS) {
+    LOG_E(LOG_HEAD "flash writer is not ready!\n");
+    err = E_NO_RESRC;
+    return hmi.Send(event);
+  }
 
   // erase update info
-  pages = UPDATE_CONTENT_INFO_SIZE / 2048;
-  addr = FLASH_UPDATE_CONTENT_INFO;
-  for (int i = 0; i < pages; i++) {
-    FLASH_ErasePage(addr);
-    addr += 2048;
-  }
+  ErasePages(FLASH_UPDATE_CONTENT_INFO, UPDATE_CONTENT_INFO_SIZE);
 
   // erase flash for new fw
-  pages = MARLIN_CODE_SIZE / 2048;
-  addr = FLASH_UPDATE_CONTENT;
-  for (int i = 0; i < pages; i++) {
-    FLASH_ErasePage(addr);
-    addr += 2048;
-  }
-
-  FLASH_Lock();
-  taskEXIT_CRITICAL();
+  ErasePages(FLASH_UPDATE_CONTENT, MARLIN_CODE_SIZE);
 
   received_fw_size_ = 0;
   req_pkt_counter_  = 0;
   pre_pkt_counter_  = 0;
+  written_pkt_counter_ = 0;
+
+  // one buffer is taken by requesting packet 0
+  free_buffers_    = 1;
+  request_pending_ = false;
+
+  start_tick_ = xTaskGetTickCount();
+  end_tick_   = 0;
+
   upgrade_state_   = UPGRADE_STA_RECV_FW;
 
   hmi.Send(event);
@@ -109,62 +129,154 @@ ErrCode UpgradeService::StartUpgrade(SSTP_Event_t &event) {
 
 
 ErrCode UpgradeService::ReceiveFW(SSTP_Event_t &event) {
-
-  uint32_t addr;
   uint32_t packet_index;
-  uint16_t tmp;
-
   uint16_t data_len;
+  uint8_t  *buffer;
+  bool     request = false;
 
   packet_index = event.data[0]<<8 | event.data[1];
 
-  if (packet_index == 0) {
-    target_ = (UpgradeTarget)event.data[2];
-    if (target_ == UPGRADE_TARGET_MAIN_CONTROLLER)
-      LOG_I("will upgrade controller!\n");
-    else
-      LOG_I("will upgrade modules!\n");
-  }
-
-  if ((packet_index < max_packet_) && (upgrade_state_ == UPGRADE_STA_RECV_FW) && (packet_index == req_pkt_counter_)) {
+  // event length = 2bytes (packet length) + length of fw packet
+  data_len = (event.length - 2);
 
-    // event length = 2bytes (packet length) + length of fw packet
-    data_len = (event.length - 2);
+  if ((packet_index < max_packet_) && (upgrade_state_ == UPGRADE_STA_RECV_FW) && (packet_index == req_pkt_counter_) &&
+      (data_len <= UPGRADE_PACKET_SIZE)) {
 
     // every packet should have 512 bytes except the last packet
-    received_fw_size_ = packet_index * 512 + data_len;
+    received_fw_size_ = packet_index * UPGRADE_PACKET_SIZE + data_len;
+
+    // writer is idle before packet 0 is given to it
+    if (packet_index == 0) {
+      packed_ = FwUnpacker::IsPacked(event.data + 2, data_len);
+      unpack_err_ = E_SUCCESS;
+      if (packed_) {
+        LOG_I(LOG_HEAD "FW is packed\n");
+        unpacker_.Begin(FLASH_UPDATE_CONTENT, MARLIN_CODE_SIZE);
+      }
+    }
 
-    addr = FLASH_UPDATE_CONTENT + packet_index * 512;
+    // buffer was taken when this packet was requested
+    buffer = packet_ + (packet_index & 1) * UPGRADE_PACKET_SIZE;
+    memcpy(buffer, event.data + 2, data_len);
+    packet_length_[packet_index & 1] = data_len;
 
-    // data len should be even number
-    if (data_len & 0x0001) data_len++;
+    req_pkt_counter_++;
+    xTaskNotifyGive(writer_);
 
+    // request next packet if the other buffer is free, otherwise writer
+    // requests it after programming this one
     taskENTER_CRITICAL();
-    FLASH_Unlock();
+    if (free_buffers_) {
+      free_buffers_--;
+      request = true;
+    }
+    else {
+      request_pending_ = true;
+    }
+    taskEXIT_CRITICAL();
+  }
+  else {
+    LOG_E("param error in receiving FW! pkt index: %u, req index: %u\n", packet_index, req_pkt_counter_);
+
+    // no buffer for next packet yet
+    request = !request_pending_;
+  }
+
+  return request? RequestNextPacket() : E_SUCCESS;
+}
 
-    for (int i = 2; i < (data_len + 2); i = i + 2) {
-      tmp = ((event.data[i + 1]<<8) | event.data[i]);
 
-      FLASH_ProgramHalfWord(addr, tmp);
+void UpgradeService::WriteFW() {
+  uint16_t index = written_pkt_counter_;
+  uint8_t  *buffer = packet_ + (index & 1) * UPGRADE_PACKET_SIZE;
+  uint16_t length = packet_length_[index & 1];
+  uint32_t addr = FLASH_UPDATE_CONTENT + index * UPGRADE_PACKET_SIZE;
+  bool     request = false;
 
-      addr = addr + 2;
+  if (packed_) {
+    // keep the first error, following data makes no sense
+    if (unpack_err_ == E_SUCCESS)
+      unpack_err_ = unpacker_.Feed(buffer, length);
+  }
+  else {
+    // data len should be even number, buffer has room for padding
+    if (length & 0x0001) buffer[length++] = 0xFF;
+
+    // only one half word in critical section, flash may be used by others
+    // between them, so unlock it every time
+    for (int i = 0; i < length; i += 2) {
+      taskENTER_CRITICAL();
+      FLASH_Unlock();
+      FLASH_ProgramHalfWord(addr + i, buffer[i + 1]<<8 | buffer[i]);
+      FLASH_Lock();
+      taskEXIT_CRITICAL();
     }
+  }
 
-    FLASH_Lock();
-    taskEXIT_CRITICAL();
+  written_pkt_counter_ = index + 1;
 
-    req_pkt_counter_++;
+  taskENTER_CRITICAL();
+  if (request_pending_) {
+    request_pending_ = false;
+    request = true;
   }
   else {
-    LOG_E("param error in receiving FW! pkt index: %u, req index: %u\n", packet_index, req_pkt_counter_);
+    free_buffers_++;
   }
+  taskEXIT_CRITICAL();
 
-  return RequestNextPacket();
+  if (request)
+    RequestNextPacket();
+}
+
+
+// buffers and task are taken by the first upgrade, and kept for later ones
+ErrCode UpgradeService::StartWriter() {
+  if (writer_)
+    return E_SUCCESS;
+
+  packet_ = (uint8_t *)pvPortMalloc(2 * UPGRADE_PACKET_SIZE);
+  if (!packet_)
+    return E_NO_MEM;
+
+  if (xTaskCreate((TaskFunction_t)UpgradeWriter, "upgrade_writer", UPGRADE_WRITER_STACK_DEPTH,
+        (void *)this, UPGRADE_WRITER_PRIO, &writer_) != pdPASS) {
+    vPortFree(packet_);
+    packet_ = NULL;
+    writer_ = NULL;
+    return E_NO_RESRC;
+  }
+
+  return E_SUCCESS;
+}
+
+
+// wait for writer to program all received packets
+ErrCode UpgradeService::WaitWriter() {
+  for (int i = 0; written_pkt_counter_ != req_pkt_counter_; i++) {
+    if (i >= 100) {
+      LOG_E(LOG_HEAD "%u of %u packets are programmed\n", written_pkt_counter_, req_pkt_counter_);
+      return E_TIMEOUT;
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+
+  return E_SUCCESS;
+}
+
+
+// throughput of receiving, until all packets are programmed at the end
+uint32_t UpgradeService::BytesPerSecond() {
+  TickType_t end = end_tick_? end_tick_ : xTaskGetTickCount();
+  uint32_t   ms = (uint64_t)(end - start_tick_) * 1000 / configTICK_RATE_HZ;
+
+  return ms? (uint64_t)received_fw_size_ * 1000 / ms : 0;
 }
 
 
 ErrCode UpgradeService::EndUpgarde(SSTP_Event_t &event) {
-  ErrCode err = E_FAILURE;
+  ErrCode  err = E_FAILURE;
+  uint32_t fw_size;
 
   event.data = &err;
   event.length = 1;
@@ -176,7 +288,36 @@ ErrCode UpgradeService::EndUpgarde(SSTP_Event_t &event) {
     return hmi.Send(event);
   }
 
-  LOG_I(LOG_HEAD "packet counts: %u,  FW size: %u\n", req_pkt_counter_, received_fw_size_);
+  if (WaitWriter() != E_SUCCESS)
+    return hmi.Send(event);
+
+  end_tick_ = xTaskGetTickCount();
+
+  LOG_I(LOG_HEAD "packet counts: %u,  FW size: %u, %u bytes/s\n", req_pkt_counter_, received_fw_size_,
+          BytesPerSecond());
+
+  fw_size = received_fw_size_;
+
+  if (packed_) {
+    if (unpack_err_ == E_SUCCESS)
+      unpack_err_ = unpacker_.End();
+
+    if (unpack_err_ != E_SUCCESS) {
+      LOG_E(LOG_HEAD "failed to unpack FW: %u\n", unpack_err_);
+      upgrade_state_ = UPGRADE_STA_IDLE;
+      return hmi.Send(event);
+    }
+
+    fw_size = unpacker_.raw_size();
+    LOG_I(LOG_HEAD "unpacked FW size: %u\n", fw_size);
+  }
+
+  // type is the first byte of raw image
+  target_ = (UpgradeTarget)(*((uint8_t *)(FLASH_UPDATE_CONTENT + UPGRADE_FW_OFFSET_FW_TYPE)));
+  if (target_ == UPGRADE_TARGET_MAIN_CONTROLLER)
+    LOG_I("will upgrade controller!\n");
+  else
+    LOG_I("will upgrade modules!\n");
 
   err = E_SUCCESS;
 
@@ -200,7 +341,7 @@ ErrCode UpgradeService::EndUpgarde(SSTP_Event_t &event) {
 
     upgrade_state_ = UPGRADE_STA_UPGRADING_EM;
 
-    err = canhost.UpgradeModules(FLASH_UPDATE_CONTENT, received_fw_size_);
+    err = canhost.UpgradeModules(FLASH_UPDATE_CONTENT, fw_size);
 
     upgrade_state_ = UPGRADE_STA_IDLE;
     target_ = UPGRADE_TARGET_UNKNOWN;
@@ -265,13 +406,19 @@ ErrCode UpgradeService::CompareMCVer(SSTP_Event_t &event) {
 }
 
 
+// [status][bytes/s of receiving FW 4B]
 ErrCode UpgradeService::GetUpgradeStatus(SSTP_Event_t &event) {
-  uint8_t up_status = (uint8_t) upgrade_state_;
+  uint8_t  buffer[5];
+  uint32_t rate = BytesPerSecond();
+  int      i = 0;
 
   // LOG_I(LOG_HEAD "SC req upgrade statue\n");
 
-  event.data = &up_status;
-  event.length = 1;
+  buffer[i++] = (uint8_t) upgrade_state_;
+  WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, rate, i);
+
+  event.data = buffer;
+  event.length = i;
 
   return hmi.Send(event);
 }
@@ -333,6 +480,23 @@ ErrCode UpgradeService::SendModuleUpgradeStatus(uint8_t sta) {
 }
 
 
+// progress of one module: [sta][MAC 4B][percent], percent is 0xFF if failed
+ErrCode UpgradeService::SendModuleUpgradeStatus(uint8_t sta, uint32_t mac, uint8_t progress) {
+  SSTP_Event_t event = {EID_UPGRADE_ACK, UPGRADE_OPC_SYNC_MODULE_UP_STATUS};
+  uint8_t buffer[6];
+  int     i = 0;
+
+  buffer[i++] = sta;
+  WORD_TO_PDU_BYTES_INDEX_MOVE(buffer, mac, i);
+  buffer[i++] = progress;
+
+  event.data = buffer;
+  event.length = i;
+
+  return hmi.Send(event);
+}
+
+
 void UpgradeService::Check(void) {
   if (upgrade_state_ != UPGRADE_STA_RECV_FW) {
     return;
@@ -346,7 +510,8 @@ void UpgradeService::Check(void) {
     timeout_++;
   }
 
-  if (!(timeout_ & 0x0003)) {
+  // writer will request it if there is no buffer for next packet
+  if (!(timeout_ & 0x0003) && !request_pending_) {
     RequestNextPacket();
   }
 }
@@ -26,9 +26,15 @@
 #include "src/core/macros.h"
 
 #include "../hmi/event_handler.h"
+#include "../common/fw_unpacker.h"
+
+#include "MapleFreeRTOS1030.h"
 
 #define VERSION_STRING_SIZE 32
 
+// every packet of firmware has 512 bytes except the last one
+#define UPGRADE_PACKET_SIZE 512
+
 #define UPGRADE_FW_OFFSET_FW_TYPE         ((uint32_t)(0))
 #define UPGRADE_FW_OFFSET_START_MODULE_ID ((uint32_t)(1))
 #define UPGRADE_FW_OFFSET_END_MODULE_ID   ((uint32_t)(3))
@@ -64,12 +70,16 @@ class UpgradeService {
     ErrCode GetModuleVer(SSTP_Event_t &event);
 
     ErrCode SendModuleUpgradeStatus(uint8_t sta);
+    ErrCode SendModuleUpgradeStatus(uint8_t sta, uint32_t mac, uint8_t progress);
     ErrCode SendModuleVer(uint32_t mac, char ver[VERSION_STRING_SIZE]);
 
     void CheckIfUpgradeModule();
 
     void Check(void);
 
+    // programs received packets to flash in order, runs in its own task
+    void WriteFW();
+
     UpgradeStatus GetState() { return upgrade_state_; }
     void SetState(UpgradeStatus sta) {
       if (sta < UPGRADE_STA_INVALID)
@@ -78,9 +88,12 @@ class UpgradeService {
 
   private:
     ErrCode RequestNextPacket();
+    ErrCode StartWriter();
+    ErrCode WaitWriter();
+    uint32_t BytesPerSecond();
 
   private:
-    static const uint16_t max_packet_ = MARLIN_CODE_SIZE / 512;
+    static const uint16_t max_packet_ = MARLIN_CODE_SIZE / UPGRADE_PACKET_SIZE;
 
     UpgradeStatus upgrade_state_ = UPGRADE_STA_IDLE;
     UpgradeTarget target_ = UPGRADE_TARGET_UNKNOWN;
@@ -89,6 +102,28 @@ class UpgradeService {
     uint16_t req_pkt_counter_ = 0;
     uint16_t pre_pkt_counter_ = 0;
     uint32_t received_fw_size_ = 0;
+
+    // packet is received into one buffer while the other one is programmed,
+    // packet N uses buffer N % 2
+    TaskHandle_t writer_ = NULL;
+    uint8_t  *packet_ = NULL;
+    uint16_t packet_length_[2];
+    volatile uint16_t written_pkt_counter_ = 0;
+
+    // buffers not taken by received or requested packets, next packet is
+    // requested by writer if there was no free buffer when it was due
+    uint8_t  free_buffers_ = 0;
+    bool     request_pending_ = false;
+
+    // packed image is unpacked by writer while receiving, so raw image is
+    // in flash when receiving is done
+    bool packed_ = false;
+    ErrCode unpack_err_ = E_SUCCESS;
+    FwUnpacker unpacker_;
+
+    // for throughput of receiving
+    TickType_t start_tick_ = 0;
+    TickType_t end_tick_ = 0;
 };
 
 
@@ -21,6 +21,7 @@
 #include "snapmaker.h"
 
 #include "common/debug.h"
+#include "common/cycle_trace.h"
 #include "hmi/event_handler.h"
 #include "module/can_host.h"
 #include "module/linear.h"
@@ -133,10 +134,9 @@ static void main_loop(void *param) {
 
   dispather_param.owner = TASK_OWN_MARLIN;
 
-  dispather_param.event_buff = (uint8_t *)pvPortMalloc(SSTP_RECV_BUFFER_SIZE);
-  configASSERT(dispather_param.event_buff);
-
-  dispather_param.event_queue = ((SnapmakerHandle_t)param)->event_queue;
+  // events are handled in place in marlin_events
+  dispather_param.event_buff = NULL;
+  dispather_param.size = 0;
 
   HeatedBedSelfCheck();
 
@@ -151,6 +151,9 @@ static void main_loop(void *param) {
 
   SERIAL_ECHOLN("Finish init\n");
 
+  canhost.StampBoot(BOOT_PHASE_READY);
+  canhost.ShowBootStamp();
+
   cur_mills = millis() - 3000;
 
   for (;;) {
@@ -182,6 +185,7 @@ static void main_loop(void *param) {
 static void hmi_task(void *param) {
   SnapmakerHandle_t    task_param;
   struct DispatcherParam dispather_param;
+  SSTP_View_t          view;
 
   ErrCode ret = E_FAILURE;
 
@@ -195,7 +199,7 @@ static void hmi_task(void *param) {
   dispather_param.event_buff = (uint8_t *)pvPortMalloc(SSTP_RECV_BUFFER_SIZE);
   configASSERT(dispather_param.event_buff);
 
-  dispather_param.event_queue = task_param->event_queue;
+  hmi.EnableRxNotify(task_param->hmi);
 
   for (;;) {
     if(READ(SCREEN_DET_PIN)) {
@@ -216,20 +220,38 @@ static void hmi_task(void *param) {
     else
       count = 0;
 
-    ret = hmi.CheckoutCmd(dispather_param.event_buff, dispather_param.size);
+    hmi.RecordWakeup();
+
+    // drain all complete events before sleeping
+    for (;;) {
+      ret = hmi.PeekCmd(view);
+      if (ret == E_SUCCESS) {
+        hmi.RecordEvent();
+
+        if (ForwardGcodeEvent(view) == E_SUCCESS) {
+          hmi.ReleaseCmd(view);
+        }
+        else {
+          dispather_param.size = ProtocolSSTP::CopyView(view, dispather_param.event_buff);
+          hmi.ReleaseCmd(view);
+
+          // execute or send out one command
+          DispatchEvent(&dispather_param);
+        }
+        continue;
+      }
 
-    systemservice.CheckIfSendWaitEvent();
+      // no more complete event
+      if (ret == E_NO_RESRC || ret == E_NO_SOF || ret == E_NO_HEADER || ret == E_NO_DATA)
+        break;
 
-    if (ret != E_SUCCESS) {
-      // no command, sleep 10ms for next command
-      vTaskDelay(pdMS_TO_TICKS(10));
-      continue;
+      // bad bytes were dropped by parser, there may be more events behind them
     }
 
-    // execute or send out one command
-    DispatchEvent(&dispather_param);
+    systemservice.CheckIfSendWaitEvent();
 
-    vTaskDelay(pdMS_TO_TICKS(5));
+    // wait for RX notify, timeout to check screen and wait event
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
   }
 }
 
@@ -247,6 +269,8 @@ static void heartbeat_task(void *param) {
 
     systemservice.CheckException();
 
+    pl_recovery.Journal();
+
     if (++counter > 100) {
       counter = 0;
 
@@ -263,6 +287,8 @@ static void heartbeat_task(void *param) {
 
 void SnapmakerSetupEarly() {
 
+  CYCLE_TRACE_INIT();
+
   systemservice.Init();
   // init serial for HMI
   hmi.Init(&MSerial2, HMI_SERIAL_IRQ_PRIORITY);
@@ -332,9 +358,6 @@ void SnapmakerSetupPost() {
   enable_power_domain(POWER_DOMAIN_ADDON);
 
   sm2_handle = (SnapmakerHandle_t)pvPortMalloc(sizeof(struct SnapmakerHandle));
-  sm2_handle->event_queue = xMessageBufferCreate(1024);
-  configASSERT(sm2_handle->event_queue);
-
   sm2_handle->event_group = xEventGroupCreate();
   configASSERT(sm2_handle->event_group);
 
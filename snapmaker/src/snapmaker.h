@@ -38,7 +38,6 @@ struct SnapmakerHandle {
   TaskHandle_t can_recv;
   TaskHandle_t can_event;
 
-  MessageBufferHandle_t event_queue;
   EventGroupHandle_t    event_group;
 };
 typedef struct SnapmakerHandle* SnapmakerHandle_t;
@@ -0,0 +1,227 @@
+/*
+ * Snapmaker2-Controller Firmware
+ * Copyright (C) 2019-2020 Snapmaker [https://github.com/Snapmaker]
+ *
+ * This file is part of Snapmaker2-Controller
+ * (see https://github.com/Snapmaker/Snapmaker2-Controller)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPMAKER_UTILS_SPSC_RING_BUFFER_H_
+#define SNAPMAKER_UTILS_SPSC_RING_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// copies not longer than this are done by loop instead of memcpy()
+#define SPSC_SMALL_COPY_SIZE  16
+
+// Ring buffer for one producer and one consumer, such as an ISR and a task,
+// or two ISRs which cannot preempt each other.
+//
+// head_ and tail_ are free running counters, only consumer writes head_ and
+// only producer writes tail_, so no lock is needed. Producer publishes tail_
+// after data is written, consumer gives room back by head_ after data is
+// read, acquire / release keeps both CPU and compiler from reordering them.
+//
+// Size must be power of 2, and all of it can be used. Elements are moved by
+// memcpy(), so T must be trivially copyable.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  // call it before producer and consumer start
+  bool Init(uint32_t size, T *buffer) {
+    if (!size || (size & (size - 1)))
+      return false;
+
+    mask_ = size - 1;
+    data_ = buffer;
+    head_ = 0;
+    tail_ = 0;
+
+    return true;
+  }
+
+  uint32_t size() { return mask_ + 1; }
+
+  /* producer side */
+
+  uint32_t Free() {
+    return mask_ + 1 - (LoadRelaxed(tail_) - LoadAcquire(head_));
+  }
+
+  bool IsFull() { return Free() == 0; }
+
+  bool InsertOne(const T &element) {
+    uint32_t tail = LoadRelaxed(tail_);
+
+    if (tail - LoadAcquire(head_) > mask_)
+      return false;
+
+    data_[tail & mask_] = element;
+    Store(tail_, tail + 1);
+
+    return true;
+  }
+
+  // insert all of elements or nothing, return count inserted
+  uint32_t InsertMulti(const T *buffer, uint32_t count) {
+    uint32_t tail = LoadRelaxed(tail_);
+
+    if (mask_ + 1 - (tail - LoadAcquire(head_)) < count)
+      return 0;
+
+    Copy(data_, tail, buffer, count, true);
+    Store(tail_, tail + count);
+
+    return count;
+  }
+
+  /* consumer side */
+
+  uint32_t Available() {
+    return LoadAcquire(tail_) - LoadRelaxed(head_);
+  }
+
+  bool IsEmpty() { return Available() == 0; }
+
+  bool RemoveOne(T &element) {
+    uint32_t head = LoadRelaxed(head_);
+
+    if (LoadAcquire(tail_) == head)
+      return false;
+
+    element = data_[head & mask_];
+    Store(head_, head + 1);
+
+    return true;
+  }
+
+  // remove up to count elements, return count removed
+  uint32_t RemoveMulti(T *buffer, uint32_t count) {
+    count = Peek(buffer, count);
+    Discard(count);
+
+    return count;
+  }
+
+  // copy up to count elements from offset without removing them
+  uint32_t Peek(T *buffer, uint32_t count, uint32_t offset = 0) {
+    uint32_t avail = Available();
+
+    if (offset >= avail)
+      return 0;
+
+    if (count > avail - offset)
+      count = avail - offset;
+
+    Copy(buffer, LoadRelaxed(head_) + offset, data_, count, false);
+
+    return count;
+  }
+
+  // element at offset, caller makes sure it's available
+  T PeekAt(uint32_t offset) {
+    return data_[(LoadRelaxed(head_) + offset) & mask_];
+  }
+
+  // where count elements from offset stay in buffer, they may wrap around
+  // the end, then seg[1] is the rest. Caller makes sure they're available
+  void Segments(uint32_t offset, uint32_t count, T *seg[2], uint32_t len[2]) {
+    uint32_t start = (LoadRelaxed(head_) + offset) & mask_;
+
+    seg[0] = data_ + start;
+    if (start + count <= mask_ + 1) {
+      len[0] = count;
+      seg[1] = NULL;
+      len[1] = 0;
+    }
+    else {
+      len[0] = mask_ + 1 - start;
+      seg[1] = data_;
+      len[1] = count - len[0];
+    }
+  }
+
+  // drop up to count elements, return count dropped
+  uint32_t Discard(uint32_t count) {
+    uint32_t avail = Available();
+
+    if (count > avail)
+      count = avail;
+
+    Store(head_, LoadRelaxed(head_) + count);
+
+    return count;
+  }
+
+  // drop all elements
+  void Reset() {
+    Store(head_, LoadAcquire(tail_));
+  }
+
+ private:
+  // index written by the other side
+  static inline uint32_t LoadAcquire(uint32_t &index) {
+    return __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+  }
+
+  // index written by this side
+  static inline uint32_t LoadRelaxed(uint32_t &index) {
+    return __atomic_load_n(&index, __ATOMIC_RELAXED);
+  }
+
+  static inline void Store(uint32_t &index, uint32_t value) {
+    __atomic_store_n(&index, value, __ATOMIC_RELEASE);
+  }
+
+  // copy count elements between ring at position pos and linear buffer
+  void Copy(T *dst, uint32_t pos, const T *src, uint32_t count, bool to_ring) {
+    uint32_t start = pos & mask_;
+    uint32_t first = mask_ + 1 - start;
+
+    // a CAN frame has only 8 bytes, calling memcpy() costs more than copying them
+    if (count * sizeof(T) <= SPSC_SMALL_COPY_SIZE) {
+      for (uint32_t i = 0; i < count; i++) {
+        if (to_ring)
+          dst[(pos + i) & mask_] = src[i];
+        else
+          dst[i] = src[(pos + i) & mask_];
+      }
+      return;
+    }
+
+    if (first > count)
+      first = count;
+
+    if (to_ring) {
+      memcpy(dst + start, src, first * sizeof(T));
+      if (count > first)
+        memcpy(dst, src + first, (count - first) * sizeof(T));
+    }
+    else {
+      memcpy(dst, src + start, first * sizeof(T));
+      if (count > first)
+        memcpy(dst + first, src, (count - first) * sizeof(T));
+    }
+  }
+
+ private:
+  uint32_t head_;   // next to read, written by consumer
+  uint32_t tail_;   // next to write, written by producer
+  uint32_t mask_;
+  T *data_;
+};
+
+#endif  // #ifndef SNAPMAKER_UTILS_SPSC_RING_BUFFER_H_